@@ -0,0 +1,534 @@
+/************************************************************************/
+/* cksm_bench.c                                                         */
+/*                                                                      */
+/* Micro benchmark for the checksum engines used by the POSIX DSI       */
+/*                                                                      */
+/*     globus_l_gfs_posix_cksm_adler32()   zlib adler32()               */
+/*     globus_l_gfs_posix_cksm_md5()       OpenSSL MD5_Update()         */
+/*                                                                      */
+/* plus a few alternative kernels (multi-threaded adler32 joined with   */
+/* adler32_combine(), OpenSSL EVP MD5). Every engine is run over an     */
+/* in-memory buffer and, optionally, an on-disk file, for each          */
+/* combination of chunk (read) size and thread count. It reports GB/s   */
+/* and CPU cycles per byte, and cross-checks that all engines of the    */
+/* same family produce identical digests.                               */
+/*                                                                      */
+/* Build:  make cksm_bench                                              */
+/* Usage:  cksm_bench [-s MB] [-f file] [-c chunks] [-t threads]        */
+/*                    [-r repeat] [-e engines]                          */
+/*                                                                      */
+/*   -s   size of the in-memory input in MB (default 256, 0 = skip)     */
+/*   -f   also benchmark reading this file from disk                    */
+/*   -c   comma separated chunk sizes, K/M suffix allowed               */
+/*        (default 64K,1M,4M: the adler32 and MD5 read sizes)           */
+/*   -t   comma separated thread counts (default 1,2,4)                 */
+/*   -r   repetitions per measurement, best one is reported (default 3) */
+/*   -e   comma separated engines (default all):                        */
+/*        adler32, adler32-mt, md5, evp-md5                             */
+/*                                                                      */
+/* Exit status is 1 if any engine disagrees with the reference digest,  */
+/* 3 if reading the input failed and 2 for bad arguments.               */
+/************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#include <openssl/md5.h>
+#include <openssl/evp.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define CKSM_BENCH_HAVE_TSC 1
+#endif
+
+#define CKSM_BENCH_MAX_LIST 16
+#define CKSM_BENCH_MAX_THREADS (CKSM_BENCH_MAX_LIST * 4)
+#define CKSM_BENCH_DIGEST_LEN 64
+
+typedef enum
+{
+    CKSM_BENCH_ADLER32 = 0,
+    CKSM_BENCH_ADLER32_MT,
+    CKSM_BENCH_MD5,
+    CKSM_BENCH_EVP_MD5,
+    CKSM_BENCH_NENGINES
+} cksm_bench_engine_t;
+
+static const char * cksm_bench_engine_names[CKSM_BENCH_NENGINES] =
+{
+    "adler32", "adler32-mt", "md5", "evp-md5"
+};
+
+/* engines of the same family must produce the same digest */
+static const int cksm_bench_engine_family[CKSM_BENCH_NENGINES] =
+{
+    0, 0, 1, 1
+};
+
+typedef struct
+{
+    cksm_bench_engine_t                 engine;
+    const unsigned char *               mem;      /* in-memory input, or NULL */
+    int                                 fd;       /* on-disk input */
+    off_t                               offset;
+    off_t                               length;
+    size_t                              chunk;
+    uLong                               adler;
+    char                                digest[CKSM_BENCH_DIGEST_LEN];
+    int                                 error;
+} cksm_bench_job_t;
+
+static
+double
+cksm_bench_now(void)
+{
+    struct timespec                     ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static
+unsigned long long
+cksm_bench_cycles(void)
+{
+#ifdef CKSM_BENCH_HAVE_TSC
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+static
+size_t
+cksm_bench_parse_size(
+    const char *                        s)
+{
+    char *                              end;
+    double                              v;
+
+    v = strtod(s, &end);
+    if (*end == 'k' || *end == 'K') v *= 1024;
+    else if (*end == 'm' || *end == 'M') v *= 1024 * 1024;
+    else if (*end == 'g' || *end == 'G') v *= 1024 * 1024 * 1024;
+    return (size_t) v;
+}
+
+static
+int
+cksm_bench_parse_list(
+    char *                              s,
+    size_t *                            list)
+{
+    char *                              tok;
+    char *                              save;
+    int                                 n = 0;
+
+    for (tok = strtok_r(s, ",", &save); tok && n < CKSM_BENCH_MAX_LIST;
+         tok = strtok_r(NULL, ",", &save))
+    {
+        list[n++] = cksm_bench_parse_size(tok);
+    }
+    return n;
+}
+
+/* fetch the next chunk of input, either straight from memory or with a
+   positional read into buf, the same way the DSI reads from storage */
+static
+ssize_t
+cksm_bench_next(
+    cksm_bench_job_t *                  job,
+    unsigned char *                     buf,
+    off_t                               pos,
+    const unsigned char **              data)
+{
+    size_t                              len;
+    ssize_t                             n;
+
+    len = job->chunk;
+    if ((off_t) len > job->offset + job->length - pos)
+        len = job->offset + job->length - pos;
+    if (job->mem != NULL)
+    {
+        *data = job->mem + pos;
+        return len;
+    }
+    n = pread(job->fd, buf, len, pos);
+    *data = buf;
+    return n;
+}
+
+static
+void *
+cksm_bench_worker(
+    void *                              arg)
+{
+    cksm_bench_job_t *                  job = (cksm_bench_job_t *) arg;
+    unsigned char *                     buf = NULL;
+    const unsigned char *               data;
+    unsigned char                       md[EVP_MAX_MD_SIZE];
+    unsigned int                        mdlen = 0;
+    MD5_CTX                             md5;
+    EVP_MD_CTX *                        evp = NULL;
+    off_t                               pos;
+    ssize_t                             n;
+    unsigned int                        i;
+
+    if (job->mem == NULL && (buf = malloc(job->chunk)) == NULL)
+    {
+        job->error = ENOMEM;
+        return NULL;
+    }
+
+    job->adler = adler32(0L, Z_NULL, 0);
+    if (job->engine == CKSM_BENCH_MD5)
+    {
+        MD5_Init(&md5);
+    }
+    else if (job->engine == CKSM_BENCH_EVP_MD5)
+    {
+        evp = EVP_MD_CTX_new();
+        EVP_DigestInit_ex(evp, EVP_md5(), NULL);
+    }
+
+    for (pos = job->offset; pos < job->offset + job->length; pos += n)
+    {
+        n = cksm_bench_next(job, buf, pos, &data);
+        if (n <= 0)
+        {
+            job->error = n < 0 ? errno : EIO;
+            break;
+        }
+        switch (job->engine)
+        {
+          case CKSM_BENCH_ADLER32:
+          case CKSM_BENCH_ADLER32_MT:
+            job->adler = adler32(job->adler, data, n);
+            break;
+          case CKSM_BENCH_MD5:
+            MD5_Update(&md5, data, n);
+            break;
+          case CKSM_BENCH_EVP_MD5:
+            EVP_DigestUpdate(evp, data, n);
+            break;
+          default:
+            break;
+        }
+    }
+
+    if (job->engine == CKSM_BENCH_MD5)
+    {
+        MD5_Final(md, &md5);
+        mdlen = MD5_DIGEST_LENGTH;
+    }
+    else if (job->engine == CKSM_BENCH_EVP_MD5)
+    {
+        EVP_DigestFinal_ex(evp, md, &mdlen);
+        EVP_MD_CTX_free(evp);
+    }
+    if (mdlen > 0)
+    {
+        for (i = 0; i < mdlen; i++)
+            sprintf(&job->digest[i*2], "%02x", (unsigned int) md[i]);
+    }
+    else
+    {
+        sprintf(job->digest, "%08lx", (unsigned long) job->adler);
+    }
+
+    free(buf);
+    return NULL;
+}
+
+/*
+ * Run one engine over [0, length) with the given chunk size and thread
+ * count. adler32-mt splits the input into one range per thread and joins
+ * the partial sums with adler32_combine(); the other engines are
+ * inherently sequential, so every thread digests the whole input and the
+ * aggregate rate is reported.
+ */
+static
+int
+cksm_bench_run(
+    cksm_bench_engine_t                 engine,
+    const unsigned char *               mem,
+    int                                 fd,
+    off_t                               length,
+    size_t                              chunk,
+    int                                 nthreads,
+    double *                            seconds,
+    double *                            bytes,
+    unsigned long long *                cycles,
+    char *                              digest)
+{
+    cksm_bench_job_t                    jobs[CKSM_BENCH_MAX_THREADS];
+    pthread_t                           tids[CKSM_BENCH_MAX_THREADS];
+    off_t                               piece;
+    uLong                               adler;
+    unsigned long long                  c0;
+    double                              t0;
+    int                                 i;
+
+    piece = (length + nthreads - 1) / nthreads;
+    memset(jobs, 0, sizeof(jobs));
+    for (i = 0; i < nthreads; i++)
+    {
+        jobs[i].engine = engine;
+        jobs[i].mem = mem;
+        jobs[i].fd = fd;
+        jobs[i].chunk = chunk;
+        if (engine == CKSM_BENCH_ADLER32_MT)
+        {
+            jobs[i].offset = (off_t) i * piece;
+            jobs[i].length = jobs[i].offset >= length ? 0 :
+                (length - jobs[i].offset < piece ?
+                 length - jobs[i].offset : piece);
+        }
+        else
+        {
+            jobs[i].offset = 0;
+            jobs[i].length = length;
+        }
+    }
+
+    c0 = cksm_bench_cycles();
+    t0 = cksm_bench_now();
+    for (i = 0; i < nthreads; i++)
+        pthread_create(&tids[i], NULL, cksm_bench_worker, &jobs[i]);
+    for (i = 0; i < nthreads; i++)
+        pthread_join(tids[i], NULL);
+    *seconds = cksm_bench_now() - t0;
+    *cycles = cksm_bench_cycles() - c0;
+
+    for (i = 0; i < nthreads; i++)
+    {
+        if (jobs[i].error != 0)
+        {
+            fprintf(stderr, "%s: %s\n", cksm_bench_engine_names[engine],
+                    strerror(jobs[i].error));
+            return -1;
+        }
+    }
+
+    if (engine == CKSM_BENCH_ADLER32_MT)
+    {
+        adler = jobs[0].adler;
+        for (i = 1; i < nthreads; i++)
+            adler = adler32_combine(adler, jobs[i].adler, jobs[i].length);
+        sprintf(digest, "%08lx", (unsigned long) adler);
+        *bytes = (double) length;
+    }
+    else
+    {
+        /* every thread digested the full input and must agree */
+        for (i = 1; i < nthreads; i++)
+        {
+            if (strcmp(jobs[i].digest, jobs[0].digest) != 0)
+            {
+                strcpy(digest, "thread-mismatch");
+                return 0;
+            }
+        }
+        strcpy(digest, jobs[0].digest);
+        *bytes = (double) length * nthreads;
+    }
+    return 0;
+}
+
+static
+int
+cksm_bench_input(
+    const char *                        label,
+    const unsigned char *               mem,
+    int                                 fd,
+    off_t                               length,
+    int *                               engines,
+    size_t *                            chunks,
+    int                                 nchunks,
+    size_t *                            threads,
+    int                                 nthreads,
+    int                                 repeat)
+{
+    char                                ref[2][CKSM_BENCH_DIGEST_LEN];
+    char                                digest[CKSM_BENCH_DIGEST_LEN];
+    double                              seconds, best, bytes;
+    unsigned long long                  cycles, best_cycles;
+    int                                 e, c, t, r, mismatch = 0;
+
+    ref[0][0] = ref[1][0] = '\0';
+    printf("\n# input: %s, %lld bytes\n", label, (long long) length);
+    printf("%-11s %10s %7s %9s %12s  %s\n",
+           "engine", "chunk", "threads", "GB/s", "cycles/byte", "digest");
+
+    for (e = 0; e < CKSM_BENCH_NENGINES; e++)
+    {
+        if (! engines[e]) continue;
+        for (c = 0; c < nchunks; c++)
+        {
+            for (t = 0; t < nthreads; t++)
+            {
+                best = 0;
+                best_cycles = 0;
+                bytes = 0;
+                digest[0] = '\0';
+                for (r = 0; r < repeat; r++)
+                {
+                    if (cksm_bench_run(e, mem, fd, length, chunks[c],
+                                       (int) threads[t], &seconds, &bytes,
+                                       &cycles, digest) != 0)
+                        return -1;
+                    if (best == 0 || seconds < best)
+                    {
+                        best = seconds;
+                        best_cycles = cycles;
+                    }
+                }
+
+                printf("%-11s %10zu %7zu %9.3f ", cksm_bench_engine_names[e],
+                       chunks[c], threads[t], bytes / best / 1e9);
+                if (best_cycles != 0)
+                    printf("%12.3f", (double) best_cycles * threads[t] / bytes);
+                else
+                    printf("%12s", "n/a");
+
+                if (ref[cksm_bench_engine_family[e]][0] == '\0')
+                    strcpy(ref[cksm_bench_engine_family[e]], digest);
+                if (strcmp(ref[cksm_bench_engine_family[e]], digest) != 0)
+                {
+                    printf("  %s MISMATCH (expected %s)\n", digest,
+                           ref[cksm_bench_engine_family[e]]);
+                    mismatch = 1;
+                }
+                else
+                {
+                    printf("  %s\n", digest);
+                }
+            }
+        }
+    }
+    return mismatch;
+}
+
+static
+void
+cksm_bench_usage(
+    const char *                        prog)
+{
+    fprintf(stderr,
+            "usage: %s [-s MB] [-f file] [-c chunks] [-t threads] "
+            "[-r repeat] [-e engines]\n", prog);
+    exit(2);
+}
+
+int
+main(
+    int                                 argc,
+    char **                             argv)
+{
+    char                                chunk_arg[256] = "64K,1M,4M";
+    char                                thread_arg[256] = "1,2,4";
+    char *                              engine_arg = NULL;
+    char *                              file = NULL;
+    size_t                              chunks[CKSM_BENCH_MAX_LIST];
+    size_t                              threads[CKSM_BENCH_MAX_LIST];
+    int                                 engines[CKSM_BENCH_NENGINES];
+    int                                 nchunks, nthreads;
+    int                                 repeat = 3;
+    size_t                              memsize = 256;
+    unsigned char *                     mem;
+    struct stat                         stbuf;
+    char *                              tok;
+    char *                              save;
+    size_t                              i;
+    int                                 e, opt, fd, rc;
+    int                                 mismatch = 0, failed = 0;
+
+    while ((opt = getopt(argc, argv, "s:f:c:t:r:e:h")) != -1)
+    {
+        switch (opt)
+        {
+          case 's': memsize = strtoul(optarg, NULL, 10); break;
+          case 'f': file = optarg; break;
+          case 'c': snprintf(chunk_arg, sizeof(chunk_arg), "%s", optarg); break;
+          case 't': snprintf(thread_arg, sizeof(thread_arg), "%s", optarg); break;
+          case 'r': repeat = atoi(optarg); break;
+          case 'e': engine_arg = optarg; break;
+          default: cksm_bench_usage(argv[0]);
+        }
+    }
+    if (repeat < 1) repeat = 1;
+
+    nchunks = cksm_bench_parse_list(chunk_arg, chunks);
+    nthreads = cksm_bench_parse_list(thread_arg, threads);
+    for (i = 0; i < (size_t) nchunks; i++)
+        if (chunks[i] == 0) cksm_bench_usage(argv[0]);
+    for (i = 0; i < (size_t) nthreads; i++)
+    {
+        if (threads[i] == 0) cksm_bench_usage(argv[0]);
+        if (threads[i] > CKSM_BENCH_MAX_THREADS)
+        {
+            fprintf(stderr, "%zu threads, using %d\n", threads[i],
+                    CKSM_BENCH_MAX_THREADS);
+            threads[i] = CKSM_BENCH_MAX_THREADS;
+        }
+    }
+
+    for (e = 0; e < CKSM_BENCH_NENGINES; e++)
+        engines[e] = (engine_arg == NULL);
+    for (tok = engine_arg ? strtok_r(engine_arg, ",", &save) : NULL; tok;
+         tok = strtok_r(NULL, ",", &save))
+    {
+        for (e = 0; e < CKSM_BENCH_NENGINES; e++)
+            if (! strcmp(tok, cksm_bench_engine_names[e])) break;
+        if (e == CKSM_BENCH_NENGINES)
+        {
+            fprintf(stderr, "unknown engine %s\n", tok);
+            cksm_bench_usage(argv[0]);
+        }
+        engines[e] = 1;
+    }
+
+    if (memsize > 0)
+    {
+        memsize *= 1024 * 1024;
+        mem = malloc(memsize);
+        if (mem == NULL)
+        {
+            fprintf(stderr, "cannot allocate %zu bytes\n", memsize);
+            return 2;
+        }
+        /* incompressible, reproducible content */
+        srandom(20090316);
+        for (i = 0; i < memsize; i++)
+            mem[i] = (unsigned char) (random() >> 7);
+        rc = cksm_bench_input("memory", mem, -1, memsize, engines,
+                              chunks, nchunks, threads, nthreads, repeat);
+        if (rc < 0) failed = 1;
+        if (rc > 0) mismatch = 1;
+        free(mem);
+    }
+
+    if (file != NULL)
+    {
+        if ((fd = open(file, O_RDONLY)) < 0 || fstat(fd, &stbuf) != 0)
+        {
+            fprintf(stderr, "%s: %s\n", file, strerror(errno));
+            return 2;
+        }
+        rc = cksm_bench_input(file, NULL, fd, stbuf.st_size, engines,
+                              chunks, nchunks, threads, nthreads, repeat);
+        if (rc < 0) failed = 1;
+        if (rc > 0) mismatch = 1;
+        close(fd);
+    }
+
+    if (failed) return 3;
+    return mismatch;
+}
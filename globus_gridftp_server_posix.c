@@ -90,15 +90,118 @@
    while (pathname[0] == '/' && pathname[1] == '/') { pathname++; }
 */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
 #include <unistd.h>
+#include <fcntl.h>
 #include <sys/types.h>
 #include <grp.h>
 #include <utime.h>
 #include <dirent.h>
 #include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <sys/vfs.h>
+#include <sys/xattr.h>
 #include <zlib.h>
 #include <openssl/md5.h>
+#include <openssl/sha.h>
 #include "globus_gridftp_server.h"
+#include "globus_gridftp_server_posix_trace.h"
+
+/*
+ * USDT probes (provider gridftp_posix) at entry and return of the storage
+ * operations and the globus callbacks, compiled in when sys/sdt.h is
+ * available (-DHAVE_SYS_SDT_H, see Makefile). Each probe has a semaphore
+ * that the tracer increments while it is attached: a probe is skipped,
+ * arguments and all, unless its semaphore is set, and the clock for the
+ * duration is read only when the *_return probe is. Without sys/sdt.h
+ * the macros compile to nothing.
+ * Paths are char *, offsets and lengths long long, durations (the last
+ * argument of a *_return probe) microseconds, e.g.
+ *
+ *   bpftrace -e 'usdt:./libglobus_gridftp_server_posix.so:gridftp_posix:read_return
+ *                { @us = hist(arg3); }'
+ */
+#ifdef HAVE_SYS_SDT_H
+#define _SDT_HAS_SEMAPHORES             1
+#include <sys/sdt.h>
+#define GLOBUS_L_GFS_POSIX_SEMAPHORE(n)                                     \
+    __attribute__((visibility("hidden"), section(".probes")))               \
+    unsigned short gridftp_posix_##n##_semaphore
+#define GLOBUS_L_GFS_POSIX_ENABLED(n)                                       \
+    __builtin_expect(gridftp_posix_##n##_semaphore != 0, 0)
+#define GLOBUS_L_GFS_POSIX_CLOCK(n)                                         \
+    (GLOBUS_L_GFS_POSIX_ENABLED(n) ? globus_l_gfs_posix_now() : 0.0)
+#define GLOBUS_L_GFS_POSIX_USEC(t)                                          \
+    ((long) ((globus_l_gfs_posix_now() - (t)) * 1000000))
+#define GLOBUS_L_GFS_POSIX_PROBE1(n, a)                                     \
+    do { if (GLOBUS_L_GFS_POSIX_ENABLED(n))                                 \
+        DTRACE_PROBE1(gridftp_posix, n, a); } while (0)
+#define GLOBUS_L_GFS_POSIX_PROBE2(n, a, b)                                  \
+    do { if (GLOBUS_L_GFS_POSIX_ENABLED(n))                                 \
+        DTRACE_PROBE2(gridftp_posix, n, a, b); } while (0)
+#define GLOBUS_L_GFS_POSIX_PROBE3(n, a, b, c)                               \
+    do { if (GLOBUS_L_GFS_POSIX_ENABLED(n))                                 \
+        DTRACE_PROBE3(gridftp_posix, n, a, b, c); } while (0)
+#define GLOBUS_L_GFS_POSIX_PROBE4(n, a, b, c, d)                            \
+    do { if (GLOBUS_L_GFS_POSIX_ENABLED(n))                                 \
+        DTRACE_PROBE4(gridftp_posix, n, a, b, c, d); } while (0)
+
+GLOBUS_L_GFS_POSIX_SEMAPHORE(admit_entry);
+GLOBUS_L_GFS_POSIX_SEMAPHORE(admit_return);
+GLOBUS_L_GFS_POSIX_SEMAPHORE(cgi_entry);
+GLOBUS_L_GFS_POSIX_SEMAPHORE(cgi_return);
+GLOBUS_L_GFS_POSIX_SEMAPHORE(cksm_chunk_entry);
+GLOBUS_L_GFS_POSIX_SEMAPHORE(cksm_chunk_return);
+GLOBUS_L_GFS_POSIX_SEMAPHORE(cksm_job_entry);
+GLOBUS_L_GFS_POSIX_SEMAPHORE(cksm_job_return);
+GLOBUS_L_GFS_POSIX_SEMAPHORE(close_entry);
+GLOBUS_L_GFS_POSIX_SEMAPHORE(close_return);
+GLOBUS_L_GFS_POSIX_SEMAPHORE(coalesce_timer_entry);
+GLOBUS_L_GFS_POSIX_SEMAPHORE(coalesce_timer_return);
+GLOBUS_L_GFS_POSIX_SEMAPHORE(kick_entry);
+GLOBUS_L_GFS_POSIX_SEMAPHORE(kick_return);
+GLOBUS_L_GFS_POSIX_SEMAPHORE(open_entry);
+GLOBUS_L_GFS_POSIX_SEMAPHORE(open_return);
+GLOBUS_L_GFS_POSIX_SEMAPHORE(prefetch_entry);
+GLOBUS_L_GFS_POSIX_SEMAPHORE(prefetch_return);
+GLOBUS_L_GFS_POSIX_SEMAPHORE(quota_entry);
+GLOBUS_L_GFS_POSIX_SEMAPHORE(quota_return);
+GLOBUS_L_GFS_POSIX_SEMAPHORE(read_entry);
+GLOBUS_L_GFS_POSIX_SEMAPHORE(read_return);
+GLOBUS_L_GFS_POSIX_SEMAPHORE(readdir_entry);
+GLOBUS_L_GFS_POSIX_SEMAPHORE(readdir_return);
+GLOBUS_L_GFS_POSIX_SEMAPHORE(recv_cb_entry);
+GLOBUS_L_GFS_POSIX_SEMAPHORE(recv_cb_return);
+GLOBUS_L_GFS_POSIX_SEMAPHORE(send_cb_entry);
+GLOBUS_L_GFS_POSIX_SEMAPHORE(send_cb_return);
+GLOBUS_L_GFS_POSIX_SEMAPHORE(send_range);
+GLOBUS_L_GFS_POSIX_SEMAPHORE(small_file);
+GLOBUS_L_GFS_POSIX_SEMAPHORE(stat_entry);
+GLOBUS_L_GFS_POSIX_SEMAPHORE(stat_return);
+GLOBUS_L_GFS_POSIX_SEMAPHORE(write_entry);
+GLOBUS_L_GFS_POSIX_SEMAPHORE(write_return);
+#else
+#define GLOBUS_L_GFS_POSIX_ENABLED(n)   0
+#define GLOBUS_L_GFS_POSIX_CLOCK(n)     0.0
+#define GLOBUS_L_GFS_POSIX_USEC(t)      ((void) (t), 0L)
+#define GLOBUS_L_GFS_POSIX_PROBE1(n, a) ((void) (a))
+#define GLOBUS_L_GFS_POSIX_PROBE2(n, a, b)                                  \
+    ((void) (a), (void) (b))
+#define GLOBUS_L_GFS_POSIX_PROBE3(n, a, b, c)                               \
+    ((void) (a), (void) (b), (void) (c))
+#define GLOBUS_L_GFS_POSIX_PROBE4(n, a, b, c, d)                            \
+    ((void) (a), (void) (b), (void) (c), (void) (d))
+#endif
 
 static
 globus_version_t local_version =
@@ -109,10 +212,329 @@ globus_version_t local_version =
     0 /* branch ID */
 };
 
+/*
+ * Storage I/O auto-tuning. The server hands us optimal_count and block_size
+ * which are right for the network but not necessarily for the storage. When
+ * GRIDFTP_POSIX_AUTOTUNE is set, we measure the storage throughput over
+ * windows of I/O and hill-climb first the number of outstanding operations,
+ * then the storage I/O size, keeping a step only if it gains more than 5%.
+ */
+#define GLOBUS_L_GFS_POSIX_TUNE_COUNT   0
+#define GLOBUS_L_GFS_POSIX_TUNE_IOSIZE  1
+#define GLOBUS_L_GFS_POSIX_TUNE_DONE    2
+
+typedef struct globus_l_gfs_posix_tune_s
+{
+    globus_bool_t                       enabled;
+    globus_bool_t                       tune_io_size;
+    int                                 phase;
+    int                                 count;
+    globus_size_t                       io_size;
+    int                                 max_count;
+    globus_size_t                       max_io_size;
+    int                                 best_count;
+    globus_size_t                       best_io_size;
+    double                              best_rate;
+    double                              win_start;
+    globus_off_t                        win_bytes;
+    int                                 win_ops;
+    globus_off_t                        total_bytes;
+    int                                 total_ops;
+    double                              total_latency;
+} globus_l_gfs_posix_tune_t;
+
+/*
+ * Write coalescing on recv. Contiguous network blocks are held (without
+ * copying) in extents that never cross a multiple of extent_size, and an
+ * extent is written with one pwritev() once it fills its aligned window.
+ * Partial extents are written at EOF, after timeout seconds, or when the
+ * blocks held by the transfer exceed max_mem.
+ */
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+#define GLOBUS_L_GFS_POSIX_MAX_EXTENTS  16
+
+typedef struct globus_l_gfs_posix_extent_s
+{
+    globus_off_t                        offset;
+    globus_size_t                       length;
+    struct iovec *                      iov;
+    int                                 niov;
+    int                                 iov_cap;
+    double                              t_first;
+} globus_l_gfs_posix_extent_t;
+
+typedef struct globus_l_gfs_posix_coalesce_s
+{
+    globus_size_t                       extent_size;
+    globus_size_t                       max_mem;
+    double                              timeout;
+    globus_size_t                       held;
+    int                                 nextents;
+    globus_l_gfs_posix_extent_t         extents[GLOBUS_L_GFS_POSIX_MAX_EXTENTS];
+    globus_bool_t                       timer_pending;
+    globus_bool_t                       timer_unregistered;
+    globus_callback_handle_t            timer;
+    globus_bool_t                       no_pwritev;
+    int                                 flushes;
+    globus_off_t                        flushed_bytes;
+} globus_l_gfs_posix_coalesce_t;
+
+/*
+ * Reorder buffer on recv. Some backends want strictly sequential writes,
+ * while MODE E parallel streams deliver blocks out of order. Blocks ahead
+ * of next_offset are held in a list sorted by offset and written once the
+ * gap before them is filled. No new reads are posted while the held data
+ * would exceed max_mem (but one read is always kept outstanding). If the
+ * buffer overflows anyway, or the gap grows beyond max_gap, the transfer
+ * falls back to writing blocks at their offsets as they arrive.
+ */
+typedef struct globus_l_gfs_posix_pending_s
+{
+    struct globus_l_gfs_posix_pending_s * next;
+    globus_byte_t *                     buffer;
+    globus_size_t                       nbytes;
+    globus_off_t                        offset;
+} globus_l_gfs_posix_pending_t;
+
+typedef struct globus_l_gfs_posix_reorder_s
+{
+    globus_bool_t                       enabled;
+    globus_size_t                       max_mem;
+    globus_off_t                        max_gap;
+    globus_off_t                        next_offset;
+    globus_range_list_t                 ranges;
+    globus_size_t                       held;
+    globus_size_t                       peak;
+    int                                 reordered;
+    globus_l_gfs_posix_pending_t *      pending;
+} globus_l_gfs_posix_reorder_t;
+
+/*
+ * Write-behind on recv. Without it an upload leaves everything dirty in
+ * the page cache and close() (or the file system behind it) stalls while
+ * gigabytes are flushed. With GRIDFTP_POSIX_WRITE_BEHIND, writeback of
+ * each half of the allowed dirty data is started with sync_file_range()
+ * as soon as it is written, and the previous half is waited for, so at
+ * most that much is dirty. The durability policy decides what happens
+ * at the end: nothing, an fdatasync(), or writes opened with O_DSYNC.
+ */
+#define GLOBUS_L_GFS_POSIX_DURABLE_NONE       0
+#define GLOBUS_L_GFS_POSIX_DURABLE_FDATASYNC  1
+#define GLOBUS_L_GFS_POSIX_DURABLE_DSYNC      2
+
+typedef struct globus_l_gfs_posix_flush_s
+{
+    int                                 durability;
+    globus_off_t                        window;
+    globus_off_t                        start;
+    globus_off_t                        end;
+    globus_off_t                        bytes;
+    globus_off_t                        prev_start;
+    globus_off_t                        prev_end;
+    int                                 syncs;
+    double                              wait;
+} globus_l_gfs_posix_flush_t;
+
+/*
+ * Storage backends. Transfers, stat of a single file and delete go
+ * through an ops table chosen by path prefix, so other storage engines
+ * can be added without touching the transfer logic. Built in are "posix"
+ * (libc, the default), "null" (a sink that discards what it is given and
+ * a source of zeros, without system calls; /dev/null and /dev/zero use
+ * it) and "mem" (files kept in POSIX shared memory, i.e. in RAM).
+ * Backends that are not seekable are written and read sequentially.
+ */
+typedef struct globus_l_gfs_posix_backend_s
+{
+    const char *                        name;
+    globus_bool_t                       seekable;
+    int                                 (*open)(const char *, int, mode_t);
+    int                                 (*close)(int);
+    ssize_t                             (*read)(int, void *, size_t);
+    ssize_t                             (*write)(int, const void *, size_t);
+    ssize_t                             (*pread)(int, void *, size_t, off_t);
+    ssize_t                             (*writev)(int, const struct iovec *,
+                                                  int);
+    ssize_t                             (*pwritev)(int, const struct iovec *,
+                                                   int, off_t);
+    off_t                               (*lseek)(int, off_t, int);
+    int                                 (*stat)(const char *, struct stat *);
+    int                                 (*unlink)(const char *);
+    int                                 (*mkdir)(const char *, mode_t);
+} globus_l_gfs_posix_backend_t;
+
+#define GLOBUS_L_GFS_POSIX_MAX_BACKENDS 16
+
+typedef struct globus_l_gfs_posix_backend_prefix_s
+{
+    char                                prefix[256];
+    const globus_l_gfs_posix_backend_t * backend;
+} globus_l_gfs_posix_backend_prefix_t;
+
+/*
+ * Restart journal on recv. The ranges that reached storage are kept in a
+ * range list and, every interval seconds, fdatasync()ed and saved next to
+ * the file ("<path>.gridftp-journal") or in its user.gridftp.journal
+ * xattr. When the client restarts the upload (REST), ranges it asks for
+ * but that the journal already has are reported back as written and the
+ * blocks are dropped instead of being written again. The journal is
+ * removed when the upload completes.
+ */
+#define GLOBUS_L_GFS_POSIX_JOURNAL_SIDECAR  1
+#define GLOBUS_L_GFS_POSIX_JOURNAL_XATTR    2
+#define GLOBUS_L_GFS_POSIX_JOURNAL_SUFFIX   ".gridftp-journal"
+#define GLOBUS_L_GFS_POSIX_JOURNAL_XNAME    "user.gridftp.journal"
+
+typedef struct globus_l_gfs_posix_journal_s
+{
+    int                                 mode;
+    char                                path[MAXPATHLEN];
+    ino_t                               ino;
+    globus_range_list_t                 written;
+    globus_range_list_t                 skip;
+    globus_off_t                        skipped;
+    double                              interval;
+    double                              t_saved;
+    globus_bool_t                       dirty;
+} globus_l_gfs_posix_journal_t;
+
+/*
+ * Bandwidth shaping. Storage I/O of a transfer draws from up to three
+ * token buckets: one for the node, one for the user and one for the path
+ * prefix, each refilled at its rate with a burst of one second. A
+ * transfer that runs a bucket into debt sleeps until the debt is paid,
+ * so concurrent transfers sharing a bucket split its rate. The buckets
+ * live in a shared memory segment (see globus_l_gfs_posix_shm_t), so the
+ * limits hold across the forked server processes.
+ */
+#define GLOBUS_L_GFS_POSIX_MAX_SHAPES   3
+#define GLOBUS_L_GFS_POSIX_KEY_LEN      128
+
+typedef struct globus_l_gfs_posix_shape_s
+{
+    int                                 nbuckets;
+    char                                key[GLOBUS_L_GFS_POSIX_MAX_SHAPES]
+                                           [GLOBUS_L_GFS_POSIX_KEY_LEN];
+    double                              rate[GLOBUS_L_GFS_POSIX_MAX_SHAPES];
+    int                                 index[GLOBUS_L_GFS_POSIX_MAX_SHAPES];
+    double                              throttled;
+    int                                 waits;
+} globus_l_gfs_posix_shape_t;
+
+/*
+ * Admission control. When many transfers hit one RAID or one OST at once,
+ * seeking between them costs more than it gains. GRIDFTP_POSIX_ADMIT caps
+ * the transfers doing storage I/O at the same time per device (st_dev of
+ * the file) or per path prefix, node wide. Transfers over the cap take a
+ * ticket and wait in FIFO order, polling from a timed callback, before
+ * their first read or write. Slots of processes that died are reclaimed.
+ * The callback is cancelled, under the handle mutex, when the transfer is
+ * aborted or the session ends while it waits.
+ */
+#define GLOBUS_L_GFS_POSIX_ADMIT_IDLE       0
+#define GLOBUS_L_GFS_POSIX_ADMIT_QUEUED     1
+#define GLOBUS_L_GFS_POSIX_ADMIT_RUNNING    2
+
+typedef struct globus_l_gfs_posix_admit_s
+{
+    int                                 slot;
+    int                                 limit;
+    char                                key[GLOBUS_L_GFS_POSIX_KEY_LEN];
+    double                              t_queued;
+    void                                (*admitted)(void *);
+    globus_bool_t                       unlimited;
+    int                                 state;
+    globus_bool_t                       cancelled;
+    globus_bool_t                       unregistered;
+    globus_callback_handle_t            timer;
+} globus_l_gfs_posix_admit_t;
+
+/*
+ * Open file cache. Striped and partial retrieve clients send several
+ * RETRs for the same file in one session, and with the xrootd preload
+ * every open() is a round trip to the redirector. GRIDFTP_POSIX_FDCACHE
+ * keeps up to that many read-only descriptors of a session open after
+ * their send, keyed by path. A descriptor is used again only if a stat
+ * of the path still shows the same inode and mtime, and it is dropped
+ * on any command that changes the path and on a recv to it.
+ */
+#define GLOBUS_L_GFS_POSIX_MAX_FDCACHE  16
+
+typedef struct globus_l_gfs_posix_cached_fd_s
+{
+    char *                              path;
+    const globus_l_gfs_posix_backend_t * backend;
+    int                                 fd;
+    dev_t                               dev;
+    ino_t                               ino;
+    struct timespec                     mtime;
+    unsigned long                       used;
+    globus_bool_t                       busy;
+    globus_bool_t                       stale;
+    globus_bool_t                       speculative;
+} globus_l_gfs_posix_cached_fd_t;
+
+typedef struct globus_l_gfs_posix_fdcache_s
+{
+    pthread_mutex_t                     lock;
+    pthread_cond_t                      cond;
+    int                                 size;
+    unsigned long                       clock;
+    int                                 hits;
+    int                                 misses;
+    globus_l_gfs_posix_cached_fd_t      fds[GLOBUS_L_GFS_POSIX_MAX_FDCACHE];
+} globus_l_gfs_posix_fdcache_t;
+
+/*
+ * Speculative prefetch. Clients nearly always follow a SIZE or MLST of a
+ * regular file with a RETR of it. With GRIDFTP_POSIX_PREFETCH, a stat of
+ * a single regular file starts a thread that opens the file and asks
+ * for readahead (POSIX_FADV_WILLNEED) of its first GRIDFTP_POSIX_PREFETCH
+ * bytes. The descriptor is left in the open file cache for the send,
+ * which waits for a speculation of its path that is still running. At
+ * most GRIDFTP_POSIX_PREFETCH_MAX of them run at once in a session. A
+ * speculative descriptor that is dropped before any send used it counts
+ * as wasted. The jobs and counters are guarded by the fdcache lock.
+ */
+typedef struct globus_l_gfs_posix_prefetch_job_s
+{
+    struct globus_l_gfs_posix_prefetch_job_s * next;
+    struct globus_l_gfs_posix_handle_s * posix_handle;
+    const globus_l_gfs_posix_backend_t * backend;
+    char *                              path;
+    globus_off_t                        length;
+} globus_l_gfs_posix_prefetch_job_t;
+
+typedef struct globus_l_gfs_posix_prefetch_s
+{
+    int                                 max;
+    int                                 running;
+    int                                 started;
+    int                                 hits;
+    int                                 wasted;
+    globus_l_gfs_posix_prefetch_job_t * jobs;
+} globus_l_gfs_posix_prefetch_t;
+
+/*
+ * Descriptor pool on send. With the xrootd preload (and some FUSE mounts)
+ * I/O on one descriptor is serialized inside the client library, so a
+ * transfer may open the file several times and spread its positional
+ * reads over the descriptors, by file range.
+ */
+#define GLOBUS_L_GFS_POSIX_MAX_FDS      16
+
 typedef struct globus_l_gfs_posix_handle_s
 {
     char *                              pathname; 
+    const globus_l_gfs_posix_backend_t * backend;
+    globus_l_gfs_posix_backend_prefix_t backends[GLOBUS_L_GFS_POSIX_MAX_BACKENDS];
+    int                                 nbackends;
     int                                 fd;
+    int                                 fds[GLOBUS_L_GFS_POSIX_MAX_FDS];
+    int                                 nfds;
+    int                                 nranges;
     char                                seekable;
     globus_size_t                       block_size;
     globus_off_t                        block_length;
@@ -121,905 +543,6272 @@ typedef struct globus_l_gfs_posix_handle_s
     globus_gfs_operation_t              op;
     int                                 optimal_count;
     int                                 outstanding;
+    int                                 active;
+    int                                 kicks;
     globus_mutex_t                      mutex;
+    globus_cond_t                       cond;
+    globus_result_t                     result;
+    globus_l_gfs_posix_tune_t           tune;
+    globus_l_gfs_posix_coalesce_t       coalesce;
+    globus_l_gfs_posix_reorder_t        reorder;
+    globus_l_gfs_posix_journal_t        journal;
+    globus_l_gfs_posix_flush_t          flush;
+    globus_l_gfs_posix_shape_t          shape;
+    globus_l_gfs_posix_admit_t          admit;
+    globus_off_t                        prealloc_end;
+    globus_bool_t                       small;
+    globus_off_t                        file_size;
+    double                              t_begin;
+    globus_off_t                        transferred;
+    int                                 node_ndx;
+    int                                 node_count;
+    globus_size_t                       io_size;
+    globus_size_t                       io_align;
+    globus_l_gfs_posix_fdcache_t        fdcache;
+    globus_l_gfs_posix_prefetch_t       prefetch;
+    char *                              username;
 } globus_l_gfs_posix_handle_t;
 
 char err_msg[256];
 static int local_io_block_size = 0;
 static int local_io_count = 0;
 
-/*************************************************************************
- *  start
- *  -----
- *  This function is called when a new session is initialized, ie a user 
- *  connectes to the server.  This hook gives the dsi an oppertunity to
- *  set internal state that will be threaded through to all other
- *  function calls associated with this session.  And an oppertunity to
- *  reject the user.
- *
- *  finished_info.info.session.session_arg should be set to an DSI
- *  defined data structure.  This pointer will be passed as the void *
- *  user_arg parameter to all other interface functions.
- * 
- *  NOTE: at nice wrapper function should exist that hides the details 
- *        of the finished_info structure, but it currently does not.  
- *        The DSI developer should jsut follow this template for now
- ************************************************************************/
 static
-void
-globus_l_gfs_posix_start(
-    globus_gfs_operation_t              op,
-    globus_gfs_session_info_t *         session_info)
+double
+globus_l_gfs_posix_now(void)
 {
-    globus_l_gfs_posix_handle_t *       posix_handle;
-    globus_gfs_finished_info_t          finished_info;
-    struct passwd *                     pw;
-
-    GlobusGFSName(globus_l_gfs_posix_start);
+    struct timeval                      tv;
 
-    globus_gridftp_server_set_checksum_support(op, "MD5:10");
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
 
-    posix_handle = (globus_l_gfs_posix_handle_t *)
-        globus_malloc(sizeof(globus_l_gfs_posix_handle_t));
+/* integer setting from the environment, def if unset */
+static
+long
+globus_l_gfs_posix_getenv_int(
+    const char *                        name,
+    long                                def)
+{
+    char *                              value;
 
-    posix_handle->fd = 0;
+    value = getenv(name);
+    if (value == NULL || *value == '\0') return def;
+    return strtol(value, NULL, 10);
+}
 
-    memset(&finished_info, '\0', sizeof(globus_gfs_finished_info_t));
-    finished_info.type = GLOBUS_GFS_OP_SESSION_START;
-    finished_info.result = GLOBUS_SUCCESS;
-    finished_info.info.session.session_arg = posix_handle;
-    finished_info.info.session.username = session_info->username;
-    pw = getpwuid(getuid());
-    finished_info.info.session.home_dir = pw->pw_dir;
+/* a size with an optional K, M or G suffix */
+static
+globus_off_t
+globus_l_gfs_posix_parse_size(
+    const char *                        value)
+{
+    char *                              end;
+    globus_off_t                        size;
 
-    globus_gridftp_server_operation_finished(
-        op, GLOBUS_SUCCESS, &finished_info);
+    size = strtoll(value, &end, 10);
+    switch (*end)
+    {
+      case 'g': case 'G': size *= 1024;  /* fall through */
+      case 'm': case 'M': size *= 1024;  /* fall through */
+      case 'k': case 'K': size *= 1024;
+    }
+    return size;
 }
 
-/*************************************************************************
- *  destroy
- *  -------
- *  This is called when a session ends, ie client quits or disconnects.
- *  The dsi should clean up all memory they associated wit the session
- *  here. 
- ************************************************************************/
+/* size setting from the environment, accepts K, M and G suffixes */
 static
-void
-globus_l_gfs_posix_destroy(
-    void *                              user_arg)
+globus_off_t
+globus_l_gfs_posix_getenv_size(
+    const char *                        name,
+    globus_off_t                        def)
 {
-    globus_l_gfs_posix_handle_t *       posix_handle;
+    char *                              value;
 
-    posix_handle = (globus_l_gfs_posix_handle_t *) user_arg;
+    value = getenv(name);
+    if (value == NULL || *value == '\0') return def;
+    return globus_l_gfs_posix_parse_size(value);
+}
 
-    globus_free(posix_handle);
+/*
+ * Per path settings are comma separated lists of prefix=value, e.g.
+ * "/xrootd/=4,/lustre/=1". A value without a prefix applies to every
+ * path. The longest matching prefix wins. Returns NULL when nothing
+ * matches. If prefix is not NULL, the matching prefix ("" for a bare
+ * value) is copied there.
+ */
+static
+char *
+globus_l_gfs_posix_prefix_match(
+    const char *                        name,
+    const char *                        pathname,
+    char *                              value,
+    size_t                              value_len,
+    char *                              prefix,
+    size_t                              prefix_len)
+{
+    char                                buf[1024];
+    char *                              env;
+    char *                              token;
+    char *                              save;
+    char *                              eq;
+    size_t                              best_len = 0;
+    globus_bool_t                       found = GLOBUS_FALSE;
+
+    env = getenv(name);
+    if (env == NULL || *env == '\0') return NULL;
+    strncpy(buf, env, sizeof(buf));
+    buf[sizeof(buf) - 1] = '\0';
+
+    for (token = strtok_r(buf, ",", &save); token != NULL;
+         token = strtok_r(NULL, ",", &save))
+    {
+        while (*token == ' ') token++;
+        eq = strrchr(token, '=');
+        if (eq == NULL)
+        {
+            if (! found)
+            {
+                strncpy(value, token, value_len);
+                value[value_len - 1] = '\0';
+                if (prefix != NULL) prefix[0] = '\0';
+                found = GLOBUS_TRUE;
+            }
+            continue;
+        }
+        *eq = '\0';
+        if (strncmp(pathname, token, strlen(token)) == 0 &&
+            (! found || strlen(token) >= best_len))
+        {
+            best_len = strlen(token);
+            strncpy(value, eq + 1, value_len);
+            value[value_len - 1] = '\0';
+            if (prefix != NULL)
+            {
+                strncpy(prefix, token, prefix_len);
+                prefix[prefix_len - 1] = '\0';
+            }
+            found = GLOBUS_TRUE;
+        }
+    }
+    return (found ? value : NULL);
+}
+
+static
+char *
+globus_l_gfs_posix_prefix_lookup(
+    const char *                        name,
+    const char *                        pathname,
+    char *                              value,
+    size_t                              value_len)
+{
+    return globus_l_gfs_posix_prefix_match(name, pathname, value, value_len,
+                                           NULL, 0);
 }
 
-/*************************************************************************
- *  stat
- *  ----
- *  This interface function is called whenever the server needs 
- *  information about a given file or resource.  It is called then an
- *  LIST is sent by the client, when the server needs to verify that 
- *  a file exists and has the proper permissions, etc.
- ************************************************************************/
 /*
+ * The same for a "name=value" list matched exactly against key, e.g. a
+ * user name. A bare value applies to every key that is not listed.
+ */
 static
-void
-globus_l_gfs_posix_stat(
-    globus_gfs_operation_t              op,
-    globus_gfs_stat_info_t *            stat_info,
-    void *                              user_arg)
+char *
+globus_l_gfs_posix_name_lookup(
+    const char *                        name,
+    const char *                        key,
+    char *                              value,
+    size_t                              value_len)
 {
-    globus_gfs_stat_t                   stat_array[1];
-    int                                 stat_count = 1;
-    globus_l_gfs_posix_handle_t *      posix_handle;
-    struct stat                         statbuf; 
-    globus_result_t                     rc;
+    char                                buf[1024];
+    char *                              env;
+    char *                              token;
+    char *                              save;
+    char *                              eq;
+    globus_bool_t                       found = GLOBUS_FALSE;
+
+    env = getenv(name);
+    if (env == NULL || *env == '\0') return NULL;
+    strncpy(buf, env, sizeof(buf));
+    buf[sizeof(buf) - 1] = '\0';
+
+    for (token = strtok_r(buf, ",", &save); token != NULL;
+         token = strtok_r(NULL, ",", &save))
+    {
+        while (*token == ' ') token++;
+        eq = strrchr(token, '=');
+        if (eq == NULL)
+        {
+            if (! found)
+            {
+                snprintf(value, value_len, "%s", token);
+                found = GLOBUS_TRUE;
+            }
+            continue;
+        }
+        *eq = '\0';
+        if (strcmp(token, key) == 0)
+        {
+            snprintf(value, value_len, "%s", eq + 1);
+            return value;
+        }
+    }
+    return (found ? value : NULL);
+}
 
-    GlobusGFSName(globus_l_gfs_posix_stat);
+static
+long
+globus_l_gfs_posix_prefix_int(
+    const char *                        name,
+    const char *                        pathname,
+    long                                def)
+{
+    char                                value[64];
 
-    posix_handle = (globus_l_gfs_posix_handle_t *) user_arg;
-    if (stat(PathName, &statbuf) == 0)    
+    if (globus_l_gfs_posix_prefix_lookup(name, pathname,
+                                         value, sizeof(value)) == NULL)
     {
-        stat_array[0].mode = statbuf.st_mode;
-        stat_array[0].nlink = statbuf.st_nlink;
-        stat_array[0].uid = statbuf.st_uid;
-        stat_array[0].gid = statbuf.st_gid;
-        stat_array[0].size = statbuf.st_size;
-        stat_array[0].mtime = statbuf.st_mtime;
-        stat_array[0].atime = statbuf.st_atime;
-        stat_array[0].ctime = statbuf.st_ctime;
-        stat_array[0].dev = statbuf.st_dev;
-        stat_array[0].ino = statbuf.st_ino;
+        return def;
+    }
+    return strtol(value, NULL, 10);
+}
 
-        globus_gridftp_server_finished_stat(
-            op, GLOBUS_SUCCESS, stat_array, stat_count);
+/*
+ * Transfer buffers. By default they come from globus_malloc(). With
+ * GRIDFTP_POSIX_HUGEPAGES they are carved from 2 MB huge pages (or from
+ * transparent huge pages when none are reserved), and with
+ * GRIDFTP_POSIX_NUMA_NODE the memory is bound to that NUMA node, or with
+ * "local" to the node of the allocating thread. Freed buffers go back
+ * to a free list of their node and size class. Classes step by a
+ * quarter of a power of two from 4 KB, so a buffer is at most a quarter
+ * larger than asked for and is reused by requests of the same class
+ * only. Buffers of a huge page or more are mapped on their own, and are
+ * unmapped when freed while the node pools more than
+ * GRIDFTP_POSIX_POOL_KEEP of free memory; smaller ones are carved from
+ * shared slabs, and what is left of a slab goes to the free lists when
+ * the next one is mapped. mbind() and getcpu() are called directly, so
+ * libnuma is not needed.
+ *
+ * Every buffer, pooled or not, carries a header with its size, so the
+ * bytes held by transfer and checksum buffers are counted either way.
+ * GRIDFTP_POSIX_MEMORY_BUDGET caps them: past the budget a transfer
+ * that already has I/O in flight gets no new buffer and posts nothing
+ * more until one comes back, so its concurrency drops, down to a single
+ * buffer. The first buffer of a transfer is always granted, it could
+ * not make progress otherwise. Sessions are forked, so the budget is
+ * for the node: every process charges its buffers to the shared memory
+ * segment (see globus_l_gfs_posix_mem_charge). Without the segment it
+ * is per process.
+ *
+ * The checksum workers, threads globus does not know of, take their
+ * buffers here too, so the pool is locked with a pthread mutex; a globus
+ * one does nothing in a server without -threads.
+ */
+#define GLOBUS_L_GFS_POSIX_HUGE_PAGE    (2 * 1024 * 1024)
+#define GLOBUS_L_GFS_POSIX_MAX_NODES    64
+#define GLOBUS_L_GFS_POSIX_NODE_ANY     -2
+#define GLOBUS_L_GFS_POSIX_NODE_LOCAL   -1
+#define GLOBUS_L_GFS_POSIX_NODE_HEAP    -3
+#define GLOBUS_L_GFS_POSIX_CHUNK_HDR    64
+#define GLOBUS_L_GFS_POSIX_MPOL_BIND    2
+#define GLOBUS_L_GFS_POSIX_NCLASSES     96
+
+typedef struct globus_l_gfs_posix_chunk_s
+{
+    struct globus_l_gfs_posix_chunk_s * next;
+    size_t                              size;
+    size_t                              map;
+    int                                 node;
+    int                                 sclass;
+    globus_bool_t                       huge;
+} globus_l_gfs_posix_chunk_t;
+
+typedef struct globus_l_gfs_posix_node_s
+{
+    globus_l_gfs_posix_chunk_t *        free[GLOBUS_L_GFS_POSIX_NCLASSES];
+    char *                              slab;
+    size_t                              slab_left;
+    globus_off_t                        pool_bytes;
+    globus_off_t                        free_bytes;
+    globus_off_t                        allocs;
+    int                                 huge_slabs;
+    int                                 thp_slabs;
+} globus_l_gfs_posix_node_t;
+
+static struct
+{
+    globus_bool_t                       initialized;
+    globus_bool_t                       enabled;
+    globus_bool_t                       hugepages;
+    globus_bool_t                       pin;
+    int                                 node;
+    globus_off_t                        budget;
+    globus_off_t                        used;
+    globus_off_t                        peak;
+    globus_off_t                        deferred;
+    globus_off_t                        keep;
+    pthread_mutex_t                     mutex;
+    globus_l_gfs_posix_node_t           nodes[GLOBUS_L_GFS_POSIX_MAX_NODES];
+} globus_l_gfs_posix_buffers;
+
+static __thread globus_bool_t           globus_l_gfs_posix_pinned = GLOBUS_FALSE;
+
+/* once per process, sessions are forked */
+static
+void
+globus_l_gfs_posix_buf_init(void)
+{
+    char *                              value;
+
+    if (globus_l_gfs_posix_buffers.initialized) return;
+    globus_l_gfs_posix_buffers.initialized = GLOBUS_TRUE;
+    pthread_mutex_init(&globus_l_gfs_posix_buffers.mutex, NULL);
+
+    globus_l_gfs_posix_buffers.hugepages =
+        globus_l_gfs_posix_getenv_int("GRIDFTP_POSIX_HUGEPAGES", 0);
+    globus_l_gfs_posix_buffers.pin =
+        globus_l_gfs_posix_getenv_int("GRIDFTP_POSIX_NUMA_PIN", 0);
+    globus_l_gfs_posix_buffers.node = GLOBUS_L_GFS_POSIX_NODE_ANY;
+    value = getenv("GRIDFTP_POSIX_NUMA_NODE");
+    if (value != NULL && ! strcmp(value, "local"))
+    {
+        globus_l_gfs_posix_buffers.node = GLOBUS_L_GFS_POSIX_NODE_LOCAL;
     }
-    else
+    else if (value != NULL && *value != '\0' &&
+             atoi(value) >= 0 && atoi(value) < GLOBUS_L_GFS_POSIX_MAX_NODES)
     {
-        rc = GlobusGFSErrorGeneric("stat() fail");
-        globus_gridftp_server_finished_stat(op, rc, NULL, 0);
+        globus_l_gfs_posix_buffers.node = atoi(value);
     }
+    globus_l_gfs_posix_buffers.enabled =
+        (globus_l_gfs_posix_buffers.hugepages ||
+         globus_l_gfs_posix_buffers.node != GLOBUS_L_GFS_POSIX_NODE_ANY);
+    globus_l_gfs_posix_buffers.budget =
+        globus_l_gfs_posix_getenv_size("GRIDFTP_POSIX_MEMORY_BUDGET", 0);
+    globus_l_gfs_posix_buffers.keep =
+        globus_l_gfs_posix_getenv_size("GRIDFTP_POSIX_POOL_KEEP",
+                                       256 * 1024 * 1024);
 }
-*/
 
-void
-globus_l_gfs_file_copy_stat(
-    globus_gfs_stat_t *                 stat_object,
-    struct stat *                       stat_buf,
-    const char *                        filename,
-    const char *                        symlink_target)
+/* the NUMA node of the calling thread */
+static
+int
+globus_l_gfs_posix_buf_local_node(void)
 {
-    GlobusGFSName(globus_l_gfs_file_copy_stat);
+    unsigned                            cpu;
+    unsigned                            node = 0;
 
-    stat_object->mode     = stat_buf->st_mode;
-    stat_object->nlink    = stat_buf->st_nlink;
-    stat_object->uid      = stat_buf->st_uid;
-    stat_object->gid      = stat_buf->st_gid;
-    stat_object->size     = stat_buf->st_size;
-    stat_object->mtime    = stat_buf->st_mtime;
-    stat_object->atime    = stat_buf->st_atime;
-    stat_object->ctime    = stat_buf->st_ctime;
-    stat_object->dev      = stat_buf->st_dev;
-    stat_object->ino      = stat_buf->st_ino;
+#ifdef SYS_getcpu
+    if (syscall(SYS_getcpu, &cpu, &node, NULL) != 0) return 0;
+#endif
+    return (node < GLOBUS_L_GFS_POSIX_MAX_NODES ? (int) node : 0);
+}
 
-    if(filename && *filename)
+/*
+ * Map a slab of at least *len bytes on node, huge pages if possible, and
+ * set *len to what was mapped.
+ */
+static
+char *
+globus_l_gfs_posix_buf_slab(
+    globus_l_gfs_posix_node_t *         pool,
+    int                                 node,
+    size_t *                            len,
+    globus_bool_t *                     huge)
+{
+    unsigned long                       mask;
+    char *                              slab = MAP_FAILED;
+    size_t                              size;
+
+    *huge = GLOBUS_FALSE;
+    if (globus_l_gfs_posix_buffers.hugepages)
     {
-        stat_object->name = strdup(filename);
+        size = (*len + GLOBUS_L_GFS_POSIX_HUGE_PAGE - 1) &
+               ~(size_t) (GLOBUS_L_GFS_POSIX_HUGE_PAGE - 1);
+        slab = mmap(NULL, size, PROT_READ|PROT_WRITE,
+                    MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB, -1, 0);
     }
-    else
+    if (slab != MAP_FAILED)
     {
-        stat_object->name = NULL;
+        *huge = GLOBUS_TRUE;
+        pool->huge_slabs++;
     }
-    if(symlink_target && *symlink_target)
+    else
     {
-        stat_object->symlink_target = strdup(symlink_target);
+        size = (*len + 4095) & ~(size_t) 4095;
+        slab = mmap(NULL, size, PROT_READ|PROT_WRITE,
+                    MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+        if (slab == MAP_FAILED) return NULL;
+        if (globus_l_gfs_posix_buffers.hugepages)
+        {
+            madvise(slab, size, MADV_HUGEPAGE);
+        }
+        pool->thp_slabs++;
     }
-    else
+#ifdef SYS_mbind
+    /* bind before the pages are touched, so they are allocated there */
+    if (globus_l_gfs_posix_buffers.node != GLOBUS_L_GFS_POSIX_NODE_ANY &&
+        node < (int) (8 * sizeof(mask)))
     {
-        stat_object->symlink_target = NULL;
+        mask = 1UL << node;
+        syscall(SYS_mbind, slab, size, GLOBUS_L_GFS_POSIX_MPOL_BIND,
+                &mask, 8 * sizeof(mask), 0);
     }
+#endif
+    pool->pool_bytes += size;
+    *len = size;
+    return slab;
 }
 
+/* class c holds 4 KB << (c / 4) times 1, 1.25, 1.5 or 1.75 */
 static
-void
-globus_l_gfs_file_destroy_stat(
-    globus_gfs_stat_t *                 stat_array,
-    int                                 stat_count)
+size_t
+globus_l_gfs_posix_buf_class_size(
+    int                                 c)
 {
-    int                                 i;
-    GlobusGFSName(globus_l_gfs_file_destroy_stat);
+    return ((size_t) 4096 << (c / 4)) / 4 * (4 + c % 4);
+}
 
-    for(i = 0; i < stat_count; i++)
-    {
-        if(stat_array[i].name != NULL)
-        {
-            globus_free(stat_array[i].name);
-        }
-        if(stat_array[i].symlink_target != NULL)
-        {
-            globus_free(stat_array[i].symlink_target);
-        }
+static
+int
+globus_l_gfs_posix_buf_class(
+    size_t                              size)
+{
+    int                                 c = 0;
+
+    while (c < GLOBUS_L_GFS_POSIX_NCLASSES &&
+           globus_l_gfs_posix_buf_class_size(c) < size)
+    {
+        c++;
     }
-    globus_free(stat_array);
+    return c;
 }
 
-/* basepath and filename must be MAXPATHLEN long
- * the pathname may be absolute or relative, basepath will be the same */
+/* put a carved chunk of class c on the free list, with the mutex held */
 static
 void
-globus_l_gfs_file_partition_path(
-    const char *                        pathname,
-    char *                              basepath,
-    char *                              filename)
+globus_l_gfs_posix_buf_carve(
+    globus_l_gfs_posix_node_t *         pool,
+    char *                              at,
+    int                                 node,
+    int                                 c)
 {
-    char                                buf[MAXPATHLEN];
-    char *                              filepart;
-    GlobusGFSName(globus_l_gfs_file_partition_path);
+    globus_l_gfs_posix_chunk_t *        chunk;
+
+    chunk = (globus_l_gfs_posix_chunk_t *) at;
+    chunk->size = globus_l_gfs_posix_buf_class_size(c);
+    chunk->map = 0;
+    chunk->node = node;
+    chunk->sclass = c;
+    chunk->huge = GLOBUS_FALSE;
+    chunk->next = pool->free[c];
+    pool->free[c] = chunk;
+    pool->free_bytes += GLOBUS_L_GFS_POSIX_CHUNK_HDR + chunk->size;
+}
 
-    strncpy(buf, pathname, MAXPATHLEN);
-    buf[MAXPATHLEN - 1] = '\0';
+static
+globus_bool_t
+globus_l_gfs_posix_mem_charge(
+    globus_off_t                        size,
+    globus_off_t                        budget,
+    globus_bool_t                       must);
 
-    filepart = strrchr(buf, '/');
-    while(filepart && !*(filepart + 1) && filepart != buf)
+static
+void
+globus_l_gfs_posix_mem_uncharge(
+    globus_off_t                        size);
+
+static
+globus_off_t
+globus_l_gfs_posix_mem_node_used(void);
+
+/*
+ * Count size bytes against the budget, with the mutex held. Unless must
+ * is set, fails once the budget would be exceeded.
+ */
+static
+globus_bool_t
+globus_l_gfs_posix_buf_reserve(
+    size_t                              size,
+    globus_bool_t                       must)
+{
+    if (globus_l_gfs_posix_buffers.budget > 0 &&
+        ! globus_l_gfs_posix_mem_charge(size,
+              globus_l_gfs_posix_buffers.budget, must))
     {
-        *filepart = '\0';
-        filepart = strrchr(buf, '/');
+        globus_l_gfs_posix_buffers.deferred++;
+        return GLOBUS_FALSE;
+    }
+    globus_l_gfs_posix_buffers.used += size;
+    if (globus_l_gfs_posix_buffers.used > globus_l_gfs_posix_buffers.peak)
+    {
+        globus_l_gfs_posix_buffers.peak = globus_l_gfs_posix_buffers.used;
     }
+    return GLOBUS_TRUE;
+}
 
-    if(!filepart)
+/* give size bytes back to the budget, with the mutex held */
+static
+void
+globus_l_gfs_posix_buf_unreserve(
+    size_t                              size)
+{
+    globus_l_gfs_posix_buffers.used -= size;
+    if (globus_l_gfs_posix_buffers.budget > 0)
     {
-        strcpy(filename, buf);
-        basepath[0] = '\0';
+        globus_l_gfs_posix_mem_uncharge(size);
+    }
+}
+
+/*
+ * A buffer of at least size bytes. Returns NULL with errno ENOBUFS when
+ * it is not a must and the memory budget is used up.
+ */
+static
+globus_byte_t *
+globus_l_gfs_posix_buf_get(
+    globus_size_t                       size,
+    globus_bool_t                       must)
+{
+    globus_l_gfs_posix_node_t *         pool;
+    globus_l_gfs_posix_chunk_t *        chunk;
+    size_t                              len;
+    size_t                              map;
+    globus_bool_t                       huge;
+    int                                 node;
+    int                                 c;
+    int                                 t;
+
+    c = globus_l_gfs_posix_buf_class(size);
+    if (! globus_l_gfs_posix_buffers.enabled ||
+        c == GLOBUS_L_GFS_POSIX_NCLASSES)
+    {
+        pthread_mutex_lock(&globus_l_gfs_posix_buffers.mutex);
+        if (! globus_l_gfs_posix_buf_reserve(size, must))
+        {
+            pthread_mutex_unlock(&globus_l_gfs_posix_buffers.mutex);
+            errno = ENOBUFS;
+            return NULL;
+        }
+        pthread_mutex_unlock(&globus_l_gfs_posix_buffers.mutex);
+        chunk = globus_malloc(GLOBUS_L_GFS_POSIX_CHUNK_HDR + size);
+        if (chunk == NULL)
+        {
+            pthread_mutex_lock(&globus_l_gfs_posix_buffers.mutex);
+            globus_l_gfs_posix_buf_unreserve(size);
+            pthread_mutex_unlock(&globus_l_gfs_posix_buffers.mutex);
+            return NULL;
+        }
+        chunk->size = size;
+        chunk->node = GLOBUS_L_GFS_POSIX_NODE_HEAP;
+        return (globus_byte_t *) chunk + GLOBUS_L_GFS_POSIX_CHUNK_HDR;
+    }
+
+    node = globus_l_gfs_posix_buffers.node;
+    if (node == GLOBUS_L_GFS_POSIX_NODE_LOCAL)
+    {
+        node = globus_l_gfs_posix_buf_local_node();
+    }
+    else if (node == GLOBUS_L_GFS_POSIX_NODE_ANY)
+    {
+        node = 0;
+    }
+    pool = &globus_l_gfs_posix_buffers.nodes[node];
+    size = globus_l_gfs_posix_buf_class_size(c);
+    len = GLOBUS_L_GFS_POSIX_CHUNK_HDR + size;
+
+    pthread_mutex_lock(&globus_l_gfs_posix_buffers.mutex);
+    if (! globus_l_gfs_posix_buf_reserve(size, must))
+    {
+        pthread_mutex_unlock(&globus_l_gfs_posix_buffers.mutex);
+        errno = ENOBUFS;
+        return NULL;
+    }
+    pool->allocs++;
+    chunk = pool->free[c];
+    if (chunk != NULL)
+    {
+        pool->free[c] = chunk->next;
+        pool->free_bytes -= len;
+        pthread_mutex_unlock(&globus_l_gfs_posix_buffers.mutex);
+        return (globus_byte_t *) chunk + GLOBUS_L_GFS_POSIX_CHUNK_HDR;
+    }
+
+    if (len >= GLOBUS_L_GFS_POSIX_HUGE_PAGE)
+    {
+        /* a mapping of its own, that can be given back */
+        map = len;
+        chunk = (globus_l_gfs_posix_chunk_t *)
+            globus_l_gfs_posix_buf_slab(pool, node, &map, &huge);
     }
     else
     {
-        if(filepart == buf)
+        if (len > pool->slab_left)
         {
-            if(!*(filepart + 1))
+            /* the rest of the slab goes to the free lists, largest first */
+            for (t = c - 1; t >= 0; t--)
             {
-                basepath[0] = '\0';
-                filename[0] = '/';
-                filename[1] = '\0';
+                while (GLOBUS_L_GFS_POSIX_CHUNK_HDR +
+                       globus_l_gfs_posix_buf_class_size(t) <=
+                       pool->slab_left)
+                {
+                    globus_l_gfs_posix_buf_carve(pool, pool->slab, node, t);
+                    pool->slab += GLOBUS_L_GFS_POSIX_CHUNK_HDR +
+                                  globus_l_gfs_posix_buf_class_size(t);
+                    pool->slab_left -= GLOBUS_L_GFS_POSIX_CHUNK_HDR +
+                                       globus_l_gfs_posix_buf_class_size(t);
+                }
             }
-            else
+            pool->slab_left = GLOBUS_L_GFS_POSIX_HUGE_PAGE;
+            pool->slab = globus_l_gfs_posix_buf_slab(pool, node,
+                                                     &pool->slab_left, &huge);
+            if (pool->slab == NULL)
             {
-                *filepart++ = '\0';
-                basepath[0] = '/';
-                basepath[1] = '\0';
-                strcpy(filename, filepart);
+                pool->slab_left = 0;
             }
         }
-        else
+        map = 0;
+        huge = GLOBUS_FALSE;
+        chunk = (globus_l_gfs_posix_chunk_t *) pool->slab;
+        if (chunk != NULL)
         {
-            *filepart++ = '\0';
-            strcpy(basepath, buf);
-            strcpy(filename, filepart);
+            pool->slab += len;
+            pool->slab_left -= len;
         }
     }
+    if (chunk == NULL)
+    {
+        pool->allocs--;
+        globus_l_gfs_posix_buf_unreserve(size);
+        pthread_mutex_unlock(&globus_l_gfs_posix_buffers.mutex);
+        return NULL;
+    }
+    pthread_mutex_unlock(&globus_l_gfs_posix_buffers.mutex);
+
+    chunk->size = size;
+    chunk->map = map;
+    chunk->node = node;
+    chunk->sclass = c;
+    chunk->huge = huge;
+    return (globus_byte_t *) chunk + GLOBUS_L_GFS_POSIX_CHUNK_HDR;
 }
 
+/* a buffer the caller cannot do without, the budget is not enforced */
+static
+globus_byte_t *
+globus_l_gfs_posix_buf_alloc(
+    globus_size_t                       size)
+{
+    return globus_l_gfs_posix_buf_get(size, GLOBUS_TRUE);
+}
 
 static
 void
-globus_l_gfs_posix_stat(
-    globus_gfs_operation_t              op,
-    globus_gfs_stat_info_t *            stat_info,
-    void *                              user_arg)
+globus_l_gfs_posix_buf_free(
+    globus_byte_t *                     buffer)
 {
-    globus_result_t                     result;
-    struct stat                         stat_buf;
-    globus_gfs_stat_t *                 stat_array;
-    int                                 stat_count = 0;
-    DIR *                               dir;
-    char                                basepath[MAXPATHLEN];
-    char                                filename[MAXPATHLEN];
-    char                                symlink_target[MAXPATHLEN];
-    char *                              PathName;
-    GlobusGFSName(globus_l_gfs_posix_stat);
-    PathName=stat_info->pathname;
+    globus_l_gfs_posix_chunk_t *        chunk;
+    globus_l_gfs_posix_node_t *         pool;
+    size_t                              len;
 
-   /* 
-      If we do stat_info->pathname++, it will cause third-party transfer
-      hanging if there is a leading // in path. Don't know why. To work
-      around, we replaced it with PathName.
-   */
-    while (PathName[0] == '/' && PathName[1] == '/')
-    {
-        PathName++;
-    }
-    
-    /* lstat is the same as stat when not operating on a link */
-    if(lstat(PathName, &stat_buf) != 0)
+    if (buffer == NULL) return;
+
+    chunk = (globus_l_gfs_posix_chunk_t *)
+        (buffer - GLOBUS_L_GFS_POSIX_CHUNK_HDR);
+    pthread_mutex_lock(&globus_l_gfs_posix_buffers.mutex);
+    globus_l_gfs_posix_buf_unreserve(chunk->size);
+    if (chunk->node == GLOBUS_L_GFS_POSIX_NODE_HEAP)
     {
-        result = GlobusGFSErrorSystemError("stat", errno);
-        goto error_stat1;
+        pthread_mutex_unlock(&globus_l_gfs_posix_buffers.mutex);
+        globus_free(chunk);
+        return;
     }
-    /* if this is a link we still need to stat to get the info we are 
-        interested in and then use realpath() to get the full path of 
-        the symlink target */
-    *symlink_target = '\0';
-    if(S_ISLNK(stat_buf.st_mode))
+    pool = &globus_l_gfs_posix_buffers.nodes[chunk->node];
+    len = GLOBUS_L_GFS_POSIX_CHUNK_HDR + chunk->size;
+    if (chunk->map > 0 &&
+        pool->free_bytes + (globus_off_t) len >
+        globus_l_gfs_posix_buffers.keep)
     {
-        if(stat(PathName, &stat_buf) != 0)
+        /* the pool is past its high-water mark */
+        pool->pool_bytes -= chunk->map;
+        if (chunk->huge)
         {
-            result = GlobusGFSErrorSystemError("stat", errno);
-            goto error_stat1;
+            pool->huge_slabs--;
         }
-        if(realpath(PathName, symlink_target) == NULL)
+        else
         {
-            result = GlobusGFSErrorSystemError("realpath", errno);
-            goto error_stat1;
+            pool->thp_slabs--;
         }
-    }    
-    globus_l_gfs_file_partition_path(PathName, basepath, filename);
-    
-    if(!S_ISDIR(stat_buf.st_mode) || stat_info->file_only)
+        pthread_mutex_unlock(&globus_l_gfs_posix_buffers.mutex);
+        munmap(chunk, chunk->map);
+        return;
+    }
+    chunk->next = pool->free[chunk->sclass];
+    pool->free[chunk->sclass] = chunk;
+    pool->free_bytes += len;
+    pthread_mutex_unlock(&globus_l_gfs_posix_buffers.mutex);
+}
+
+/* whether a buffer of size bytes fits in what is left of the budget */
+static
+globus_bool_t
+globus_l_gfs_posix_buf_room(
+    globus_size_t                       size)
+{
+    globus_bool_t                       room;
+
+    pthread_mutex_lock(&globus_l_gfs_posix_buffers.mutex);
+    room = (globus_l_gfs_posix_buffers.budget == 0 ||
+            globus_l_gfs_posix_mem_node_used() + (globus_off_t) size <=
+            globus_l_gfs_posix_buffers.budget);
+    pthread_mutex_unlock(&globus_l_gfs_posix_buffers.mutex);
+    return room;
+}
+
+/*
+ * With GRIDFTP_POSIX_NUMA_PIN, a thread doing storage I/O is pinned to
+ * the CPUs of the configured node the first time it gets here.
+ */
+static
+void
+globus_l_gfs_posix_buf_pin(void)
+{
+    cpu_set_t                           cpus;
+    char                                path[64];
+    char                                list[1024];
+    char *                              token;
+    char *                              save;
+    int                                 first, last;
+    FILE *                              F;
+
+    if (globus_l_gfs_posix_pinned ||
+        ! globus_l_gfs_posix_buffers.pin ||
+        globus_l_gfs_posix_buffers.node < 0)
     {
-        stat_array = (globus_gfs_stat_t *)
-            globus_malloc(sizeof(globus_gfs_stat_t));
-        if(!stat_array)
-        {
-            result = GlobusGFSErrorMemory("stat_array");
-            goto error_alloc1;
-        }
-        
-        globus_l_gfs_file_copy_stat(
-            stat_array, &stat_buf, filename, symlink_target);
-        stat_count = 1;
+        return;
     }
-    else
+    globus_l_gfs_posix_pinned = GLOBUS_TRUE;
+
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist",
+             globus_l_gfs_posix_buffers.node);
+    F = fopen(path, "r");
+    if (F == NULL) return;
+    if (fgets(list, sizeof(list), F) == NULL) list[0] = '\0';
+    fclose(F);
+
+    /* a list like "0-7,16-23" */
+    CPU_ZERO(&cpus);
+    for (token = strtok_r(list, ",\n", &save); token != NULL;
+         token = strtok_r(NULL, ",\n", &save))
     {
-        struct dirent *                 dir_entry;
-        int                             i;
-        char                            dir_path[MAXPATHLEN];
-    
-        dir = opendir(PathName);
-        if(!dir)
+        if (sscanf(token, "%d-%d", &first, &last) != 2)
         {
-            result = GlobusGFSErrorSystemError("opendir", errno);
-            goto error_open;
+            last = first = atoi(token);
         }
-        
-        stat_count = 0;
-        while(globus_libc_readdir_r(dir, &dir_entry) == 0 && dir_entry)  
+        for (; first <= last && first < CPU_SETSIZE; first++)
         {
-            stat_count++;
-            globus_free(dir_entry);
+            CPU_SET(first, &cpus);
         }
-        
-        rewinddir(dir);
-        
-        stat_array = (globus_gfs_stat_t *)
-            globus_malloc(sizeof(globus_gfs_stat_t) * stat_count);
-        if(!stat_array)
+    }
+    if (CPU_COUNT(&cpus) > 0)
+    {
+        sched_setaffinity(0, sizeof(cpus), &cpus);
+    }
+}
+
+static
+void
+globus_l_gfs_posix_buf_report(void)
+{
+    globus_l_gfs_posix_node_t *         pool;
+    char                                budget[128];
+    int                                 i;
+
+    /* nothing to tell about plain heap buffers */
+    if (globus_l_gfs_posix_buffers.budget <= 0 &&
+        ! globus_l_gfs_posix_buffers.enabled)
+    {
+        return;
+    }
+    pthread_mutex_lock(&globus_l_gfs_posix_buffers.mutex);
+    budget[0] = '\0';
+    if (globus_l_gfs_posix_buffers.budget > 0)
+    {
+        snprintf(budget, sizeof(budget),
+                 ", %.1f MB on the node of a %.1f MB budget, %lld deferred",
+                 globus_l_gfs_posix_mem_node_used() / 1048576.0,
+                 globus_l_gfs_posix_buffers.budget / 1048576.0,
+                 (long long) globus_l_gfs_posix_buffers.deferred);
+    }
+    globus_gfs_log_message(GLOBUS_GFS_LOG_INFO,
+        "buffer memory: %.1f MB in use, %.1f MB peak%s\n",
+        globus_l_gfs_posix_buffers.used / 1048576.0,
+        globus_l_gfs_posix_buffers.peak / 1048576.0, budget);
+    for (i = 0; globus_l_gfs_posix_buffers.enabled &&
+                i < GLOBUS_L_GFS_POSIX_MAX_NODES; i++)
+    {
+        pool = &globus_l_gfs_posix_buffers.nodes[i];
+        if (pool->allocs == 0) continue;
+        globus_gfs_log_message(GLOBUS_GFS_LOG_INFO,
+            "buffers on node %d: %lld allocations, %lld MB pooled "
+            "(%lld MB free) in %d huge page and %d other slabs\n", i,
+            (long long) pool->allocs, (long long) (pool->pool_bytes >> 20),
+            (long long) (pool->free_bytes >> 20),
+            pool->huge_slabs, pool->thp_slabs);
+    }
+    pthread_mutex_unlock(&globus_l_gfs_posix_buffers.mutex);
+}
+
+/*
+ * Node wide state shared by the forked server processes, in a POSIX
+ * shared memory segment that the first process creates. Every process
+ * trusts what is in it, so it is created 0600 for the session's uid or,
+ * when sessions run as several local users, 0660 for the group named by
+ * GRIDFTP_POSIX_SHM_GROUP, which those users must be members of. A
+ * segment with another mode or owner is not used. One robust mutex
+ * protects it: if a process dies holding it, the next locker takes it
+ * over.
+ */
+#define GLOBUS_L_GFS_POSIX_SHM_NAME     "/gridftp-posix-3"
+#define GLOBUS_L_GFS_POSIX_SHM_MAGIC    0x67667031
+#define GLOBUS_L_GFS_POSIX_MAX_BUCKETS  256
+#define GLOBUS_L_GFS_POSIX_MAX_STREAMS  1024
+#define GLOBUS_L_GFS_POSIX_STREAM_FREE      0
+#define GLOBUS_L_GFS_POSIX_STREAM_WAITING   1
+#define GLOBUS_L_GFS_POSIX_STREAM_ACTIVE    2
+#define GLOBUS_L_GFS_POSIX_MAX_MEMS     1024
+
+typedef struct globus_l_gfs_posix_stream_s
+{
+    char                                key[GLOBUS_L_GFS_POSIX_KEY_LEN];
+    pid_t                               pid;
+    int                                 state;
+    unsigned long                       ticket;
+} globus_l_gfs_posix_stream_t;
+
+/* the buffer memory a process holds */
+typedef struct globus_l_gfs_posix_mem_s
+{
+    pid_t                               pid;
+    globus_off_t                        used;
+} globus_l_gfs_posix_mem_t;
+
+typedef struct globus_l_gfs_posix_bucket_s
+{
+    char                                key[GLOBUS_L_GFS_POSIX_KEY_LEN];
+    double                              rate;
+    double                              tokens;
+    double                              t_last;
+} globus_l_gfs_posix_bucket_t;
+
+typedef struct globus_l_gfs_posix_shm_s
+{
+    volatile int                        magic;
+    pthread_mutex_t                     mutex;
+    int                                 nbuckets;
+    globus_l_gfs_posix_bucket_t         buckets[GLOBUS_L_GFS_POSIX_MAX_BUCKETS];
+    unsigned long                       next_ticket;
+    globus_l_gfs_posix_stream_t         streams[GLOBUS_L_GFS_POSIX_MAX_STREAMS];
+    globus_off_t                        mem_used;
+    globus_l_gfs_posix_mem_t            mems[GLOBUS_L_GFS_POSIX_MAX_MEMS];
+} globus_l_gfs_posix_shm_t;
+
+static globus_l_gfs_posix_shm_t *       globus_l_gfs_posix_shm = NULL;
+
+/* once per process, only when a feature that needs it is configured */
+static
+void
+globus_l_gfs_posix_shm_init(void)
+{
+    static globus_bool_t                initialized = GLOBUS_FALSE;
+    globus_l_gfs_posix_shm_t *          shm;
+    pthread_mutexattr_t                 attr;
+    struct stat                         st;
+    struct group *                      gr;
+    char *                              group;
+    globus_bool_t                       creator = GLOBUS_FALSE;
+    gid_t                               gid = (gid_t) -1;
+    mode_t                              mode = 0600;
+    int                                 fd;
+    int                                 i;
+
+    if (initialized) return;
+    initialized = GLOBUS_TRUE;
+    if (getenv("GRIDFTP_POSIX_RATE_NODE") == NULL &&
+        getenv("GRIDFTP_POSIX_RATE_USER") == NULL &&
+        getenv("GRIDFTP_POSIX_RATE_PATH") == NULL &&
+        getenv("GRIDFTP_POSIX_ADMIT") == NULL &&
+        getenv("GRIDFTP_POSIX_CKSM_NODE") == NULL &&
+        getenv("GRIDFTP_POSIX_MEMORY_BUDGET") == NULL)
+    {
+        return;
+    }
+
+    group = getenv("GRIDFTP_POSIX_SHM_GROUP");
+    if (group != NULL && *group != '\0')
+    {
+        gr = getgrnam(group);
+        if (gr == NULL)
         {
-            result = GlobusGFSErrorMemory("stat_array");
-            goto error_alloc2;
+            globus_gfs_log_message(GLOBUS_GFS_LOG_ERR,
+                "shared memory %s: no group %s, node wide limits are off\n",
+                GLOBUS_L_GFS_POSIX_SHM_NAME, group);
+            return;
         }
+        gid = gr->gr_gid;
+        mode = 0660;
+    }
 
-        snprintf(dir_path, sizeof(dir_path), "%s/%s", basepath, filename);
-        dir_path[MAXPATHLEN - 1] = '\0';
-        
-        for(i = 0;
-            globus_libc_readdir_r(dir, &dir_entry) == 0 && dir_entry;  
-            i++)
+    fd = shm_open(GLOBUS_L_GFS_POSIX_SHM_NAME, O_RDWR | O_CREAT | O_EXCL,
+                  mode);
+    if (fd >= 0)
+    {
+        creator = GLOBUS_TRUE;
+        /* the umask may have taken bits off, the group is ours to set */
+        if ((gid != (gid_t) -1 && fchown(fd, (uid_t) -1, gid) != 0) ||
+            fchmod(fd, mode) != 0 ||
+            ftruncate(fd, sizeof(globus_l_gfs_posix_shm_t)) != 0)
         {
-            char                        tmp_path[MAXPATHLEN];
-            char                        *path;
-                
-            snprintf(tmp_path, sizeof(tmp_path), "%s/%s", dir_path, dir_entry->d_name);
-            tmp_path[MAXPATHLEN - 1] = '\0';
-            path=tmp_path;
-        
-            /* function globus_l_gfs_file_partition_path() seems to add two 
-               extra '/'s to the beginning of tmp_path. XROOTD is sensitive 
-               to the extra '/'s not defined in XROOTD_VMP so we remove them */
-            if (path[0] == '/' && path[1] == '/') { path++; }
-            while (path[0] == '/' && path[1] == '/') { path++; }
-            /* lstat is the same as stat when not operating on a link */
-            if(lstat(path, &stat_buf) != 0)
+            close(fd);
+            shm_unlink(GLOBUS_L_GFS_POSIX_SHM_NAME);
+            fd = -1;
+        }
+    }
+    else if (errno == EEXIST)
+    {
+        fd = shm_open(GLOBUS_L_GFS_POSIX_SHM_NAME, O_RDWR, 0);
+        /* the creator may not have sized it yet */
+        for (i = 0; fd >= 0 && i < 100; i++)
+        {
+            if (fstat(fd, &st) != 0 ||
+                st.st_size >= (off_t) sizeof(globus_l_gfs_posix_shm_t))
             {
-                result = GlobusGFSErrorSystemError("lstat", errno);
-                globus_free(dir_entry);
-                /* just skip invalid entries */
-                stat_count--;
-                i--;
-                continue;
+                break;
             }
-            /* if this is a link we still need to stat to get the info we are 
-                interested in and then use realpath() to get the full path of 
-                the symlink target */
+            usleep(10000);
+        }
+    }
+    if (fd < 0)
+    {
+        globus_gfs_log_message(GLOBUS_GFS_LOG_ERR,
+            "shared memory %s: %s, node wide limits are off\n",
+            GLOBUS_L_GFS_POSIX_SHM_NAME, strerror(errno));
+        return;
+    }
+    /* whoever can write to it steers the limits of every session */
+    if (fstat(fd, &st) != 0 ||
+        st.st_size < (off_t) sizeof(globus_l_gfs_posix_shm_t) ||
+        (st.st_mode & 07777) != mode ||
+        (mode == 0600 ? st.st_uid != geteuid() : st.st_gid != gid))
+    {
+        globus_gfs_log_message(GLOBUS_GFS_LOG_ERR,
+            "shared memory %s is not mode %o and owned by this %s (remove "
+            "it from /dev/shm), node wide limits are off\n",
+            GLOBUS_L_GFS_POSIX_SHM_NAME, (unsigned) mode,
+            (mode == 0600 ? "user" : "group"));
+        close(fd);
+        return;
+    }
+    shm = mmap(NULL, sizeof(globus_l_gfs_posix_shm_t),
+               PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (shm == MAP_FAILED)
+    {
+        globus_gfs_log_message(GLOBUS_GFS_LOG_ERR,
+            "shared memory %s: %s, node wide limits are off\n",
+            GLOBUS_L_GFS_POSIX_SHM_NAME, strerror(errno));
+        return;
+    }
+
+    if (creator)
+    {
+        pthread_mutexattr_init(&attr);
+        pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+        pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+        pthread_mutex_init(&shm->mutex, &attr);
+        pthread_mutexattr_destroy(&attr);
+        __sync_synchronize();
+        shm->magic = GLOBUS_L_GFS_POSIX_SHM_MAGIC;
+    }
+    for (i = 0; shm->magic != GLOBUS_L_GFS_POSIX_SHM_MAGIC && i < 100; i++)
+    {
+        usleep(10000);
+    }
+    if (shm->magic != GLOBUS_L_GFS_POSIX_SHM_MAGIC)
+    {
+        globus_gfs_log_message(GLOBUS_GFS_LOG_ERR,
+            "shared memory %s was never initialized (remove it from "
+            "/dev/shm), node wide limits are off\n",
+            GLOBUS_L_GFS_POSIX_SHM_NAME);
+        munmap(shm, sizeof(globus_l_gfs_posix_shm_t));
+        return;
+    }
+    globus_l_gfs_posix_shm = shm;
+}
+
+static
+void
+globus_l_gfs_posix_shm_lock(void)
+{
+    if (pthread_mutex_lock(&globus_l_gfs_posix_shm->mutex) == EOWNERDEAD)
+    {
+        pthread_mutex_consistent(&globus_l_gfs_posix_shm->mutex);
+    }
+}
+
+static
+void
+globus_l_gfs_posix_shm_unlock(void)
+{
+    pthread_mutex_unlock(&globus_l_gfs_posix_shm->mutex);
+}
+
+/*
+ * Node wide buffer memory, for GRIDFTP_POSIX_MEMORY_BUDGET. Each process
+ * charges its buffers both to the node total, which the budget is
+ * checked against, and to a slot of its own, so that what a process
+ * held when it died can be taken off the total again.
+ */
+static int                              globus_l_gfs_posix_mem_slot = -1;
+static pid_t                            globus_l_gfs_posix_mem_pid = 0;
+
+/* give back what dead processes held, with the shm lock held */
+static
+void
+globus_l_gfs_posix_mem_reclaim(void)
+{
+    globus_l_gfs_posix_mem_t *          mem;
+    int                                 i;
+
+    for (i = 0; i < GLOBUS_L_GFS_POSIX_MAX_MEMS; i++)
+    {
+        mem = &globus_l_gfs_posix_shm->mems[i];
+        if (mem->pid != 0 && kill(mem->pid, 0) != 0 && errno == ESRCH)
+        {
+            globus_l_gfs_posix_shm->mem_used -= mem->used;
+            mem->pid = 0;
+            mem->used = 0;
+        }
+    }
+}
+
+/* the slot of this process, with the shm lock held; NULL if all taken */
+static
+globus_l_gfs_posix_mem_t *
+globus_l_gfs_posix_mem_self(void)
+{
+    globus_l_gfs_posix_mem_t *          mem;
+    pid_t                               pid;
+    int                                 pass;
+    int                                 i;
+
+    pid = getpid();
+    if (globus_l_gfs_posix_mem_pid == pid)
+    {
+        return &globus_l_gfs_posix_shm->mems[globus_l_gfs_posix_mem_slot];
+    }
+    /* the first buffer of this process, or a fork of one that had some */
+    for (pass = 0; pass < 2; pass++)
+    {
+        for (i = 0; i < GLOBUS_L_GFS_POSIX_MAX_MEMS; i++)
+        {
+            mem = &globus_l_gfs_posix_shm->mems[i];
+            if (mem->pid == 0)
+            {
+                mem->pid = pid;
+                mem->used = 0;
+                globus_l_gfs_posix_mem_slot = i;
+                globus_l_gfs_posix_mem_pid = pid;
+                return mem;
+            }
+        }
+        globus_l_gfs_posix_mem_reclaim();
+    }
+    return NULL;
+}
+
+/*
+ * Charge size bytes of buffers to the node. Unless must is set, fails
+ * when the node would go past budget; what dead processes held is given
+ * back first. Without the segment, or a slot in it, the budget holds
+ * for this process only.
+ */
+static
+globus_bool_t
+globus_l_gfs_posix_mem_charge(
+    globus_off_t                        size,
+    globus_off_t                        budget,
+    globus_bool_t                       must)
+{
+    globus_l_gfs_posix_mem_t *          mem;
+
+    if (globus_l_gfs_posix_shm == NULL)
+    {
+        return (must ||
+                globus_l_gfs_posix_buffers.used + size <= budget);
+    }
+    globus_l_gfs_posix_shm_lock();
+    mem = globus_l_gfs_posix_mem_self();
+    if (mem == NULL)
+    {
+        globus_l_gfs_posix_shm_unlock();
+        return (must ||
+                globus_l_gfs_posix_buffers.used + size <= budget);
+    }
+    if (! must && globus_l_gfs_posix_shm->mem_used + size > budget)
+    {
+        globus_l_gfs_posix_mem_reclaim();
+        if (globus_l_gfs_posix_shm->mem_used + size > budget)
+        {
+            globus_l_gfs_posix_shm_unlock();
+            return GLOBUS_FALSE;
+        }
+    }
+    mem->used += size;
+    globus_l_gfs_posix_shm->mem_used += size;
+    globus_l_gfs_posix_shm_unlock();
+    return GLOBUS_TRUE;
+}
+
+static
+void
+globus_l_gfs_posix_mem_uncharge(
+    globus_off_t                        size)
+{
+    globus_l_gfs_posix_mem_t *          mem;
+
+    if (globus_l_gfs_posix_shm == NULL) return;
+    globus_l_gfs_posix_shm_lock();
+    mem = globus_l_gfs_posix_mem_self();
+    if (mem != NULL)
+    {
+        /* a buffer from before a fork was charged to the parent */
+        if (size > mem->used) size = mem->used;
+        mem->used -= size;
+        globus_l_gfs_posix_shm->mem_used -= size;
+    }
+    globus_l_gfs_posix_shm_unlock();
+}
+
+/* the buffer memory the budget is checked against */
+static
+globus_off_t
+globus_l_gfs_posix_mem_node_used(void)
+{
+    globus_off_t                        used;
+
+    if (globus_l_gfs_posix_shm == NULL)
+    {
+        return globus_l_gfs_posix_buffers.used;
+    }
+    globus_l_gfs_posix_shm_lock();
+    used = globus_l_gfs_posix_shm->mem_used;
+    globus_l_gfs_posix_shm_unlock();
+    return used;
+}
+
+/*
+ * The key "kind:name" of a bucket or a stream slot. A name too long for
+ * the segment gets no limit rather than the one of another name that
+ * shares its first characters.
+ */
+static
+globus_bool_t
+globus_l_gfs_posix_shm_key(
+    char *                              key,
+    const char *                        kind,
+    const char *                        name)
+{
+    if (snprintf(key, GLOBUS_L_GFS_POSIX_KEY_LEN, "%s:%s", kind, name) >=
+        GLOBUS_L_GFS_POSIX_KEY_LEN)
+    {
+        globus_gfs_log_message(GLOBUS_GFS_LOG_WARN,
+            "%s %s is too long for a node wide limit, not limited\n",
+            kind, name);
+        return GLOBUS_FALSE;
+    }
+    return GLOBUS_TRUE;
+}
+
+/* copy a key into the segment */
+static
+void
+globus_l_gfs_posix_shm_key_set(
+    char *                              dst,
+    const char *                        key)
+{
+    strncpy(dst, key, GLOBUS_L_GFS_POSIX_KEY_LEN);
+    dst[GLOBUS_L_GFS_POSIX_KEY_LEN - 1] = '\0';
+}
+
+/* compare a key in the segment, which any process may have scribbled on */
+static
+globus_bool_t
+globus_l_gfs_posix_shm_key_is(
+    char *                              shm_key,
+    const char *                        key)
+{
+    shm_key[GLOBUS_L_GFS_POSIX_KEY_LEN - 1] = '\0';
+    return (strncmp(shm_key, key, GLOBUS_L_GFS_POSIX_KEY_LEN) == 0);
+}
+
+/* bandwidth shaping */
+
+static
+void
+globus_l_gfs_posix_shape_add(
+    globus_l_gfs_posix_shape_t *        shape,
+    const char *                        kind,
+    const char *                        name,
+    const char *                        value)
+{
+    globus_off_t                        rate;
+
+    rate = globus_l_gfs_posix_parse_size(value);
+    if (rate <= 0) return;
+    if (! globus_l_gfs_posix_shm_key(shape->key[shape->nbuckets],
+                                     kind, name))
+    {
+        return;
+    }
+    shape->rate[shape->nbuckets] = rate;
+    shape->index[shape->nbuckets] = -1;
+    shape->nbuckets++;
+}
+
+/*
+ * GRIDFTP_POSIX_RATE_NODE is one rate for the node, GRIDFTP_POSIX_RATE_USER
+ * is a "name=rate" list matched exactly against the user name and
+ * GRIDFTP_POSIX_RATE_PATH a "prefix=rate" list matched against the path;
+ * every user (or prefix) gets a bucket of its own.
+ */
+static
+void
+globus_l_gfs_posix_shape_init(
+    globus_l_gfs_posix_handle_t *       posix_handle)
+{
+    globus_l_gfs_posix_shape_t *        shape;
+    char                                value[64];
+    char                                prefix[1024];
+    char *                              env;
+
+    shape = &posix_handle->shape;
+    shape->nbuckets = 0;
+    shape->throttled = 0;
+    shape->waits = 0;
+    if (globus_l_gfs_posix_shm == NULL) return;
+
+    env = getenv("GRIDFTP_POSIX_RATE_NODE");
+    if (env != NULL && *env != '\0')
+    {
+        globus_l_gfs_posix_shape_add(shape, "node", "", env);
+    }
+    if (posix_handle->username != NULL &&
+        globus_l_gfs_posix_name_lookup("GRIDFTP_POSIX_RATE_USER",
+            posix_handle->username, value, sizeof(value)) != NULL)
+    {
+        globus_l_gfs_posix_shape_add(shape, "user", posix_handle->username,
+                                     value);
+    }
+    if (globus_l_gfs_posix_prefix_match("GRIDFTP_POSIX_RATE_PATH",
+            posix_handle->pathname, value, sizeof(value),
+            prefix, sizeof(prefix)) != NULL)
+    {
+        globus_l_gfs_posix_shape_add(shape, "path", prefix, value);
+    }
+}
+
+/* the bucket for key, a free or the least recently used one if new */
+static
+globus_l_gfs_posix_bucket_t *
+globus_l_gfs_posix_shape_bucket(
+    globus_l_gfs_posix_shape_t *        shape,
+    int                                 i,
+    double                              now)
+{
+    globus_l_gfs_posix_shm_t *          shm;
+    globus_l_gfs_posix_bucket_t *       bucket;
+    int                                 j;
+    int                                 lru = 0;
+
+    shm = globus_l_gfs_posix_shm;
+    j = shape->index[i];
+    if (j >= 0 && j < GLOBUS_L_GFS_POSIX_MAX_BUCKETS &&
+        globus_l_gfs_posix_shm_key_is(shm->buckets[j].key, shape->key[i]))
+    {
+        return &shm->buckets[j];
+    }
+    if (shm->nbuckets < 0 || shm->nbuckets > GLOBUS_L_GFS_POSIX_MAX_BUCKETS)
+    {
+        shm->nbuckets = 0;
+    }
+    for (j = 0; j < shm->nbuckets; j++)
+    {
+        if (globus_l_gfs_posix_shm_key_is(shm->buckets[j].key,
+                                          shape->key[i]))
+        {
+            break;
+        }
+        if (shm->buckets[j].t_last < shm->buckets[lru].t_last) lru = j;
+    }
+    if (j == shm->nbuckets)
+    {
+        if (shm->nbuckets < GLOBUS_L_GFS_POSIX_MAX_BUCKETS)
+        {
+            shm->nbuckets++;
+        }
+        else
+        {
+            j = lru;
+        }
+        bucket = &shm->buckets[j];
+        globus_l_gfs_posix_shm_key_set(bucket->key, shape->key[i]);
+        bucket->tokens = shape->rate[i];
+        bucket->t_last = now;
+    }
+    shape->index[i] = j;
+    return &shm->buckets[j];
+}
+
+/* take nbytes from the buckets of the transfer, return the debt in s */
+static
+double
+globus_l_gfs_posix_shape_debt(
+    globus_l_gfs_posix_handle_t *       posix_handle,
+    globus_size_t                       nbytes)
+{
+    globus_l_gfs_posix_shape_t *        shape;
+    globus_l_gfs_posix_bucket_t *       bucket;
+    double                              now;
+    double                              wait = 0;
+    int                                 i;
+
+    shape = &posix_handle->shape;
+    if (shape->nbuckets == 0 || nbytes == 0) return 0;
+
+    now = globus_l_gfs_posix_now();
+    globus_l_gfs_posix_shm_lock();
+    for (i = 0; i < shape->nbuckets; i++)
+    {
+        bucket = globus_l_gfs_posix_shape_bucket(shape, i, now);
+        bucket->rate = shape->rate[i];
+        if (now > bucket->t_last)
+        {
+            bucket->tokens += (now - bucket->t_last) * bucket->rate;
+            bucket->t_last = now;
+        }
+        if (bucket->tokens > bucket->rate)
+        {
+            bucket->tokens = bucket->rate;
+        }
+        bucket->tokens -= nbytes;
+        if (-bucket->tokens / bucket->rate > wait)
+        {
+            wait = -bucket->tokens / bucket->rate;
+        }
+    }
+    globus_l_gfs_posix_shm_unlock();
+    return wait;
+}
+
+static
+void
+globus_l_gfs_posix_shape_sleep(
+    double                              wait)
+{
+    struct timespec                     ts;
+
+    if (wait <= 0) return;
+    ts.tv_sec = (time_t) wait;
+    ts.tv_nsec = (long) ((wait - ts.tv_sec) * 1000000000);
+    while (nanosleep(&ts, &ts) != 0 && errno == EINTR);
+}
+
+/* take nbytes from the buckets of the transfer, sleep off any debt */
+static
+double
+globus_l_gfs_posix_shape_take(
+    globus_l_gfs_posix_handle_t *       posix_handle,
+    globus_size_t                       nbytes)
+{
+    double                              wait;
+
+    wait = globus_l_gfs_posix_shape_debt(posix_handle, nbytes);
+    globus_l_gfs_posix_shape_sleep(wait);
+    return wait;
+}
+
+static
+void
+globus_l_gfs_posix_shape_report(
+    globus_l_gfs_posix_shape_t *        shape,
+    const char *                        what)
+{
+    if (shape->waits == 0) return;
+    globus_gfs_log_message(GLOBUS_GFS_LOG_INFO,
+        "rate limit: %s throttled %d times for %.2f s\n",
+        what, shape->waits, shape->throttled);
+}
+
+/* admission control */
+
+static
+void
+globus_l_gfs_posix_admit_try(
+    void *                              user_arg);
+
+/*
+ * GRIDFTP_POSIX_ADMIT is a per path limit; a prefix=limit entry caps the
+ * transfers under that prefix, a bare limit caps them per device.
+ */
+static
+globus_bool_t
+globus_l_gfs_posix_admit_init(
+    globus_l_gfs_posix_handle_t *       posix_handle)
+{
+    globus_l_gfs_posix_admit_t *        admit;
+    char                                value[64];
+    char                                prefix[1024];
+    char                                dev[32];
+    struct stat                         st;
+
+    admit = &posix_handle->admit;
+    admit->slot = -1;
+    admit->unlimited = GLOBUS_FALSE;
+    if (globus_l_gfs_posix_shm == NULL ||
+        globus_l_gfs_posix_prefix_match("GRIDFTP_POSIX_ADMIT",
+            posix_handle->pathname, value, sizeof(value),
+            prefix, sizeof(prefix)) == NULL)
+    {
+        return GLOBUS_FALSE;
+    }
+    admit->limit = strtol(value, NULL, 10);
+    if (admit->limit <= 0) return GLOBUS_FALSE;
+    if (prefix[0] != '\0')
+    {
+        return globus_l_gfs_posix_shm_key(admit->key, "path", prefix);
+    }
+    if (fstat(posix_handle->fd, &st) != 0)
+    {
+        /* the null backend has no device */
+        return GLOBUS_FALSE;
+    }
+    snprintf(dev, sizeof(dev), "%lx", (unsigned long) st.st_dev);
+    return globus_l_gfs_posix_shm_key(admit->key, "dev", dev);
+}
+
+/* take a ticket, or check the one we have; TRUE once admitted */
+static
+globus_bool_t
+globus_l_gfs_posix_admit_check(
+    globus_l_gfs_posix_admit_t *        admit)
+{
+    globus_l_gfs_posix_shm_t *          shm;
+    globus_l_gfs_posix_stream_t *       stream;
+    globus_l_gfs_posix_stream_t *       mine;
+    globus_bool_t                       admitted;
+    int                                 active = 0;
+    int                                 ahead = 0;
+    int                                 i;
+
+    shm = globus_l_gfs_posix_shm;
+    globus_l_gfs_posix_shm_lock();
+    if (admit->slot < 0)
+    {
+        for (i = 0; i < GLOBUS_L_GFS_POSIX_MAX_STREAMS; i++)
+        {
+            if (shm->streams[i].state == GLOBUS_L_GFS_POSIX_STREAM_FREE) break;
+        }
+        if (i == GLOBUS_L_GFS_POSIX_MAX_STREAMS)
+        {
+            /* table full, do not hold up the transfer; the caller logs
+               it, this may run on a checksum worker */
+            globus_l_gfs_posix_shm_unlock();
+            admit->unlimited = GLOBUS_TRUE;
+            return GLOBUS_TRUE;
+        }
+        admit->slot = i;
+        mine = &shm->streams[i];
+        globus_l_gfs_posix_shm_key_set(mine->key, admit->key);
+        mine->pid = getpid();
+        mine->ticket = shm->next_ticket++;
+        mine->state = GLOBUS_L_GFS_POSIX_STREAM_WAITING;
+    }
+    mine = &shm->streams[admit->slot];
+
+    for (i = 0; i < GLOBUS_L_GFS_POSIX_MAX_STREAMS; i++)
+    {
+        stream = &shm->streams[i];
+        if (stream == mine ||
+            stream->state == GLOBUS_L_GFS_POSIX_STREAM_FREE ||
+            ! globus_l_gfs_posix_shm_key_is(stream->key, admit->key))
+        {
+            continue;
+        }
+        if (kill(stream->pid, 0) != 0 && errno == ESRCH)
+        {
+            stream->state = GLOBUS_L_GFS_POSIX_STREAM_FREE;
+            continue;
+        }
+        if (stream->state == GLOBUS_L_GFS_POSIX_STREAM_ACTIVE)
+        {
+            active++;
+        }
+        else if (stream->ticket < mine->ticket)
+        {
+            ahead++;
+        }
+    }
+    admitted = (active < admit->limit && ahead == 0);
+    if (admitted)
+    {
+        mine->state = GLOBUS_L_GFS_POSIX_STREAM_ACTIVE;
+    }
+    globus_l_gfs_posix_shm_unlock();
+    return admitted;
+}
+
+static
+void
+globus_l_gfs_posix_admit_release(
+    globus_l_gfs_posix_admit_t *        admit)
+{
+    globus_l_gfs_posix_stream_t *       stream;
+
+    if (admit->slot < 0) return;
+    globus_l_gfs_posix_shm_lock();
+    stream = &globus_l_gfs_posix_shm->streams[admit->slot];
+    if (stream->pid == getpid())
+    {
+        stream->state = GLOBUS_L_GFS_POSIX_STREAM_FREE;
+    }
+    globus_l_gfs_posix_shm_unlock();
+    admit->slot = -1;
+}
+
+/* run admitted(posix_handle) once the transfer may do storage I/O */
+static
+void
+globus_l_gfs_posix_admit(
+    globus_l_gfs_posix_handle_t *       posix_handle,
+    void                                (*admitted)(void *))
+{
+    if (! globus_l_gfs_posix_admit_init(posix_handle))
+    {
+        admitted(posix_handle);
+        return;
+    }
+    posix_handle->admit.admitted = admitted;
+    posix_handle->admit.t_queued = globus_l_gfs_posix_now();
+    GLOBUS_L_GFS_POSIX_PROBE2(admit_entry, posix_handle->pathname,
+                              posix_handle->admit.key);
+    globus_mutex_lock(&posix_handle->mutex);
+    posix_handle->admit.state = GLOBUS_L_GFS_POSIX_ADMIT_QUEUED;
+    globus_mutex_unlock(&posix_handle->mutex);
+    globus_l_gfs_posix_admit_try(posix_handle);
+}
+
+static
+void
+globus_l_gfs_posix_admit_try(
+    void *                              user_arg)
+{
+    globus_l_gfs_posix_handle_t *       posix_handle;
+    globus_l_gfs_posix_admit_t *        admit;
+    globus_reltime_t                    delay;
+    globus_bool_t                       go;
+    double                              wait;
+
+    posix_handle = (globus_l_gfs_posix_handle_t *) user_arg;
+    admit = &posix_handle->admit;
+    globus_mutex_lock(&posix_handle->mutex);
+    if (admit->state != GLOBUS_L_GFS_POSIX_ADMIT_QUEUED)
+    {
+        /* cancelled while the callback was on its way */
+        globus_mutex_unlock(&posix_handle->mutex);
+        return;
+    }
+    admit->state = GLOBUS_L_GFS_POSIX_ADMIT_RUNNING;
+    /* an aborted transfer goes ahead, to fail and clean up */
+    go = (posix_handle->result != GLOBUS_SUCCESS);
+    globus_mutex_unlock(&posix_handle->mutex);
+
+    if (! go && ! globus_l_gfs_posix_admit_check(admit))
+    {
+        GlobusTimeReltimeSet(delay, 0, 50000);
+        globus_mutex_lock(&posix_handle->mutex);
+        if (! admit->cancelled && posix_handle->result == GLOBUS_SUCCESS &&
+            globus_callback_register_oneshot(&admit->timer, &delay,
+                globus_l_gfs_posix_admit_try, posix_handle) == GLOBUS_SUCCESS)
+        {
+            admit->state = GLOBUS_L_GFS_POSIX_ADMIT_QUEUED;
+            globus_cond_broadcast(&posix_handle->cond);
+            globus_mutex_unlock(&posix_handle->mutex);
+            return;
+        }
+        globus_mutex_unlock(&posix_handle->mutex);
+        /* cannot wait, or no longer should, go ahead without a slot */
+        globus_l_gfs_posix_admit_release(admit);
+    }
+    globus_mutex_lock(&posix_handle->mutex);
+    admit->state = GLOBUS_L_GFS_POSIX_ADMIT_IDLE;
+    go = ! admit->cancelled;
+    globus_cond_broadcast(&posix_handle->cond);
+    globus_mutex_unlock(&posix_handle->mutex);
+    /* the session is going away, the handle may be freed by now */
+    if (! go) return;
+
+    if (admit->unlimited)
+    {
+        globus_gfs_log_message(GLOBUS_GFS_LOG_WARN,
+            "admission: all %d slots are taken, %s goes ahead "
+            "unlimited\n", GLOBUS_L_GFS_POSIX_MAX_STREAMS, admit->key);
+    }
+
+    wait = globus_l_gfs_posix_now() - admit->t_queued;
+    GLOBUS_L_GFS_POSIX_PROBE2(admit_return, posix_handle->pathname,
+                              (long) (wait * 1000000));
+    if (wait >= 0.1)
+    {
+        globus_gfs_log_message(GLOBUS_GFS_LOG_INFO,
+            "admission: %s waited %.2f s for %s\n",
+            posix_handle->pathname, wait, admit->key);
+    }
+    admit->admitted(posix_handle);
+}
+
+static
+void
+globus_l_gfs_posix_admit_unregistered(
+    void *                              user_arg)
+{
+    globus_l_gfs_posix_handle_t *       posix_handle;
+
+    posix_handle = (globus_l_gfs_posix_handle_t *) user_arg;
+    globus_mutex_lock(&posix_handle->mutex);
+    posix_handle->admit.unregistered = GLOBUS_TRUE;
+    globus_cond_broadcast(&posix_handle->cond);
+    globus_mutex_unlock(&posix_handle->mutex);
+}
+
+/*
+ * Take a waiting transfer off the admission queue, with the mutex held.
+ * Waits out a check that is running and returns TRUE if the transfer was
+ * queued; it then has neither been admitted nor will be.
+ */
+static
+globus_bool_t
+globus_l_gfs_posix_admit_cancel(
+    globus_l_gfs_posix_handle_t *       posix_handle)
+{
+    globus_l_gfs_posix_admit_t *        admit;
+
+    admit = &posix_handle->admit;
+    while (admit->state == GLOBUS_L_GFS_POSIX_ADMIT_RUNNING)
+    {
+        globus_cond_wait(&posix_handle->cond, &posix_handle->mutex);
+    }
+    if (admit->state != GLOBUS_L_GFS_POSIX_ADMIT_QUEUED)
+    {
+        return GLOBUS_FALSE;
+    }
+    admit->state = GLOBUS_L_GFS_POSIX_ADMIT_IDLE;
+    admit->unregistered = GLOBUS_FALSE;
+    if (globus_callback_unregister(admit->timer,
+            globus_l_gfs_posix_admit_unregistered, posix_handle,
+            NULL) == GLOBUS_SUCCESS)
+    {
+        while (! admit->unregistered)
+        {
+            globus_cond_wait(&posix_handle->cond, &posix_handle->mutex);
+        }
+    }
+    return GLOBUS_TRUE;
+}
+
+/* posix backend */
+
+static
+int
+globus_l_gfs_posix_backend_posix_open(
+    const char *                        pathname,
+    int                                 flags,
+    mode_t                              mode)
+{
+    return open(pathname, flags, mode);
+}
+
+static const globus_l_gfs_posix_backend_t globus_l_gfs_posix_backend_posix =
+{
+    "posix",
+    GLOBUS_TRUE,
+    globus_l_gfs_posix_backend_posix_open,
+    close,
+    read,
+    write,
+    pread,
+    writev,
+    pwritev,
+    lseek,
+    stat,
+    unlink,
+    mkdir
+};
+
+/*
+ * null backend. Reads return zeros up to a size, then end of file: the
+ * size is GRIDFTP_POSIX_NULL_SIZE (default 0), or what the ranges of a
+ * send ask for. Each open takes a slot that keeps the position, the
+ * descriptor counts down from INT_MAX and is never a real one.
+ */
+#define GLOBUS_L_GFS_POSIX_NULL_FD      INT_MAX
+#define GLOBUS_L_GFS_POSIX_NULL_SLOTS   64
+
+static struct
+{
+    pthread_mutex_t                    mutex;
+    struct
+    {
+        globus_bool_t                  busy;
+        globus_off_t                   pos;
+        globus_off_t                   size;
+    }                                  slots[GLOBUS_L_GFS_POSIX_NULL_SLOTS];
+} globus_l_gfs_posix_null =
+{
+    PTHREAD_MUTEX_INITIALIZER
+};
+
+static
+globus_off_t
+globus_l_gfs_posix_backend_null_size(void)
+{
+    return (globus_off_t)
+        globus_l_gfs_posix_getenv_size("GRIDFTP_POSIX_NULL_SIZE", 0);
+}
+
+static
+int
+globus_l_gfs_posix_backend_null_open(
+    const char *                        pathname,
+    int                                 flags,
+    mode_t                              mode)
+{
+    int                                 i;
+
+    pthread_mutex_lock(&globus_l_gfs_posix_null.mutex);
+    for (i = 0; i < GLOBUS_L_GFS_POSIX_NULL_SLOTS; i++)
+    {
+        if (! globus_l_gfs_posix_null.slots[i].busy) break;
+    }
+    if (i == GLOBUS_L_GFS_POSIX_NULL_SLOTS)
+    {
+        pthread_mutex_unlock(&globus_l_gfs_posix_null.mutex);
+        errno = EMFILE;
+        return -1;
+    }
+    globus_l_gfs_posix_null.slots[i].busy = GLOBUS_TRUE;
+    globus_l_gfs_posix_null.slots[i].pos = 0;
+    globus_l_gfs_posix_null.slots[i].size =
+        globus_l_gfs_posix_backend_null_size();
+    pthread_mutex_unlock(&globus_l_gfs_posix_null.mutex);
+    return GLOBUS_L_GFS_POSIX_NULL_FD - i;
+}
+
+static
+int
+globus_l_gfs_posix_backend_null_slot(
+    int                                 fd)
+{
+    int                                 i = GLOBUS_L_GFS_POSIX_NULL_FD - fd;
+
+    if (fd < 0 || i < 0 || i >= GLOBUS_L_GFS_POSIX_NULL_SLOTS)
+    {
+        errno = EBADF;
+        return -1;
+    }
+    return i;
+}
+
+static
+int
+globus_l_gfs_posix_backend_null_close(
+    int                                 fd)
+{
+    int                                 i;
+
+    i = globus_l_gfs_posix_backend_null_slot(fd);
+    if (i < 0) return -1;
+    pthread_mutex_lock(&globus_l_gfs_posix_null.mutex);
+    globus_l_gfs_posix_null.slots[i].busy = GLOBUS_FALSE;
+    pthread_mutex_unlock(&globus_l_gfs_posix_null.mutex);
+    return 0;
+}
+
+/* a send range of known length can be read even past the size */
+static
+void
+globus_l_gfs_posix_backend_null_want(
+    int                                 fd,
+    globus_off_t                        length)
+{
+    int                                 i;
+
+    i = globus_l_gfs_posix_backend_null_slot(fd);
+    if (i < 0) return;
+    pthread_mutex_lock(&globus_l_gfs_posix_null.mutex);
+    if (globus_l_gfs_posix_null.slots[i].size <
+        globus_l_gfs_posix_null.slots[i].pos + length)
+    {
+        globus_l_gfs_posix_null.slots[i].size =
+            globus_l_gfs_posix_null.slots[i].pos + length;
+    }
+    pthread_mutex_unlock(&globus_l_gfs_posix_null.mutex);
+}
+
+static
+ssize_t
+globus_l_gfs_posix_backend_null_read(
+    int                                 fd,
+    void *                              buf,
+    size_t                              count)
+{
+    int                                 i;
+
+    i = globus_l_gfs_posix_backend_null_slot(fd);
+    if (i < 0) return -1;
+    pthread_mutex_lock(&globus_l_gfs_posix_null.mutex);
+    if (globus_l_gfs_posix_null.slots[i].pos +
+        (globus_off_t) count > globus_l_gfs_posix_null.slots[i].size)
+    {
+        count = (globus_l_gfs_posix_null.slots[i].pos <
+                 globus_l_gfs_posix_null.slots[i].size ?
+                 globus_l_gfs_posix_null.slots[i].size -
+                 globus_l_gfs_posix_null.slots[i].pos : 0);
+    }
+    globus_l_gfs_posix_null.slots[i].pos += count;
+    pthread_mutex_unlock(&globus_l_gfs_posix_null.mutex);
+    /* never send what happened to be in the buffer */
+    memset(buf, 0, count);
+    return count;
+}
+
+static
+ssize_t
+globus_l_gfs_posix_backend_null_write(
+    int                                 fd,
+    const void *                        buf,
+    size_t                              count)
+{
+    return count;
+}
+
+static
+ssize_t
+globus_l_gfs_posix_backend_null_pread(
+    int                                 fd,
+    void *                              buf,
+    size_t                              count,
+    off_t                               offset)
+{
+    return globus_l_gfs_posix_backend_null_read(fd, buf, count);
+}
+
+static
+ssize_t
+globus_l_gfs_posix_backend_null_writev(
+    int                                 fd,
+    const struct iovec *                iov,
+    int                                 iovcnt)
+{
+    ssize_t                             count = 0;
+    int                                 i;
+
+    for (i = 0; i < iovcnt; i++)
+    {
+        count += iov[i].iov_len;
+    }
+    return count;
+}
+
+static
+ssize_t
+globus_l_gfs_posix_backend_null_pwritev(
+    int                                 fd,
+    const struct iovec *                iov,
+    int                                 iovcnt,
+    off_t                               offset)
+{
+    return globus_l_gfs_posix_backend_null_writev(fd, iov, iovcnt);
+}
+
+static
+off_t
+globus_l_gfs_posix_backend_null_lseek(
+    int                                 fd,
+    off_t                               offset,
+    int                                 whence)
+{
+    return offset;
+}
+
+/* every path exists, looks like /dev/null and is as long as reads go */
+static
+int
+globus_l_gfs_posix_backend_null_stat(
+    const char *                        pathname,
+    struct stat *                       stat_buf)
+{
+    memset(stat_buf, 0, sizeof(struct stat));
+    stat_buf->st_mode = S_IFCHR | 0666;
+    stat_buf->st_size = globus_l_gfs_posix_backend_null_size();
+    stat_buf->st_nlink = 1;
+    stat_buf->st_mtime = time(NULL);
+    return 0;
+}
+
+static
+int
+globus_l_gfs_posix_backend_null_unlink(
+    const char *                        pathname)
+{
+    return 0;
+}
+
+/* also used by mem, whose name space is flat */
+static
+int
+globus_l_gfs_posix_backend_null_mkdir(
+    const char *                        pathname,
+    mode_t                              mode)
+{
+    return 0;
+}
+
+static const globus_l_gfs_posix_backend_t globus_l_gfs_posix_backend_null =
+{
+    "null",
+    GLOBUS_FALSE,
+    globus_l_gfs_posix_backend_null_open,
+    globus_l_gfs_posix_backend_null_close,
+    globus_l_gfs_posix_backend_null_read,
+    globus_l_gfs_posix_backend_null_write,
+    globus_l_gfs_posix_backend_null_pread,
+    globus_l_gfs_posix_backend_null_writev,
+    globus_l_gfs_posix_backend_null_pwritev,
+    globus_l_gfs_posix_backend_null_lseek,
+    globus_l_gfs_posix_backend_null_stat,
+    globus_l_gfs_posix_backend_null_unlink,
+    globus_l_gfs_posix_backend_null_mkdir
+};
+
+/*
+ * mem backend. The gridftp server forks a process per session, so the
+ * files live in POSIX shared memory where the next session finds them.
+ * The path becomes a shared memory object name with '/' and '%' escaped.
+ */
+static
+int
+globus_l_gfs_posix_backend_mem_name(
+    const char *                        pathname,
+    char *                              name,
+    size_t                              len)
+{
+    size_t                              i = 0;
+
+    name[i++] = '/';
+    for (; *pathname != '\0'; pathname++)
+    {
+        if (i + 4 > len)
+        {
+            errno = ENAMETOOLONG;
+            return -1;
+        }
+        if (*pathname == '/' || *pathname == '%')
+        {
+            i += sprintf(name + i, "%%%02X", (unsigned char) *pathname);
+        }
+        else
+        {
+            name[i++] = *pathname;
+        }
+    }
+    name[i] = '\0';
+    return 0;
+}
+
+static
+int
+globus_l_gfs_posix_backend_mem_open(
+    const char *                        pathname,
+    int                                 flags,
+    mode_t                              mode)
+{
+    char                                name[NAME_MAX];
+
+    if (globus_l_gfs_posix_backend_mem_name(pathname, name, sizeof(name)) != 0)
+    {
+        return -1;
+    }
+    /* shm_open() only knows about read and write access */
+    if ((flags & O_ACCMODE) == O_WRONLY)
+    {
+        flags = (flags & ~O_ACCMODE) | O_RDWR;
+    }
+    return shm_open(name, flags & (O_ACCMODE|O_CREAT|O_EXCL|O_TRUNC), mode);
+}
+
+static
+int
+globus_l_gfs_posix_backend_mem_stat(
+    const char *                        pathname,
+    struct stat *                       stat_buf)
+{
+    int                                 fd;
+    int                                 rc;
+
+    fd = globus_l_gfs_posix_backend_mem_open(pathname, O_RDONLY, 0);
+    if (fd < 0) return -1;
+    rc = fstat(fd, stat_buf);
+    close(fd);
+    return rc;
+}
+
+static
+int
+globus_l_gfs_posix_backend_mem_unlink(
+    const char *                        pathname)
+{
+    char                                name[NAME_MAX];
+
+    if (globus_l_gfs_posix_backend_mem_name(pathname, name, sizeof(name)) != 0)
+    {
+        return -1;
+    }
+    return shm_unlink(name);
+}
+
+static const globus_l_gfs_posix_backend_t globus_l_gfs_posix_backend_mem =
+{
+    "mem",
+    GLOBUS_TRUE,
+    globus_l_gfs_posix_backend_mem_open,
+    close,
+    read,
+    write,
+    pread,
+    writev,
+    pwritev,
+    lseek,
+    globus_l_gfs_posix_backend_mem_stat,
+    globus_l_gfs_posix_backend_mem_unlink,
+    globus_l_gfs_posix_backend_null_mkdir
+};
+
+static const globus_l_gfs_posix_backend_t * globus_l_gfs_posix_backend_list[] =
+{
+    &globus_l_gfs_posix_backend_posix,
+    &globus_l_gfs_posix_backend_null,
+    &globus_l_gfs_posix_backend_mem,
+    NULL
+};
+
+/*
+ * Read the prefix=backend list of GRIDFTP_POSIX_BACKEND into the session,
+ * after the built-in entries for /dev/null and /dev/zero.
+ */
+static
+void
+globus_l_gfs_posix_backend_init(
+    globus_l_gfs_posix_handle_t *       posix_handle)
+{
+    char                                buf[1024];
+    char *                              env;
+    char *                              token;
+    char *                              save;
+    char *                              eq;
+    int                                 i;
+
+    env = getenv("GRIDFTP_POSIX_BACKEND");
+    snprintf(buf, sizeof(buf), "/dev/null=null,/dev/zero=null,%s",
+             (env != NULL ? env : ""));
+
+    posix_handle->nbackends = 0;
+    for (token = strtok_r(buf, ",", &save); token != NULL;
+         token = strtok_r(NULL, ",", &save))
+    {
+        while (*token == ' ') token++;
+        eq = strrchr(token, '=');
+        if (eq == NULL ||
+            posix_handle->nbackends == GLOBUS_L_GFS_POSIX_MAX_BACKENDS)
+        {
+            continue;
+        }
+        *eq = '\0';
+        for (i = 0; globus_l_gfs_posix_backend_list[i] != NULL; i++)
+        {
+            if (! strcmp(eq + 1, globus_l_gfs_posix_backend_list[i]->name))
+            {
+                break;
+            }
+        }
+        if (globus_l_gfs_posix_backend_list[i] == NULL)
+        {
+            globus_gfs_log_message(GLOBUS_GFS_LOG_WARN,
+                "unknown storage backend %s for %s\n", eq + 1, token);
+            continue;
+        }
+        strncpy(posix_handle->backends[posix_handle->nbackends].prefix,
+                token, sizeof(posix_handle->backends[0].prefix) - 1);
+        posix_handle->backends[posix_handle->nbackends].prefix[
+            sizeof(posix_handle->backends[0].prefix) - 1] = '\0';
+        posix_handle->backends[posix_handle->nbackends].backend =
+            globus_l_gfs_posix_backend_list[i];
+        posix_handle->nbackends++;
+    }
+}
+
+/* the backend of the longest matching prefix, posix if none matches */
+static
+const globus_l_gfs_posix_backend_t *
+globus_l_gfs_posix_backend_select(
+    globus_l_gfs_posix_handle_t *       posix_handle,
+    const char *                        pathname)
+{
+    const globus_l_gfs_posix_backend_t * backend;
+    size_t                              best_len = 0;
+    size_t                              len;
+    int                                 i;
+
+    backend = &globus_l_gfs_posix_backend_posix;
+    for (i = 0; i < posix_handle->nbackends; i++)
+    {
+        len = strlen(posix_handle->backends[i].prefix);
+        if (len >= best_len &&
+            strncmp(pathname, posix_handle->backends[i].prefix, len) == 0)
+        {
+            best_len = len;
+            backend = posix_handle->backends[i].backend;
+        }
+    }
+    return backend;
+}
+
+/*
+ * Parent directory creation on recv. With GRIDFTP_POSIX_MKDIRS, an upload
+ * whose open fails with ENOENT creates the missing directories (mkdir -p,
+ * with GRIDFTP_POSIX_MKDIRS_MODE) and opens again, which saves clients a
+ * MKD round trip per level. The process remembers the directories it
+ * knows to exist, so the next upload into the same tree only walks up to
+ * the first of them. The cache is shared by all sessions of the process,
+ * which may run on several threads, so it has its own lock.
+ */
+#define GLOBUS_L_GFS_POSIX_MAX_DIRS     64
+
+static struct
+{
+    pthread_mutex_t                     lock;
+    char *                              dirs[GLOBUS_L_GFS_POSIX_MAX_DIRS];
+    int                                 next;
+} globus_l_gfs_posix_dircache =
+{
+    PTHREAD_MUTEX_INITIALIZER
+};
+
+/* with the lock held */
+static
+globus_bool_t
+globus_l_gfs_posix_dircache_find(
+    const char *                        dir)
+{
+    int                                 i;
+
+    for (i = 0; i < GLOBUS_L_GFS_POSIX_MAX_DIRS; i++)
+    {
+        if (globus_l_gfs_posix_dircache.dirs[i] != NULL &&
+            strcmp(globus_l_gfs_posix_dircache.dirs[i], dir) == 0)
+        {
+            return GLOBUS_TRUE;
+        }
+    }
+    return GLOBUS_FALSE;
+}
+
+static
+globus_bool_t
+globus_l_gfs_posix_dircache_has(
+    const char *                        dir)
+{
+    globus_bool_t                       found;
+
+    pthread_mutex_lock(&globus_l_gfs_posix_dircache.lock);
+    found = globus_l_gfs_posix_dircache_find(dir);
+    pthread_mutex_unlock(&globus_l_gfs_posix_dircache.lock);
+    return found;
+}
+
+static
+void
+globus_l_gfs_posix_dircache_add(
+    const char *                        dir)
+{
+    char **                             slot;
+
+    pthread_mutex_lock(&globus_l_gfs_posix_dircache.lock);
+    if (! globus_l_gfs_posix_dircache_find(dir))
+    {
+        slot = &globus_l_gfs_posix_dircache.dirs[
+            globus_l_gfs_posix_dircache.next];
+        free(*slot);
+        *slot = strdup(dir);
+        globus_l_gfs_posix_dircache.next =
+            (globus_l_gfs_posix_dircache.next + 1) %
+            GLOBUS_L_GFS_POSIX_MAX_DIRS;
+    }
+    pthread_mutex_unlock(&globus_l_gfs_posix_dircache.lock);
+}
+
+/* dir and everything below it is gone */
+static
+void
+globus_l_gfs_posix_dircache_forget(
+    const char *                        dir)
+{
+    size_t                              len;
+    char *                              cached;
+    int                                 i;
+
+    len = strlen(dir);
+    while (len > 1 && dir[len - 1] == '/') len--;
+    pthread_mutex_lock(&globus_l_gfs_posix_dircache.lock);
+    for (i = 0; i < GLOBUS_L_GFS_POSIX_MAX_DIRS; i++)
+    {
+        cached = globus_l_gfs_posix_dircache.dirs[i];
+        if (cached != NULL && strncmp(cached, dir, len) == 0 &&
+            (cached[len] == '\0' || cached[len] == '/'))
+        {
+            free(cached);
+            globus_l_gfs_posix_dircache.dirs[i] = NULL;
+        }
+    }
+    pthread_mutex_unlock(&globus_l_gfs_posix_dircache.lock);
+}
+
+/*
+ * GRIDFTP_POSIX_MKDIRS_MODE, octal. Anything else, or a mode without
+ * owner write and search (mkdir -p could not go on below the first
+ * level), is logged and 0755 is used.
+ */
+static
+mode_t
+globus_l_gfs_posix_mkdirs_mode(void)
+{
+    char *                              value;
+    char *                              end;
+    long                                mode;
+
+    value = getenv("GRIDFTP_POSIX_MKDIRS_MODE");
+    if (value == NULL || *value == '\0') return 0755;
+    errno = 0;
+    mode = strtol(value, &end, 8);
+    if (errno != 0 || *end != '\0' || mode < 0 || mode > 07777 ||
+        (mode & 0300) != 0300)
+    {
+        globus_gfs_log_message(GLOBUS_GFS_LOG_WARN,
+            "GRIDFTP_POSIX_MKDIRS_MODE %s is not a usable directory mode, "
+            "using 0755\n", value);
+        return 0755;
+    }
+    return (mode_t) mode;
+}
+
+/* create the missing parent directories of filename, 0 on success */
+static
+int
+globus_l_gfs_posix_mkdirs(
+    globus_l_gfs_posix_handle_t *       posix_handle,
+    const char *                        filename)
+{
+    char                                dir[MAXPATHLEN];
+    char *                              end;
+    mode_t                              mode;
+    size_t                              top;
+    int                                 attempt;
+    int                                 depth;
+
+    mode = globus_l_gfs_posix_mkdirs_mode();
+
+    /* a cached directory may have been removed behind our back, the
+       second attempt does not trust the cache */
+    for (attempt = 0; attempt < 2; attempt++)
+    {
+        strncpy(dir, filename, sizeof(dir));
+        dir[sizeof(dir) - 1] = '\0';
+        /* xrootd CGI */
+        end = strchr(dir, '?');
+        if (end != NULL) *end = '\0';
+
+        /* walk up to the deepest directory that exists */
+        depth = 0;
+        for (;;)
+        {
+            end = strrchr(dir, '/');
+            if (end == NULL || end == dir)
+            {
+                errno = ENOENT;
+                return -1;
+            }
+            *end = '\0';
+            /* the open just said the parent is missing, whatever the
+               cache thinks */
+            if (attempt == 0 && depth > 0 &&
+                globus_l_gfs_posix_dircache_has(dir))
+            {
+                break;
+            }
+            if (posix_handle->backend->mkdir(dir, mode) == 0 ||
+                errno == EEXIST)
+            {
+                globus_l_gfs_posix_dircache_add(dir);
+                break;
+            }
+            if (errno != ENOENT) return -1;
+            depth++;
+        }
+
+        /* and create the ones below it */
+        top = strlen(dir);
+        while (depth > 0)
+        {
+            dir[strlen(dir)] = '/';
+            if (posix_handle->backend->mkdir(dir, mode) != 0 &&
+                errno != EEXIST)
+            {
+                break;
+            }
+            globus_l_gfs_posix_dircache_add(dir);
+            depth--;
+        }
+        if (depth == 0) return 0;
+        if (errno != ENOENT) return -1;
+        dir[top] = '\0';
+        globus_l_gfs_posix_dircache_forget(dir);
+    }
+    return -1;
+}
+
+/* open file cache */
+
+static
+void
+globus_l_gfs_posix_fdcache_init(
+    globus_l_gfs_posix_handle_t *       posix_handle)
+{
+    globus_l_gfs_posix_fdcache_t *      fdcache;
+
+    fdcache = &posix_handle->fdcache;
+    memset(fdcache, 0, sizeof(globus_l_gfs_posix_fdcache_t));
+    pthread_mutex_init(&fdcache->lock, NULL);
+    pthread_cond_init(&fdcache->cond, NULL);
+    fdcache->size = globus_l_gfs_posix_getenv_int("GRIDFTP_POSIX_FDCACHE", 0);
+    if (fdcache->size > GLOBUS_L_GFS_POSIX_MAX_FDCACHE)
+    {
+        fdcache->size = GLOBUS_L_GFS_POSIX_MAX_FDCACHE;
+    }
+    memset(&posix_handle->prefetch, 0, sizeof(globus_l_gfs_posix_prefetch_t));
+    posix_handle->prefetch.max = globus_l_gfs_posix_getenv_int(
+        "GRIDFTP_POSIX_PREFETCH_MAX", 4);
+}
+
+/*
+ * Close an entry, or leave that to fdcache_close() if it is in use.
+ * This and the functions below that do not lock are called with the
+ * fdcache lock held.
+ */
+static
+void
+globus_l_gfs_posix_fdcache_drop(
+    globus_l_gfs_posix_handle_t *       posix_handle,
+    globus_l_gfs_posix_cached_fd_t *    cached)
+{
+    if (cached->busy)
+    {
+        cached->stale = GLOBUS_TRUE;
+        return;
+    }
+    if (cached->speculative)
+    {
+        posix_handle->prefetch.wasted++;
+    }
+    cached->backend->close(cached->fd);
+    free(cached->path);
+    cached->path = NULL;
+}
+
+/* keep fd in a free entry, or in place of the least recently used one */
+static
+globus_l_gfs_posix_cached_fd_t *
+globus_l_gfs_posix_fdcache_insert(
+    globus_l_gfs_posix_handle_t *       posix_handle,
+    const char *                        pathname,
+    const globus_l_gfs_posix_backend_t * backend,
+    int                                 fd,
+    const struct stat *                 st,
+    globus_bool_t                       busy)
+{
+    globus_l_gfs_posix_fdcache_t *      fdcache;
+    globus_l_gfs_posix_cached_fd_t *    cached;
+    globus_l_gfs_posix_cached_fd_t *    victim = NULL;
+    int                                 i;
+
+    fdcache = &posix_handle->fdcache;
+    for (i = 0; i < fdcache->size; i++)
+    {
+        cached = &fdcache->fds[i];
+        if (cached->path == NULL)
+        {
+            victim = cached;
+            break;
+        }
+        if (! cached->busy &&
+            (victim == NULL || cached->used < victim->used))
+        {
+            victim = cached;
+        }
+    }
+    if (victim == NULL) return NULL;
+    if (victim->path != NULL)
+    {
+        globus_l_gfs_posix_fdcache_drop(posix_handle, victim);
+    }
+    victim->path = strdup(pathname);
+    if (victim->path == NULL) return NULL;
+    victim->backend = backend;
+    victim->fd = fd;
+    victim->dev = st->st_dev;
+    victim->ino = st->st_ino;
+    victim->mtime = st->st_mtim;
+    victim->used = ++fdcache->clock;
+    victim->busy = busy;
+    victim->stale = GLOBUS_FALSE;
+    victim->speculative = GLOBUS_FALSE;
+    return victim;
+}
+
+static
+globus_bool_t
+globus_l_gfs_posix_prefetch_running(
+    globus_l_gfs_posix_handle_t *       posix_handle,
+    const char *                        pathname)
+{
+    globus_l_gfs_posix_prefetch_job_t * job;
+
+    for (job = posix_handle->prefetch.jobs; job != NULL; job = job->next)
+    {
+        if (strcmp(job->path, pathname) == 0) return GLOBUS_TRUE;
+    }
+    return GLOBUS_FALSE;
+}
+
+/*
+ * Open pathname read-only for a send, from the cache if the descriptor
+ * there still refers to the file at that path.
+ */
+static
+int
+globus_l_gfs_posix_fdcache_open(
+    globus_l_gfs_posix_handle_t *       posix_handle,
+    const char *                        pathname)
+{
+    globus_l_gfs_posix_fdcache_t *      fdcache;
+    globus_l_gfs_posix_cached_fd_t *    cached;
+    struct stat                         st;
+    int                                 fd;
+    int                                 i;
+
+    fdcache = &posix_handle->fdcache;
+    if (fdcache->size == 0 || ! posix_handle->backend->seekable)
+    {
+        return posix_handle->backend->open(pathname, O_RDONLY, 0);
+    }
+
+    pthread_mutex_lock(&fdcache->lock);
+    while (globus_l_gfs_posix_prefetch_running(posix_handle, pathname))
+    {
+        pthread_cond_wait(&fdcache->cond, &fdcache->lock);
+    }
+    for (i = 0; i < fdcache->size; i++)
+    {
+        cached = &fdcache->fds[i];
+        if (cached->path == NULL || cached->stale ||
+            strcmp(cached->path, pathname) != 0)
+        {
+            continue;
+        }
+        if (! cached->busy && cached->backend == posix_handle->backend &&
+            posix_handle->backend->stat(pathname, &st) == 0 &&
+            st.st_dev == cached->dev && st.st_ino == cached->ino &&
+            st.st_mtim.tv_sec == cached->mtime.tv_sec &&
+            st.st_mtim.tv_nsec == cached->mtime.tv_nsec)
+        {
+            cached->busy = GLOBUS_TRUE;
+            cached->used = ++fdcache->clock;
+            fdcache->hits++;
+            if (cached->speculative)
+            {
+                posix_handle->prefetch.hits++;
+                cached->speculative = GLOBUS_FALSE;
+            }
+            pthread_mutex_unlock(&fdcache->lock);
+            return cached->fd;
+        }
+        globus_l_gfs_posix_fdcache_drop(posix_handle, cached);
+    }
+    fdcache->misses++;
+    pthread_mutex_unlock(&fdcache->lock);
+
+    fd = posix_handle->backend->open(pathname, O_RDONLY, 0);
+    if (fd < 0 || fstat(fd, &st) != 0) return fd;
+    pthread_mutex_lock(&fdcache->lock);
+    globus_l_gfs_posix_fdcache_insert(posix_handle, pathname,
+                                      posix_handle->backend, fd, &st,
+                                      GLOBUS_TRUE);
+    pthread_mutex_unlock(&fdcache->lock);
+    return fd;
+}
+
+/* the send is done with fd; cached descriptors stay open */
+static
+int
+globus_l_gfs_posix_fdcache_close(
+    globus_l_gfs_posix_handle_t *       posix_handle,
+    int                                 fd)
+{
+    globus_l_gfs_posix_cached_fd_t *    cached;
+    int                                 i;
+
+    pthread_mutex_lock(&posix_handle->fdcache.lock);
+    for (i = 0; i < posix_handle->fdcache.size; i++)
+    {
+        cached = &posix_handle->fdcache.fds[i];
+        if (cached->path != NULL && cached->busy && cached->fd == fd)
+        {
+            cached->busy = GLOBUS_FALSE;
+            if (cached->stale)
+            {
+                globus_l_gfs_posix_fdcache_drop(posix_handle, cached);
+            }
+            pthread_mutex_unlock(&posix_handle->fdcache.lock);
+            return 0;
+        }
+    }
+    pthread_mutex_unlock(&posix_handle->fdcache.lock);
+    return posix_handle->backend->close(fd);
+}
+
+/* pathname changed, or (with subtree) everything below it */
+static
+void
+globus_l_gfs_posix_fdcache_forget(
+    globus_l_gfs_posix_handle_t *       posix_handle,
+    const char *                        pathname,
+    globus_bool_t                       subtree)
+{
+    globus_l_gfs_posix_cached_fd_t *    cached;
+    size_t                              len;
+    int                                 i;
+
+    len = strlen(pathname);
+    while (subtree && len > 1 && pathname[len - 1] == '/') len--;
+    pthread_mutex_lock(&posix_handle->fdcache.lock);
+    for (i = 0; i < posix_handle->fdcache.size; i++)
+    {
+        cached = &posix_handle->fdcache.fds[i];
+        if (cached->path == NULL) continue;
+        if (strcmp(cached->path, pathname) == 0 ||
+            (subtree && strncmp(cached->path, pathname, len) == 0 &&
+             cached->path[len] == '/'))
+        {
+            globus_l_gfs_posix_fdcache_drop(posix_handle, cached);
+        }
+    }
+    pthread_mutex_unlock(&posix_handle->fdcache.lock);
+}
+
+static
+void *
+globus_l_gfs_posix_prefetch_worker(
+    void *                              arg)
+{
+    globus_l_gfs_posix_prefetch_job_t * job;
+    globus_l_gfs_posix_prefetch_job_t ** link;
+    globus_l_gfs_posix_handle_t *       posix_handle;
+    globus_l_gfs_posix_cached_fd_t *    cached = NULL;
+    struct stat                         st;
+    double                              t_probe;
+    int                                 fd;
+
+    job = (globus_l_gfs_posix_prefetch_job_t *) arg;
+    posix_handle = job->posix_handle;
+    GLOBUS_L_GFS_POSIX_PROBE2(prefetch_entry, job->path,
+                              (long long) job->length);
+    t_probe = GLOBUS_L_GFS_POSIX_CLOCK(prefetch_return);
+    fd = job->backend->open(job->path, O_RDONLY, 0);
+    if (fd >= 0)
+    {
+        posix_fadvise(fd, 0, job->length, POSIX_FADV_WILLNEED);
+    }
+
+    pthread_mutex_lock(&posix_handle->fdcache.lock);
+    if (fd >= 0 && fstat(fd, &st) == 0)
+    {
+        cached = globus_l_gfs_posix_fdcache_insert(posix_handle, job->path,
+                                                   job->backend, fd, &st,
+                                                   GLOBUS_FALSE);
+    }
+    if (cached != NULL)
+    {
+        cached->speculative = GLOBUS_TRUE;
+    }
+    for (link = &posix_handle->prefetch.jobs; *link != job;
+         link = &(*link)->next);
+    *link = job->next;
+    posix_handle->prefetch.running--;
+    pthread_cond_broadcast(&posix_handle->fdcache.cond);
+    pthread_mutex_unlock(&posix_handle->fdcache.lock);
+
+    /* without a cache entry only the readahead is left */
+    if (fd >= 0 && cached == NULL)
+    {
+        job->backend->close(fd);
+    }
+    GLOBUS_L_GFS_POSIX_PROBE3(prefetch_return, job->path, fd,
+                              GLOBUS_L_GFS_POSIX_USEC(t_probe));
+    free(job->path);
+    free(job);
+    return NULL;
+}
+
+/* pathname was just stat()ed, start warming it up for the RETR */
+static
+void
+globus_l_gfs_posix_prefetch(
+    globus_l_gfs_posix_handle_t *       posix_handle,
+    const globus_l_gfs_posix_backend_t * backend,
+    const char *                        pathname,
+    const struct stat *                 st)
+{
+    globus_l_gfs_posix_prefetch_t *     prefetch;
+    globus_l_gfs_posix_prefetch_job_t * job;
+    globus_l_gfs_posix_prefetch_job_t ** link;
+    char                                value[64];
+    globus_off_t                        length;
+    pthread_attr_t                      attr;
+    pthread_t                           thread;
+    globus_bool_t                       busy;
+    int                                 i;
+    int                                 rc;
+
+    prefetch = &posix_handle->prefetch;
+    if (! S_ISREG(st->st_mode) || st->st_size == 0 || ! backend->seekable ||
+        globus_l_gfs_posix_prefix_lookup("GRIDFTP_POSIX_PREFETCH",
+            pathname, value, sizeof(value)) == NULL)
+    {
+        return;
+    }
+    length = globus_l_gfs_posix_parse_size(value);
+    if (length <= 0) return;
+    if (length > st->st_size) length = st->st_size;
+
+    job = (globus_l_gfs_posix_prefetch_job_t *)
+        malloc(sizeof(globus_l_gfs_posix_prefetch_job_t));
+    if (job == NULL) return;
+    job->posix_handle = posix_handle;
+    job->backend = backend;
+    job->length = length;
+    job->path = strdup(pathname);
+    if (job->path == NULL)
+    {
+        free(job);
+        return;
+    }
+
+    pthread_mutex_lock(&posix_handle->fdcache.lock);
+    busy = (prefetch->running >= prefetch->max ||
+            globus_l_gfs_posix_prefetch_running(posix_handle, pathname));
+    for (i = 0; i < posix_handle->fdcache.size && ! busy; i++)
+    {
+        busy = (posix_handle->fdcache.fds[i].path != NULL &&
+                ! posix_handle->fdcache.fds[i].stale &&
+                strcmp(posix_handle->fdcache.fds[i].path, pathname) == 0);
+    }
+    if (busy)
+    {
+        pthread_mutex_unlock(&posix_handle->fdcache.lock);
+        free(job->path);
+        free(job);
+        return;
+    }
+    job->next = prefetch->jobs;
+    prefetch->jobs = job;
+    prefetch->running++;
+    prefetch->started++;
+    pthread_mutex_unlock(&posix_handle->fdcache.lock);
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    rc = pthread_create(&thread, &attr, globus_l_gfs_posix_prefetch_worker,
+                        job);
+    pthread_attr_destroy(&attr);
+    if (rc != 0)
+    {
+        pthread_mutex_lock(&posix_handle->fdcache.lock);
+        for (link = &prefetch->jobs; *link != job; link = &(*link)->next);
+        *link = job->next;
+        prefetch->running--;
+        prefetch->started--;
+        pthread_cond_broadcast(&posix_handle->fdcache.cond);
+        pthread_mutex_unlock(&posix_handle->fdcache.lock);
+        free(job->path);
+        free(job);
+    }
+}
+
+static
+void
+globus_l_gfs_posix_fdcache_destroy(
+    globus_l_gfs_posix_handle_t *       posix_handle)
+{
+    globus_l_gfs_posix_fdcache_t *      fdcache;
+    globus_l_gfs_posix_prefetch_t *     prefetch;
+    int                                 i;
+
+    fdcache = &posix_handle->fdcache;
+    prefetch = &posix_handle->prefetch;
+    pthread_mutex_lock(&fdcache->lock);
+    while (prefetch->running > 0)
+    {
+        pthread_cond_wait(&fdcache->cond, &fdcache->lock);
+    }
+    for (i = 0; i < fdcache->size; i++)
+    {
+        if (fdcache->fds[i].path != NULL)
+        {
+            fdcache->fds[i].busy = GLOBUS_FALSE;
+            globus_l_gfs_posix_fdcache_drop(posix_handle, &fdcache->fds[i]);
+        }
+    }
+    pthread_mutex_unlock(&fdcache->lock);
+    if (fdcache->hits + fdcache->misses > 0)
+    {
+        globus_gfs_log_message(GLOBUS_GFS_LOG_INFO,
+            "open file cache: %d hits, %d misses\n",
+            fdcache->hits, fdcache->misses);
+    }
+    if (prefetch->started > 0)
+    {
+        globus_gfs_log_message(GLOBUS_GFS_LOG_INFO,
+            "prefetch: %d started, %d hits, %d wasted\n",
+            prefetch->started, prefetch->hits, prefetch->wasted);
+    }
+    pthread_cond_destroy(&fdcache->cond);
+    pthread_mutex_destroy(&fdcache->lock);
+}
+
+/*
+ * Operation trace. With GRIDFTP_POSIX_TRACE set to a directory, every
+ * process (each session is one) appends to its own file there a compact
+ * binary record of each operation it gets and another one when it
+ * finishes it (the layout is in globus_gridftp_server_posix_trace.h).
+ * replay/gfs_replay runs such traces against the DSI. A record is one
+ * write() on an O_APPEND descriptor, there is no buffer to lose or lock.
+ * After a short write tracing stops, but the descriptor stays open: other
+ * threads may be writing to it, and a closed number could be reused.
+ */
+static struct
+{
+    globus_bool_t                       initialized;
+    int                                 fd;
+    volatile int                        stopped;
+} globus_l_gfs_posix_trace;
+
+static
+globus_bool_t
+globus_l_gfs_posix_trace_on(void)
+{
+    return (globus_l_gfs_posix_trace.fd != -1 &&
+            ! globus_l_gfs_posix_trace.stopped);
+}
+
+/* once per process, at the first session */
+static
+void
+globus_l_gfs_posix_trace_init(void)
+{
+    globus_l_gfs_posix_trace_header_t   header;
+    char                                path[MAXPATHLEN];
+    char *                              dir;
+    int                                 fd;
+
+    if (globus_l_gfs_posix_trace.initialized) return;
+    globus_l_gfs_posix_trace.initialized = GLOBUS_TRUE;
+    globus_l_gfs_posix_trace.fd = -1;
+
+    dir = getenv("GRIDFTP_POSIX_TRACE");
+    if (dir == NULL || *dir == '\0') return;
+    snprintf(path, sizeof(path), "%s/gridftp-posix.%ld.%d.trace",
+             dir, (long) time(NULL), (int) getpid());
+    fd = open(path, O_WRONLY|O_CREAT|O_EXCL|O_APPEND|O_CLOEXEC,
+              S_IRUSR|S_IWUSR);
+    if (fd == -1)
+    {
+        globus_gfs_log_message(GLOBUS_GFS_LOG_ERR,
+            "cannot create trace %s: %s\n", path, strerror(errno));
+        return;
+    }
+    header.magic = GLOBUS_L_GFS_POSIX_TRACE_MAGIC;
+    header.version = GLOBUS_L_GFS_POSIX_TRACE_VERSION;
+    header.record_size = sizeof(globus_l_gfs_posix_trace_record_t);
+    if (write(fd, &header, sizeof(header)) != sizeof(header))
+    {
+        close(fd);
+        return;
+    }
+    /* records only once the header is out */
+    globus_l_gfs_posix_trace.fd = fd;
+}
+
+/* fill in the time, append path, arg and ranges, write it out */
+static
+void
+globus_l_gfs_posix_trace_write(
+    globus_l_gfs_posix_trace_record_t * record,
+    const char *                        path,
+    const char *                        arg,
+    globus_range_list_t                 ranges)
+{
+    char                                buf[sizeof(*record) + 2 * MAXPATHLEN +
+                                            GLOBUS_L_GFS_POSIX_TRACE_MAX_RANGES *
+                                            2 * sizeof(int64_t)];
+    globus_off_t                        offset;
+    globus_off_t                        length;
+    int64_t                             pair[2];
+    size_t                              len;
+    int                                 n;
+    int                                 i;
+
+    if (path == NULL) path = "";
+    if (arg == NULL) arg = "";
+    record->usec = (int64_t) (globus_l_gfs_posix_now() * 1000000);
+    record->path_len = strnlen(path, MAXPATHLEN);
+    record->arg_len = strnlen(arg, MAXPATHLEN);
+    len = sizeof(*record);
+    memcpy(buf + len, path, record->path_len);
+    len += record->path_len;
+    memcpy(buf + len, arg, record->arg_len);
+    len += record->arg_len;
+
+    n = (ranges == NULL ? 0 : globus_range_list_size(ranges));
+    if (n > GLOBUS_L_GFS_POSIX_TRACE_MAX_RANGES)
+    {
+        n = GLOBUS_L_GFS_POSIX_TRACE_MAX_RANGES;
+        record->flags |= GLOBUS_L_GFS_POSIX_TRACE_TRUNCATED;
+    }
+    for (i = 0; i < n; i++)
+    {
+        globus_range_list_at(ranges, i, &offset, &length);
+        pair[0] = offset;
+        pair[1] = length;
+        memcpy(buf + len, pair, sizeof(pair));
+        len += sizeof(pair);
+    }
+    record->nranges = n;
+    memcpy(buf, record, sizeof(*record));
+    if (write(globus_l_gfs_posix_trace.fd, buf, len) != (ssize_t) len &&
+        __sync_bool_compare_and_swap(&globus_l_gfs_posix_trace.stopped, 0, 1))
+    {
+        /* full or gone, trace no more rather than add to a torn record */
+        globus_gfs_log_message(GLOBUS_GFS_LOG_ERR,
+            "trace write failed, tracing stopped\n");
+    }
+}
+
+static
+void
+globus_l_gfs_posix_trace_session(
+    globus_l_gfs_posix_handle_t *       posix_handle)
+{
+    globus_l_gfs_posix_trace_record_t   record;
+
+    if (! globus_l_gfs_posix_trace_on()) return;
+    memset(&record, 0, sizeof(record));
+    record.type = GLOBUS_L_GFS_POSIX_TRACE_SESSION;
+    record.session = (uintptr_t) posix_handle;
+    record.id = (uintptr_t) posix_handle;
+    globus_l_gfs_posix_trace_write(&record, NULL, NULL, NULL);
+}
+
+static
+void
+globus_l_gfs_posix_trace_stat(
+    globus_l_gfs_posix_handle_t *       posix_handle,
+    globus_gfs_operation_t              op,
+    globus_gfs_stat_info_t *            stat_info,
+    const char *                        pathname)
+{
+    globus_l_gfs_posix_trace_record_t   record;
+
+    if (! globus_l_gfs_posix_trace_on()) return;
+    memset(&record, 0, sizeof(record));
+    record.type = GLOBUS_L_GFS_POSIX_TRACE_STAT;
+    record.code = stat_info->file_only;
+    record.session = (uintptr_t) posix_handle;
+    record.id = (uintptr_t) op;
+    globus_l_gfs_posix_trace_write(&record, pathname, NULL, NULL);
+}
+
+static
+void
+globus_l_gfs_posix_trace_command(
+    globus_l_gfs_posix_handle_t *       posix_handle,
+    globus_gfs_operation_t              op,
+    globus_gfs_command_info_t *         cmd_info,
+    const char *                        pathname)
+{
+    globus_l_gfs_posix_trace_record_t   record;
+    const char *                        arg = NULL;
+
+    if (! globus_l_gfs_posix_trace_on()) return;
+    memset(&record, 0, sizeof(record));
+    record.type = GLOBUS_L_GFS_POSIX_TRACE_COMMAND;
+    record.code = cmd_info->command;
+    record.session = (uintptr_t) posix_handle;
+    record.id = (uintptr_t) op;
+    switch (cmd_info->command)
+    {
+      case GLOBUS_GFS_CMD_CKSM:
+        arg = cmd_info->cksm_alg;
+        record.offset = cmd_info->cksm_offset;
+        record.length = cmd_info->cksm_length;
+        break;
+      case GLOBUS_GFS_CMD_TRNC:
+        record.offset = cmd_info->cksm_offset;
+        break;
+      case GLOBUS_GFS_CMD_RNTO:
+        arg = cmd_info->rnfr_pathname;
+        break;
+      case GLOBUS_GFS_CMD_SITE_CHMOD:
+        record.offset = cmd_info->chmod_mode;
+        break;
+      case GLOBUS_GFS_CMD_SITE_CHGRP:
+        arg = cmd_info->chgrp_group;
+        break;
+      case GLOBUS_GFS_CMD_SITE_UTIME:
+        record.offset = cmd_info->utime_time;
+        break;
+      case GLOBUS_GFS_CMD_SITE_SYMLINK:
+        arg = cmd_info->from_pathname;
+        break;
+    }
+    globus_l_gfs_posix_trace_write(&record, pathname, arg, NULL);
+}
+
+/* after the handle is set up for the transfer */
+static
+void
+globus_l_gfs_posix_trace_transfer(
+    globus_l_gfs_posix_handle_t *       posix_handle,
+    int                                 type,
+    globus_gfs_transfer_info_t *        transfer_info)
+{
+    globus_l_gfs_posix_trace_record_t   record;
+    int                                 concurrency;
+
+    if (! globus_l_gfs_posix_trace_on()) return;
+    memset(&record, 0, sizeof(record));
+    record.type = type;
+    record.session = (uintptr_t) posix_handle;
+    record.id = (uintptr_t) posix_handle->op;
+    record.block_size = posix_handle->block_size;
+    globus_gridftp_server_get_optimal_concurrency(posix_handle->op,
+                                                  &concurrency);
+    record.concurrency = concurrency;
+    record.offset = transfer_info->partial_offset;
+    record.length = transfer_info->partial_length;
+    record.size = transfer_info->alloc_size;
+    globus_l_gfs_posix_trace_write(&record, posix_handle->pathname, NULL,
+                                   transfer_info->range_list);
+}
+
+/* id is the op, or the handle for the end of a session */
+static
+void
+globus_l_gfs_posix_trace_end(
+    void *                              id,
+    globus_result_t                     result,
+    globus_off_t                        size,
+    int                                 flags)
+{
+    globus_l_gfs_posix_trace_record_t   record;
+
+    if (! globus_l_gfs_posix_trace_on()) return;
+    memset(&record, 0, sizeof(record));
+    record.type = GLOBUS_L_GFS_POSIX_TRACE_END;
+    record.flags = flags;
+    if (result != GLOBUS_SUCCESS)
+    {
+        record.flags |= GLOBUS_L_GFS_POSIX_TRACE_FAILED;
+    }
+    record.id = (uintptr_t) id;
+    record.size = size;
+    globus_l_gfs_posix_trace_write(&record, NULL, NULL, NULL);
+}
+
+/*************************************************************************
+ *  start
+ *  -----
+ *  This function is called when a new session is initialized, ie a user 
+ *  connectes to the server.  This hook gives the dsi an oppertunity to
+ *  set internal state that will be threaded through to all other
+ *  function calls associated with this session.  And an oppertunity to
+ *  reject the user.
+ *
+ *  finished_info.info.session.session_arg should be set to an DSI
+ *  defined data structure.  This pointer will be passed as the void *
+ *  user_arg parameter to all other interface functions.
+ * 
+ *  NOTE: at nice wrapper function should exist that hides the details 
+ *        of the finished_info structure, but it currently does not.  
+ *        The DSI developer should jsut follow this template for now
+ ************************************************************************/
+static
+void
+globus_l_gfs_posix_start(
+    globus_gfs_operation_t              op,
+    globus_gfs_session_info_t *         session_info)
+{
+    globus_l_gfs_posix_handle_t *       posix_handle;
+    globus_gfs_finished_info_t          finished_info;
+    struct passwd *                     pw;
+
+    GlobusGFSName(globus_l_gfs_posix_start);
+
+    globus_gridftp_server_set_checksum_support(op,
+        "MD5:10;ADLER32:10;CRC32:10;SHA1:10;");
+
+    posix_handle = (globus_l_gfs_posix_handle_t *)
+        globus_malloc(sizeof(globus_l_gfs_posix_handle_t));
+
+    posix_handle->fd = 0;
+    posix_handle->admit.slot = -1;
+    posix_handle->admit.state = GLOBUS_L_GFS_POSIX_ADMIT_IDLE;
+    posix_handle->admit.cancelled = GLOBUS_FALSE;
+    posix_handle->username = (session_info->username != NULL ?
+                              strdup(session_info->username) : NULL);
+    globus_mutex_init(&posix_handle->mutex, NULL);
+    globus_cond_init(&posix_handle->cond, NULL);
+    globus_l_gfs_posix_buf_init();
+    globus_l_gfs_posix_shm_init();
+    globus_l_gfs_posix_backend_init(posix_handle);
+    posix_handle->backend = &globus_l_gfs_posix_backend_posix;
+    globus_l_gfs_posix_fdcache_init(posix_handle);
+    globus_l_gfs_posix_trace_init();
+    globus_l_gfs_posix_trace_session(posix_handle);
+
+    memset(&finished_info, '\0', sizeof(globus_gfs_finished_info_t));
+    finished_info.type = GLOBUS_GFS_OP_SESSION_START;
+    finished_info.result = GLOBUS_SUCCESS;
+    finished_info.info.session.session_arg = posix_handle;
+    finished_info.info.session.username = session_info->username;
+    pw = getpwuid(getuid());
+    finished_info.info.session.home_dir = pw->pw_dir;
+
+    globus_gridftp_server_operation_finished(
+        op, GLOBUS_SUCCESS, &finished_info);
+}
+
+static
+void
+globus_l_gfs_posix_close_fds(
+    globus_l_gfs_posix_handle_t *       posix_handle);
+
+/*************************************************************************
+ *  destroy
+ *  -------
+ *  This is called when a session ends, ie client quits or disconnects.
+ *  The dsi should clean up all memory they associated wit the session
+ *  here. 
+ ************************************************************************/
+static
+void
+globus_l_gfs_posix_destroy(
+    void *                              user_arg)
+{
+    globus_l_gfs_posix_handle_t *       posix_handle;
+    globus_bool_t                       queued;
+
+    posix_handle = (globus_l_gfs_posix_handle_t *) user_arg;
+
+    globus_l_gfs_posix_trace_end(posix_handle, GLOBUS_SUCCESS, 0, 0);
+    globus_mutex_lock(&posix_handle->mutex);
+    posix_handle->admit.cancelled = GLOBUS_TRUE;
+    queued = globus_l_gfs_posix_admit_cancel(posix_handle);
+    globus_mutex_unlock(&posix_handle->mutex);
+    if (queued)
+    {
+        /* the transfer never started, its files are still open */
+        globus_l_gfs_posix_close_fds(posix_handle);
+    }
+    globus_l_gfs_posix_admit_release(&posix_handle->admit);
+    globus_l_gfs_posix_fdcache_destroy(posix_handle);
+    globus_cond_destroy(&posix_handle->cond);
+    globus_mutex_destroy(&posix_handle->mutex);
+    free(posix_handle->username);
+    globus_free(posix_handle);
+}
+
+/*************************************************************************
+ *  stat
+ *  ----
+ *  This interface function is called whenever the server needs 
+ *  information about a given file or resource.  It is called then an
+ *  LIST is sent by the client, when the server needs to verify that 
+ *  a file exists and has the proper permissions, etc.
+ ************************************************************************/
+/*
+static
+void
+globus_l_gfs_posix_stat(
+    globus_gfs_operation_t              op,
+    globus_gfs_stat_info_t *            stat_info,
+    void *                              user_arg)
+{
+    globus_gfs_stat_t                   stat_array[1];
+    int                                 stat_count = 1;
+    globus_l_gfs_posix_handle_t *      posix_handle;
+    struct stat                         statbuf; 
+    globus_result_t                     rc;
+
+    GlobusGFSName(globus_l_gfs_posix_stat);
+
+    posix_handle = (globus_l_gfs_posix_handle_t *) user_arg;
+    if (stat(PathName, &statbuf) == 0)    
+    {
+        stat_array[0].mode = statbuf.st_mode;
+        stat_array[0].nlink = statbuf.st_nlink;
+        stat_array[0].uid = statbuf.st_uid;
+        stat_array[0].gid = statbuf.st_gid;
+        stat_array[0].size = statbuf.st_size;
+        stat_array[0].mtime = statbuf.st_mtime;
+        stat_array[0].atime = statbuf.st_atime;
+        stat_array[0].ctime = statbuf.st_ctime;
+        stat_array[0].dev = statbuf.st_dev;
+        stat_array[0].ino = statbuf.st_ino;
+
+        globus_gridftp_server_finished_stat(
+            op, GLOBUS_SUCCESS, stat_array, stat_count);
+    }
+    else
+    {
+        rc = GlobusGFSErrorGeneric("stat() fail");
+        globus_gridftp_server_finished_stat(op, rc, NULL, 0);
+    }
+}
+*/
+
+void
+globus_l_gfs_file_copy_stat(
+    globus_gfs_stat_t *                 stat_object,
+    struct stat *                       stat_buf,
+    const char *                        filename,
+    const char *                        symlink_target)
+{
+    GlobusGFSName(globus_l_gfs_file_copy_stat);
+
+    stat_object->mode     = stat_buf->st_mode;
+    stat_object->nlink    = stat_buf->st_nlink;
+    stat_object->uid      = stat_buf->st_uid;
+    stat_object->gid      = stat_buf->st_gid;
+    stat_object->size     = stat_buf->st_size;
+    stat_object->mtime    = stat_buf->st_mtime;
+    stat_object->atime    = stat_buf->st_atime;
+    stat_object->ctime    = stat_buf->st_ctime;
+    stat_object->dev      = stat_buf->st_dev;
+    stat_object->ino      = stat_buf->st_ino;
+
+    if(filename && *filename)
+    {
+        stat_object->name = strdup(filename);
+    }
+    else
+    {
+        stat_object->name = NULL;
+    }
+    if(symlink_target && *symlink_target)
+    {
+        stat_object->symlink_target = strdup(symlink_target);
+    }
+    else
+    {
+        stat_object->symlink_target = NULL;
+    }
+}
+
+static
+void
+globus_l_gfs_file_destroy_stat(
+    globus_gfs_stat_t *                 stat_array,
+    int                                 stat_count)
+{
+    int                                 i;
+    GlobusGFSName(globus_l_gfs_file_destroy_stat);
+
+    for(i = 0; i < stat_count; i++)
+    {
+        if(stat_array[i].name != NULL)
+        {
+            globus_free(stat_array[i].name);
+        }
+        if(stat_array[i].symlink_target != NULL)
+        {
+            globus_free(stat_array[i].symlink_target);
+        }
+    }
+    globus_free(stat_array);
+}
+
+/* basepath and filename must be MAXPATHLEN long
+ * the pathname may be absolute or relative, basepath will be the same */
+static
+void
+globus_l_gfs_file_partition_path(
+    const char *                        pathname,
+    char *                              basepath,
+    char *                              filename)
+{
+    char                                buf[MAXPATHLEN];
+    char *                              filepart;
+    GlobusGFSName(globus_l_gfs_file_partition_path);
+
+    strncpy(buf, pathname, MAXPATHLEN);
+    buf[MAXPATHLEN - 1] = '\0';
+
+    filepart = strrchr(buf, '/');
+    while(filepart && !*(filepart + 1) && filepart != buf)
+    {
+        *filepart = '\0';
+        filepart = strrchr(buf, '/');
+    }
+
+    if(!filepart)
+    {
+        strcpy(filename, buf);
+        basepath[0] = '\0';
+    }
+    else
+    {
+        if(filepart == buf)
+        {
+            if(!*(filepart + 1))
+            {
+                basepath[0] = '\0';
+                filename[0] = '/';
+                filename[1] = '\0';
+            }
+            else
+            {
+                *filepart++ = '\0';
+                basepath[0] = '/';
+                basepath[1] = '\0';
+                strcpy(filename, filepart);
+            }
+        }
+        else
+        {
+            *filepart++ = '\0';
+            strcpy(basepath, buf);
+            strcpy(filename, filepart);
+        }
+    }
+}
+
+
+static
+void
+globus_l_gfs_posix_stat(
+    globus_gfs_operation_t              op,
+    globus_gfs_stat_info_t *            stat_info,
+    void *                              user_arg)
+{
+    globus_result_t                     result;
+    struct stat                         stat_buf;
+    globus_gfs_stat_t *                 stat_array;
+    int                                 stat_count = 0;
+    DIR *                               dir;
+    char                                basepath[MAXPATHLEN];
+    char                                filename[MAXPATHLEN];
+    char                                symlink_target[MAXPATHLEN];
+    char *                              PathName;
+    const globus_l_gfs_posix_backend_t * backend;
+    double                              t_probe;
+    globus_off_t                        trace_size = 0;
+    int                                 trace_flags = 0;
+    GlobusGFSName(globus_l_gfs_posix_stat);
+    PathName=stat_info->pathname;
+
+   /* 
+      If we do stat_info->pathname++, it will cause third-party transfer
+      hanging if there is a leading // in path. Don't know why. To work
+      around, we replaced it with PathName.
+   */
+    while (PathName[0] == '/' && PathName[1] == '/')
+    {
+        PathName++;
+    }
+    
+    globus_l_gfs_posix_trace_stat((globus_l_gfs_posix_handle_t *) user_arg,
+                                  op, stat_info, PathName);
+    GLOBUS_L_GFS_POSIX_PROBE1(stat_entry, PathName);
+    t_probe = (GLOBUS_L_GFS_POSIX_ENABLED(readdir_return) ?
+               GLOBUS_L_GFS_POSIX_CLOCK(readdir_return) :
+               GLOBUS_L_GFS_POSIX_CLOCK(stat_return));
+    backend = globus_l_gfs_posix_backend_select(
+        (globus_l_gfs_posix_handle_t *) user_arg, PathName);
+
+    /* lstat is the same as stat when not operating on a link, the other
+       backends have neither links nor directories */
+    if((backend == &globus_l_gfs_posix_backend_posix ?
+        lstat(PathName, &stat_buf) :
+        backend->stat(PathName, &stat_buf)) != 0)
+    {
+        result = GlobusGFSErrorSystemError("stat", errno);
+        goto error_stat1;
+    }
+    /* if this is a link we still need to stat to get the info we are 
+        interested in and then use realpath() to get the full path of 
+        the symlink target */
+    *symlink_target = '\0';
+    if(S_ISLNK(stat_buf.st_mode))
+    {
+        if(stat(PathName, &stat_buf) != 0)
+        {
+            result = GlobusGFSErrorSystemError("stat", errno);
+            goto error_stat1;
+        }
+        if(realpath(PathName, symlink_target) == NULL)
+        {
+            result = GlobusGFSErrorSystemError("realpath", errno);
+            goto error_stat1;
+        }
+    }    
+    globus_l_gfs_file_partition_path(PathName, basepath, filename);
+    
+    if(!S_ISDIR(stat_buf.st_mode) || stat_info->file_only)
+    {
+        stat_array = (globus_gfs_stat_t *)
+            globus_malloc(sizeof(globus_gfs_stat_t));
+        if(!stat_array)
+        {
+            result = GlobusGFSErrorMemory("stat_array");
+            goto error_alloc1;
+        }
+        
+        globus_l_gfs_file_copy_stat(
+            stat_array, &stat_buf, filename, symlink_target);
+        stat_count = 1;
+        trace_size = stat_buf.st_size;
+        if (S_ISDIR(stat_buf.st_mode))
+        {
+            trace_flags = GLOBUS_L_GFS_POSIX_TRACE_DIR;
+        }
+        globus_l_gfs_posix_prefetch((globus_l_gfs_posix_handle_t *) user_arg,
+                                    backend, PathName, &stat_buf);
+    }
+    else
+    {
+        struct dirent *                 dir_entry;
+        int                             i;
+        char                            dir_path[MAXPATHLEN];
+    
+        GLOBUS_L_GFS_POSIX_PROBE1(readdir_entry, PathName);
+        dir = opendir(PathName);
+        if(!dir)
+        {
+            result = GlobusGFSErrorSystemError("opendir", errno);
+            goto error_open;
+        }
+        
+        stat_count = 0;
+        while(globus_libc_readdir_r(dir, &dir_entry) == 0 && dir_entry)  
+        {
+            stat_count++;
+            globus_free(dir_entry);
+        }
+        
+        rewinddir(dir);
+        
+        stat_array = (globus_gfs_stat_t *)
+            globus_malloc(sizeof(globus_gfs_stat_t) * stat_count);
+        if(!stat_array)
+        {
+            result = GlobusGFSErrorMemory("stat_array");
+            goto error_alloc2;
+        }
+
+        snprintf(dir_path, sizeof(dir_path), "%s/%s", basepath, filename);
+        dir_path[MAXPATHLEN - 1] = '\0';
+        
+        for(i = 0;
+            globus_libc_readdir_r(dir, &dir_entry) == 0 && dir_entry;  
+            i++)
+        {
+            char                        tmp_path[MAXPATHLEN];
+            char                        *path;
+                
+            snprintf(tmp_path, sizeof(tmp_path), "%s/%s", dir_path, dir_entry->d_name);
+            tmp_path[MAXPATHLEN - 1] = '\0';
+            path=tmp_path;
+        
+            /* function globus_l_gfs_file_partition_path() seems to add two 
+               extra '/'s to the beginning of tmp_path. XROOTD is sensitive 
+               to the extra '/'s not defined in XROOTD_VMP so we remove them */
+            if (path[0] == '/' && path[1] == '/') { path++; }
+            while (path[0] == '/' && path[1] == '/') { path++; }
+            /* lstat is the same as stat when not operating on a link */
+            if(lstat(path, &stat_buf) != 0)
+            {
+                result = GlobusGFSErrorSystemError("lstat", errno);
+                globus_free(dir_entry);
+                /* just skip invalid entries */
+                stat_count--;
+                i--;
+                continue;
+            }
+            /* if this is a link we still need to stat to get the info we are 
+                interested in and then use realpath() to get the full path of 
+                the symlink target */
             *symlink_target = '\0';
             if(S_ISLNK(stat_buf.st_mode))
             {
-                if(stat(path, &stat_buf) != 0)
-                {
-                    result = GlobusGFSErrorSystemError("stat", errno);
-                    globus_free(dir_entry);
-                    /* just skip invalid entries */
-                    stat_count--;
-                    i--;
-                    continue;
-                }
-                if(realpath(path, symlink_target) == NULL)
-                {
-                    result = GlobusGFSErrorSystemError("realpath", errno);
-                    globus_free(dir_entry);
-                    /* just skip invalid entries */
-                    stat_count--;
-                    i--;
-                    continue;
-                }
-            }    
-            globus_l_gfs_file_copy_stat(
-                &stat_array[i], &stat_buf, dir_entry->d_name, symlink_target);
-            globus_free(dir_entry);
+                if(stat(path, &stat_buf) != 0)
+                {
+                    result = GlobusGFSErrorSystemError("stat", errno);
+                    globus_free(dir_entry);
+                    /* just skip invalid entries */
+                    stat_count--;
+                    i--;
+                    continue;
+                }
+                if(realpath(path, symlink_target) == NULL)
+                {
+                    result = GlobusGFSErrorSystemError("realpath", errno);
+                    globus_free(dir_entry);
+                    /* just skip invalid entries */
+                    stat_count--;
+                    i--;
+                    continue;
+                }
+            }    
+            globus_l_gfs_file_copy_stat(
+                &stat_array[i], &stat_buf, dir_entry->d_name, symlink_target);
+            globus_free(dir_entry);
+        }
+        
+        if(i != stat_count)
+        {
+            result = GlobusGFSErrorSystemError("readdir", errno);
+            goto error_read;
+        }
+        
+        closedir(dir);
+        GLOBUS_L_GFS_POSIX_PROBE3(readdir_return, PathName, stat_count,
+                                  GLOBUS_L_GFS_POSIX_USEC(t_probe));
+        trace_size = stat_count;
+        trace_flags = GLOBUS_L_GFS_POSIX_TRACE_DIR;
+    }
+    
+    GLOBUS_L_GFS_POSIX_PROBE3(stat_return, PathName, stat_count,
+                              GLOBUS_L_GFS_POSIX_USEC(t_probe));
+    globus_l_gfs_posix_trace_end(op, GLOBUS_SUCCESS, trace_size, trace_flags);
+    globus_gridftp_server_finished_stat(
+        op, GLOBUS_SUCCESS, stat_array, stat_count);
+    
+    
+    globus_l_gfs_file_destroy_stat(stat_array, stat_count);
+    
+    return;
+
+error_read:
+    globus_l_gfs_file_destroy_stat(stat_array, stat_count);
+    
+error_alloc2:
+    closedir(dir);
+    
+error_open:
+error_alloc1:
+error_stat1:
+    GLOBUS_L_GFS_POSIX_PROBE3(stat_return, PathName, -1,
+                              GLOBUS_L_GFS_POSIX_USEC(t_probe));
+    globus_l_gfs_posix_trace_end(op, result, 0, 0);
+    globus_gridftp_server_finished_stat(op, result, NULL, 0);
+
+/*    GlobusGFSFileDebugExitWithError();  */
+}
+
+/* recursively delete a directory */
+static
+globus_result_t
+globus_l_gfs_file_delete_dir(
+    const char *                        pathname)
+{
+
+    globus_result_t                     result;
+    int                                 rc;
+    DIR *                               dir;
+    struct stat                         stat_buf;
+    struct dirent *                     dir_entry;
+    int                                 i;
+    char                                path[MAXPATHLEN];
+    GlobusGFSName(globus_l_gfs_file_delete_dir);
+    GlobusGFSFileDebugEnter();
+    
+    /* lstat is the same as stat when not operating on a link */
+    if(lstat(pathname, &stat_buf) != 0)
+    {
+        result = GlobusGFSErrorSystemError("stat", errno);
+        goto error_stat;
+    }
+    
+    if(!S_ISDIR(stat_buf.st_mode))
+    {
+        /* remove anything that isn't a dir -- don't follow links */
+        rc = unlink(pathname);       
+        if(rc != 0)
+        {
+            result = GlobusGFSErrorSystemError("unlink", errno);
+            goto error_unlink1;
+        }
+    }
+    else
+    {
+        dir = globus_libc_opendir(pathname);
+        if(!dir)
+        {
+            result = GlobusGFSErrorSystemError("opendir", errno);
+            goto error_open;
+        }
+        
+        for(i = 0;
+            globus_libc_readdir_r(dir, &dir_entry) == 0 && dir_entry;
+            i++)
+        {   
+            if(dir_entry->d_name[0] == '.' && 
+                (dir_entry->d_name[1] == '\0' || 
+                (dir_entry->d_name[1] == '.' && dir_entry->d_name[2] == '\0')))
+            {
+                globus_free(dir_entry);
+                continue;
+            }
+            snprintf(path, sizeof(path), "%s/%s", pathname, dir_entry->d_name);
+            path[MAXPATHLEN - 1] = '\0';
+              
+            /* lstat is the same as stat when not operating on a link */
+            if(lstat(path, &stat_buf) != 0)
+            {
+                result = GlobusGFSErrorSystemError("lstat", errno);
+                globus_free(dir_entry);
+                /* just skip invalid entries */
+                continue;
+            }
+            
+            if(!S_ISDIR(stat_buf.st_mode))
+            {
+                /* remove anything that isn't a dir -- don't follow links */
+                rc = unlink(path);       
+                if(rc != 0)
+                {
+                    result = GlobusGFSErrorSystemError("unlink", errno);
+                    goto error_unlink2;
+                }
+            }
+            else
+            {
+                result = globus_l_gfs_file_delete_dir(path);
+                if(result != GLOBUS_SUCCESS)
+                {
+                    goto error_recurse;
+                }
+            }
+
+            globus_free(dir_entry);
+        }
+
+        closedir(dir);
+        rc = rmdir(pathname);
+        if(rc != 0)
+        {
+            result = GlobusGFSErrorSystemError("rmdir", errno);
+            goto error_rmdir;
+        }
+    } 
+    
+    GlobusGFSFileDebugExit();
+    return GLOBUS_SUCCESS;
+
+error_recurse:
+error_unlink2:
+        closedir(dir);
+        globus_free(dir_entry);
+error_open: 
+error_stat:
+error_unlink1:
+error_rmdir:    
+    GlobusGFSFileDebugExitWithError();
+    return result; 
+}
+
+/* change group */
+static
+globus_result_t
+globus_l_gfs_posix_chgrp(
+    const char *                        pathname,
+    const char *                        group)
+{
+    int                                 rc;
+    globus_result_t                     result;
+    struct group *                      grp_info;
+    int                                 grp_id;
+    char*                               endpt;
+
+    GlobusGFSName(globus_l_gfs_posix_chgrp);
+
+    grp_info = getgrnam(group);
+    if(grp_info != NULL)
+    {
+        grp_id = grp_info->gr_gid;
+    }
+    else 
+    {
+        grp_id = strtol(group, &endpt, 10);
+        if(*group == '\0' || *endpt != '\0') 
+        {
+            errno = EPERM;
+            return GLOBUS_FAILURE; 
+        }
+    }
+    if(grp_id < 0) {
+	errno = EPERM;
+        return GLOBUS_FAILURE;
+    }
+    if (chown(pathname, -1, grp_id) != 0) return GLOBUS_FAILURE;
+    return GLOBUS_SUCCESS;
+}
+
+/*************************************************************************
+ * Checksum engine
+ *
+ * One read pass over the file feeds every algorithm in the job: the one
+ * the client asked for plus those in GRIDFTP_POSIX_CKSM_ALGS, so asking
+ * for another digest of the same file later costs no storage reads.
+ * With GRIDFTP_POSIX_CKSM_XATTR, digests of whole files are stored in
+ * user.gridftp.<alg> xattrs, together with the file's mtime, size and
+ * inode, and CKSM is answered from them for as long as none of these
+ * change. Uploads over an existing file, TRNC and UTIME remove them, as
+ * the mtime alone does not show that the content changed.
+ *
+ * Jobs are queued to a pool of GRIDFTP_POSIX_CKSM_WORKERS threads per
+ * process that run at low CPU and I/O priority, so a burst of checksums
+ * does not take the storage away from transfers. A request for a file
+ * and range that is already queued or running joins that job instead of
+ * reading the file again. GRIDFTP_POSIX_CKSM_NODE caps the checksums
+ * running at once on the node, using the admission slots.
+ *
+ * The workers are threads of our own, which globus knows nothing of
+ * (without -threads its locks do nothing), so they only read and hash.
+ * Finished jobs go on a done list, and the replies and progress markers
+ * are sent from a globus callback that polls it while jobs are pending.
+ ************************************************************************/
+
+#define GLOBUS_L_GFS_POSIX_CKSM_ADLER32 0
+#define GLOBUS_L_GFS_POSIX_CKSM_MD5     1
+#define GLOBUS_L_GFS_POSIX_CKSM_CRC32   2
+#define GLOBUS_L_GFS_POSIX_CKSM_SHA1    3
+#define GLOBUS_L_GFS_POSIX_CKSM_NALGS   4
+#define GLOBUS_L_GFS_POSIX_CKSM_LEN     (2 * SHA_DIGEST_LENGTH + 1)
+#define GLOBUS_L_GFS_POSIX_CKSM_XATTR   "user.gridftp."
+#define GLOBUS_L_GFS_POSIX_IOPRIO_IDLE  (3 << 13)
+#define GLOBUS_L_GFS_POSIX_IOPRIO_LOW   ((2 << 13) | 7)
+#define GLOBUS_L_GFS_POSIX_CKSM_POLL    10000
+#define GLOBUS_L_GFS_POSIX_CKSM_MARKERS 64
+
+static const char * globus_l_gfs_posix_cksm_names[] =
+{
+    "adler32", "md5", "crc32", "sha1"
+};
+
+/* a request waiting for a job */
+typedef struct globus_l_gfs_posix_cksm_waiter_s
+{
+    struct globus_l_gfs_posix_cksm_waiter_s * next;
+    globus_gfs_operation_t             op;
+    int                                alg;
+    int                                marker_freq;
+    time_t                             t_lastmarker;
+} globus_l_gfs_posix_cksm_waiter_t;
+
+typedef struct globus_l_gfs_posix_cksm_job_s
+{
+    struct globus_l_gfs_posix_cksm_job_s * next;
+    globus_l_gfs_posix_cksm_waiter_t * waiters;
+    char *                             pathname;
+    globus_bool_t                      started;
+    int                                algs;
+    globus_bool_t                      store;
+    struct stat                        st;
+    uLong                              adler;
+    uLong                              crc;
+    MD5_CTX                            md5;
+    SHA_CTX                            sha1;
+    globus_off_t                       offset;
+    globus_off_t                       length;
+    globus_off_t                       total_bytes;
+    globus_off_t                       progress;
+    globus_bool_t                      unlimited;
+    int                                err;
+    char                               digests[GLOBUS_L_GFS_POSIX_CKSM_NALGS]
+                                              [GLOBUS_L_GFS_POSIX_CKSM_LEN];
+} globus_l_gfs_posix_cksm_job_t;
+
+#define MAXBLOCSIZE4CKSM 4*1024*1024
+
+static struct
+{
+    pthread_mutex_t                    mutex;
+    pthread_cond_t                     cond;
+    globus_l_gfs_posix_cksm_job_t *    jobs;
+    globus_l_gfs_posix_cksm_job_t *    done;
+    globus_bool_t                      polling;
+    int                                workers;
+    int                                idle;
+} globus_l_gfs_posix_cksm_sched =
+{
+    PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, NULL, NULL,
+    GLOBUS_FALSE, 0, 0
+};
+
+static
+int
+globus_l_gfs_posix_cksm_alg(
+    const char *                       name)
+{
+    int                                i;
+
+    for (i = 0; i < GLOBUS_L_GFS_POSIX_CKSM_NALGS; i++)
+    {
+        if (strcasecmp(name, globus_l_gfs_posix_cksm_names[i]) == 0)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* hex digest of alg, the job's contexts are finalized */
+static
+void
+globus_l_gfs_posix_cksm_format(
+    globus_l_gfs_posix_cksm_job_t *    job,
+    int                                alg,
+    char *                             out)
+{
+    unsigned char                      digest[SHA_DIGEST_LENGTH];
+    int                                len = 0;
+    int                                i;
+
+    switch (alg)
+    {
+      case GLOBUS_L_GFS_POSIX_CKSM_ADLER32:
+        sprintf(out, "%08lx", (unsigned long) job->adler);
+        return;
+      case GLOBUS_L_GFS_POSIX_CKSM_CRC32:
+        sprintf(out, "%08lx", (unsigned long) job->crc);
+        return;
+      case GLOBUS_L_GFS_POSIX_CKSM_MD5:
+        MD5_Final(digest, &job->md5);
+        len = MD5_DIGEST_LENGTH;
+        break;
+      case GLOBUS_L_GFS_POSIX_CKSM_SHA1:
+        SHA1_Final(digest, &job->sha1);
+        len = SHA_DIGEST_LENGTH;
+        break;
+    }
+    for (i = 0; i < len; i++)
+    {
+        sprintf(&out[i * 2], "%02x", (unsigned int) digest[i]);
+    }
+    out[len * 2] = '\0';
+}
+
+/* a stored digest of alg that is still valid for the file in st */
+static
+globus_bool_t
+globus_l_gfs_posix_cksm_cached(
+    const char *                       filename,
+    int                                alg,
+    const struct stat *                st,
+    char *                             out)
+{
+    char                               name[64];
+    char                               value[128];
+    ssize_t                            len;
+    long                               sec;
+    long                               nsec;
+    long long                          size;
+    unsigned long long                 ino;
+
+    snprintf(name, sizeof(name), GLOBUS_L_GFS_POSIX_CKSM_XATTR "%s",
+             globus_l_gfs_posix_cksm_names[alg]);
+    len = getxattr(filename, name, value, sizeof(value) - 1);
+    if (len <= 0) return GLOBUS_FALSE;
+    value[len] = '\0';
+    if (sscanf(value, "%40s %ld.%ld %lld %llu", out, &sec, &nsec, &size,
+               &ino) != 5 ||
+        sec != (long) st->st_mtim.tv_sec || nsec != st->st_mtim.tv_nsec ||
+        size != (long long) st->st_size ||
+        ino != (unsigned long long) st->st_ino)
+    {
+        return GLOBUS_FALSE;
+    }
+    return GLOBUS_TRUE;
+}
+
+/* the content of filename may change, drop its stored digests */
+static
+void
+globus_l_gfs_posix_cksm_forget(
+    const char *                       filename)
+{
+    char                               name[64];
+    int                                i;
+
+    for (i = 0; i < GLOBUS_L_GFS_POSIX_CKSM_NALGS; i++)
+    {
+        snprintf(name, sizeof(name), GLOBUS_L_GFS_POSIX_CKSM_XATTR "%s",
+                 globus_l_gfs_posix_cksm_names[i]);
+        if (removexattr(filename, name) != 0 &&
+            (errno == ENOTSUP || errno == ENOENT))
+        {
+            /* no xattrs here, or no file */
+            break;
+        }
+    }
+}
+
+/* keep the digests of a whole file, unless it changed while we read it */
+static
+void
+globus_l_gfs_posix_cksm_store(
+    globus_l_gfs_posix_cksm_job_t *    job,
+    int                                fd)
+{
+    struct stat                        st;
+    char                               name[64];
+    char                               value[128];
+    int                                i;
+
+    if (fstat(fd, &st) != 0 ||
+        st.st_mtim.tv_sec != job->st.st_mtim.tv_sec ||
+        st.st_mtim.tv_nsec != job->st.st_mtim.tv_nsec ||
+        st.st_size != job->st.st_size || st.st_ino != job->st.st_ino)
+    {
+        return;
+    }
+    for (i = 0; i < GLOBUS_L_GFS_POSIX_CKSM_NALGS; i++)
+    {
+        if (! (job->algs & (1 << i))) continue;
+        snprintf(name, sizeof(name), GLOBUS_L_GFS_POSIX_CKSM_XATTR "%s",
+                 globus_l_gfs_posix_cksm_names[i]);
+        snprintf(value, sizeof(value), "%s %ld.%09ld %lld %llu",
+                 job->digests[i], (long) st.st_mtim.tv_sec,
+                 (long) st.st_mtim.tv_nsec, (long long) st.st_size,
+                 (unsigned long long) st.st_ino);
+        if (fsetxattr(fd, name, value, strlen(value), 0) != 0)
+        {
+            break;
+        }
+    }
+}
+
+/* checksum workers run below the transfers */
+static
+void
+globus_l_gfs_posix_cksm_priority(void)
+{
+    struct sched_param                 param;
+    char *                             env;
+
+    env = getenv("GRIDFTP_POSIX_CKSM_PRIORITY");
+    if (env != NULL && strcmp(env, "normal") == 0) return;
+    if (env != NULL && strcmp(env, "idle") == 0)
+    {
+        memset(&param, 0, sizeof(param));
+        pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
+        syscall(SYS_ioprio_set, 1, 0, GLOBUS_L_GFS_POSIX_IOPRIO_IDLE);
+    }
+    else
+    {
+        /* nice and ioprio of 0 are the calling thread on Linux */
+        setpriority(PRIO_PROCESS, 0, 19);
+        syscall(SYS_ioprio_set, 1, 0, GLOBUS_L_GFS_POSIX_IOPRIO_LOW);
+    }
+}
+
+/*
+ * Progress markers to the requests of running jobs that are due one, from
+ * the poll callback. They are sent after the lock is dropped, at most
+ * GLOBUS_L_GFS_POSIX_CKSM_MARKERS per poll; the rest are due at the next.
+ */
+static
+void
+globus_l_gfs_posix_cksm_markers(void)
+{
+    globus_l_gfs_posix_cksm_job_t *    job;
+    globus_l_gfs_posix_cksm_waiter_t * waiter;
+    globus_gfs_operation_t             ops[GLOBUS_L_GFS_POSIX_CKSM_MARKERS];
+    globus_off_t                       bytes[GLOBUS_L_GFS_POSIX_CKSM_MARKERS];
+    char                               count[128];
+    time_t                             t;
+    int                                n = 0;
+    int                                i;
+
+    t = time(NULL);
+    pthread_mutex_lock(&globus_l_gfs_posix_cksm_sched.mutex);
+    for (job = globus_l_gfs_posix_cksm_sched.jobs; job != NULL;
+         job = job->next)
+    {
+        if (! job->started) continue;
+        for (waiter = job->waiters;
+             waiter != NULL && n < GLOBUS_L_GFS_POSIX_CKSM_MARKERS;
+             waiter = waiter->next)
+        {
+            if ( (t - waiter->t_lastmarker) > waiter->marker_freq )
+            {
+                waiter->t_lastmarker = t;
+                ops[n] = waiter->op;
+                bytes[n++] = job->progress;
+            }
+        }
+    }
+    pthread_mutex_unlock(&globus_l_gfs_posix_cksm_sched.mutex);
+    for (i = 0; i < n; i++)
+    {
+        sprintf(count, "%"GLOBUS_OFF_T_FORMAT, bytes[i]);
+        globus_gridftp_server_intermediate_command(ops[i], GLOBUS_SUCCESS,
+                                                   count);
+    }
+}
+
+/* read the file once for all the algorithms of the job, errno or 0 */
+static
+int
+globus_l_gfs_posix_cksm_run(
+    globus_l_gfs_posix_cksm_job_t *    job,
+    char *                             buffer)
+{
+    globus_l_gfs_posix_admit_t         admit;
+    globus_off_t                       readlen;
+    globus_off_t                       offset;
+    globus_off_t                       length;
+    double                             t_probe;
+    int                                cached = 0;
+    int                                err = 0;
+    int                                fd;
+    int                                i;
+
+    admit.slot = -1;
+    admit.unlimited = GLOBUS_FALSE;
+    admit.limit = globus_l_gfs_posix_getenv_int("GRIDFTP_POSIX_CKSM_NODE", 0);
+    if (globus_l_gfs_posix_shm != NULL && admit.limit > 0)
+    {
+        strcpy(admit.key, "cksm");
+        while (! globus_l_gfs_posix_admit_check(&admit))
+        {
+            usleep(100000);
+        }
+        job->unlimited = admit.unlimited;
+    }
+
+    /* another process may have done it while we waited */
+    for (i = 0; job->store && i < GLOBUS_L_GFS_POSIX_CKSM_NALGS; i++)
+    {
+        if ((job->algs & (1 << i)) &&
+            globus_l_gfs_posix_cksm_cached(job->pathname, i, &job->st,
+                                           job->digests[i]))
+        {
+            cached |= 1 << i;
+        }
+    }
+    if (cached == job->algs)
+    {
+        globus_l_gfs_posix_admit_release(&admit);
+        return 0;
+    }
+
+    if ((fd = open(job->pathname, O_RDONLY)) < 0)
+    {
+        err = errno;
+        globus_l_gfs_posix_admit_release(&admit);
+        return err;
+    }
+    offset = job->offset;
+    length = job->length;
+    while (length > 0)
+    {
+        GLOBUS_L_GFS_POSIX_PROBE3(cksm_chunk_entry, job->pathname,
+            (long long) offset,
+            (long long) (length > MAXBLOCSIZE4CKSM ?
+                         MAXBLOCSIZE4CKSM : length));
+        t_probe = GLOBUS_L_GFS_POSIX_CLOCK(cksm_chunk_return);
+        readlen = pread(fd, buffer, ( length > MAXBLOCSIZE4CKSM ?
+                                      MAXBLOCSIZE4CKSM : length ), offset);
+        if (readlen < 0 && errno == EINTR) continue;
+        if (readlen <= 0)
+        {
+            /* an error, or the file shrank under us */
+            err = (readlen < 0 ? errno : EIO);
+            break;
+        }
+        offset += readlen;
+        length -= readlen;
+        job->total_bytes += readlen;
+
+        if (job->algs & (1 << GLOBUS_L_GFS_POSIX_CKSM_ADLER32))
+            job->adler = adler32(job->adler, (Bytef *) buffer, readlen);
+        if (job->algs & (1 << GLOBUS_L_GFS_POSIX_CKSM_CRC32))
+            job->crc = crc32(job->crc, (Bytef *) buffer, readlen);
+        if (job->algs & (1 << GLOBUS_L_GFS_POSIX_CKSM_MD5))
+            MD5_Update(&job->md5, buffer, readlen);
+        if (job->algs & (1 << GLOBUS_L_GFS_POSIX_CKSM_SHA1))
+            SHA1_Update(&job->sha1, buffer, readlen);
+        GLOBUS_L_GFS_POSIX_PROBE4(cksm_chunk_return, job->pathname,
+            (long long) (offset - readlen), (long long) readlen,
+            GLOBUS_L_GFS_POSIX_USEC(t_probe));
+
+        pthread_mutex_lock(&globus_l_gfs_posix_cksm_sched.mutex);
+        job->progress = job->total_bytes;
+        pthread_mutex_unlock(&globus_l_gfs_posix_cksm_sched.mutex);
+    }
+
+    if (err == 0)
+    {
+        for (i = 0; i < GLOBUS_L_GFS_POSIX_CKSM_NALGS; i++)
+        {
+            if (job->algs & (1 << i))
+            {
+                globus_l_gfs_posix_cksm_format(job, i, job->digests[i]);
+            }
+        }
+        if (job->store)
+        {
+            globus_l_gfs_posix_cksm_store(job, fd);
+        }
+    }
+    close(fd);
+    globus_l_gfs_posix_admit_release(&admit);
+    return err;
+}
+
+/* reply to every request of a finished job, from the poll callback */
+static
+void
+globus_l_gfs_posix_cksm_reply(
+    globus_l_gfs_posix_cksm_job_t *    job)
+{
+    globus_l_gfs_posix_cksm_waiter_t * waiter;
+    globus_result_t                    result;
+
+    GlobusGFSName(globus_l_gfs_posix_cksm_reply);
+
+    if (job->unlimited)
+    {
+        globus_gfs_log_message(GLOBUS_GFS_LOG_WARN,
+            "admission: all %d slots are taken, cksm went ahead "
+            "unlimited\n", GLOBUS_L_GFS_POSIX_MAX_STREAMS);
+    }
+    while ((waiter = job->waiters) != NULL)
+    {
+        job->waiters = waiter->next;
+        if (job->err != 0)
+        {
+            result = GlobusGFSErrorSystemError("checksum", job->err);
+            globus_l_gfs_posix_trace_end(waiter->op, result, 0, 0);
+            globus_gridftp_server_finished_command(waiter->op, result, NULL);
+        }
+        else
+        {
+            globus_l_gfs_posix_trace_end(waiter->op, GLOBUS_SUCCESS,
+                                         job->length, 0);
+            globus_gridftp_server_finished_command(waiter->op, GLOBUS_SUCCESS,
+                                                   job->digests[waiter->alg]);
+        }
+        globus_free(waiter);
+    }
+    free(job->pathname);
+    globus_free(job);
+}
+
+static
+void *
+globus_l_gfs_posix_cksm_worker(
+    void *                             arg)
+{
+    globus_l_gfs_posix_cksm_job_t *    job;
+    globus_l_gfs_posix_cksm_job_t **   prev;
+    char *                             buffer;
+    double                             t_job;
+    int                                err;
+
+    globus_l_gfs_posix_cksm_priority();
+    buffer = (char *) globus_l_gfs_posix_buf_alloc(MAXBLOCSIZE4CKSM);
+
+    pthread_mutex_lock(&globus_l_gfs_posix_cksm_sched.mutex);
+    for (;;)
+    {
+        for (job = globus_l_gfs_posix_cksm_sched.jobs;
+             job != NULL && job->started; job = job->next);
+        if (job == NULL)
+        {
+            globus_l_gfs_posix_cksm_sched.idle++;
+            pthread_cond_wait(&globus_l_gfs_posix_cksm_sched.cond,
+                              &globus_l_gfs_posix_cksm_sched.mutex);
+            globus_l_gfs_posix_cksm_sched.idle--;
+            continue;
+        }
+        job->started = GLOBUS_TRUE;
+        pthread_mutex_unlock(&globus_l_gfs_posix_cksm_sched.mutex);
+
+        GLOBUS_L_GFS_POSIX_PROBE2(cksm_job_entry, job->pathname,
+                                  (long long) job->offset);
+        t_job = GLOBUS_L_GFS_POSIX_CLOCK(cksm_job_return);
+        err = (buffer == NULL ? ENOMEM :
+               globus_l_gfs_posix_cksm_run(job, buffer));
+        GLOBUS_L_GFS_POSIX_PROBE2(cksm_job_return, job->pathname,
+                                  GLOBUS_L_GFS_POSIX_USEC(t_job));
+
+        /* no request can join it once it is off the list, the poll
+           callback replies */
+        pthread_mutex_lock(&globus_l_gfs_posix_cksm_sched.mutex);
+        for (prev = &globus_l_gfs_posix_cksm_sched.jobs; *prev != job;
+             prev = &(*prev)->next);
+        *prev = job->next;
+        job->err = err;
+        job->next = globus_l_gfs_posix_cksm_sched.done;
+        globus_l_gfs_posix_cksm_sched.done = job;
+    }
+    return NULL;
+}
+
+/*
+ * Replies and markers for the jobs, on a globus thread. Registered by
+ * the first request while none is pending, and polls until no job is
+ * queued, running or done.
+ */
+static
+void
+globus_l_gfs_posix_cksm_poll(
+    void *                             user_arg)
+{
+    globus_l_gfs_posix_cksm_job_t *    done;
+    globus_l_gfs_posix_cksm_job_t *    job;
+    globus_reltime_t                   delay;
+
+    pthread_mutex_lock(&globus_l_gfs_posix_cksm_sched.mutex);
+    done = globus_l_gfs_posix_cksm_sched.done;
+    globus_l_gfs_posix_cksm_sched.done = NULL;
+    pthread_mutex_unlock(&globus_l_gfs_posix_cksm_sched.mutex);
+    while ((job = done) != NULL)
+    {
+        done = job->next;
+        globus_l_gfs_posix_cksm_reply(job);
+    }
+    globus_l_gfs_posix_cksm_markers();
+
+    pthread_mutex_lock(&globus_l_gfs_posix_cksm_sched.mutex);
+    GlobusTimeReltimeSet(delay, 0, GLOBUS_L_GFS_POSIX_CKSM_POLL);
+    globus_l_gfs_posix_cksm_sched.polling =
+        ((globus_l_gfs_posix_cksm_sched.jobs != NULL ||
+          globus_l_gfs_posix_cksm_sched.done != NULL) &&
+         globus_callback_register_oneshot(NULL, &delay,
+             globus_l_gfs_posix_cksm_poll, NULL) == GLOBUS_SUCCESS);
+    pthread_mutex_unlock(&globus_l_gfs_posix_cksm_sched.mutex);
+}
+
+/* queue a request, joining a job for the same file and range if any */
+static
+globus_result_t
+globus_l_gfs_posix_cksm_submit(
+    globus_gfs_operation_t             op,
+    char *                             filename,
+    int                                alg,
+    const struct stat *                st,
+    globus_off_t                       offset,
+    globus_off_t                       length)
+{
+    globus_l_gfs_posix_cksm_job_t *    job;
+    globus_l_gfs_posix_cksm_job_t **   tail;
+    globus_l_gfs_posix_cksm_waiter_t * waiter;
+    pthread_t                          thread;
+    pthread_attr_t                     attr;
+    globus_reltime_t                   delay;
+    char                               algs[256];
+    char                               *token, *save, *env;
+    int                                max_workers;
+    int                                queued;
+    int                                i;
+
+    waiter = globus_malloc(sizeof(globus_l_gfs_posix_cksm_waiter_t));
+    if (waiter == NULL) return GLOBUS_FAILURE;
+    waiter->op = op;
+    waiter->alg = alg;
+    globus_gridftp_server_get_update_interval(op, &waiter->marker_freq);
+    waiter->t_lastmarker = time(NULL);
+
+    pthread_mutex_lock(&globus_l_gfs_posix_cksm_sched.mutex);
+    for (tail = &globus_l_gfs_posix_cksm_sched.jobs; (job = *tail) != NULL;
+         tail = &job->next)
+    {
+        if (job->st.st_dev == st->st_dev && job->st.st_ino == st->st_ino &&
+            job->st.st_mtim.tv_sec == st->st_mtim.tv_sec &&
+            job->st.st_mtim.tv_nsec == st->st_mtim.tv_nsec &&
+            job->offset == offset && job->length == length &&
+            (! job->started || (job->algs & (1 << alg))))
+        {
+            break;
+        }
+    }
+    if (job == NULL)
+    {
+        job = globus_malloc(sizeof(globus_l_gfs_posix_cksm_job_t));
+        if (job == NULL)
+        {
+            pthread_mutex_unlock(&globus_l_gfs_posix_cksm_sched.mutex);
+            globus_free(waiter);
+            return GLOBUS_FAILURE;
+        }
+        memset(job, 0, sizeof(globus_l_gfs_posix_cksm_job_t));
+        job->pathname = strdup(filename);
+        job->st = *st;
+        job->offset = offset;
+        job->length = length;
+        env = getenv("GRIDFTP_POSIX_CKSM_ALGS");
+        if (env != NULL)
+        {
+            strncpy(algs, env, sizeof(algs));
+            algs[sizeof(algs) - 1] = '\0';
+            for (token = strtok_r(algs, ",", &save); token != NULL;
+                 token = strtok_r(NULL, ",", &save))
+            {
+                while (*token == ' ') token++;
+                if ((i = globus_l_gfs_posix_cksm_alg(token)) >= 0)
+                {
+                    job->algs |= 1 << i;
+                }
+            }
+        }
+        /* only whole files are worth keeping */
+        job->store = (offset == 0 && length == st->st_size &&
+                      globus_l_gfs_posix_prefix_int(
+                          "GRIDFTP_POSIX_CKSM_XATTR", filename, 0));
+        job->adler = adler32(0L, Z_NULL, 0);
+        job->crc = crc32(0L, Z_NULL, 0);
+        MD5_Init(&job->md5);
+        SHA1_Init(&job->sha1);
+        *tail = job;
+    }
+    job->algs |= 1 << alg;
+    waiter->next = job->waiters;
+    job->waiters = waiter;
+
+    /* a woken worker stays idle until it runs, count the queue instead */
+    queued = 0;
+    for (job = globus_l_gfs_posix_cksm_sched.jobs; job != NULL;
+         job = job->next)
+    {
+        if (! job->started) queued++;
+    }
+    max_workers = globus_l_gfs_posix_getenv_int("GRIDFTP_POSIX_CKSM_WORKERS",
+                                                2);
+    /* past the memory budget, the workers there are take the queue */
+    if (queued > globus_l_gfs_posix_cksm_sched.idle &&
+        globus_l_gfs_posix_cksm_sched.workers < max_workers &&
+        (globus_l_gfs_posix_cksm_sched.workers == 0 ||
+         globus_l_gfs_posix_buf_room(MAXBLOCSIZE4CKSM)))
+    {
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        if (pthread_create(&thread, &attr, globus_l_gfs_posix_cksm_worker,
+                           NULL) == 0)
+        {
+            globus_l_gfs_posix_cksm_sched.workers++;
+        }
+        pthread_attr_destroy(&attr);
+    }
+    if (globus_l_gfs_posix_cksm_sched.workers == 0)
+    {
+        /* the job stays queued, but nobody would ever run it */
+        globus_gfs_log_message(GLOBUS_GFS_LOG_ERR,
+                               "cannot start a checksum worker\n");
+    }
+    if (! globus_l_gfs_posix_cksm_sched.polling)
+    {
+        GlobusTimeReltimeSet(delay, 0, GLOBUS_L_GFS_POSIX_CKSM_POLL);
+        globus_l_gfs_posix_cksm_sched.polling =
+            (globus_callback_register_oneshot(NULL, &delay,
+                 globus_l_gfs_posix_cksm_poll, NULL) == GLOBUS_SUCCESS);
+    }
+    pthread_cond_signal(&globus_l_gfs_posix_cksm_sched.cond);
+    pthread_mutex_unlock(&globus_l_gfs_posix_cksm_sched.mutex);
+    return GLOBUS_SUCCESS;
+}
+
+/* checksum of a file range, the reply is sent when done */
+static
+globus_result_t 
+globus_l_gfs_posix_cksm(
+    globus_gfs_operation_t             op,
+    char *                             filename,
+    const char *                       alg_name,
+    globus_off_t                       offset,
+    globus_off_t                       length)
+{
+    struct stat                        stbuf;
+    char                               cksm[GLOBUS_L_GFS_POSIX_CKSM_LEN];
+    int                                alg;
+    int                                rc;
+
+    alg = globus_l_gfs_posix_cksm_alg(alg_name);
+    if (alg < 0) return GLOBUS_FAILURE;
+
+    rc = stat(filename, &stbuf);
+    if (rc != 0 || ! S_ISREG(stbuf.st_mode))
+        return GLOBUS_FAILURE;
+    if (offset < 0) offset = 0;
+    if (length < 0 || (offset + length) > stbuf.st_size) 
+        length = stbuf.st_size - offset;
+
+    if (offset == 0 && length == stbuf.st_size &&
+        globus_l_gfs_posix_prefix_int("GRIDFTP_POSIX_CKSM_XATTR",
+                                      filename, 0) &&
+        globus_l_gfs_posix_cksm_cached(filename, alg, &stbuf, cksm))
+    {
+        globus_l_gfs_posix_trace_end(op, GLOBUS_SUCCESS, length, 0);
+        globus_gridftp_server_finished_command(op, GLOBUS_SUCCESS, cksm);
+        return GLOBUS_SUCCESS;
+    }
+    return globus_l_gfs_posix_cksm_submit(op, filename, alg, &stbuf,
+                                          offset, length);
+}
+
+/*************************************************************************
+ * Adler23 checksum
+ ************************************************************************/
+globus_result_t 
+globus_l_gfs_posix_cksm_adler32(
+    globus_gfs_operation_t             op,
+    char *                             filename,
+    globus_off_t                       offset,
+    globus_off_t                       length)
+{
+    char *ext_adler32, ext_cmd[1024], *pt, cksm[512];
+    FILE *F;
+
+    ext_adler32 = NULL;
+    if ((ext_adler32 = getenv("GRIDFTP_CKSUM_EXT_ADLER32")) != NULL)
+    {
+        strcpy(ext_cmd, ext_adler32);
+        strcat(ext_cmd, " ");
+        strcat(ext_cmd, filename);
+        F = popen(ext_cmd, "r");
+        if (F == NULL) return GLOBUS_FAILURE;
+        fscanf(F, "%511s", cksm);
+        pclose(F);
+
+        pt = strchr(cksm, ' ');
+        if (pt != NULL) pt[0] = '\0'; /* take the first string */ 
+    }
+    else /* calculate adler32 */
+    {
+        return globus_l_gfs_posix_cksm(op, filename, "adler32",
+                                       offset, length);
+    }
+
+    globus_l_gfs_posix_trace_end(op, GLOBUS_SUCCESS, 0, 0);
+    globus_gridftp_server_finished_command(op, GLOBUS_SUCCESS, cksm);       
+    return GLOBUS_SUCCESS;
+}
+
+/*************************************************************************
+ * MD5 checksum
+ ************************************************************************/
+globus_result_t 
+globus_l_gfs_posix_cksm_md5(
+    globus_gfs_operation_t             op,
+    char *                             filename,
+    globus_off_t                       offset,
+    globus_off_t                       length)
+{
+    char *ext_md5, ext_cmd[1024], *pt, cksm[512];
+    FILE *F;
+
+    ext_md5 = NULL;
+    if ((ext_md5 = getenv("GRIDFTP_CKSUM_EXT_MD5")) != NULL)
+    {
+        strcpy(ext_cmd, ext_md5);
+        strcat(ext_cmd, " ");
+        strcat(ext_cmd, filename);
+        F = popen(ext_cmd, "r");
+        if (F == NULL) return GLOBUS_FAILURE;
+        fscanf(F, "%511s", cksm);
+        pclose(F);
+
+        pt = strchr(cksm, ' ');
+        if (pt != NULL) pt[0] = '\0'; /* take the first string */ 
+
+        globus_l_gfs_posix_trace_end(op, GLOBUS_SUCCESS, 0, 0);
+        globus_gridftp_server_finished_command(op, GLOBUS_SUCCESS, cksm);       
+    }
+    else /* calculate md5 */
+    {
+        return globus_l_gfs_posix_cksm(op, filename, "md5", offset, length);
+    }
+    return GLOBUS_SUCCESS;
+}
+
+/*************************************************************************
+ *  command
+ *  -------
+ *  This interface function is called when the client sends a 'command'.
+ *  commands are such things as mkdir, remdir, delete.  The complete
+ *  enumeration is below.
+ *
+ *  To determine which command is being requested look at:
+ *      cmd_info->command
+ *
+ *      GLOBUS_GFS_CMD_MKD = 1,
+ *      GLOBUS_GFS_CMD_RMD,
+ *      GLOBUS_GFS_CMD_DELE,
+ *      GLOBUS_GFS_CMD_RNTO,
+ *      GLOBUS_GFS_CMD_RNFR,
+ *      GLOBUS_GFS_CMD_CKSM,
+ *      GLOBUS_GFS_CMD_SITE_CHMOD,
+ *      GLOBUS_GFS_CMD_SITE_DSI
+ ************************************************************************/
+static
+void
+globus_l_gfs_posix_command(
+    globus_gfs_operation_t              op,
+    globus_gfs_command_info_t *         cmd_info,
+    void *                              user_arg)
+{
+    char *                              PathName;
+    globus_l_gfs_posix_handle_t *       posix_handle;
+    globus_result_t                     rc;
+    struct utimbuf                      ubuf;
+    int                                 alg;
+    GlobusGFSName(globus_l_gfs_posix_command);
+
+    posix_handle = (globus_l_gfs_posix_handle_t *) user_arg;
+
+    PathName=cmd_info->pathname;
+    while (PathName[0] == '/' && PathName[1] == '/')
+    {
+        PathName++;
+    }
+    globus_l_gfs_posix_trace_command(posix_handle, op, cmd_info, PathName);
+
+    rc = GLOBUS_SUCCESS;
+    switch(cmd_info->command)
+    {
+      case GLOBUS_GFS_CMD_MKD:
+        (mkdir(PathName, 0777) == 0) || 
+            (rc = GlobusGFSErrorSystemError("mkdir", errno)); 
+        if (rc == GLOBUS_SUCCESS) globus_l_gfs_posix_dircache_add(PathName);
+        break;
+      case GLOBUS_GFS_CMD_RMD:
+        globus_l_gfs_posix_dircache_forget(PathName);
+        globus_l_gfs_posix_fdcache_forget(posix_handle, PathName, GLOBUS_TRUE);
+        (rmdir(PathName) == 0) || 
+            (rc = GlobusGFSErrorSystemError("rmdir", errno)); 
+        break;
+      case GLOBUS_GFS_CMD_DELE:
+        globus_l_gfs_posix_fdcache_forget(posix_handle, PathName, GLOBUS_FALSE);
+        (globus_l_gfs_posix_backend_select(posix_handle, PathName)->unlink(
+            PathName) == 0) ||
+            (rc = GlobusGFSErrorSystemError("unlink", errno)); 
+        break;
+      case GLOBUS_GFS_CMD_TRNC:
+        globus_l_gfs_posix_fdcache_forget(posix_handle, PathName, GLOBUS_FALSE);
+        globus_l_gfs_posix_cksm_forget(PathName);
+        (truncate(PathName, cmd_info->cksm_offset) == 0) ||
+            (rc = GlobusGFSErrorSystemError("truncate", errno)); 
+        break;
+      case GLOBUS_GFS_CMD_SITE_RDEL:
+        globus_l_gfs_posix_dircache_forget(PathName);
+        globus_l_gfs_posix_fdcache_forget(posix_handle, PathName, GLOBUS_TRUE);
+        rc = globus_l_gfs_file_delete_dir(PathName);
+        break;
+      case GLOBUS_GFS_CMD_RNTO:
+        globus_l_gfs_posix_fdcache_forget(posix_handle, cmd_info->rnfr_pathname,
+                                          GLOBUS_TRUE);
+        globus_l_gfs_posix_fdcache_forget(posix_handle, PathName, GLOBUS_TRUE);
+        (rename(cmd_info->rnfr_pathname, PathName) == 0) || 
+            (rc = GlobusGFSErrorSystemError("rename", errno)); 
+        break;
+      case GLOBUS_GFS_CMD_SITE_CHMOD:
+        globus_l_gfs_posix_fdcache_forget(posix_handle, PathName, GLOBUS_FALSE);
+        (chmod(PathName, cmd_info->chmod_mode) == 0) ||
+            (rc = GlobusGFSErrorSystemError("chmod", errno)); 
+        break;
+      case GLOBUS_GFS_CMD_SITE_CHGRP:
+        globus_l_gfs_posix_fdcache_forget(posix_handle, PathName, GLOBUS_FALSE);
+        (globus_l_gfs_posix_chgrp(PathName, cmd_info->chgrp_group) == 0) ||
+            (rc = GlobusGFSErrorSystemError("chgrp", errno));
+        break;
+      case GLOBUS_GFS_CMD_SITE_UTIME:
+        globus_l_gfs_posix_fdcache_forget(posix_handle, PathName, GLOBUS_FALSE);
+        globus_l_gfs_posix_cksm_forget(PathName);
+        ubuf.modtime = cmd_info->utime_time;
+        ubuf.actime = time(NULL);
+
+        (utime(PathName, &ubuf) == 0) || 
+            (rc = GlobusGFSErrorSystemError("utime", errno));
+        break;
+      case GLOBUS_GFS_CMD_SITE_SYMLINK:
+        globus_l_gfs_posix_fdcache_forget(posix_handle, PathName, GLOBUS_FALSE);
+        (symlink(cmd_info->from_pathname, cmd_info->pathname) == 0) || 
+            (rc = GlobusGFSErrorSystemError("symlink", errno));
+        break;
+      case GLOBUS_GFS_CMD_CKSM:
+        /* any case of the name, so the external commands are not
+           bypassed by "Adler32" */
+        alg = globus_l_gfs_posix_cksm_alg(cmd_info->cksm_alg);
+        if (alg == GLOBUS_L_GFS_POSIX_CKSM_ADLER32)
+            rc = globus_l_gfs_posix_cksm_adler32(op, 
+                                                 PathName,
+                                                 cmd_info->cksm_offset,
+                                                 cmd_info->cksm_length);
+        else if (alg == GLOBUS_L_GFS_POSIX_CKSM_MD5)
+            rc = globus_l_gfs_posix_cksm_md5(op,
+                                             PathName,
+                                             cmd_info->cksm_offset,
+                                             cmd_info->cksm_length);
+        else
+            rc = globus_l_gfs_posix_cksm(op,
+                                         PathName,
+                                         cmd_info->cksm_alg,
+                                         cmd_info->cksm_offset,
+                                         cmd_info->cksm_length);
+        break;
+
+      default:
+        rc = GLOBUS_FAILURE;
+        break;
+    }
+
+    if ( rc != GLOBUS_SUCCESS || cmd_info->command != GLOBUS_GFS_CMD_CKSM)
+    {
+        globus_l_gfs_posix_trace_end(op, rc, 0, 0);
+        globus_gridftp_server_finished_command(op, rc, NULL);
+    }
+}
+
+/* storage I/O auto-tuning */
+
+static
+void
+globus_l_gfs_posix_tune_init(
+    globus_l_gfs_posix_tune_t *         tune,
+    int                                 count,
+    globus_size_t                       io_size,
+    globus_bool_t                       tune_io_size)
+{
+    memset(tune, 0, sizeof(globus_l_gfs_posix_tune_t));
+    tune->enabled = globus_l_gfs_posix_getenv_int("GRIDFTP_POSIX_AUTOTUNE", 0);
+    tune->tune_io_size = tune_io_size;
+    tune->count = (count > 0 ? count : 1);
+    tune->io_size = io_size;
+    tune->max_count = globus_l_gfs_posix_getenv_int(
+        "GRIDFTP_POSIX_AUTOTUNE_MAX_COUNT", 64);
+    if (tune->max_count < tune->count) tune->max_count = tune->count;
+    tune->max_io_size = globus_l_gfs_posix_getenv_size(
+        "GRIDFTP_POSIX_AUTOTUNE_MAX_IOSIZE", 64*1024*1024);
+    if (tune->max_io_size < tune->io_size) tune->max_io_size = tune->io_size;
+    tune->best_count = tune->count;
+    tune->best_io_size = tune->io_size;
+    tune->phase = GLOBUS_L_GFS_POSIX_TUNE_COUNT;
+    tune->win_start = globus_l_gfs_posix_now();
+}
+
+/* move to the next setting to try, or to the next phase when exhausted */
+static
+void
+globus_l_gfs_posix_tune_step(
+    globus_l_gfs_posix_tune_t *         tune)
+{
+    if (tune->phase == GLOBUS_L_GFS_POSIX_TUNE_COUNT)
+    {
+        if (tune->count < tune->max_count)
+        {
+            tune->count = (tune->count * 2 > tune->max_count ?
+                           tune->max_count : tune->count * 2);
+            return;
+        }
+        tune->phase = GLOBUS_L_GFS_POSIX_TUNE_IOSIZE;
+    }
+    if (tune->phase == GLOBUS_L_GFS_POSIX_TUNE_IOSIZE)
+    {
+        if (tune->tune_io_size && tune->io_size < tune->max_io_size)
+        {
+            tune->io_size = (tune->io_size * 2 > tune->max_io_size ?
+                             tune->max_io_size : tune->io_size * 2);
+            return;
+        }
+        tune->phase = GLOBUS_L_GFS_POSIX_TUNE_DONE;
+    }
+    /* exhausted the last knob here, or gave up on it in tune_sample */
+    if (tune->phase == GLOBUS_L_GFS_POSIX_TUNE_DONE)
+    {
+        globus_gfs_log_message(GLOBUS_GFS_LOG_INFO,
+            "autotune: converged on %d outstanding ops of %lu bytes, %.1f MB/s\n",
+            tune->count, (unsigned long) tune->io_size, tune->best_rate / 1e6);
+    }
+}
+
+/* account one storage operation, called with the handle locked */
+static
+void
+globus_l_gfs_posix_tune_sample(
+    globus_l_gfs_posix_tune_t *         tune,
+    globus_size_t                       nbytes,
+    double                              latency)
+{
+    double                              now;
+    double                              rate;
+
+    if (! tune->enabled) return;
+
+    tune->total_bytes += nbytes;
+    tune->total_ops++;
+    tune->total_latency += latency;
+    if (tune->phase == GLOBUS_L_GFS_POSIX_TUNE_DONE) return;
+
+    tune->win_bytes += nbytes;
+    tune->win_ops++;
+    now = globus_l_gfs_posix_now();
+    if (tune->win_ops < 2 * tune->count + 4 || now - tune->win_start < 0.2)
+        return;
+
+    rate = tune->win_bytes / (now - tune->win_start);
+    if (rate > tune->best_rate * 1.05)
+    {
+        tune->best_rate = rate;
+        tune->best_count = tune->count;
+        tune->best_io_size = tune->io_size;
+        globus_l_gfs_posix_tune_step(tune);
+    }
+    else
+    {
+        /* no gain, go back to the best setting and tune the next knob */
+        tune->count = tune->best_count;
+        tune->io_size = tune->best_io_size;
+        tune->phase++;
+        globus_l_gfs_posix_tune_step(tune);
+    }
+    tune->win_bytes = 0;
+    tune->win_ops = 0;
+    tune->win_start = now;
+}
+
+static
+void
+globus_l_gfs_posix_tune_report(
+    globus_l_gfs_posix_tune_t *         tune,
+    const char *                        what)
+{
+    if (! tune->enabled || tune->total_ops == 0) return;
+    globus_gfs_log_message(GLOBUS_GFS_LOG_INFO,
+        "autotune: %s used %d outstanding ops of %lu bytes, "
+        "%d storage ops averaging %.2f ms\n",
+        what, tune->count, (unsigned long) tune->io_size, tune->total_ops,
+        tune->total_latency * 1000 / tune->total_ops);
+}
+
+/*
+ * Storage geometry. With GRIDFTP_POSIX_GEOMETRY, the storage I/O size of
+ * a transfer comes from the file, not from the network block size: the
+ * Lustre stripe (stripe size times stripe count, from the lustre.lov
+ * xattr), else the larger of st_blksize and the statfs() optimal
+ * transfer size (the GPFS block size, for one). The I/O size is the
+ * smallest multiple of that unit which holds a network block, up to
+ * GRIDFTP_POSIX_GEOMETRY_MAX, and storage requests are aligned to the
+ * unit: send reads up to the next boundary first, recv coalesces blocks
+ * into aligned extents of the I/O size.
+ */
+#define GLOBUS_L_GFS_POSIX_LOV_MAGIC_V1 0x0BD10BD0
+#define GLOBUS_L_GFS_POSIX_LOV_MAGIC_V3 0x0BD30BD0
+
+/*
+ * The unit of the storage under fd, 0 if there is nothing to go by.
+ * A unit that is too large may only be cut to a multiple of *grain.
+ */
+static
+globus_size_t
+globus_l_gfs_posix_geometry_unit(
+    int                                 fd,
+    globus_size_t *                     grain,
+    char *                              source,
+    size_t                              source_len)
+{
+    unsigned char                       lov[256];
+    uint32_t                            magic;
+    uint32_t                            stripe_size;
+    uint16_t                            stripe_count;
+    struct stat                         st;
+    struct statfs                       sfs;
+    globus_size_t                       unit = 0;
+
+    /* struct lov_user_md: magic, pattern, 16 byte object id, then the
+       stripe size and count; composite (PFL) layouts are not parsed */
+    if (fgetxattr(fd, "lustre.lov", lov, sizeof(lov)) >= 32)
+    {
+        memcpy(&magic, lov, sizeof(magic));
+        memcpy(&stripe_size, lov + 24, sizeof(stripe_size));
+        memcpy(&stripe_count, lov + 28, sizeof(stripe_count));
+        if ((magic == GLOBUS_L_GFS_POSIX_LOV_MAGIC_V1 ||
+             magic == GLOBUS_L_GFS_POSIX_LOV_MAGIC_V3) &&
+            stripe_size > 0 && stripe_count > 0 && stripe_count < 0xffff)
+        {
+            snprintf(source, source_len, "lustre %u x %u",
+                     (unsigned) stripe_count, (unsigned) stripe_size);
+            *grain = stripe_size;
+            return (globus_size_t) stripe_size * stripe_count;
+        }
+    }
+    if (fstat(fd, &st) == 0 && st.st_blksize > 0)
+    {
+        unit = st.st_blksize;
+        snprintf(source, source_len, "st_blksize");
+    }
+    if (fstatfs(fd, &sfs) == 0 && sfs.f_bsize > 0 &&
+        (globus_size_t) sfs.f_bsize > unit)
+    {
+        unit = sfs.f_bsize;
+        snprintf(source, source_len, "statfs");
+    }
+    *grain = unit;
+    return unit;
+}
+
+/* set io_size and io_align of a transfer on an open, seekable file */
+static
+void
+globus_l_gfs_posix_geometry(
+    globus_l_gfs_posix_handle_t *       posix_handle)
+{
+    char                                source[64];
+    globus_size_t                       unit;
+    globus_size_t                       grain;
+    globus_size_t                       max;
+
+    posix_handle->io_size = posix_handle->block_size;
+    posix_handle->io_align = 0;
+    if (! posix_handle->seekable ||
+        ! globus_l_gfs_posix_prefix_int("GRIDFTP_POSIX_GEOMETRY",
+                                        posix_handle->pathname, 0))
+    {
+        return;
+    }
+    unit = globus_l_gfs_posix_geometry_unit(posix_handle->fd, &grain,
+                                            source, sizeof(source));
+    if (unit == 0) return;
+    max = globus_l_gfs_posix_getenv_size("GRIDFTP_POSIX_GEOMETRY_MAX",
+                                         64*1024*1024);
+    if (unit > max)
+    {
+        /* a wide stripe, keep to whole stripe objects */
+        unit = (max > grain ? max / grain * grain : grain);
+    }
+    posix_handle->io_align = unit;
+    posix_handle->io_size = (posix_handle->block_size + unit - 1) / unit * unit;
+    if (posix_handle->io_size > max)
+    {
+        posix_handle->io_size = (max > unit ? max / unit * unit : unit);
+    }
+    globus_gfs_log_message(GLOBUS_GFS_LOG_INFO,
+        "storage geometry of %s: %lu byte units (%s), I/O size %lu\n",
+        posix_handle->pathname, (unsigned long) unit, source,
+        (unsigned long) posix_handle->io_size);
+}
+
+/* receive file from client */
+
+static
+void
+globus_l_gfs_posix_write_to_storage(
+    globus_l_gfs_posix_handle_t *      posix_handle);
+
+/* remember the first error of a transfer, it is reported at the end */
+static
+void
+globus_l_gfs_posix_set_error(
+    globus_l_gfs_posix_handle_t *       posix_handle,
+    globus_result_t                     rc)
+{
+    if (posix_handle->result == GLOBUS_SUCCESS)
+    {
+        posix_handle->result = rc;
+    }
+    posix_handle->done = GLOBUS_TRUE;
+}
+
+/* write-behind */
+
+/* called before the file is opened, the policy may change the open flags */
+static
+void
+globus_l_gfs_posix_flush_init(
+    globus_l_gfs_posix_handle_t *       posix_handle)
+{
+    globus_l_gfs_posix_flush_t *        flush;
+    char                                value[16];
+
+    flush = &posix_handle->flush;
+    memset(flush, 0, sizeof(globus_l_gfs_posix_flush_t));
+    flush->window = globus_l_gfs_posix_getenv_size(
+        "GRIDFTP_POSIX_WRITE_BEHIND", 0) / 2;
+    flush->durability = GLOBUS_L_GFS_POSIX_DURABLE_NONE;
+    if (globus_l_gfs_posix_prefix_lookup("GRIDFTP_POSIX_DURABILITY",
+            posix_handle->pathname, value, sizeof(value)) != NULL)
+    {
+        if (! strcmp(value, "fdatasync"))
+        {
+            flush->durability = GLOBUS_L_GFS_POSIX_DURABLE_FDATASYNC;
+        }
+        else if (! strcmp(value, "dsync"))
+        {
+            flush->durability = GLOBUS_L_GFS_POSIX_DURABLE_DSYNC;
+        }
+    }
+}
+
+/* start writeback of the current window, wait for the one before it */
+static
+void
+globus_l_gfs_posix_flush_window(
+    globus_l_gfs_posix_handle_t *       posix_handle,
+    globus_bool_t                       wait_all)
+{
+    globus_l_gfs_posix_flush_t *        flush;
+    double                              t_start;
+
+    flush = &posix_handle->flush;
+    if (flush->bytes > 0 &&
+        sync_file_range(posix_handle->fd, flush->start,
+                        flush->end - flush->start,
+                        SYNC_FILE_RANGE_WRITE) != 0)
+    {
+        /* not a local file system, or a preload library without it */
+        flush->window = 0;
+        return;
+    }
+    t_start = globus_l_gfs_posix_now();
+    if (flush->prev_end > flush->prev_start)
+    {
+        sync_file_range(posix_handle->fd, flush->prev_start,
+                        flush->prev_end - flush->prev_start,
+                        SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE |
+                        SYNC_FILE_RANGE_WAIT_AFTER);
+    }
+    if (wait_all && flush->bytes > 0)
+    {
+        sync_file_range(posix_handle->fd, flush->start,
+                        flush->end - flush->start,
+                        SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE |
+                        SYNC_FILE_RANGE_WAIT_AFTER);
+    }
+    flush->wait += globus_l_gfs_posix_now() - t_start;
+    flush->syncs++;
+    flush->prev_start = flush->start;
+    flush->prev_end = flush->end;
+    flush->bytes = 0;
+}
+
+/* account a write; blocks arrive out of order, a window is their extent */
+static
+void
+globus_l_gfs_posix_flush_add(
+    globus_l_gfs_posix_handle_t *       posix_handle,
+    globus_off_t                        offset,
+    globus_off_t                        length)
+{
+    globus_l_gfs_posix_flush_t *        flush;
+
+    flush = &posix_handle->flush;
+    if (flush->window == 0 || ! posix_handle->seekable) return;
+    if (flush->bytes == 0 || offset < flush->start)
+    {
+        flush->start = offset;
+    }
+    if (flush->bytes == 0 || offset + length > flush->end)
+    {
+        flush->end = offset + length;
+    }
+    flush->bytes += length;
+    if (flush->bytes >= flush->window)
+    {
+        globus_l_gfs_posix_flush_window(posix_handle, GLOBUS_FALSE);
+    }
+}
+
+/* make the end of the transfer cheap, and as durable as asked for */
+static
+void
+globus_l_gfs_posix_flush_finish(
+    globus_l_gfs_posix_handle_t *       posix_handle)
+{
+    globus_l_gfs_posix_flush_t *        flush;
+    globus_result_t                     rc;
+    double                              t_start;
+
+    GlobusGFSName(globus_l_gfs_posix_flush_finish);
+
+    flush = &posix_handle->flush;
+    if (flush->window > 0 && posix_handle->seekable)
+    {
+        globus_l_gfs_posix_flush_window(posix_handle, GLOBUS_TRUE);
+        globus_gfs_log_message(GLOBUS_GFS_LOG_INFO,
+            "receive write-behind: %d flushes, %.3f seconds waiting\n",
+            flush->syncs, flush->wait);
+    }
+    if (flush->durability == GLOBUS_L_GFS_POSIX_DURABLE_FDATASYNC &&
+        posix_handle->seekable && posix_handle->result == GLOBUS_SUCCESS)
+    {
+        t_start = globus_l_gfs_posix_now();
+        if (fdatasync(posix_handle->fd) != 0 && errno != EINVAL)
+        {
+            rc = GlobusGFSErrorSystemError("fdatasync", errno);
+            globus_l_gfs_posix_set_error(posix_handle, rc);
+        }
+        globus_gfs_log_message(GLOBUS_GFS_LOG_INFO,
+            "receive fdatasync: %.3f seconds\n",
+            globus_l_gfs_posix_now() - t_start);
+    }
+}
+
+/* restart journal */
+
+/* saved as text: a header naming the inode, then "offset length" lines */
+static
+char *
+globus_l_gfs_posix_journal_format(
+    globus_l_gfs_posix_journal_t *      journal,
+    size_t *                            len)
+{
+    char *                              buf;
+    globus_off_t                        offset;
+    globus_off_t                        length;
+    int                                 n;
+    int                                 i;
+
+    n = globus_range_list_size(journal->written);
+    buf = (char *) globus_malloc(64 + n * 44);
+    if (buf == NULL) return NULL;
+    *len = sprintf(buf, "gridftp-journal 1 %lu\n",
+                   (unsigned long) journal->ino);
+    for (i = 0; i < n; i++)
+    {
+        globus_range_list_at(journal->written, i, &offset, &length);
+        *len += sprintf(buf + *len, "%lld %lld\n",
+                        (long long) offset, (long long) length);
+    }
+    return buf;
+}
+
+/* read the saved journal, NULL if there is none */
+static
+char *
+globus_l_gfs_posix_journal_load(
+    globus_l_gfs_posix_handle_t *       posix_handle)
+{
+    globus_l_gfs_posix_journal_t *      journal;
+    struct stat                         stat_buffer;
+    char *                              buf = NULL;
+    ssize_t                             len = -1;
+    int                                 fd;
+
+    journal = &posix_handle->journal;
+    if (journal->mode == GLOBUS_L_GFS_POSIX_JOURNAL_XATTR)
+    {
+        len = fgetxattr(posix_handle->fd, GLOBUS_L_GFS_POSIX_JOURNAL_XNAME,
+                        NULL, 0);
+        if (len < 0 || (buf = (char *) globus_malloc(len + 1)) == NULL)
+        {
+            return NULL;
+        }
+        len = fgetxattr(posix_handle->fd, GLOBUS_L_GFS_POSIX_JOURNAL_XNAME,
+                        buf, len);
+    }
+    else
+    {
+        fd = open(journal->path, O_RDONLY);
+        if (fd < 0) return NULL;
+        if (fstat(fd, &stat_buffer) == 0 &&
+            (buf = (char *) globus_malloc(stat_buffer.st_size + 1)) != NULL)
+        {
+            len = pread(fd, buf, stat_buffer.st_size, 0);
+        }
+        close(fd);
+    }
+    if (len < 0)
+    {
+        globus_free(buf);
+        return NULL;
+    }
+    buf[len] = '\0';
+    return buf;
+}
+
+/* parse a saved journal into ranges, FALSE if it is not for this file */
+static
+globus_bool_t
+globus_l_gfs_posix_journal_parse(
+    globus_l_gfs_posix_journal_t *      journal,
+    char *                              buf)
+{
+    char *                              line;
+    char *                              save;
+    unsigned long                       ino;
+    long long                           offset;
+    long long                           length;
+
+    line = strtok_r(buf, "\n", &save);
+    if (line == NULL ||
+        sscanf(line, "gridftp-journal 1 %lu", &ino) != 1 ||
+        ino != (unsigned long) journal->ino)
+    {
+        return GLOBUS_FALSE;
+    }
+    while ((line = strtok_r(NULL, "\n", &save)) != NULL)
+    {
+        if (sscanf(line, "%lld %lld", &offset, &length) == 2 &&
+            offset >= 0 && length > 0)
+        {
+            globus_range_list_insert(journal->written, offset, length);
+        }
+    }
+    return GLOBUS_TRUE;
+}
+
+static
+void
+globus_l_gfs_posix_journal_remove(
+    globus_l_gfs_posix_handle_t *       posix_handle)
+{
+    if (posix_handle->journal.mode == GLOBUS_L_GFS_POSIX_JOURNAL_XATTR)
+    {
+        fremovexattr(posix_handle->fd, GLOBUS_L_GFS_POSIX_JOURNAL_XNAME);
+    }
+    else
+    {
+        unlink(posix_handle->journal.path);
+    }
+}
+
+/* flush the file, then save the ranges written so far */
+static
+void
+globus_l_gfs_posix_journal_save(
+    globus_l_gfs_posix_handle_t *       posix_handle)
+{
+    globus_l_gfs_posix_journal_t *      journal;
+    char                                tmp[MAXPATHLEN + 8];
+    char *                              buf;
+    size_t                              len;
+    int                                 fd;
+    int                                 rc = -1;
+
+    journal = &posix_handle->journal;
+    journal->t_saved = globus_l_gfs_posix_now();
+    if (! journal->dirty) return;
+
+    /* only ranges that are on stable storage may go into the journal */
+    if (fdatasync(posix_handle->fd) != 0 && errno != EINVAL && errno != ENOSYS)
+    {
+        return;
+    }
+    buf = globus_l_gfs_posix_journal_format(journal, &len);
+    if (buf == NULL) return;
+
+    if (journal->mode == GLOBUS_L_GFS_POSIX_JOURNAL_XATTR)
+    {
+        rc = fsetxattr(posix_handle->fd, GLOBUS_L_GFS_POSIX_JOURNAL_XNAME,
+                       buf, len, 0);
+    }
+    else
+    {
+        /* replace the journal atomically, never leave half of one */
+        snprintf(tmp, sizeof(tmp), "%s.tmp", journal->path);
+        fd = open(tmp, O_WRONLY|O_CREAT|O_TRUNC, S_IRUSR|S_IWUSR);
+        if (fd >= 0)
+        {
+            if (write(fd, buf, len) == (ssize_t) len)
+            {
+                fdatasync(fd);
+                rc = 0;
+            }
+            close(fd);
+            if (rc == 0)
+            {
+                rc = rename(tmp, journal->path);
+            }
+            if (rc != 0)
+            {
+                unlink(tmp);
+            }
         }
-        
-        if(i != stat_count)
+    }
+    globus_free(buf);
+
+    if (rc == 0)
+    {
+        journal->dirty = GLOBUS_FALSE;
+    }
+    else
+    {
+        globus_gfs_log_message(GLOBUS_GFS_LOG_WARN,
+            "restart journal for %s not saved: %s\n",
+            posix_handle->pathname, strerror(errno));
+    }
+}
+
+/*
+ * Called before the first read is posted. A transfer of the whole file
+ * (a single range from offset 0) starts over and drops any old journal.
+ * A restarted transfer loads it, and what the client asks for but the
+ * journal already has is reported as written and will be skipped.
+ */
+static
+void
+globus_l_gfs_posix_journal_init(
+    globus_l_gfs_posix_handle_t *       posix_handle,
+    globus_gfs_transfer_info_t *        transfer_info)
+{
+    globus_l_gfs_posix_journal_t *      journal;
+    struct stat                         stat_buffer;
+    char                                mode[16];
+    char *                              buf;
+    char *                              cgi;
+    globus_off_t                        offset, length;
+    globus_off_t                        want_offset, want_length;
+    globus_off_t                        start, end;
+    size_t                              len;
+    int                                 nwant;
+    int                                 i, j;
+
+    journal = &posix_handle->journal;
+    memset(journal, 0, sizeof(globus_l_gfs_posix_journal_t));
+    if (! posix_handle->seekable ||
+        globus_l_gfs_posix_prefix_lookup("GRIDFTP_POSIX_RESTART_JOURNAL",
+            posix_handle->pathname, mode, sizeof(mode)) == NULL ||
+        fstat(posix_handle->fd, &stat_buffer) != 0)
+    {
+        return;
+    }
+    if (! strcmp(mode, "xattr"))
+    {
+        journal->mode = GLOBUS_L_GFS_POSIX_JOURNAL_XATTR;
+    }
+    else if (! strcmp(mode, "sidecar") || ! strcmp(mode, "1"))
+    {
+        journal->mode = GLOBUS_L_GFS_POSIX_JOURNAL_SIDECAR;
+    }
+    else
+    {
+        return;
+    }
+
+    journal->ino = stat_buffer.st_ino;
+    cgi = strchr(posix_handle->pathname, '?');
+    len = (cgi != NULL ? (size_t) (cgi - posix_handle->pathname) :
+                         strlen(posix_handle->pathname));
+    if (snprintf(journal->path, sizeof(journal->path), "%.*s%s", (int) len,
+                 posix_handle->pathname, GLOBUS_L_GFS_POSIX_JOURNAL_SUFFIX) >=
+        (int) sizeof(journal->path))
+    {
+        globus_gfs_log_message(GLOBUS_GFS_LOG_WARN,
+            "restart journal off for %s: path too long\n",
+            posix_handle->pathname);
+        journal->mode = 0;
+        return;
+    }
+    journal->interval = globus_l_gfs_posix_getenv_int(
+        "GRIDFTP_POSIX_RESTART_JOURNAL_INTERVAL", 30);
+    journal->t_saved = globus_l_gfs_posix_now();
+    globus_range_list_init(&journal->written);
+
+    nwant = (transfer_info->range_list != NULL ?
+             globus_range_list_size(transfer_info->range_list) : 0);
+    if (nwant > 0)
+    {
+        globus_range_list_at(transfer_info->range_list, 0,
+                             &want_offset, &want_length);
+    }
+    if (nwant == 0 || (nwant == 1 && want_offset == 0))
+    {
+        globus_l_gfs_posix_journal_remove(posix_handle);
+        return;
+    }
+
+    buf = globus_l_gfs_posix_journal_load(posix_handle);
+    if (buf == NULL) return;
+    if (! globus_l_gfs_posix_journal_parse(journal, buf))
+    {
+        /* left by an earlier file of the same name */
+        globus_free(buf);
+        globus_l_gfs_posix_journal_remove(posix_handle);
+        return;
+    }
+    globus_free(buf);
+
+    globus_range_list_init(&journal->skip);
+    for (i = 0; i < globus_range_list_size(journal->written); i++)
+    {
+        globus_range_list_at(journal->written, i, &offset, &length);
+        for (j = 0; j < nwant; j++)
         {
-            result = GlobusGFSErrorSystemError("readdir", errno);
-            goto error_read;
+            globus_range_list_at(transfer_info->range_list, j,
+                                 &want_offset, &want_length);
+            start = (offset > want_offset ? offset : want_offset);
+            end = offset + length;
+            /* a length of -1 means up to the end of file */
+            if (want_length >= 0 && want_offset + want_length < end)
+            {
+                end = want_offset + want_length;
+            }
+            if (end > start)
+            {
+                globus_range_list_insert(journal->skip, start, end - start);
+                globus_gridftp_server_update_bytes_written(posix_handle->op,
+                                                           start, end - start);
+                journal->skipped += end - start;
+            }
         }
-        
-        closedir(dir);
     }
-    
-    globus_gridftp_server_finished_stat(
-        op, GLOBUS_SUCCESS, stat_array, stat_count);
-    
-    
-    globus_l_gfs_file_destroy_stat(stat_array, stat_count);
-    
-    return;
+    globus_gfs_log_message(GLOBUS_GFS_LOG_INFO,
+        "restart journal: %lld bytes of %s already on storage\n",
+        (long long) journal->skipped, posix_handle->pathname);
+}
 
-error_read:
-    globus_l_gfs_file_destroy_stat(stat_array, stat_count);
-    
-error_alloc2:
-    closedir(dir);
-    
-error_open:
-error_alloc1:
-error_stat1:
-    globus_gridftp_server_finished_stat(op, result, NULL, 0);
+/* TRUE if a received block is already on storage */
+static
+globus_bool_t
+globus_l_gfs_posix_journal_covers(
+    globus_l_gfs_posix_journal_t *      journal,
+    globus_off_t                        offset,
+    globus_size_t                       nbytes)
+{
+    globus_off_t                        skip_offset;
+    globus_off_t                        skip_length;
+    int                                 i;
 
-/*    GlobusGFSFileDebugExitWithError();  */
+    if (journal->skip == NULL) return GLOBUS_FALSE;
+    for (i = 0; i < globus_range_list_size(journal->skip); i++)
+    {
+        globus_range_list_at(journal->skip, i, &skip_offset, &skip_length);
+        if (skip_offset <= offset &&
+            offset + (globus_off_t) nbytes <= skip_offset + skip_length)
+        {
+            return GLOBUS_TRUE;
+        }
+    }
+    return GLOBUS_FALSE;
+}
+
+/* a range reached storage: tell the server, write-behind and the journal */
+static
+void
+globus_l_gfs_posix_stored(
+    globus_l_gfs_posix_handle_t *       posix_handle,
+    globus_off_t                        offset,
+    globus_off_t                        length)
+{
+    globus_l_gfs_posix_journal_t *      journal;
+
+    globus_gridftp_server_update_bytes_written(posix_handle->op,
+                                               offset, length);
+    globus_l_gfs_posix_flush_add(posix_handle, offset, length);
+    journal = &posix_handle->journal;
+    if (journal->mode == 0) return;
+    globus_range_list_insert(journal->written, offset, length);
+    journal->dirty = GLOBUS_TRUE;
+    if (globus_l_gfs_posix_now() - journal->t_saved >= journal->interval)
+    {
+        globus_l_gfs_posix_journal_save(posix_handle);
+    }
+}
+
+/* keep the journal of a failed transfer for the restart, drop it otherwise */
+static
+void
+globus_l_gfs_posix_journal_finish(
+    globus_l_gfs_posix_handle_t *       posix_handle)
+{
+    globus_l_gfs_posix_journal_t *      journal;
+
+    journal = &posix_handle->journal;
+    if (journal->mode == 0) return;
+    if (posix_handle->result == GLOBUS_SUCCESS)
+    {
+        globus_l_gfs_posix_journal_remove(posix_handle);
+    }
+    else
+    {
+        globus_l_gfs_posix_journal_save(posix_handle);
+    }
+    globus_range_list_destroy(journal->written);
+    if (journal->skip != NULL)
+    {
+        globus_range_list_destroy(journal->skip);
+    }
+    journal->mode = 0;
+}
+
+/* write a vector of buffers at offset, handling short writes */
+static
+globus_result_t
+globus_l_gfs_posix_store_iov(
+    globus_l_gfs_posix_handle_t *       posix_handle,
+    const struct iovec *                iov,
+    int                                 niov,
+    globus_off_t                        offset,
+    globus_size_t                       length)
+{
+    struct iovec *                      left = NULL;
+    ssize_t                             nbytes;
+
+    GlobusGFSName(globus_l_gfs_posix_store_iov);
+
+    while (length > 0)
+    {
+        if (! posix_handle->coalesce.no_pwritev)
+        {
+            nbytes = posix_handle->backend->pwritev(posix_handle->fd,
+                                                    iov, niov, offset);
+            /* some preload libraries (xrootd) wrap writev() but not pwritev() */
+            if (nbytes < 0 && (errno == ENOSYS || errno == EBADF))
+            {
+                posix_handle->coalesce.no_pwritev = GLOBUS_TRUE;
+                continue;
+            }
+        }
+        else if (posix_handle->backend->lseek(posix_handle->fd, offset,
+                                              SEEK_SET) != offset)
+        {
+            nbytes = -1;
+        }
+        else
+        {
+            nbytes = posix_handle->backend->writev(posix_handle->fd,
+                                                   iov, niov);
+        }
+        if (nbytes <= 0)
+        {
+            globus_free(left);
+            return GlobusGFSErrorSystemError("write", nbytes < 0 ? errno : EIO);
+        }
+
+        offset += nbytes;
+        length -= nbytes;
+        if (length == 0) break;
+
+        /* short write: continue with a private copy of what is left */
+        while ((size_t) nbytes >= iov->iov_len)
+        {
+            nbytes -= iov->iov_len;
+            iov++;
+            niov--;
+        }
+        if (left == NULL)
+        {
+            left = (struct iovec *) globus_malloc(niov * sizeof(struct iovec));
+            if (left == NULL)
+            {
+                return GlobusGFSErrorMemory("iovec");
+            }
+        }
+        memmove(left, iov, niov * sizeof(struct iovec));
+        left->iov_base = (char *) left->iov_base + nbytes;
+        left->iov_len -= nbytes;
+        iov = left;
+    }
+    globus_free(left);
+    return GLOBUS_SUCCESS;
+}
+
+static
+void
+globus_l_gfs_posix_coalesce_init(
+    globus_l_gfs_posix_handle_t *       posix_handle)
+{
+    globus_l_gfs_posix_coalesce_t *     coalesce;
+
+    coalesce = &posix_handle->coalesce;
+    memset(coalesce, 0, sizeof(globus_l_gfs_posix_coalesce_t));
+    coalesce->extent_size = globus_l_gfs_posix_getenv_size(
+        "GRIDFTP_POSIX_COALESCE_SIZE", 0);
+    if (coalesce->extent_size == 0 && posix_handle->io_align > 0)
+    {
+        coalesce->extent_size = posix_handle->io_size;
+    }
+    if (coalesce->extent_size == 0 || ! posix_handle->seekable) 
+    {
+        coalesce->extent_size = 0;
+        return;
+    }
+    if (coalesce->extent_size < posix_handle->block_size)
+    {
+        coalesce->extent_size = posix_handle->block_size;
+    }
+    if (posix_handle->io_align > 0)
+    {
+        /* whole, aligned units of the storage */
+        coalesce->extent_size = (coalesce->extent_size +
+            posix_handle->io_align - 1) / posix_handle->io_align *
+            posix_handle->io_align;
+    }
+    coalesce->max_mem = globus_l_gfs_posix_getenv_size(
+        "GRIDFTP_POSIX_COALESCE_MAXMEM", 4 * coalesce->extent_size);
+    coalesce->timeout = globus_l_gfs_posix_getenv_int(
+        "GRIDFTP_POSIX_COALESCE_TIMEOUT", 5);
+}
+
+/* write iov to storage at offset, unless the transfer already failed */
+static
+void
+globus_l_gfs_posix_coalesce_write(
+    globus_l_gfs_posix_handle_t *       posix_handle,
+    struct iovec *                      iov,
+    int                                 niov,
+    globus_off_t                        offset,
+    globus_size_t                       length)
+{
+    globus_l_gfs_posix_coalesce_t *     coalesce;
+    globus_result_t                     rc;
+    double                              t_start;
+
+    coalesce = &posix_handle->coalesce;
+    if (posix_handle->result != GLOBUS_SUCCESS)
+    {
+        return;
+    }
+    GLOBUS_L_GFS_POSIX_PROBE3(write_entry, posix_handle->pathname,
+        (long long) offset, (long long) length);
+    t_start = globus_l_gfs_posix_now();
+    rc = globus_l_gfs_posix_store_iov(posix_handle, iov, niov, offset,
+                                      length);
+    GLOBUS_L_GFS_POSIX_PROBE4(write_return, posix_handle->pathname,
+        (long long) offset,
+        (long long) (rc == GLOBUS_SUCCESS ? length : -1),
+        GLOBUS_L_GFS_POSIX_USEC(t_start));
+    if (rc != GLOBUS_SUCCESS)
+    {
+        globus_l_gfs_posix_set_error(posix_handle, rc);
+    }
+    else
+    {
+        globus_l_gfs_posix_tune_sample(&posix_handle->tune, length,
+            globus_l_gfs_posix_now() - t_start);
+        globus_l_gfs_posix_stored(posix_handle, offset, length);
+        coalesce->flushes++;
+        coalesce->flushed_bytes += length;
+    }
+}
+
+/* write extent i to storage and release its buffers */
+static
+void
+globus_l_gfs_posix_coalesce_flush(
+    globus_l_gfs_posix_handle_t *       posix_handle,
+    int                                 i)
+{
+    globus_l_gfs_posix_coalesce_t *     coalesce;
+    globus_l_gfs_posix_extent_t *       extent;
+    int                                 j;
+
+    coalesce = &posix_handle->coalesce;
+    extent = &coalesce->extents[i];
+
+    globus_l_gfs_posix_coalesce_write(posix_handle, extent->iov,
+                                      extent->niov, extent->offset,
+                                      extent->length);
+
+    for (j = 0; j < extent->niov; j++)
+    {
+        globus_l_gfs_posix_buf_free(extent->iov[j].iov_base);
+    }
+    globus_free(extent->iov);
+    coalesce->held -= extent->length;
+    coalesce->nextents--;
+    if (i != coalesce->nextents)
+    {
+        *extent = coalesce->extents[coalesce->nextents];
+    }
+}
+
+/* write one block on its own, when there is no memory to hold it */
+static
+void
+globus_l_gfs_posix_coalesce_alone(
+    globus_l_gfs_posix_handle_t *       posix_handle,
+    globus_byte_t *                     buffer,
+    globus_size_t                       nbytes,
+    globus_off_t                        offset)
+{
+    struct iovec                        iov;
+
+    iov.iov_base = buffer;
+    iov.iov_len = nbytes;
+    globus_l_gfs_posix_coalesce_write(posix_handle, &iov, 1, offset, nbytes);
+    globus_l_gfs_posix_buf_free(buffer);
+}
+
+static
+int
+globus_l_gfs_posix_coalesce_oldest(
+    globus_l_gfs_posix_coalesce_t *     coalesce)
+{
+    int                                 i, oldest = 0;
+
+    for (i = 1; i < coalesce->nextents; i++)
+    {
+        if (coalesce->extents[i].t_first < coalesce->extents[oldest].t_first)
+        {
+            oldest = i;
+        }
+    }
+    return oldest;
+}
+
+static
+void
+globus_l_gfs_posix_coalesce_flush_all(
+    globus_l_gfs_posix_handle_t *       posix_handle)
+{
+    while (posix_handle->coalesce.nextents > 0)
+    {
+        globus_l_gfs_posix_coalesce_flush(posix_handle,
+            globus_l_gfs_posix_coalesce_oldest(&posix_handle->coalesce));
+    }
+}
+
+static
+void
+globus_l_gfs_posix_coalesce_timer_cb(
+    void *                              user_arg)
+{
+    globus_l_gfs_posix_handle_t *       posix_handle;
+    globus_l_gfs_posix_coalesce_t *     coalesce;
+    globus_reltime_t                    delay;
+    double                              now;
+    int                                 i;
+
+    posix_handle = (globus_l_gfs_posix_handle_t *) user_arg;
+    coalesce = &posix_handle->coalesce;
+
+    globus_mutex_lock(&posix_handle->mutex);
+    if (! coalesce->timer_pending)
+    {
+        /* unregistered by coalesce_finish while waiting for the mutex */
+        globus_mutex_unlock(&posix_handle->mutex);
+        return;
+    }
+    GLOBUS_L_GFS_POSIX_PROBE1(coalesce_timer_entry, posix_handle->pathname);
+    coalesce->timer_pending = GLOBUS_FALSE;
+    now = globus_l_gfs_posix_now();
+    for (i = coalesce->nextents - 1; i >= 0; i--)
+    {
+        if (now - coalesce->extents[i].t_first >= coalesce->timeout)
+        {
+            globus_l_gfs_posix_coalesce_flush(posix_handle, i);
+        }
+    }
+    if (coalesce->nextents > 0 && ! posix_handle->done)
+    {
+        GlobusTimeReltimeSet(delay, (long) coalesce->timeout, 0);
+        if (globus_callback_register_oneshot(&coalesce->timer, &delay,
+                globus_l_gfs_posix_coalesce_timer_cb,
+                posix_handle) == GLOBUS_SUCCESS)
+        {
+            coalesce->timer_pending = GLOBUS_TRUE;
+        }
+    }
+    GLOBUS_L_GFS_POSIX_PROBE2(coalesce_timer_return, posix_handle->pathname,
+                              GLOBUS_L_GFS_POSIX_USEC(now));
+    globus_mutex_unlock(&posix_handle->mutex);
 }
 
-/* recursively delete a directory */
 static
-globus_result_t
-globus_l_gfs_file_delete_dir(
-    const char *                        pathname)
+void
+globus_l_gfs_posix_coalesce_add(
+    globus_l_gfs_posix_handle_t *       posix_handle,
+    globus_byte_t *                     buffer,
+    globus_size_t                       nbytes,
+    globus_off_t                        offset)
 {
+    globus_l_gfs_posix_coalesce_t *     coalesce;
+    globus_l_gfs_posix_extent_t *       extent = NULL;
+    globus_l_gfs_posix_extent_t *       next;
+    struct iovec *                      iov;
+    globus_reltime_t                    delay;
+    globus_off_t                        window;
+    int                                 i, j;
+
+    coalesce = &posix_handle->coalesce;
+    if (posix_handle->tune.enabled)
+    {
+        coalesce->extent_size = posix_handle->tune.io_size;
+    }
+    window = offset / coalesce->extent_size;
 
-    globus_result_t                     result;
-    int                                 rc;
-    DIR *                               dir;
-    struct stat                         stat_buf;
-    struct dirent *                     dir_entry;
-    int                                 i;
-    char                                path[MAXPATHLEN];
-    GlobusGFSName(globus_l_gfs_file_delete_dir);
-    GlobusGFSFileDebugEnter();
-    
-    /* lstat is the same as stat when not operating on a link */
-    if(lstat(pathname, &stat_buf) != 0)
+    while (coalesce->nextents > 0 &&
+           coalesce->held + nbytes > coalesce->max_mem)
     {
-        result = GlobusGFSErrorSystemError("stat", errno);
-        goto error_stat;
+        globus_l_gfs_posix_coalesce_flush(posix_handle,
+            globus_l_gfs_posix_coalesce_oldest(coalesce));
     }
-    
-    if(!S_ISDIR(stat_buf.st_mode))
+
+    /* append to the extent that ends where this block starts */
+    for (i = 0; i < coalesce->nextents; i++)
     {
-        /* remove anything that isn't a dir -- don't follow links */
-        rc = unlink(pathname);       
-        if(rc != 0)
+        if (coalesce->extents[i].offset +
+                (globus_off_t) coalesce->extents[i].length == offset &&
+            coalesce->extents[i].offset / coalesce->extent_size == window &&
+            coalesce->extents[i].niov < IOV_MAX)
         {
-            result = GlobusGFSErrorSystemError("unlink", errno);
-            goto error_unlink1;
+            extent = &coalesce->extents[i];
+            break;
         }
     }
-    else
+    if (extent == NULL)
     {
-        dir = globus_libc_opendir(pathname);
-        if(!dir)
+        if (coalesce->nextents == GLOBUS_L_GFS_POSIX_MAX_EXTENTS)
         {
-            result = GlobusGFSErrorSystemError("opendir", errno);
-            goto error_open;
+            globus_l_gfs_posix_coalesce_flush(posix_handle,
+                globus_l_gfs_posix_coalesce_oldest(coalesce));
         }
-        
-        for(i = 0;
-            globus_libc_readdir_r(dir, &dir_entry) == 0 && dir_entry;
-            i++)
-        {   
-            if(dir_entry->d_name[0] == '.' && 
-                (dir_entry->d_name[1] == '\0' || 
-                (dir_entry->d_name[1] == '.' && dir_entry->d_name[2] == '\0')))
-            {
-                globus_free(dir_entry);
-                continue;
-            }
-            snprintf(path, sizeof(path), "%s/%s", pathname, dir_entry->d_name);
-            path[MAXPATHLEN - 1] = '\0';
-              
-            /* lstat is the same as stat when not operating on a link */
-            if(lstat(path, &stat_buf) != 0)
-            {
-                result = GlobusGFSErrorSystemError("lstat", errno);
-                globus_free(dir_entry);
-                /* just skip invalid entries */
-                continue;
-            }
-            
-            if(!S_ISDIR(stat_buf.st_mode))
+        iov = (struct iovec *) globus_malloc(16 * sizeof(struct iovec));
+        if (iov == NULL)
+        {
+            globus_l_gfs_posix_coalesce_alone(posix_handle, buffer, nbytes,
+                                              offset);
+            return;
+        }
+        i = coalesce->nextents++;
+        extent = &coalesce->extents[i];
+        memset(extent, 0, sizeof(globus_l_gfs_posix_extent_t));
+        extent->iov = iov;
+        extent->iov_cap = 16;
+        extent->offset = offset;
+        extent->t_first = globus_l_gfs_posix_now();
+    }
+    else if (extent->niov == extent->iov_cap)
+    {
+        iov = (struct iovec *) globus_realloc(extent->iov,
+            2 * extent->iov_cap * sizeof(struct iovec));
+        if (iov == NULL)
+        {
+            /* write what the extent holds, then this block after it */
+            globus_l_gfs_posix_coalesce_flush(posix_handle, i);
+            globus_l_gfs_posix_coalesce_alone(posix_handle, buffer, nbytes,
+                                              offset);
+            return;
+        }
+        extent->iov = iov;
+        extent->iov_cap *= 2;
+    }
+    extent->iov[extent->niov].iov_base = buffer;
+    extent->iov[extent->niov].iov_len = nbytes;
+    extent->niov++;
+    extent->length += nbytes;
+    coalesce->held += nbytes;
+
+    /* join the extent that starts where this one now ends, if any */
+    for (j = 0; j < coalesce->nextents; j++)
+    {
+        next = &coalesce->extents[j];
+        if (j != i &&
+            next->offset == extent->offset + (globus_off_t) extent->length &&
+            next->offset / coalesce->extent_size == window &&
+            extent->niov + next->niov <= IOV_MAX)
+        {
+            if (extent->niov + next->niov > extent->iov_cap)
             {
-                /* remove anything that isn't a dir -- don't follow links */
-                rc = unlink(path);       
-                if(rc != 0)
+                iov = (struct iovec *) globus_realloc(extent->iov,
+                    (extent->niov + next->niov) * sizeof(struct iovec));
+                if (iov == NULL)
                 {
-                    result = GlobusGFSErrorSystemError("unlink", errno);
-                    goto error_unlink2;
+                    /* leave the two extents apart */
+                    break;
                 }
+                extent->iov = iov;
+                extent->iov_cap = extent->niov + next->niov;
             }
-            else
+            memcpy(&extent->iov[extent->niov], next->iov,
+                   next->niov * sizeof(struct iovec));
+            extent->niov += next->niov;
+            extent->length += next->length;
+            globus_free(next->iov);
+            coalesce->nextents--;
+            if (j != coalesce->nextents)
             {
-                result = globus_l_gfs_file_delete_dir(path);
-                if(result != GLOBUS_SUCCESS)
-                {
-                    goto error_recurse;
-                }
+                *next = coalesce->extents[coalesce->nextents];
             }
-
-            globus_free(dir_entry);
+            if (i == coalesce->nextents)
+            {
+                i = j;
+            }
+            extent = &coalesce->extents[i];
+            break;
         }
+    }
 
-        closedir(dir);
-        rc = rmdir(pathname);
-        if(rc != 0)
+    /* the extent has filled its aligned window */
+    if (extent->offset + (globus_off_t) extent->length >=
+            (window + 1) * (globus_off_t) coalesce->extent_size ||
+        extent->niov == IOV_MAX)
+    {
+        globus_l_gfs_posix_coalesce_flush(posix_handle, i);
+    }
+    else if (! coalesce->timer_pending && coalesce->timeout > 0)
+    {
+        GlobusTimeReltimeSet(delay, (long) coalesce->timeout, 0);
+        if (globus_callback_register_oneshot(&coalesce->timer, &delay,
+                globus_l_gfs_posix_coalesce_timer_cb,
+                posix_handle) == GLOBUS_SUCCESS)
         {
-            result = GlobusGFSErrorSystemError("rmdir", errno);
-            goto error_rmdir;
+            coalesce->timer_pending = GLOBUS_TRUE;
         }
-    } 
-    
-    GlobusGFSFileDebugExit();
-    return GLOBUS_SUCCESS;
-
-error_recurse:
-error_unlink2:
-        closedir(dir);
-        globus_free(dir_entry);
-error_open: 
-error_stat:
-error_unlink1:
-error_rmdir:    
-    GlobusGFSFileDebugExitWithError();
-    return result; 
+    }
 }
 
-/* change group */
 static
-globus_result_t
-globus_l_gfs_posix_chgrp(
-    const char *                        pathname,
-    const char *                        group)
+void
+globus_l_gfs_posix_coalesce_unregistered(
+    void *                              user_arg)
 {
-    int                                 rc;
-    globus_result_t                     result;
-    struct group *                      grp_info;
-    int                                 grp_id;
-    char*                               endpt;
+    globus_l_gfs_posix_handle_t *       posix_handle;
 
-    GlobusGFSName(globus_l_gfs_posix_chgrp);
+    posix_handle = (globus_l_gfs_posix_handle_t *) user_arg;
+    globus_mutex_lock(&posix_handle->mutex);
+    posix_handle->coalesce.timer_unregistered = GLOBUS_TRUE;
+    globus_cond_broadcast(&posix_handle->cond);
+    globus_mutex_unlock(&posix_handle->mutex);
+}
 
-    grp_info = getgrnam(group);
-    if(grp_info != NULL)
-    {
-        grp_id = grp_info->gr_gid;
-    }
-    else 
+static
+void
+globus_l_gfs_posix_coalesce_finish(
+    globus_l_gfs_posix_handle_t *       posix_handle)
+{
+    globus_l_gfs_posix_coalesce_t *     coalesce;
+
+    coalesce = &posix_handle->coalesce;
+    globus_l_gfs_posix_coalesce_flush_all(posix_handle);
+    if (coalesce->timer_pending)
     {
-        grp_id = strtol(group, &endpt, 10);
-        if(*group == '\0' || *endpt != '\0') 
+        /*
+         * The timer may be queued, or already running and waiting for the
+         * mutex we hold. It is unregistered either way, and we wait for
+         * the unregister callback, after which it can no longer touch the
+         * handle.
+         */
+        coalesce->timer_pending = GLOBUS_FALSE;
+        coalesce->timer_unregistered = GLOBUS_FALSE;
+        if (globus_callback_unregister(coalesce->timer,
+                globus_l_gfs_posix_coalesce_unregistered, posix_handle,
+                NULL) == GLOBUS_SUCCESS)
         {
-            errno = EPERM;
-            return GLOBUS_FAILURE; 
+            while (! coalesce->timer_unregistered)
+            {
+                globus_cond_wait(&posix_handle->cond, &posix_handle->mutex);
+            }
         }
     }
-    if(grp_id < 0) {
-	errno = EPERM;
-        return GLOBUS_FAILURE;
+    if (coalesce->flushes > 0)
+    {
+        globus_gfs_log_message(GLOBUS_GFS_LOG_INFO,
+            "receive coalesced into %d writes averaging %lu bytes\n",
+            coalesce->flushes,
+            (unsigned long) (coalesce->flushed_bytes / coalesce->flushes));
     }
-    if (chown(pathname, -1, grp_id) != 0) return GLOBUS_FAILURE;
-    return GLOBUS_SUCCESS;
 }
 
-/* cksm from external call main initially include path */
-char    cksm[512];
-
-/*************************************************************************
- * Adler23 checksum
- ************************************************************************/
-globus_result_t 
-globus_l_gfs_posix_cksm_adler32(
-    globus_gfs_operation_t             op,
-    char *                             filename)
+/* hand one received block to storage, takes ownership of the buffer */
+static
+void
+globus_l_gfs_posix_store_block(
+    globus_l_gfs_posix_handle_t *       posix_handle,
+    globus_byte_t *                     buffer,
+    globus_size_t                       nbytes,
+    globus_off_t                        offset)
 {
-    int rc, fd, len;
-    char *ext_adler32, buf[65536], ext_cmd[1024], *pt;
-    FILE *F;
-    struct stat stbuf;
-    uLong adler;
+    globus_off_t                        start_offset;
+    ssize_t                             bytes_written;
+    globus_result_t                     rc;
+    double                              t_start;
 
-    ext_adler32 = NULL;
-    if ((ext_adler32 = getenv("GRIDFTP_CKSUM_EXT_ADLER32")) != NULL)
-    {
-        strcpy(ext_cmd, ext_adler32);
-        strcat(ext_cmd, " ");
-        strcat(ext_cmd, filename);
-        F = popen(ext_cmd, "r");
-        if (F == NULL) return GLOBUS_FAILURE;
-        fscanf(F, "%s", cksm);
-        pclose(F);
+    GlobusGFSName(globus_l_gfs_posix_store_block);
 
-        pt = strchr(cksm, ' ');
-        if (pt != NULL) pt[0] = '\0'; /* take the first string */ 
+    if (posix_handle->result != GLOBUS_SUCCESS ||
+        globus_l_gfs_posix_journal_covers(&posix_handle->journal,
+                                          offset, nbytes))
+    {
+        globus_l_gfs_posix_buf_free(buffer);
+        return;
     }
-    else /* calculate adler32 */
+    if (posix_handle->coalesce.extent_size > 0)
     {
-        rc = stat(filename, &stbuf);
-        if (rc != 0 || ! S_ISREG(stbuf.st_mode) || (fd = open(filename,O_RDONLY)) < 0)
-            return GLOBUS_FAILURE;
-        adler = adler32(0L, Z_NULL, 0);
-        while ((len = read(fd, buf, 65536)) > 0)
-            adler = adler32(adler, buf, len);
+        /* the extent owns the buffer from now on */
+        globus_l_gfs_posix_coalesce_add(posix_handle, buffer, nbytes, offset);
+        return;
+    }
 
-        close(fd);
-        sprintf(cksm, "%08x", adler);
-        cksm[8] = '\0';
+    if (posix_handle->seekable)
+    {
+        start_offset = posix_handle->backend->lseek(posix_handle->fd,
+                                                    offset, SEEK_SET);
     }
 
-    globus_gridftp_server_finished_command(op, GLOBUS_SUCCESS, cksm);       
-    return GLOBUS_SUCCESS;
+    if (posix_handle->seekable && start_offset != offset) 
+    {
+        rc = GlobusGFSErrorSystemError("lseek", errno);
+        globus_l_gfs_posix_set_error(posix_handle, rc);
+    }
+    else
+    {
+        GLOBUS_L_GFS_POSIX_PROBE3(write_entry, posix_handle->pathname,
+                                  (long long) offset, (long long) nbytes);
+        t_start = globus_l_gfs_posix_now();
+        bytes_written = posix_handle->backend->write(posix_handle->fd,
+                                                     buffer, nbytes);
+        GLOBUS_L_GFS_POSIX_PROBE4(write_return, posix_handle->pathname,
+            (long long) offset, (long long) bytes_written,
+            GLOBUS_L_GFS_POSIX_USEC(t_start));
+        globus_l_gfs_posix_tune_sample(&posix_handle->tune, nbytes,
+            globus_l_gfs_posix_now() - t_start);
+        if (bytes_written < (ssize_t) nbytes) 
+        {
+            rc = GlobusGFSErrorSystemError("write", errno);
+            globus_l_gfs_posix_set_error(posix_handle, rc);
+        }
+        else
+        {
+            globus_l_gfs_posix_stored(posix_handle, offset, nbytes);
+        }
+    }
+    globus_l_gfs_posix_buf_free(buffer);
 }
 
-/*************************************************************************
- * MD5 checksum
- ************************************************************************/
-
-struct globus_l_gfs_posix_cksm_md5_cb_t
-{
-    globus_gfs_operation_t             op;
-    MD5_CTX                            c;
-    int                                fd;
-    globus_off_t                       fsize;
-    globus_off_t                       blocksize;
-    globus_off_t                       offset;
-    globus_off_t                       length;
-    globus_off_t                       total_bytes;
-    int                                marker_freq;
-    time_t                             t_lastmarker;
-};
-
-#define MAXBLOCSIZE4CKSM 4*1024*1024
+/* reorder buffer */
 
-void 
-globus_l_gfs_posix_cksm_md5_cb(
-    void *                             user_arg)
+static
+void
+globus_l_gfs_posix_reorder_init(
+    globus_l_gfs_posix_handle_t *       posix_handle,
+    globus_gfs_transfer_info_t *        transfer_info)
 {
-    char                               buffer[MAXBLOCSIZE4CKSM+1];
-    globus_off_t                       readlen;
-    globus_result_t                    result;
-    unsigned char                      md5digest[MD5_DIGEST_LENGTH];
-    int                                i;
-    time_t                             t;
-
-    struct globus_l_gfs_posix_cksm_md5_cb_t * md5updt;
-
-    md5updt = (struct globus_l_gfs_posix_cksm_md5_cb_t *) user_arg;
-    if ( md5updt->length == 0 )
+    globus_l_gfs_posix_reorder_t *      reorder;
+    globus_off_t                        offset;
+    globus_off_t                        length;
+
+    reorder = &posix_handle->reorder;
+    memset(reorder, 0, sizeof(globus_l_gfs_posix_reorder_t));
+    reorder->max_mem = globus_l_gfs_posix_getenv_size(
+        "GRIDFTP_POSIX_REORDER_MAXMEM", 0);
+    if (reorder->max_mem == 0 || ! posix_handle->seekable) return;
+    if (reorder->max_mem < 2 * posix_handle->block_size)
     {
-        close(md5updt->fd);
-
-        MD5_Final(md5digest, &(md5updt->c));
-        for(i = 0; i < MD5_DIGEST_LENGTH; ++i)
-            sprintf(&cksm[i*2], "%02x", (unsigned int)md5digest[i]);
-        cksm[MD5_DIGEST_LENGTH*2+1] = '\0';
+        reorder->max_mem = 2 * posix_handle->block_size;
+    }
+    reorder->max_gap = globus_l_gfs_posix_getenv_size(
+        "GRIDFTP_POSIX_REORDER_MAXGAP", 16 * (globus_off_t) reorder->max_mem);
+    reorder->enabled = GLOBUS_TRUE;
 
-        globus_gridftp_server_finished_command(md5updt->op, GLOBUS_SUCCESS, cksm);       
-        globus_free(md5updt);
+    /* on restart only the missing ranges are sent, in order */
+    if (transfer_info->range_list != NULL &&
+        globus_range_list_size(transfer_info->range_list) > 0)
+    {
+        globus_range_list_copy(&reorder->ranges, transfer_info->range_list);
+        globus_range_list_at(reorder->ranges, 0, &offset, &length);
+        reorder->next_offset = offset;
     }
     else
     {
-        readlen = read(md5updt->fd, buffer, ( md5updt->length > md5updt->blocksize ?
-                                          md5updt->blocksize : md5updt->length ) );
-        if (readlen > 0 && errno == 0)
-        {
-            md5updt->offset += readlen;
-            md5updt->length -= readlen;
-            md5updt->total_bytes += readlen;
+        /* otherwise the blocks start where the write range does */
+        reorder->next_offset = posix_handle->offset;
+    }
+}
 
-            MD5_Update(&(md5updt->c), buffer, readlen);
+/* skip next_offset over the holes between the ranges being received */
+static
+void
+globus_l_gfs_posix_reorder_skip(
+    globus_l_gfs_posix_reorder_t *      reorder)
+{
+    globus_off_t                        offset;
+    globus_off_t                        length;
+    int                                 i;
 
-            t = time(NULL);
-            if ( (t - md5updt->t_lastmarker) > md5updt->marker_freq )
+    if (reorder->ranges == NULL) return;
+    for (i = 0; i < globus_range_list_size(reorder->ranges); i++)
+    {
+        globus_range_list_at(reorder->ranges, i, &offset, &length);
+        if (length < 0 || offset + length > reorder->next_offset)
+        {
+            if (offset > reorder->next_offset)
             {
-                md5updt->t_lastmarker = t;
-                char                        count[128];
-                sprintf(count, "%"GLOBUS_OFF_T_FORMAT, md5updt->total_bytes);
-                globus_gridftp_server_intermediate_command(md5updt->op, GLOBUS_SUCCESS, count);
+                reorder->next_offset = offset;
             }
+            return;
         }
-        else
-        {   // something isn't right, we will end getting a timeout
-            errno = 0;
-            sleep(2);
+    }
+}
+
+/* write out every held block that is next in line */
+static
+void
+globus_l_gfs_posix_reorder_drain(
+    globus_l_gfs_posix_handle_t *       posix_handle,
+    globus_bool_t                       all)
+{
+    globus_l_gfs_posix_reorder_t *      reorder;
+    globus_l_gfs_posix_pending_t *      pending;
+
+    reorder = &posix_handle->reorder;
+    while ((pending = reorder->pending) != NULL &&
+           (all || pending->offset <= reorder->next_offset))
+    {
+        reorder->pending = pending->next;
+        reorder->held -= pending->nbytes;
+        if (pending->offset + (globus_off_t) pending->nbytes >
+                reorder->next_offset)
+        {
+            reorder->next_offset = pending->offset + pending->nbytes;
         }
+        globus_l_gfs_posix_store_block(posix_handle, pending->buffer,
+                                       pending->nbytes, pending->offset);
+        globus_free(pending);
+        globus_l_gfs_posix_reorder_skip(reorder);
+    }
+}
+
+static
+void
+globus_l_gfs_posix_reorder_add(
+    globus_l_gfs_posix_handle_t *       posix_handle,
+    globus_byte_t *                     buffer,
+    globus_size_t                       nbytes,
+    globus_off_t                        offset)
+{
+    globus_l_gfs_posix_reorder_t *      reorder;
+    globus_l_gfs_posix_pending_t *      pending;
+    globus_l_gfs_posix_pending_t **     prev;
+    globus_off_t                        last_end;
 
-        result = globus_callback_register_oneshot( NULL,
-                                                   NULL,
-                                                   globus_l_gfs_posix_cksm_md5_cb,
-                                                   md5updt);
-        if(result != GLOBUS_SUCCESS)
+    reorder = &posix_handle->reorder;
+    if (offset <= reorder->next_offset)
+    {
+        if (offset + (globus_off_t) nbytes > reorder->next_offset)
         {
-            result = GlobusGFSErrorWrapFailed(
-                "globus_callback_register_oneshot", result);
-            globus_panic(NULL, result, "oneshot failed, no recovery");
+            reorder->next_offset = offset + nbytes;
         }
+        globus_l_gfs_posix_store_block(posix_handle, buffer, nbytes, offset);
+        globus_l_gfs_posix_reorder_skip(reorder);
+        globus_l_gfs_posix_reorder_drain(posix_handle, GLOBUS_FALSE);
+        return;
+    }
+
+    pending = (globus_l_gfs_posix_pending_t *)
+        globus_malloc(sizeof(globus_l_gfs_posix_pending_t));
+    if (pending == NULL)
+    {
+        globus_l_gfs_posix_set_error(posix_handle,
+            GlobusGFSErrorMemory("reorder buffer"));
+        globus_l_gfs_posix_buf_free(buffer);
+        return;
+    }
+    pending->buffer = buffer;
+    pending->nbytes = nbytes;
+    pending->offset = offset;
+    for (prev = &reorder->pending;
+         *prev != NULL && (*prev)->offset < offset;
+         prev = &(*prev)->next);
+    pending->next = *prev;
+    *prev = pending;
+    reorder->held += nbytes;
+    reorder->reordered++;
+    if (reorder->held > reorder->peak) reorder->peak = reorder->held;
+
+    for (last_end = offset + nbytes; pending->next; pending = pending->next)
+    {
+        last_end = pending->next->offset + pending->next->nbytes;
+    }
+    if (reorder->held > reorder->max_mem ||
+        last_end - reorder->next_offset > reorder->max_gap)
+    {
+        globus_gfs_log_message(GLOBUS_GFS_LOG_WARN,
+            "reorder buffer full (%lu bytes held, waiting for offset %"
+            GLOBUS_OFF_T_FORMAT "), falling back to out of order writes\n",
+            (unsigned long) reorder->held, reorder->next_offset);
+        globus_l_gfs_posix_reorder_drain(posix_handle, GLOBUS_TRUE);
+        reorder->enabled = GLOBUS_FALSE;
     }
 }
 
-globus_result_t 
-globus_l_gfs_posix_cksm_md5(
-    globus_gfs_operation_t             op,
-    char *                             filename,
-    globus_off_t                       offset,
-    globus_off_t                       length)
+/* room for one more outstanding read without overflowing the buffer */
+static
+globus_bool_t
+globus_l_gfs_posix_reorder_room(
+    globus_l_gfs_posix_handle_t *       posix_handle)
 {
-    char *ext_md5, ext_cmd[1024], *pt;
-    FILE *F;
-
-    int rc, fd;
-    struct stat stbuf;
-    globus_result_t                    result;
+    globus_l_gfs_posix_reorder_t *      reorder;
 
-    ext_md5 = NULL;
-    if ((ext_md5 = getenv("GRIDFTP_CKSUM_EXT_MD5")) != NULL)
-    {
-        strcpy(ext_cmd, ext_md5);
-        strcat(ext_cmd, " ");
-        strcat(ext_cmd, filename);
-        F = popen(ext_cmd, "r");
-        if (F == NULL) return GLOBUS_FAILURE;
-        fscanf(F, "%s", cksm);
-        pclose(F);
+    reorder = &posix_handle->reorder;
+    return (! reorder->enabled || posix_handle->outstanding == 0 ||
+            reorder->held + (posix_handle->outstanding + 1) *
+                posix_handle->block_size <= reorder->max_mem);
+}
 
-        pt = strchr(cksm, ' ');
-        if (pt != NULL) pt[0] = '\0'; /* take the first string */ 
+static
+void
+globus_l_gfs_posix_reorder_finish(
+    globus_l_gfs_posix_handle_t *       posix_handle)
+{
+    globus_l_gfs_posix_reorder_t *      reorder;
 
-        globus_gridftp_server_finished_command(op, GLOBUS_SUCCESS, cksm);       
+    reorder = &posix_handle->reorder;
+    globus_l_gfs_posix_reorder_drain(posix_handle, GLOBUS_TRUE);
+    if (reorder->ranges != NULL)
+    {
+        globus_range_list_destroy(reorder->ranges);
+        reorder->ranges = NULL;
     }
-    else /* calculate md5 */
+    if (reorder->reordered > 0)
     {
-        struct globus_l_gfs_posix_cksm_md5_cb_t * md5updt;
-
-        rc = stat(filename, &stbuf);
-        if (rc != 0 || ! S_ISREG(stbuf.st_mode) || (fd = open(filename,O_RDONLY)) < 0)
-            return GLOBUS_FAILURE;
-
-        md5updt = globus_malloc(sizeof( struct globus_l_gfs_posix_cksm_md5_cb_t));
-        MD5_Init(&(md5updt->c));
+        globus_gfs_log_message(GLOBUS_GFS_LOG_INFO,
+            "receive reordered %d blocks, at most %lu bytes held\n",
+            reorder->reordered, (unsigned long) reorder->peak);
+    }
+}
 
-        if (length < 0 || (offset + length) > stbuf.st_size) 
-            length = stbuf.st_size - offset;
+/*
+ * Preallocation on recv. Parallel streams write at scattered offsets, which
+ * fragments the file badly on XFS/ext4. With GRIDFTP_POSIX_PREALLOCATE set
+ * the expected size (ALLO, or the write range) is reserved up front with
+ * fallocate(FALLOC_FL_KEEP_SIZE), which also fails right away with ENOSPC
+ * instead of halfway through the upload. Blocks reserved beyond the final
+ * end of file are released when the transfer completes.
+ */
+static
+globus_result_t
+globus_l_gfs_posix_preallocate(
+    globus_l_gfs_posix_handle_t *       posix_handle,
+    globus_gfs_transfer_info_t *        transfer_info)
+{
+    globus_off_t                        start;
+    globus_off_t                        end;
 
-        lseek(fd, offset, SEEK_SET); 
+    GlobusGFSName(globus_l_gfs_posix_preallocate);
 
-        md5updt->op = op;
-        md5updt->fd = fd;
-        md5updt->blocksize = MAXBLOCSIZE4CKSM;
-        md5updt->fsize = stbuf.st_size;
-        md5updt->offset = offset;
-        md5updt->length = length;
-        md5updt->total_bytes = 0;
-        globus_gridftp_server_get_update_interval(op, &md5updt->marker_freq);
-        md5updt->t_lastmarker = time(NULL);
+    posix_handle->prealloc_end = 0;
+    if (! globus_l_gfs_posix_getenv_int("GRIDFTP_POSIX_PREALLOCATE", 0) ||
+        ! posix_handle->seekable)
+    {
+        return GLOBUS_SUCCESS;
+    }
 
+    if (transfer_info->alloc_size > 0)
+    {
+        start = 0;
+        end = transfer_info->alloc_size;
+    }
+    else if (posix_handle->block_length > 0)
+    {
+        start = posix_handle->offset;
+        end = posix_handle->offset + posix_handle->block_length;
+    }
+    else
+    {
+        return GLOBUS_SUCCESS;
+    }
 
-        result = globus_callback_register_oneshot( NULL,
-                                                   NULL,
-                                                   globus_l_gfs_posix_cksm_md5_cb,
-                                                   md5updt);
-        if(result != GLOBUS_SUCCESS)
+    if (fallocate(posix_handle->fd, FALLOC_FL_KEEP_SIZE, start, end - start)
+        != 0)
+    {
+        if (errno == ENOSPC || errno == EDQUOT || errno == EFBIG)
         {
-            result = GlobusGFSErrorWrapFailed(
-                "globus_callback_register_oneshot", result);
-            globus_panic(NULL, result, "oneshot failed, no recovery");
+            return GlobusGFSErrorSystemError("fallocate", errno);
         }
-
+        /* not supported by this file system or preload library */
+        return GLOBUS_SUCCESS;
     }
+    posix_handle->prealloc_end = end;
     return GLOBUS_SUCCESS;
 }
 
-/*************************************************************************
- *  command
- *  -------
- *  This interface function is called when the client sends a 'command'.
- *  commands are such things as mkdir, remdir, delete.  The complete
- *  enumeration is below.
- *
- *  To determine which command is being requested look at:
- *      cmd_info->command
- *
- *      GLOBUS_GFS_CMD_MKD = 1,
- *      GLOBUS_GFS_CMD_RMD,
- *      GLOBUS_GFS_CMD_DELE,
- *      GLOBUS_GFS_CMD_RNTO,
- *      GLOBUS_GFS_CMD_RNFR,
- *      GLOBUS_GFS_CMD_CKSM,
- *      GLOBUS_GFS_CMD_SITE_CHMOD,
- *      GLOBUS_GFS_CMD_SITE_DSI
- ************************************************************************/
+/* give back what was reserved beyond the end of file */
 static
 void
-globus_l_gfs_posix_command(
-    globus_gfs_operation_t              op,
-    globus_gfs_command_info_t *         cmd_info,
-    void *                              user_arg)
+globus_l_gfs_posix_prealloc_trim(
+    globus_l_gfs_posix_handle_t *       posix_handle)
 {
-    char *                              PathName;
-    globus_l_gfs_posix_handle_t *       posix_handle;
-    globus_result_t                     rc;
-    struct utimbuf                      ubuf;
-    GlobusGFSName(globus_l_gfs_posix_command);
-
-    posix_handle = (globus_l_gfs_posix_handle_t *) user_arg;
+    struct stat                         stat_buffer;
 
-    PathName=cmd_info->pathname;
-    while (PathName[0] == '/' && PathName[1] == '/')
+    if (posix_handle->prealloc_end == 0) return;
+    if (fstat(posix_handle->fd, &stat_buffer) == 0 &&
+        stat_buffer.st_size < posix_handle->prealloc_end)
     {
-        PathName++;
+        /* truncating to the current size drops the blocks past EOF */
+        ftruncate(posix_handle->fd, stat_buffer.st_size);
     }
+    posix_handle->prealloc_end = 0;
+}
 
-    rc = GLOBUS_SUCCESS;
-    switch(cmd_info->command)
-    {
-      case GLOBUS_GFS_CMD_MKD:
-        (mkdir(PathName, 0777) == 0) || 
-            (rc = GlobusGFSErrorSystemError("mkdir", errno)); 
-        break;
-      case GLOBUS_GFS_CMD_RMD:
-        (rmdir(PathName) == 0) || 
-            (rc = GlobusGFSErrorSystemError("rmdir", errno)); 
-        break;
-      case GLOBUS_GFS_CMD_DELE:
-        (unlink(PathName) == 0) ||
-            (rc = GlobusGFSErrorSystemError("unlink", errno)); 
-        break;
-      case GLOBUS_GFS_CMD_TRNC:
-        (truncate(PathName, cmd_info->cksm_offset) == 0) ||
-            (rc = GlobusGFSErrorSystemError("truncate", errno)); 
-        break;
-      case GLOBUS_GFS_CMD_SITE_RDEL:
-        rc = globus_l_gfs_file_delete_dir(PathName);
-        break;
-      case GLOBUS_GFS_CMD_RNTO:
-        (rename(cmd_info->rnfr_pathname, PathName) == 0) || 
-            (rc = GlobusGFSErrorSystemError("rename", errno)); 
-        break;
-      case GLOBUS_GFS_CMD_SITE_CHMOD:
-        (chmod(PathName, cmd_info->chmod_mode) == 0) ||
-            (rc = GlobusGFSErrorSystemError("chmod", errno)); 
-        break;
-      case GLOBUS_GFS_CMD_SITE_CHGRP:
-        (globus_l_gfs_posix_chgrp(PathName, cmd_info->chgrp_group) == 0) ||
-            (rc = GlobusGFSErrorSystemError("chgrp", errno));
-        break;
-      case GLOBUS_GFS_CMD_SITE_UTIME:
-        ubuf.modtime = cmd_info->utime_time;
-        ubuf.actime = time(NULL);
-
-        (utime(PathName, &ubuf) == 0) || 
-            (rc = GlobusGFSErrorSystemError("utime", errno));
-        break;
-      case GLOBUS_GFS_CMD_SITE_SYMLINK:
-        (symlink(cmd_info->from_pathname, cmd_info->pathname) == 0) || 
-            (rc = GlobusGFSErrorSystemError("symlink", errno));
-        break;
-      case GLOBUS_GFS_CMD_CKSM:
-        if (!strcmp(cmd_info->cksm_alg, "adler32") || 
-            !strcmp(cmd_info->cksm_alg, "ADLER32"))
-            rc = globus_l_gfs_posix_cksm_adler32(op, 
-                                                 PathName);
-        else if (!strcmp(cmd_info->cksm_alg, "md5") ||
-                  !strcmp(cmd_info->cksm_alg, "MD5"))
-            rc = globus_l_gfs_posix_cksm_md5(op,
-                                             PathName,
-                                             cmd_info->cksm_offset,
-                                             cmd_info->cksm_length);
-        else
-            rc = GLOBUS_FAILURE;
-        break;
+/*
+ * Small file fast path. A transfer of a file no larger than one block is
+ * mostly per file overhead: the descriptor pool, the concurrent readers
+ * and the tuning of send, the optimal_count buffers posted by recv. With
+ * GRIDFTP_POSIX_SMALL_FILE set, a send of a file up to that size (and
+ * block_size) does one read and one register_write per range, and a recv
+ * whose ALLO or write range is that small keeps a single read posted and
+ * writes each block as it arrives. The time from the request to the
+ * finished transfer is logged for each of these files.
+ */
+static
+globus_bool_t
+globus_l_gfs_posix_small(
+    globus_l_gfs_posix_handle_t *       posix_handle,
+    globus_off_t                        size)
+{
+    char                                value[64];
+    globus_off_t                        limit;
 
-      default:
-        rc = GLOBUS_FAILURE;
-        break;
+    if (! posix_handle->seekable || size < 0 ||
+        globus_l_gfs_posix_prefix_lookup("GRIDFTP_POSIX_SMALL_FILE",
+            posix_handle->pathname, value, sizeof(value)) == NULL)
+    {
+        return GLOBUS_FALSE;
+    }
+    limit = globus_l_gfs_posix_parse_size(value);
+    if (limit > (globus_off_t) posix_handle->block_size)
+    {
+        limit = posix_handle->block_size;
     }
+    return (size <= limit);
+}
 
-    if ( rc != GLOBUS_SUCCESS || cmd_info->command != GLOBUS_GFS_CMD_CKSM)
-        globus_gridftp_server_finished_command(op, rc, NULL);
+static
+void
+globus_l_gfs_posix_small_report(
+    globus_l_gfs_posix_handle_t *       posix_handle,
+    const char *                        what)
+{
+    double                              elapsed;
+
+    elapsed = globus_l_gfs_posix_now() - posix_handle->t_begin;
+    GLOBUS_L_GFS_POSIX_PROBE3(small_file, posix_handle->pathname,
+                              (long long) posix_handle->transferred,
+                              (long) (elapsed * 1000000));
+    globus_gfs_log_message(GLOBUS_GFS_LOG_INFO,
+        "%s small file %s: %lld bytes in %.3f ms\n", what,
+        posix_handle->pathname, (long long) posix_handle->transferred,
+        elapsed * 1000);
 }
 
-/* receive file from client */
+/*
+ * Striped transfers. In a striped server (a frontend started with -r and
+ * its data nodes, which may all run on one host for testing) every data
+ * node loads this DSI and works on the shared file system, and the
+ * server gives each node only its stripes: get_read_range() returns the
+ * ranges of node_ndx on send, and on receive blocks arrive with their
+ * file offsets. Both paths already read and write exactly there. The
+ * data channels stay with the server, which is why the active, passive
+ * and data destroy slots of the iface are NULL. A node must only leave
+ * alone what concerns the whole file: the reorder buffer, the restart
+ * journal and the trim after preallocation are off when node_count > 1.
+ * Each node logs what it moved, the send_range USDT probe fires for
+ * every stripe.
+ */
+static
+void
+globus_l_gfs_posix_stripe_report(
+    globus_l_gfs_posix_handle_t *       posix_handle,
+    const char *                        what,
+    const char *                        unit)
+{
+    double                              elapsed;
+
+    if (posix_handle->node_count <= 1) return;
+    elapsed = globus_l_gfs_posix_now() - posix_handle->t_begin;
+    globus_gfs_log_message(GLOBUS_GFS_LOG_INFO,
+        "striped %s: node %d of %d, %d %s, %lld bytes, %.2f s, "
+        "%.1f MB/s\n", what, posix_handle->node_ndx + 1,
+        posix_handle->node_count, posix_handle->nranges, unit,
+        (long long) posix_handle->transferred, elapsed,
+        (elapsed > 0 ? posix_handle->transferred / elapsed / 1e6 : 0.0));
+}
 
+/* the receive is over: close the file and finish, with the mutex held */
 static
 void
-globus_l_gfs_posix_write_to_storage(
-    globus_l_gfs_posix_handle_t *      posix_handle);
+globus_l_gfs_posix_recv_end(
+    globus_l_gfs_posix_handle_t *       posix_handle)
+{
+    int                                 close_rc;
+    double                              t_probe;
+
+    GlobusGFSName(globus_l_gfs_posix_recv_end);
+
+    globus_l_gfs_posix_reorder_finish(posix_handle);
+    globus_l_gfs_posix_coalesce_finish(posix_handle);
+    globus_l_gfs_posix_flush_finish(posix_handle);
+    globus_l_gfs_posix_journal_finish(posix_handle);
+    globus_l_gfs_posix_prealloc_trim(posix_handle);
+    GLOBUS_L_GFS_POSIX_PROBE1(close_entry, posix_handle->pathname);
+    t_probe = GLOBUS_L_GFS_POSIX_CLOCK(close_return);
+    close_rc = posix_handle->backend->close(posix_handle->fd);
+    GLOBUS_L_GFS_POSIX_PROBE3(close_return, posix_handle->pathname,
+                              close_rc, GLOBUS_L_GFS_POSIX_USEC(t_probe));
+    if (close_rc == -1 && posix_handle->result == GLOBUS_SUCCESS)
+    {
+         posix_handle->result = GlobusGFSErrorSystemError("close", errno);
+    }
+    sprintf(err_msg,"receive %d blocks of size %d bytes\n",
+                    local_io_count,local_io_block_size);
+    globus_gfs_log_message(GLOBUS_GFS_LOG_INFO,err_msg);
+    local_io_count = 0;
+    local_io_block_size = 0;
+    globus_l_gfs_posix_tune_report(&posix_handle->tune, "receive");
+    globus_l_gfs_posix_shape_report(&posix_handle->shape, "receive");
+    globus_l_gfs_posix_buf_report();
+    globus_l_gfs_posix_admit_release(&posix_handle->admit);
+    if (posix_handle->small)
+    {
+        globus_l_gfs_posix_small_report(posix_handle, "receive");
+    }
+    globus_l_gfs_posix_stripe_report(posix_handle, "receive", "blocks");
+
+    globus_l_gfs_posix_trace_end(posix_handle->op, posix_handle->result,
+                                 posix_handle->transferred, 0);
+    globus_gridftp_server_finished_transfer(posix_handle->op,
+                                            posix_handle->result);
+}
 
 static
 void 
@@ -1032,68 +6821,77 @@ globus_l_gfs_posix_write_to_storage_cb(
     globus_bool_t                       eof,
     void *                              user_arg)
 {
-    globus_off_t                        start_offset;
-    globus_size_t                       bytes_written;
     globus_result_t                     rc; 
     globus_l_gfs_posix_handle_t *       posix_handle;
+    char *                              pathname;
+    double                              t_cb;
+    double                              throttled = 0;
                                                                                                                                            
     GlobusGFSName(globus_l_gfs_posix_write_to_storage_cb);
     posix_handle = (globus_l_gfs_posix_handle_t *) user_arg;
+    /* the handle may be on to the next transfer by the time we return */
+    pathname = posix_handle->pathname;
+    GLOBUS_L_GFS_POSIX_PROBE3(recv_cb_entry, pathname, (long long) offset,
+                              (long long) nbytes);
+    t_cb = GLOBUS_L_GFS_POSIX_CLOCK(recv_cb_return);
+    globus_l_gfs_posix_buf_pin();
+    if (result == GLOBUS_SUCCESS)
+    {
+        throttled = globus_l_gfs_posix_shape_take(posix_handle, nbytes);
+    }
 
     globus_mutex_lock(&posix_handle->mutex);
-    rc = GLOBUS_SUCCESS;
+    if (throttled > 0)
+    {
+        posix_handle->shape.throttled += throttled;
+        posix_handle->shape.waits++;
+    }
     if (result != GLOBUS_SUCCESS)
     {
         rc = GlobusGFSErrorGeneric("call back fail");
-        posix_handle->done = GLOBUS_TRUE;
+        globus_l_gfs_posix_set_error(posix_handle, rc);
     }
     else if (eof)
     {
         posix_handle->done = GLOBUS_TRUE;
     }
 
-    if (nbytes > 0)
+    if (nbytes > 0 && posix_handle->result == GLOBUS_SUCCESS)
     {
-        if (posix_handle->seekable)
+        if (nbytes != local_io_block_size)
+        {
+             if (local_io_block_size != 0)
+             {
+                  sprintf(err_msg,"receive %d blocks of size %d bytes\n",
+                                  local_io_count,local_io_block_size);
+                  globus_gfs_log_message(GLOBUS_GFS_LOG_INFO,err_msg);
+             }
+             local_io_block_size = nbytes;
+             local_io_count=1;
+        }
+        else
         {
-            start_offset = lseek(posix_handle->fd, offset, SEEK_SET);
+             local_io_count++;
         }
+        posix_handle->transferred += nbytes;
+        posix_handle->nranges++;
 
-        if (posix_handle->seekable && start_offset != offset) 
+        if (posix_handle->reorder.enabled)
         {
-            rc = GlobusGFSErrorSystemError("lseek", errno);
-            posix_handle->done = GLOBUS_TRUE;
+            globus_l_gfs_posix_reorder_add(posix_handle, buffer,
+                                           nbytes, offset);
         }
         else
         {
-            bytes_written = write(posix_handle->fd, buffer, nbytes);
-            if (bytes_written < nbytes) 
-            {
-                rc = GlobusGFSErrorSystemError("write", errno);
-                posix_handle->done = GLOBUS_TRUE;
-            }
-            else
-            {
-                globus_gridftp_server_update_bytes_written(op, offset, nbytes);
-            }
-            if (nbytes != local_io_block_size)
-            {
-                 if (local_io_block_size != 0)
-                 {
-                      sprintf(err_msg,"receive %d blocks of size %d bytes\n",
-                                      local_io_count,local_io_block_size);
-                      globus_gfs_log_message(GLOBUS_GFS_LOG_INFO,err_msg);
-                 }
-                 local_io_block_size = nbytes;
-                 local_io_count=1;
-            }
-            else
-            {
-                 local_io_count++;
-            }
+            globus_l_gfs_posix_store_block(posix_handle, buffer,
+                                           nbytes, offset);
         }
+        buffer = NULL;
+    }
+    if (buffer != NULL)
+    {
+        globus_l_gfs_posix_buf_free(buffer);
     }
-    globus_free(buffer);
 
     posix_handle->outstanding--;
     if (! posix_handle->done)
@@ -1102,19 +6900,11 @@ globus_l_gfs_posix_write_to_storage_cb(
     }
     else if (posix_handle->outstanding == 0) 
     {
-        if (close(posix_handle->fd) == -1) 
-        {
-             rc = GlobusGFSErrorSystemError("close", errno);
-        }
-        sprintf(err_msg,"receive %d blocks of size %d bytes\n",
-                        local_io_count,local_io_block_size);
-        globus_gfs_log_message(GLOBUS_GFS_LOG_INFO,err_msg);
-        local_io_count = 0;
-        local_io_block_size = 0;
-
-        globus_gridftp_server_finished_transfer(op, rc);
+        globus_l_gfs_posix_recv_end(posix_handle);
     }
     globus_mutex_unlock(&posix_handle->mutex);
+    GLOBUS_L_GFS_POSIX_PROBE2(recv_cb_return, pathname,
+                              GLOBUS_L_GFS_POSIX_USEC(t_cb));
 }
 
 static
@@ -1126,17 +6916,31 @@ globus_l_gfs_posix_write_to_storage(
     globus_result_t                     rc;
 
     GlobusGFSName(globus_l_gfs_posix_write_to_storage);
-    globus_gridftp_server_get_optimal_concurrency(posix_handle->op,
+    if (posix_handle->tune.enabled)
+    {
+        posix_handle->optimal_count = posix_handle->tune.count;
+    }
+    else if (! posix_handle->small)
+    {
+        globus_gridftp_server_get_optimal_concurrency(posix_handle->op,
                                                   &posix_handle->optimal_count);
+    }
 
-    while (posix_handle->outstanding < posix_handle->optimal_count) 
+    while (posix_handle->outstanding < posix_handle->optimal_count &&
+           globus_l_gfs_posix_reorder_room(posix_handle)) 
     {
-        buffer = globus_malloc(posix_handle->block_size);
+        buffer = globus_l_gfs_posix_buf_get(posix_handle->block_size,
+                                            posix_handle->outstanding == 0);
+        if (buffer == NULL && errno == ENOBUFS)
+        {
+            /* over the memory budget, post more when a read returns */
+            break;
+        }
         if (buffer == NULL)
         {
             rc = GlobusGFSErrorGeneric("fail to allocate buffer");
-            globus_gridftp_server_finished_transfer(posix_handle->op, rc);
-            return;
+            globus_l_gfs_posix_set_error(posix_handle, rc);
+            break;
         }
         rc = globus_gridftp_server_register_read(posix_handle->op,
                                        buffer,
@@ -1146,14 +6950,42 @@ globus_l_gfs_posix_write_to_storage(
         if (rc != GLOBUS_SUCCESS)
         {
             rc = GlobusGFSErrorGeneric("globus_gridftp_server_register_read() fail");
-            globus_gridftp_server_finished_transfer(posix_handle->op, rc);
-            return;
+            globus_l_gfs_posix_set_error(posix_handle, rc);
+            globus_l_gfs_posix_buf_free(buffer);
+            break;
         }
         posix_handle->outstanding++;
     }
+    /* failed with nothing in flight, no callback is left to finish it */
+    if (posix_handle->done && posix_handle->outstanding == 0)
+    {
+        globus_l_gfs_posix_recv_end(posix_handle);
+    }
     return; 
 }
 
+/* the first reads of a receive, once admitted */
+static
+void
+globus_l_gfs_posix_recv_admitted(
+    void *                              user_arg)
+{
+    globus_l_gfs_posix_handle_t *       posix_handle;
+
+    posix_handle = (globus_l_gfs_posix_handle_t *) user_arg;
+    globus_mutex_lock(&posix_handle->mutex);
+    if (posix_handle->result != GLOBUS_SUCCESS)
+    {
+        /* aborted while it waited, nothing was read */
+        globus_l_gfs_posix_recv_end(posix_handle);
+    }
+    else
+    {
+        globus_l_gfs_posix_write_to_storage(posix_handle);
+    }
+    globus_mutex_unlock(&posix_handle->mutex);
+}
+
 /*************************************************************************
  *  recv
  *  ----
@@ -1179,6 +7011,9 @@ globus_l_gfs_posix_recv(
     globus_l_gfs_posix_handle_t *      posix_handle;
     globus_result_t                     rc; 
     struct stat                         stat_buffer;
+    int                                 flags;
+    ssize_t                             xattr_len;
+    double                              t_probe;
     char *filename;
 
     filename=NULL;
@@ -1196,13 +7031,24 @@ globus_l_gfs_posix_recv(
     posix_handle->op = op;
     posix_handle->outstanding = 0;
     posix_handle->done = GLOBUS_FALSE;
+    posix_handle->result = GLOBUS_SUCCESS;
+    posix_handle->small = GLOBUS_FALSE;
+    posix_handle->t_begin = globus_l_gfs_posix_now();
+    posix_handle->transferred = 0;
+    posix_handle->node_ndx = transfer_info->node_ndx;
+    posix_handle->node_count = transfer_info->node_count;
+    posix_handle->nranges = 0;
     globus_gridftp_server_get_block_size(op, &posix_handle->block_size); 
+    globus_l_gfs_posix_trace_transfer(posix_handle,
+                                      GLOBUS_L_GFS_POSIX_TRACE_RECV,
+                                      transfer_info);
 
     globus_gridftp_server_get_write_range(posix_handle->op,
                                           &posix_handle->offset,
                                           &posix_handle->block_length);
 
-    globus_gridftp_server_begin_transfer(posix_handle->op, 0, posix_handle);
+    globus_gridftp_server_begin_transfer(posix_handle->op,
+        GLOBUS_GFS_EVENT_TRANSFER_ABORT, posix_handle);
 
 /* 
    Calculate space usage of a xrootd space token. This is xrootd specific.
@@ -1229,7 +7075,12 @@ globus_l_gfs_posix_recv(
         else
             strcat(cns, token);
 
-        if (getxattr(cns, "xroot.space", xattrs, 128) > 0)
+        GLOBUS_L_GFS_POSIX_PROBE1(quota_entry, cns);
+        t_probe = GLOBUS_L_GFS_POSIX_CLOCK(quota_return);
+        xattr_len = getxattr(cns, "xroot.space", xattrs, 128);
+        GLOBUS_L_GFS_POSIX_PROBE3(quota_return, cns, (long long) xattr_len,
+                                  GLOBUS_L_GFS_POSIX_USEC(t_probe));
+        if (xattr_len > 0)
         {
             spaceusage = 0;
             spacequota = 0;
@@ -1252,6 +7103,8 @@ globus_l_gfs_posix_recv(
             if (spaceusage > spacequota) 
             {
                 rc = GlobusGFSErrorGeneric(err_msg);
+                globus_l_gfs_posix_trace_end(op, rc,
+                                             posix_handle->transferred, 0);
                 globus_gridftp_server_finished_transfer(op, rc);
                 return;
             }
@@ -1264,6 +7117,8 @@ globus_l_gfs_posix_recv(
         strcat(ext_cmd, " ");
         strcat(ext_cmd, posix_handle->pathname);
 
+        GLOBUS_L_GFS_POSIX_PROBE1(cgi_entry, posix_handle->pathname);
+        t_probe = GLOBUS_L_GFS_POSIX_CLOCK(cgi_return);
         F = popen(ext_cmd, "r");
         if (F) 
         {
@@ -1271,39 +7126,134 @@ globus_l_gfs_posix_recv(
             fscanf(F, "%s", filename);
             pclose(F);
         }
+        GLOBUS_L_GFS_POSIX_PROBE2(cgi_return, posix_handle->pathname,
+                                  GLOBUS_L_GFS_POSIX_USEC(t_probe));
     }
 /* end of XROOTD specfic code */
     
     if ( filename == NULL ) filename = posix_handle->pathname;
-    if (stat(posix_handle->pathname, &stat_buffer) == 0)
+    posix_handle->backend = globus_l_gfs_posix_backend_select(posix_handle,
+                                                    posix_handle->pathname);
+    globus_l_gfs_posix_fdcache_forget(posix_handle, posix_handle->pathname,
+                                      GLOBUS_FALSE);
+    globus_l_gfs_posix_flush_init(posix_handle);
+    flags = O_WRONLY;
+    if (posix_handle->flush.durability == GLOBUS_L_GFS_POSIX_DURABLE_DSYNC)
+    {
+        flags |= O_DSYNC;
+    }
+    GLOBUS_L_GFS_POSIX_PROBE2(open_entry, filename, flags);
+    t_probe = GLOBUS_L_GFS_POSIX_CLOCK(open_return);
+    posix_handle->fd = -1;
+    if (posix_handle->backend->stat(posix_handle->pathname, &stat_buffer) == 0)
+    {
+        posix_handle->fd = posix_handle->backend->open(filename,
+                                      flags, 0); /* |O_TRUNC);  */
+        if (posix_handle->fd != -1 &&
+            posix_handle->backend == &globus_l_gfs_posix_backend_posix)
+        {
+            /* the digests stored for the old content no longer hold */
+            globus_l_gfs_posix_cksm_forget(filename);
+        }
+    }
+    else if (errno == ENOENT)
+    {
+        posix_handle->fd = posix_handle->backend->open(filename,
+                                      flags|O_CREAT,
+                                      S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH);    
+        if (posix_handle->fd == -1 && errno == ENOENT &&
+            globus_l_gfs_posix_prefix_int("GRIDFTP_POSIX_MKDIRS",
+                                          posix_handle->pathname, 0) &&
+            globus_l_gfs_posix_mkdirs(posix_handle, filename) == 0)
+        {
+            posix_handle->fd = posix_handle->backend->open(filename,
+                                      flags|O_CREAT,
+                                      S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH);
+        }
+    }
+    GLOBUS_L_GFS_POSIX_PROBE3(open_return, filename, posix_handle->fd,
+                              GLOBUS_L_GFS_POSIX_USEC(t_probe));
+
+    if (posix_handle->fd == -1)
+    {
+        rc = GlobusGFSErrorSystemError("open", errno);
+        globus_l_gfs_posix_trace_end(op, rc,
+                                     posix_handle->transferred, 0);
+        globus_gridftp_server_finished_transfer(op, rc);
+        return;
+    }
+
+/*
+ * /dev/null and /dev/zero (the null backend) are not seekable. They are used
+ * for memory-to-memory performance test
+ */
+    posix_handle->seekable = posix_handle->backend->seekable;
+
+    rc = globus_l_gfs_posix_preallocate(posix_handle, transfer_info);
+    if (rc != GLOBUS_SUCCESS)
     {
-        posix_handle->fd = open(filename, O_WRONLY); /* |O_TRUNC);  */
+        posix_handle->backend->close(posix_handle->fd);
+        globus_l_gfs_posix_trace_end(op, rc,
+                                     posix_handle->transferred, 0);
+        globus_gridftp_server_finished_transfer(op, rc);
+        return;
     }
-    else if (errno == ENOENT)
+    if (posix_handle->node_count > 1)
     {
-        posix_handle->fd = open(filename, O_WRONLY|O_CREAT,
-                                 S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH);    
+        /* the other data nodes may still be extending the file, a trim
+           to our idea of its size would cut their blocks off */
+        posix_handle->prealloc_end = 0;
     }
 
-    if (posix_handle->fd == -1)
+    /* one block at a time, written as it arrives */
+    posix_handle->small = globus_l_gfs_posix_small(posix_handle,
+        (transfer_info->alloc_size > 0 ? transfer_info->alloc_size :
+         posix_handle->offset == 0 && posix_handle->block_length > 0 ?
+         posix_handle->block_length : -1));
+    if (posix_handle->small)
     {
-        rc = GlobusGFSErrorSystemError("open", errno);
-        globus_gridftp_server_finished_transfer(op, rc);
+        memset(&posix_handle->coalesce, 0,
+               sizeof(globus_l_gfs_posix_coalesce_t));
+        memset(&posix_handle->reorder, 0,
+               sizeof(globus_l_gfs_posix_reorder_t));
+        memset(&posix_handle->journal, 0,
+               sizeof(globus_l_gfs_posix_journal_t));
+        memset(&posix_handle->tune, 0, sizeof(globus_l_gfs_posix_tune_t));
+        posix_handle->optimal_count = 1;
+        globus_l_gfs_posix_shape_init(posix_handle);
+        globus_l_gfs_posix_admit(posix_handle,
+                                 globus_l_gfs_posix_recv_admitted);
+        return;
     }
 
-/*
- * /dev/null and /dev/zero are not seekable. They are used for memory-to-memory
- * performance test
- */
-    posix_handle->seekable=1;
-    if (! strcmp(posix_handle->pathname,"/dev/null"))
+    /* network blocks arrive in block_size, so the storage I/O size can
+       only be tuned when they are coalesced */
+    globus_l_gfs_posix_geometry(posix_handle);
+    globus_l_gfs_posix_coalesce_init(posix_handle);
+    if (posix_handle->node_count > 1)
     {
-        posix_handle->seekable=0;
+        /* this node only gets its stripes of the file */
+        memset(&posix_handle->reorder, 0,
+               sizeof(globus_l_gfs_posix_reorder_t));
+        memset(&posix_handle->journal, 0,
+               sizeof(globus_l_gfs_posix_journal_t));
     }
-
-    globus_mutex_lock(&posix_handle->mutex);
-    globus_l_gfs_posix_write_to_storage(posix_handle);
-    globus_mutex_unlock(&posix_handle->mutex);
+    else
+    {
+        globus_l_gfs_posix_reorder_init(posix_handle, transfer_info);
+        globus_l_gfs_posix_journal_init(posix_handle, transfer_info);
+    }
+    globus_gridftp_server_get_optimal_concurrency(posix_handle->op,
+                                                  &posix_handle->optimal_count);
+    globus_l_gfs_posix_tune_init(&posix_handle->tune,
+                                 posix_handle->optimal_count,
+                                 (posix_handle->coalesce.extent_size > 0 ?
+                                  posix_handle->coalesce.extent_size :
+                                  posix_handle->block_size),
+                                 posix_handle->coalesce.extent_size > 0);
+    globus_l_gfs_posix_shape_init(posix_handle);
+
+    globus_l_gfs_posix_admit(posix_handle, globus_l_gfs_posix_recv_admitted);
     return;
 }
 
@@ -1314,6 +7264,58 @@ void
 globus_l_gfs_posix_read_from_storage(
     globus_l_gfs_posix_handle_t *      posix_handle);
 
+/* open the extra descriptors of the pool, fds[0] is posix_handle->fd */
+static
+void
+globus_l_gfs_posix_open_fds(
+    globus_l_gfs_posix_handle_t *       posix_handle)
+{
+    int                                 nfds;
+    double                              t_probe;
+
+    posix_handle->fds[0] = posix_handle->fd;
+    posix_handle->nfds = 1;
+    if (! posix_handle->seekable) return;
+
+    nfds = globus_l_gfs_posix_prefix_int("GRIDFTP_POSIX_NFDS",
+                                         posix_handle->pathname, 1);
+    if (nfds > GLOBUS_L_GFS_POSIX_MAX_FDS) nfds = GLOBUS_L_GFS_POSIX_MAX_FDS;
+    while (posix_handle->nfds < nfds)
+    {
+        GLOBUS_L_GFS_POSIX_PROBE2(open_entry, posix_handle->pathname,
+                                  O_RDONLY);
+        t_probe = GLOBUS_L_GFS_POSIX_CLOCK(open_return);
+        posix_handle->fds[posix_handle->nfds] =
+            posix_handle->backend->open(posix_handle->pathname, O_RDONLY, 0);
+        GLOBUS_L_GFS_POSIX_PROBE3(open_return, posix_handle->pathname,
+                                  posix_handle->fds[posix_handle->nfds],
+                                  GLOBUS_L_GFS_POSIX_USEC(t_probe));
+        if (posix_handle->fds[posix_handle->nfds] < 0) break;
+        posix_handle->nfds++;
+    }
+}
+
+static
+void
+globus_l_gfs_posix_close_fds(
+    globus_l_gfs_posix_handle_t *       posix_handle)
+{
+    double                              t_probe;
+    int                                 close_rc;
+    int                                 i;
+
+    for (i = 1; i < posix_handle->nfds; i++)
+    {
+        posix_handle->backend->close(posix_handle->fds[i]);
+    }
+    posix_handle->nfds = 1;
+    GLOBUS_L_GFS_POSIX_PROBE1(close_entry, posix_handle->pathname);
+    t_probe = GLOBUS_L_GFS_POSIX_CLOCK(close_return);
+    close_rc = globus_l_gfs_posix_fdcache_close(posix_handle, posix_handle->fd);
+    GLOBUS_L_GFS_POSIX_PROBE3(close_return, posix_handle->pathname, close_rc,
+                              GLOBUS_L_GFS_POSIX_USEC(t_probe));
+}
+
 static
 void
 globus_l_gfs_posix_read_from_storage_cb(
@@ -1325,57 +7327,160 @@ globus_l_gfs_posix_read_from_storage_cb(
 {
     GlobusGFSName(globus_l_gfs_posix_read_from_storage_cb);
     globus_l_gfs_posix_handle_t *      posix_handle;
+    char *                              pathname;
+    double                              t_cb;
  
     posix_handle = (globus_l_gfs_posix_handle_t *) user_arg;
 
+    pathname = posix_handle->pathname;
+    GLOBUS_L_GFS_POSIX_PROBE2(send_cb_entry, pathname, (long long) nbytes);
+    t_cb = GLOBUS_L_GFS_POSIX_CLOCK(send_cb_return);
+    globus_l_gfs_posix_buf_free(buffer);
+    globus_mutex_lock(&posix_handle->mutex);
+    if (result != GLOBUS_SUCCESS)
+    {
+        globus_l_gfs_posix_set_error(posix_handle, result);
+    }
     posix_handle->outstanding--;
-    globus_free(buffer);
+    posix_handle->active++;
+    globus_mutex_unlock(&posix_handle->mutex);
+    globus_l_gfs_posix_read_from_storage(posix_handle);
+    GLOBUS_L_GFS_POSIX_PROBE2(send_cb_return, pathname,
+                              GLOBUS_L_GFS_POSIX_USEC(t_cb));
+}
+
+/* an extra reader, started to fill free slots */
+static
+void
+globus_l_gfs_posix_read_kick(
+    void *                              user_arg)
+{
+    globus_l_gfs_posix_handle_t *      posix_handle;
+    char *                              pathname;
+    double                              t_cb;
+ 
+    posix_handle = (globus_l_gfs_posix_handle_t *) user_arg;
+
+    pathname = posix_handle->pathname;
+    GLOBUS_L_GFS_POSIX_PROBE1(kick_entry, pathname);
+    t_cb = GLOBUS_L_GFS_POSIX_CLOCK(kick_return);
+    globus_mutex_lock(&posix_handle->mutex);
+    posix_handle->kicks--;
+    posix_handle->active++;
+    globus_mutex_unlock(&posix_handle->mutex);
     globus_l_gfs_posix_read_from_storage(posix_handle);
+    GLOBUS_L_GFS_POSIX_PROBE2(kick_return, pathname,
+                              GLOBUS_L_GFS_POSIX_USEC(t_cb));
+}
+
+/* read length bytes at offset, the result is only short at end of file */
+static
+ssize_t
+globus_l_gfs_posix_read_block(
+    globus_l_gfs_posix_handle_t *       posix_handle,
+    int                                 fd,
+    globus_byte_t *                     buffer,
+    globus_size_t                       length,
+    globus_off_t                        offset)
+{
+    globus_size_t                       total = 0;
+    ssize_t                             nbytes;
+
+    if (! posix_handle->seekable)
+    {
+        return posix_handle->backend->read(fd, buffer, length);
+    }
+    while (total < length)
+    {
+        nbytes = posix_handle->backend->pread(fd, buffer + total,
+                                              length - total, offset + total);
+        if (nbytes < 0)
+        {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (nbytes == 0) break;
+        total += nbytes;
+    }
+    return total;
 }
 
+/*
+ * Fetch the next range to send from the server. Restarts and partial
+ * retrieves can ask for several ranges, and the server returns a zero
+ * length once all of them have been handed out.
+ */
+static
+globus_bool_t
+globus_l_gfs_posix_next_range(
+    globus_l_gfs_posix_handle_t *       posix_handle)
+{
+    globus_gridftp_server_get_read_range(posix_handle->op,
+                                         &posix_handle->offset,
+                                         &posix_handle->block_length);
+    if (posix_handle->block_length == 0)
+    {
+        return GLOBUS_FALSE;
+    }
+    if (posix_handle->backend == &globus_l_gfs_posix_backend_null &&
+        posix_handle->block_length > 0)
+    {
+        globus_l_gfs_posix_backend_null_want(posix_handle->fd,
+                                             posix_handle->block_length);
+    }
+    GLOBUS_L_GFS_POSIX_PROBE3(send_range, posix_handle->pathname,
+                              (long long) posix_handle->offset,
+                              (long long) posix_handle->block_length);
+    posix_handle->nranges++;
+    return GLOBUS_TRUE;
+}
 
+/*
+ * Every caller holds one count in posix_handle->active (taken under the
+ * mutex). Slots are reserved under the mutex, the storage reads of a
+ * seekable file run outside it so up to optimal_count of them proceed at
+ * once, each in its own thread (extra readers are started as oneshots).
+ * The transfer is finished by whoever leaves last once it is done.
+ */
 static
 void
 globus_l_gfs_posix_read_from_storage(
     globus_l_gfs_posix_handle_t *      posix_handle)
 {
     globus_byte_t *                     buffer;
-    globus_size_t                       nbytes;
+    ssize_t                             nbytes;
     globus_size_t                       read_length;
+    globus_size_t                       io_size;
+    globus_off_t                        offset;
+    globus_off_t                        end;
     globus_result_t                     rc;
+    globus_bool_t                       bounded;
+    globus_bool_t                       eof;
+    globus_bool_t                       finish;
+    double                              t_start;
+    double                              throttled;
+    globus_size_t                       paid = 0;
+    int                                 nranges;
+    int                                 fd;
 
     GlobusGFSName(globus_l_gfs_posix_read_from_storage);
 
+    globus_l_gfs_posix_buf_pin();
     globus_mutex_lock(&posix_handle->mutex);
-    while (posix_handle->outstanding < posix_handle->optimal_count &&
-           ! posix_handle->done) 
+    for (;;)
     {
-        buffer = globus_malloc(posix_handle->block_size);
-        if (buffer == NULL)
-        {
-            rc = GlobusGFSErrorGeneric("fail to allocate buffer");
-            globus_gridftp_server_finished_transfer(posix_handle->op, rc);
-            return;
-        }
-/*
-        if (posix_handle->seekable)
-        {
-            lseek(posix_handle->fd, posix_handle->offset, SEEK_SET);
-        }
- */ 
-        /* block_length == -1 indicates transferring data to until eof */
-        if (posix_handle->block_length < 0 ||   
-            posix_handle->block_length > posix_handle->block_size)
+        if (posix_handle->tune.enabled)
         {
-            read_length = posix_handle->block_size;
+            posix_handle->optimal_count = posix_handle->tune.count;
         }
-        else
+        if (posix_handle->done ||
+            posix_handle->outstanding >= posix_handle->optimal_count)
         {
-            read_length = posix_handle->block_length;
+            break;
         }
- 
-        nbytes = read(posix_handle->fd, buffer, read_length);
-        if (nbytes == 0)    /* eof */
+        /* current range is complete, move on to the next one */
+        if (posix_handle->block_length == 0 &&
+            ! globus_l_gfs_posix_next_range(posix_handle))
         {
             posix_handle->done = GLOBUS_TRUE;
             sprintf(err_msg,"send %d blocks of size %d bytes\n",
@@ -1383,54 +7488,365 @@ globus_l_gfs_posix_read_from_storage(
             globus_gfs_log_message(GLOBUS_GFS_LOG_INFO,err_msg);
             local_io_count = 0;
             local_io_block_size = 0;
+            if (posix_handle->nranges > 1)
+            {
+                globus_gfs_log_message(GLOBUS_GFS_LOG_INFO,
+                    "send %d ranges\n", posix_handle->nranges);
+            }
+            globus_l_gfs_posix_tune_report(&posix_handle->tune, "send");
+            globus_l_gfs_posix_buf_report();
+            break;
         }
-        else
+
+        io_size = (posix_handle->tune.enabled ?
+                   posix_handle->tune.io_size : posix_handle->io_size);
+        read_length = io_size;
+        if (posix_handle->io_align > 0)
         {
-            if (nbytes != local_io_block_size)
+            /* end on a unit boundary, the next read starts on one */
+            end = (posix_handle->offset + io_size) /
+                  posix_handle->io_align * posix_handle->io_align;
+            if (end <= posix_handle->offset)
             {
-                 if (local_io_block_size != 0)
-                 {
-                      sprintf(err_msg,"send %d blocks of size %d bytes\n",
-                                      local_io_count,local_io_block_size);
-                      globus_gfs_log_message(GLOBUS_GFS_LOG_INFO,err_msg);
-                 }
-                 local_io_block_size = nbytes;
-                 local_io_count=1;
+                end = (posix_handle->offset / posix_handle->io_align + 1) *
+                      posix_handle->io_align;
             }
-            else
+            read_length = end - posix_handle->offset;
+        }
+        /* block_length == -1 indicates transferring data to until eof */
+        if (posix_handle->block_length >= 0 &&
+            posix_handle->block_length < (globus_off_t) read_length)
+        {
+            read_length = posix_handle->block_length;
+        }
+        buffer = globus_l_gfs_posix_buf_get(read_length,
+                                            posix_handle->outstanding == 0);
+        if (buffer == NULL && errno == ENOBUFS)
+        {
+            /* over the memory budget, read more when a write returns */
+            break;
+        }
+        if (buffer == NULL)
+        {
+            rc = GlobusGFSErrorGeneric("fail to allocate buffer");
+            globus_l_gfs_posix_set_error(posix_handle, rc);
+            break;
+        }
+
+        /*
+         * A stream reads in order under the mutex, so it pays for its read
+         * before it reserves the range and sleeps off the debt without the
+         * mutex, then takes another look at where the transfer is.
+         */
+        if (! posix_handle->seekable && paid < read_length)
+        {
+            throttled = globus_l_gfs_posix_shape_debt(posix_handle,
+                                                      read_length - paid);
+            paid = read_length;
+            if (throttled > 0)
             {
-                 local_io_count++;
+                globus_l_gfs_posix_buf_free(buffer);
+                globus_mutex_unlock(&posix_handle->mutex);
+                globus_l_gfs_posix_shape_sleep(throttled);
+                globus_mutex_lock(&posix_handle->mutex);
+                posix_handle->shape.throttled += throttled;
+                posix_handle->shape.waits++;
+                continue;
             }
         }
-        if (! posix_handle->done) 
+
+        /* reserve the slot and the file range */
+        offset = posix_handle->offset;
+        nranges = posix_handle->nranges;
+        bounded = (posix_handle->block_length > 0);
+        posix_handle->offset += read_length;
+        if (bounded)
         {
-            posix_handle->outstanding++;
-            posix_handle->offset += nbytes;
-            posix_handle->block_length -= nbytes;
-            rc = globus_gridftp_server_register_write(posix_handle->op,
-                                       buffer,
-                                       nbytes,
-                                       posix_handle->offset - nbytes,
-                                       -1,
-                                       globus_l_gfs_posix_read_from_storage_cb,
-                                       posix_handle);
-            if (rc != GLOBUS_SUCCESS)
+            posix_handle->block_length -= read_length;
+        }
+        posix_handle->outstanding++;
+        fd = posix_handle->fds[(offset / io_size) % posix_handle->nfds];
+
+        while (posix_handle->seekable &&
+               posix_handle->outstanding + posix_handle->kicks <
+               posix_handle->optimal_count &&
+               globus_callback_register_oneshot(NULL, NULL,
+                   globus_l_gfs_posix_read_kick, posix_handle) ==
+               GLOBUS_SUCCESS)
+        {
+            posix_handle->kicks++;
+        }
+
+        /* a stream has no offsets, its reads have to stay in order */
+        throttled = 0;
+        if (posix_handle->seekable)
+        {
+            globus_mutex_unlock(&posix_handle->mutex);
+            throttled = globus_l_gfs_posix_shape_take(posix_handle,
+                                                      read_length);
+        }
+        else
+        {
+            paid = (paid > read_length ? paid - read_length : 0);
+        }
+        GLOBUS_L_GFS_POSIX_PROBE3(read_entry, posix_handle->pathname,
+            (long long) offset, (long long) read_length);
+        t_start = globus_l_gfs_posix_now();
+        nbytes = globus_l_gfs_posix_read_block(posix_handle, fd, buffer,
+                                               read_length, offset);
+        GLOBUS_L_GFS_POSIX_PROBE4(read_return, posix_handle->pathname,
+            (long long) offset, (long long) nbytes,
+            GLOBUS_L_GFS_POSIX_USEC(t_start));
+        if (posix_handle->seekable)
+        {
+            globus_mutex_lock(&posix_handle->mutex);
+        }
+        if (throttled > 0)
+        {
+            posix_handle->shape.throttled += throttled;
+            posix_handle->shape.waits++;
+        }
+
+        if (nbytes < 0)
+        {
+            rc = GlobusGFSErrorSystemError("read", errno);
+            globus_l_gfs_posix_set_error(posix_handle, rc);
+            posix_handle->outstanding--;
+            globus_l_gfs_posix_buf_free(buffer);
+            continue;
+        }
+        globus_l_gfs_posix_tune_sample(&posix_handle->tune, nbytes,
+                                       globus_l_gfs_posix_now() - t_start);
+        if (posix_handle->seekable)
+        {
+            eof = ((globus_size_t) nbytes < read_length);
+        }
+        else
+        {
+            /* give back what a short read of the stream did not use */
+            eof = (nbytes == 0);
+            posix_handle->offset -= read_length - nbytes;
+            if (bounded)
             {
-                rc = GlobusGFSErrorGeneric("globus_gridftp_server_register_write() fail");
-                globus_gridftp_server_finished_transfer(posix_handle->op, rc);
+                posix_handle->block_length += read_length - nbytes;
             }
         }
+        /* nothing more in this range, unless we already moved past it */
+        if (eof && posix_handle->nranges == nranges)
+        {
+            posix_handle->block_length = 0;
+        }
+        if (nbytes == 0)
+        {
+            posix_handle->outstanding--;
+            globus_l_gfs_posix_buf_free(buffer);
+            continue;
+        }
+
+        if (nbytes != local_io_block_size)
+        {
+             if (local_io_block_size != 0)
+             {
+                  sprintf(err_msg,"send %d blocks of size %d bytes\n",
+                                  local_io_count,local_io_block_size);
+                  globus_gfs_log_message(GLOBUS_GFS_LOG_INFO,err_msg);
+             }
+             local_io_block_size = nbytes;
+             local_io_count=1;
+        }
+        else
+        {
+             local_io_count++;
+        }
+
+        rc = globus_gridftp_server_register_write(posix_handle->op,
+                                   buffer,
+                                   nbytes,
+                                   offset,
+                                   -1,
+                                   globus_l_gfs_posix_read_from_storage_cb,
+                                   posix_handle);
+        if (rc != GLOBUS_SUCCESS)
+        {
+            rc = GlobusGFSErrorGeneric("globus_gridftp_server_register_write() fail");
+            globus_l_gfs_posix_set_error(posix_handle, rc);
+            posix_handle->outstanding--;
+            globus_l_gfs_posix_buf_free(buffer);
+        }
+        else
+        {
+            posix_handle->transferred += nbytes;
+        }
     }
+    posix_handle->active--;
+    finish = (posix_handle->done && posix_handle->outstanding == 0 &&
+              posix_handle->kicks == 0 && posix_handle->active == 0);
     globus_mutex_unlock(&posix_handle->mutex);
-    if (posix_handle->outstanding == 0)
+
+    if (finish)
     {
-        close(posix_handle->fd);
+        globus_l_gfs_posix_shape_report(&posix_handle->shape, "send");
+        globus_l_gfs_posix_stripe_report(posix_handle, "send", "stripes");
+        globus_l_gfs_posix_close_fds(posix_handle);
+        globus_l_gfs_posix_admit_release(&posix_handle->admit);
+        globus_l_gfs_posix_trace_end(posix_handle->op, posix_handle->result,
+                                     posix_handle->transferred, 0);
         globus_gridftp_server_finished_transfer(posix_handle->op, 
-                                                GLOBUS_SUCCESS);
+                                                posix_handle->result);
     }
     return;
 }
 
+static
+void
+globus_l_gfs_posix_send_small_cb(
+    globus_gfs_operation_t              op,
+    globus_result_t                     result,
+    globus_byte_t *                     buffer,
+    globus_size_t                       nbytes,
+    void *                              user_arg);
+
+/*
+ * Send a small file, one range at a time: a single read of what the
+ * range holds (file_size was taken at open, a file that grows during
+ * the send is sent as it was), then a single register_write. There is
+ * never more than one operation in flight, so no locking is needed.
+ */
+static
+void
+globus_l_gfs_posix_send_small(
+    void *                              user_arg)
+{
+    globus_l_gfs_posix_handle_t *       posix_handle;
+    globus_byte_t *                     buffer;
+    globus_size_t                       length;
+    globus_result_t                     rc;
+    ssize_t                             nbytes;
+    double                              t_start;
+    double                              throttled;
+    double                              t_probe;
+    int                                 close_rc;
+
+    GlobusGFSName(globus_l_gfs_posix_send_small);
+
+    posix_handle = (globus_l_gfs_posix_handle_t *) user_arg;
+    while (posix_handle->result == GLOBUS_SUCCESS &&
+           globus_l_gfs_posix_next_range(posix_handle))
+    {
+        if (posix_handle->offset >= posix_handle->file_size) continue;
+        length = posix_handle->file_size - posix_handle->offset;
+        if (posix_handle->block_length > 0 &&
+            posix_handle->block_length < (globus_off_t) length)
+        {
+            length = posix_handle->block_length;
+        }
+        buffer = globus_l_gfs_posix_buf_alloc(length);
+        if (buffer == NULL)
+        {
+            rc = GlobusGFSErrorGeneric("fail to allocate buffer");
+            globus_l_gfs_posix_set_error(posix_handle, rc);
+            break;
+        }
+        throttled = globus_l_gfs_posix_shape_take(posix_handle, length);
+        if (throttled > 0)
+        {
+            posix_handle->shape.throttled += throttled;
+            posix_handle->shape.waits++;
+        }
+        GLOBUS_L_GFS_POSIX_PROBE3(read_entry, posix_handle->pathname,
+            (long long) posix_handle->offset, (long long) length);
+        t_start = GLOBUS_L_GFS_POSIX_CLOCK(read_return);
+        nbytes = globus_l_gfs_posix_read_block(posix_handle, posix_handle->fd,
+                                               buffer, length,
+                                               posix_handle->offset);
+        GLOBUS_L_GFS_POSIX_PROBE4(read_return, posix_handle->pathname,
+            (long long) posix_handle->offset, (long long) nbytes,
+            GLOBUS_L_GFS_POSIX_USEC(t_start));
+        if (nbytes <= 0)
+        {
+            if (nbytes < 0)
+            {
+                rc = GlobusGFSErrorSystemError("read", errno);
+                globus_l_gfs_posix_set_error(posix_handle, rc);
+            }
+            globus_l_gfs_posix_buf_free(buffer);
+            continue;
+        }
+        rc = globus_gridftp_server_register_write(posix_handle->op,
+                                   buffer,
+                                   nbytes,
+                                   posix_handle->offset,
+                                   -1,
+                                   globus_l_gfs_posix_send_small_cb,
+                                   posix_handle);
+        if (rc != GLOBUS_SUCCESS)
+        {
+            rc = GlobusGFSErrorGeneric("globus_gridftp_server_register_write() fail");
+            globus_l_gfs_posix_set_error(posix_handle, rc);
+            globus_l_gfs_posix_buf_free(buffer);
+            break;
+        }
+        posix_handle->transferred += nbytes;
+        return;
+    }
+
+    globus_l_gfs_posix_shape_report(&posix_handle->shape, "send");
+    GLOBUS_L_GFS_POSIX_PROBE1(close_entry, posix_handle->pathname);
+    t_probe = GLOBUS_L_GFS_POSIX_CLOCK(close_return);
+    close_rc = globus_l_gfs_posix_fdcache_close(posix_handle, posix_handle->fd);
+    GLOBUS_L_GFS_POSIX_PROBE3(close_return, posix_handle->pathname, close_rc,
+                              GLOBUS_L_GFS_POSIX_USEC(t_probe));
+    globus_l_gfs_posix_admit_release(&posix_handle->admit);
+    globus_l_gfs_posix_small_report(posix_handle, "send");
+    globus_l_gfs_posix_stripe_report(posix_handle, "send", "stripes");
+    globus_l_gfs_posix_trace_end(posix_handle->op, posix_handle->result,
+                                 posix_handle->transferred, 0);
+    globus_gridftp_server_finished_transfer(posix_handle->op,
+                                            posix_handle->result);
+}
+
+static
+void
+globus_l_gfs_posix_send_small_cb(
+    globus_gfs_operation_t              op,
+    globus_result_t                     result,
+    globus_byte_t *                     buffer,
+    globus_size_t                       nbytes,
+    void *                              user_arg)
+{
+    globus_l_gfs_posix_handle_t *       posix_handle;
+    char *                              pathname;
+    double                              t_cb;
+
+    posix_handle = (globus_l_gfs_posix_handle_t *) user_arg;
+
+    pathname = posix_handle->pathname;
+    GLOBUS_L_GFS_POSIX_PROBE2(send_cb_entry, pathname, (long long) nbytes);
+    t_cb = GLOBUS_L_GFS_POSIX_CLOCK(send_cb_return);
+    globus_l_gfs_posix_buf_free(buffer);
+    if (result != GLOBUS_SUCCESS)
+    {
+        globus_l_gfs_posix_set_error(posix_handle, result);
+    }
+    globus_l_gfs_posix_send_small(posix_handle);
+    GLOBUS_L_GFS_POSIX_PROBE2(send_cb_return, pathname,
+                              GLOBUS_L_GFS_POSIX_USEC(t_cb));
+}
+
+/* the first reads of a send, once admitted */
+static
+void
+globus_l_gfs_posix_send_admitted(
+    void *                              user_arg)
+{
+    globus_l_gfs_posix_handle_t *       posix_handle;
+
+    posix_handle = (globus_l_gfs_posix_handle_t *) user_arg;
+    posix_handle->active = 1;
+    posix_handle->kicks = 0;
+    globus_l_gfs_posix_read_from_storage(posix_handle);
+}
+
 /*************************************************************************
  *  send
  *  ----
@@ -1455,6 +7871,8 @@ globus_l_gfs_posix_send(
 {
     globus_result_t                     rc;
     globus_l_gfs_posix_handle_t *       posix_handle;
+    struct stat                         stat_buffer;
+    double                              t_probe;
     GlobusGFSName(globus_l_gfs_posix_send);
 
     posix_handle = (globus_l_gfs_posix_handle_t *) user_arg;
@@ -1468,41 +7886,116 @@ globus_l_gfs_posix_send(
     posix_handle->op = op;
     posix_handle->outstanding = 0;
     posix_handle->done = GLOBUS_FALSE;
+    posix_handle->result = GLOBUS_SUCCESS;
+    posix_handle->nranges = 0;
+    posix_handle->small = GLOBUS_FALSE;
+    posix_handle->t_begin = globus_l_gfs_posix_now();
+    posix_handle->transferred = 0;
+    posix_handle->node_ndx = transfer_info->node_ndx;
+    posix_handle->node_count = transfer_info->node_count;
     globus_gridftp_server_get_block_size(op, &posix_handle->block_size);
-
-    globus_gridftp_server_get_read_range(posix_handle->op,
-                                         &posix_handle->offset,
-                                         &posix_handle->block_length);
-
-    globus_gridftp_server_begin_transfer(posix_handle->op, 0, posix_handle);
-    posix_handle->fd = open(posix_handle->pathname, O_RDONLY);
+    globus_l_gfs_posix_trace_transfer(posix_handle,
+                                      GLOBUS_L_GFS_POSIX_TRACE_SEND,
+                                      transfer_info);
+
+    /* read_from_storage() fetches the ranges to send */
+    posix_handle->offset = 0;
+    posix_handle->block_length = 0;
+
+    globus_gridftp_server_begin_transfer(posix_handle->op,
+        GLOBUS_GFS_EVENT_TRANSFER_ABORT, posix_handle);
+    posix_handle->backend = globus_l_gfs_posix_backend_select(posix_handle,
+                                                    posix_handle->pathname);
+    GLOBUS_L_GFS_POSIX_PROBE2(open_entry, posix_handle->pathname, O_RDONLY);
+    t_probe = GLOBUS_L_GFS_POSIX_CLOCK(open_return);
+    posix_handle->fd = globus_l_gfs_posix_fdcache_open(posix_handle,
+                                                       posix_handle->pathname);
+    GLOBUS_L_GFS_POSIX_PROBE3(open_return, posix_handle->pathname,
+                              posix_handle->fd,
+                              GLOBUS_L_GFS_POSIX_USEC(t_probe));
     if (posix_handle->fd == -1)
     {
         rc = GlobusGFSErrorSystemError("open", errno);
+        globus_l_gfs_posix_trace_end(op, rc,
+                                     posix_handle->transferred, 0);
         globus_gridftp_server_finished_transfer(op, rc);
+        return;
     }
 
 /*
- * /dev/null and /dev/zero are not seekable. They are used for memory-to-memory
- * performance test.
+ * /dev/null and /dev/zero (the null backend) are not seekable. They are used
+ * for memory-to-memory performance test.
  */
-    posix_handle->seekable=1;
-    if (! strcmp(posix_handle->pathname,"/dev/zero"))
-    {
-        posix_handle->seekable=0;
-    }
-    else 
+    posix_handle->seekable = posix_handle->backend->seekable;
+    if (posix_handle->seekable &&
+        fstat(posix_handle->fd, &stat_buffer) == 0 &&
+        globus_l_gfs_posix_small(posix_handle, stat_buffer.st_size))
     {
-        lseek(posix_handle->fd, posix_handle->offset, SEEK_SET);
+        posix_handle->small = GLOBUS_TRUE;
+        posix_handle->file_size = stat_buffer.st_size;
+        posix_handle->fds[0] = posix_handle->fd;
+        posix_handle->nfds = 1;
+        globus_l_gfs_posix_shape_init(posix_handle);
+        globus_l_gfs_posix_admit(posix_handle,
+                                 globus_l_gfs_posix_send_small);
+        return;
     }
+    globus_l_gfs_posix_open_fds(posix_handle);
+    globus_l_gfs_posix_geometry(posix_handle);
 
     globus_gridftp_server_get_optimal_concurrency(posix_handle->op,
                                                   &posix_handle->optimal_count);
+    globus_l_gfs_posix_tune_init(&posix_handle->tune,
+                                 posix_handle->optimal_count,
+                                 posix_handle->io_size,
+                                 GLOBUS_TRUE);
+    globus_l_gfs_posix_shape_init(posix_handle);
 
-    globus_l_gfs_posix_read_from_storage(posix_handle);
+    globus_l_gfs_posix_admit(posix_handle, globus_l_gfs_posix_send_admitted);
     return;
 }
 
+/*************************************************************************
+ *  trev
+ *  ----
+ *  Transfer events. send and recv ask for aborts only: a transfer that is
+ *  doing I/O finds out from its failed callbacks, one still waiting for
+ *  admission is taken off the queue here and fails right away.
+ ************************************************************************/
+static
+void
+globus_l_gfs_posix_trev(
+    globus_gfs_event_info_t *           event_info,
+    void *                              user_arg)
+{
+    globus_l_gfs_posix_handle_t *       posix_handle;
+    globus_result_t                     rc;
+    globus_bool_t                       queued;
+
+    GlobusGFSName(globus_l_gfs_posix_trev);
+
+    posix_handle = (globus_l_gfs_posix_handle_t *) user_arg;
+    if (event_info->type != GLOBUS_GFS_EVENT_TRANSFER_ABORT) return;
+
+    globus_mutex_lock(&posix_handle->mutex);
+    if (posix_handle->admit.state == GLOBUS_L_GFS_POSIX_ADMIT_IDLE)
+    {
+        globus_mutex_unlock(&posix_handle->mutex);
+        return;
+    }
+    rc = GlobusGFSErrorGeneric("transfer aborted while waiting for admission");
+    globus_l_gfs_posix_set_error(posix_handle, rc);
+    /* a check that is running sees the error and goes ahead by itself */
+    queued = (posix_handle->admit.state == GLOBUS_L_GFS_POSIX_ADMIT_QUEUED &&
+              globus_l_gfs_posix_admit_cancel(posix_handle));
+    globus_mutex_unlock(&posix_handle->mutex);
+    if (queued)
+    {
+        globus_l_gfs_posix_admit_release(&posix_handle->admit);
+        posix_handle->admit.admitted(posix_handle);
+    }
+}
+
 static
 int
 globus_l_gfs_posix_activate(void);
@@ -1522,9 +8015,9 @@ static globus_gfs_storage_iface_t       globus_l_gfs_posix_dsi_iface =
     NULL, /* list */
     globus_l_gfs_posix_send,
     globus_l_gfs_posix_recv,
-    NULL, /* trev */
-    NULL, /* active */
-    NULL, /* passive */
+    globus_l_gfs_posix_trev,
+    NULL, /* active, the server's data channels also serve striped */
+    NULL, /* passive, transfers (see globus_l_gfs_posix_stripe_report) */
     NULL, /* data destroy */
     globus_l_gfs_posix_command, 
     globus_l_gfs_posix_stat,
@@ -0,0 +1,82 @@
+/************************************************************************/
+/* globus_gridftp_server_posix_trace.h                                  */
+/*                                                                      */
+/* Layout of the operation trace the POSIX DSI writes when              */
+/* GRIDFTP_POSIX_TRACE is set, and that replay/gfs_replay reads.        */
+/*                                                                      */
+/* A trace file is one header followed by records. A record is a fixed  */
+/* part, then path_len bytes of path and arg_len bytes of argument (no  */
+/* terminating NULs), then nranges (offset, length) pairs of int64_t.   */
+/* Everything is in host byte order.                                    */
+/*                                                                      */
+/* Every operation is a BEGIN record (SESSION, STAT, COMMAND, SEND or   */
+/* RECV) written when the DSI gets it, and an END record with the same  */
+/* id written when the DSI reports it finished. The id is only unique   */
+/* while the operation runs, an END belongs to the latest BEGIN with    */
+/* its id in the same file.                                             */
+/*                                                                      */
+/*   type     code      arg        offset, length       size            */
+/*   SESSION  -         -          -                    -               */
+/*   STAT     file_only -          -                    -               */
+/*   COMMAND  command   cksm alg,  cksm offset, length  -               */
+/*                      rnfr path, (TRNC: offset,                       */
+/*                      group,     CHMOD: mode,                         */
+/*                      link from  UTIME: time)                         */
+/*   SEND     -         -          partial offset,      -               */
+/*                                 length, ranges                       */
+/*   RECV     -         -          partial offset,      alloc size      */
+/*                                 length, ranges                       */
+/*   END      -         -          -                    bytes moved or  */
+/*                                                      checksummed;    */
+/*                                                      stat: size, or  */
+/*                                                      entries listed  */
+/************************************************************************/
+
+#ifndef GLOBUS_GRIDFTP_SERVER_POSIX_TRACE_H
+#define GLOBUS_GRIDFTP_SERVER_POSIX_TRACE_H
+
+#include <stdint.h>
+
+#define GLOBUS_L_GFS_POSIX_TRACE_MAGIC      0x54504647  /* "GFPT" */
+#define GLOBUS_L_GFS_POSIX_TRACE_VERSION    1
+#define GLOBUS_L_GFS_POSIX_TRACE_MAX_RANGES 64
+
+/* record types */
+#define GLOBUS_L_GFS_POSIX_TRACE_SESSION    1
+#define GLOBUS_L_GFS_POSIX_TRACE_STAT       2
+#define GLOBUS_L_GFS_POSIX_TRACE_COMMAND    3
+#define GLOBUS_L_GFS_POSIX_TRACE_SEND       4
+#define GLOBUS_L_GFS_POSIX_TRACE_RECV       5
+#define GLOBUS_L_GFS_POSIX_TRACE_END        6
+
+/* record flags */
+#define GLOBUS_L_GFS_POSIX_TRACE_FAILED     0x01    /* END: not a success */
+#define GLOBUS_L_GFS_POSIX_TRACE_DIR        0x02    /* END of STAT: a dir */
+#define GLOBUS_L_GFS_POSIX_TRACE_TRUNCATED  0x04    /* more ranges left out */
+
+typedef struct
+{
+    uint32_t                            magic;
+    uint16_t                            version;
+    uint16_t                            record_size;
+} globus_l_gfs_posix_trace_header_t;
+
+typedef struct
+{
+    uint8_t                             type;
+    uint8_t                             flags;
+    uint16_t                            code;
+    uint16_t                            path_len;
+    uint16_t                            arg_len;
+    uint32_t                            block_size;
+    uint16_t                            concurrency;
+    uint16_t                            nranges;
+    uint64_t                            session;
+    uint64_t                            id;
+    int64_t                             usec;       /* since the epoch */
+    int64_t                             offset;
+    int64_t                             length;
+    int64_t                             size;
+} globus_l_gfs_posix_trace_record_t;
+
+#endif
@@ -0,0 +1,1166 @@
+/************************************************************************/
+/* replay/gfs_replay.c                                                  */
+/*                                                                      */
+/* Replays operation traces of the POSIX DSI (GRIDFTP_POSIX_TRACE)      */
+/* against the DSI itself, linked with the stub runtime in this         */
+/* directory instead of a gridftp server, on a local file system.       */
+/*                                                                      */
+/* Every traced path is replayed under a root directory. Before the     */
+/* replay, the files the trace reads (sends, checksums and stats of     */
+/* files) are created there with the size the trace implies, and the    */
+/* directories it lists. Sessions start at their traced time divided by */
+/* the speed. The operations of a session run one after the other,      */
+/* each at its traced time or when the one before it finished, if that */
+/* is later. The data channel is memory, so the times are those of the  */
+/* DSI and the storage under it.                                        */
+/*                                                                      */
+/* For every kind of operation it reports the count, the failures, the  */
+/* operations whose outcome differs from the trace, the latency as      */
+/* traced and as replayed, and for transfers the throughput.            */
+/*                                                                      */
+/* Build:  make gfs_replay                                              */
+/* Usage:  gfs_replay [-r root] [-s speed] [-t threads] [-n] [-v]       */
+/*                    trace...                                          */
+/*                                                                      */
+/*   -r   directory the traced paths are replayed under                 */
+/*        (default ./replay-root)                                       */
+/*   -s   speed up, 1 replays at the traced pace, 10 ten times faster,  */
+/*        0 as fast as possible (default 1)                             */
+/*   -t   callback threads, the most DSI operations that block on       */
+/*        storage at once (default 32)                                  */
+/*   -n   do not create the files and directories the trace reads       */
+/*   -v   print the log messages of the DSI                             */
+/*                                                                      */
+/* The DSI reads its GRIDFTP_POSIX_* settings from the environment, as  */
+/* in the server, so tuning changes are compared by replaying the same  */
+/* trace with different settings.                                       */
+/************************************************************************/
+
+#include <unistd.h>
+#include <errno.h>
+#include <getopt.h>
+#include "stub_runtime.h"
+#include "globus_gridftp_server_posix_trace.h"
+
+#define GFS_REPLAY_FILL_SIZE            (1024 * 1024)
+
+/* what the report is broken down by */
+typedef enum
+{
+    GFS_REPLAY_STAT = 0,
+    GFS_REPLAY_LIST,
+    GFS_REPLAY_SEND,
+    GFS_REPLAY_RECV,
+    GFS_REPLAY_CKSM,
+    GFS_REPLAY_MKD,
+    GFS_REPLAY_RMD,
+    GFS_REPLAY_DELE,
+    GFS_REPLAY_RNTO,
+    GFS_REPLAY_OTHER,
+    GFS_REPLAY_NKINDS
+} gfs_replay_kind_t;
+
+static const char * gfs_replay_kind_names[GFS_REPLAY_NKINDS] =
+{
+    "stat", "list", "send", "recv", "cksm", "mkd", "rmd", "dele", "rnto",
+    "other"
+};
+
+struct gfs_replay_session_s;
+
+typedef struct
+{
+    /* as traced */
+    uint64_t                            id;
+    int                                 type;
+    int                                 code;
+    int                                 end_flags;
+    globus_bool_t                       ended;
+    uint32_t                            block_size;
+    int                                 concurrency;
+    int64_t                             t_begin;
+    int64_t                             t_end;
+    int64_t                             offset;
+    int64_t                             length;
+    int64_t                             size;
+    int64_t                             end_size;
+    char *                              path;
+    char *                              arg;
+    int                                 nranges;
+    int64_t *                           ranges;
+    struct gfs_replay_session_s *       session;
+    /* as replayed */
+    char *                              local_path;
+    char *                              local_arg;
+    globus_range_list_t                 range_list;
+    union
+    {
+        globus_gfs_stat_info_t          stat;
+        globus_gfs_command_info_t       command;
+        globus_gfs_transfer_info_t      transfer;
+    }                                   info;
+    double                              t_issue;
+    double                              t_done;
+    globus_result_t                     result;
+    globus_off_t                        bytes;
+    globus_bool_t                       replayed;
+} gfs_replay_op_t;
+
+typedef struct gfs_replay_session_s
+{
+    int                                 file;
+    uint64_t                            id;
+    globus_bool_t                       closed;
+    int64_t                             t_start;
+    gfs_replay_op_t **                  ops;
+    int                                 nops;
+    int                                 cap;
+    int                                 next;
+    void *                              session_arg;
+} gfs_replay_session_t;
+
+/* a path the trace reads, and what it has to be */
+typedef struct
+{
+    char *                              path;
+    int64_t                             size;
+    globus_bool_t                       dir;
+} gfs_replay_need_t;
+
+static struct
+{
+    const char *                        root;
+    double                              speed;
+    int                                 threads;
+    globus_gfs_storage_iface_t *        iface;
+    gfs_replay_session_t **             sessions;
+    int                                 nsessions;
+    int                                 scap;
+    int64_t                             t0;
+    double                              wall0;
+    int                                 active;
+    pthread_mutex_t                     lock;
+    volatile int                        stop;
+} gfs_replay = { "./replay-root", 1.0, 32 };
+
+extern globus_extension_module_t        globus_gridftp_server_posix_module;
+
+static
+void *
+gfs_replay_alloc(
+    size_t                              size)
+{
+    void *                              p;
+
+    p = calloc(1, size);
+    if (p == NULL)
+    {
+        fprintf(stderr, "out of memory\n");
+        exit(2);
+    }
+    return p;
+}
+
+static
+char *
+gfs_replay_string(
+    const char *                        s,
+    size_t                              len)
+{
+    char *                              p;
+
+    p = gfs_replay_alloc(len + 1);
+    memcpy(p, s, len);
+    return p;
+}
+
+/*
+ * The traced path, under the replay root. "." and ".." are resolved
+ * here, ".." at the top stays there, so no trace can reach outside the
+ * root.
+ */
+static
+char *
+gfs_replay_local(
+    const char *                        path)
+{
+    const char *                        end;
+    char *                              p;
+    size_t                              root;
+    size_t                              len;
+    size_t                              n;
+
+    root = strlen(gfs_replay.root);
+    len = root + strlen(path) + 2;
+    p = gfs_replay_alloc(len);
+    memcpy(p, gfs_replay.root, root);
+    len = root;
+    for (; *path != '\0'; path = end)
+    {
+        while (*path == '/') path++;
+        for (end = path; *end != '\0' && *end != '/'; end++);
+        n = end - path;
+        if (n == 0 || (n == 1 && path[0] == '.'))
+        {
+            continue;
+        }
+        if (n == 2 && path[0] == '.' && path[1] == '.')
+        {
+            while (len > root && p[len - 1] != '/') len--;
+            if (len > root) len--;
+            continue;
+        }
+        p[len++] = '/';
+        memcpy(p + len, path, n);
+        len += n;
+    }
+    if (len == root) p[len++] = '/';
+    p[len] = '\0';
+    return p;
+}
+
+static
+gfs_replay_kind_t
+gfs_replay_kind(
+    gfs_replay_op_t *                   op)
+{
+    switch (op->type)
+    {
+      case GLOBUS_L_GFS_POSIX_TRACE_STAT:
+        return (! op->code && (op->end_flags & GLOBUS_L_GFS_POSIX_TRACE_DIR) ?
+                GFS_REPLAY_LIST : GFS_REPLAY_STAT);
+      case GLOBUS_L_GFS_POSIX_TRACE_SEND:
+        return GFS_REPLAY_SEND;
+      case GLOBUS_L_GFS_POSIX_TRACE_RECV:
+        return GFS_REPLAY_RECV;
+    }
+    switch (op->code)
+    {
+      case GLOBUS_GFS_CMD_CKSM: return GFS_REPLAY_CKSM;
+      case GLOBUS_GFS_CMD_MKD:  return GFS_REPLAY_MKD;
+      case GLOBUS_GFS_CMD_RMD:  return GFS_REPLAY_RMD;
+      case GLOBUS_GFS_CMD_DELE: return GFS_REPLAY_DELE;
+      case GLOBUS_GFS_CMD_RNTO: return GFS_REPLAY_RNTO;
+    }
+    return GFS_REPLAY_OTHER;
+}
+
+/*
+ * Loading. A session is found by its id among those of the same file
+ * that have not ended, the latest first: ids are addresses, and a
+ * process reuses them.
+ */
+static
+gfs_replay_session_t *
+gfs_replay_session(
+    int                                 file,
+    uint64_t                            id,
+    int64_t                             t_start,
+    globus_bool_t                       create)
+{
+    gfs_replay_session_t *              session;
+    int                                 i;
+
+    for (i = gfs_replay.nsessions - 1; ! create && i >= 0; i--)
+    {
+        session = gfs_replay.sessions[i];
+        if (session->file != file) break;
+        if (session->id == id && ! session->closed) return session;
+    }
+    session = gfs_replay_alloc(sizeof(gfs_replay_session_t));
+    session->file = file;
+    session->id = id;
+    session->t_start = t_start;
+    if (gfs_replay.nsessions == gfs_replay.scap)
+    {
+        gfs_replay.scap = (gfs_replay.scap == 0 ? 64 : 2 * gfs_replay.scap);
+        gfs_replay.sessions = realloc(gfs_replay.sessions,
+            gfs_replay.scap * sizeof(gfs_replay_session_t *));
+        if (gfs_replay.sessions == NULL)
+        {
+            fprintf(stderr, "out of memory\n");
+            exit(2);
+        }
+    }
+    gfs_replay.sessions[gfs_replay.nsessions++] = session;
+    return session;
+}
+
+static
+void
+gfs_replay_add(
+    gfs_replay_session_t *              session,
+    gfs_replay_op_t *                   op)
+{
+    if (session->nops == session->cap)
+    {
+        session->cap = (session->cap == 0 ? 64 : 2 * session->cap);
+        session->ops = realloc(session->ops,
+                               session->cap * sizeof(gfs_replay_op_t *));
+        if (session->ops == NULL)
+        {
+            fprintf(stderr, "out of memory\n");
+            exit(2);
+        }
+    }
+    session->ops[session->nops++] = op;
+    op->session = session;
+}
+
+static
+int
+gfs_replay_load(
+    const char *                        name,
+    int                                 file)
+{
+    globus_l_gfs_posix_trace_header_t   header;
+    globus_l_gfs_posix_trace_record_t   record;
+    gfs_replay_session_t *              session;
+    gfs_replay_op_t *                   op;
+    gfs_replay_op_t **                  pending = NULL;
+    int                                 npending = 0;
+    int                                 cap = 0;
+    char *                              buf;
+    size_t                              len;
+    size_t                              pos;
+    size_t                              need;
+    struct stat                         st;
+    FILE *                              F;
+    int                                 i;
+
+    F = fopen(name, "r");
+    if (F == NULL || fstat(fileno(F), &st) != 0)
+    {
+        fprintf(stderr, "%s: %s\n", name, strerror(errno));
+        return -1;
+    }
+    len = st.st_size;
+    buf = gfs_replay_alloc(len + 1);
+    if (fread(buf, 1, len, F) != len)
+    {
+        fprintf(stderr, "%s: short read\n", name);
+        fclose(F);
+        return -1;
+    }
+    fclose(F);
+
+    memcpy(&header, buf, len < sizeof(header) ? len : sizeof(header));
+    if (len < sizeof(header) ||
+        header.magic != GLOBUS_L_GFS_POSIX_TRACE_MAGIC ||
+        header.version != GLOBUS_L_GFS_POSIX_TRACE_VERSION ||
+        header.record_size != sizeof(record))
+    {
+        fprintf(stderr, "%s: not a trace of this version\n", name);
+        free(buf);
+        return -1;
+    }
+
+    for (pos = sizeof(header); pos + sizeof(record) <= len; pos = need)
+    {
+        memcpy(&record, buf + pos, sizeof(record));
+        need = pos + sizeof(record) + record.path_len + record.arg_len +
+               record.nranges * 2 * sizeof(int64_t);
+        if (need > len) break;  /* cut short by a crash */
+
+        if (record.type == GLOBUS_L_GFS_POSIX_TRACE_SESSION)
+        {
+            gfs_replay_session(file, record.session, record.usec, GLOBUS_TRUE);
+            continue;
+        }
+        if (record.type == GLOBUS_L_GFS_POSIX_TRACE_END)
+        {
+            for (i = npending - 1; i >= 0; i--)
+            {
+                if (pending[i]->id == record.id)
+                {
+                    break;
+                }
+            }
+            if (i < 0)
+            {
+                /* the end of a session */
+                session = gfs_replay_session(file, record.id, record.usec,
+                                             GLOBUS_FALSE);
+                session->closed = GLOBUS_TRUE;
+                continue;
+            }
+            op = pending[i];
+            pending[i] = pending[--npending];
+            op->ended = GLOBUS_TRUE;
+            op->t_end = record.usec;
+            op->end_flags = record.flags;
+            op->end_size = record.size;
+            continue;
+        }
+
+        op = gfs_replay_alloc(sizeof(gfs_replay_op_t));
+        op->type = record.type;
+        op->code = record.code;
+        op->block_size = record.block_size;
+        op->concurrency = record.concurrency;
+        op->t_begin = record.usec;
+        op->offset = record.offset;
+        op->length = record.length;
+        op->size = record.size;
+        op->path = gfs_replay_string(buf + pos + sizeof(record),
+                                     record.path_len);
+        op->arg = gfs_replay_string(buf + pos + sizeof(record) +
+                                    record.path_len, record.arg_len);
+        op->nranges = record.nranges;
+        op->ranges = gfs_replay_alloc(2 * record.nranges * sizeof(int64_t) + 1);
+        memcpy(op->ranges, buf + pos + sizeof(record) + record.path_len +
+               record.arg_len, 2 * record.nranges * sizeof(int64_t));
+        op->id = record.id;
+        gfs_replay_add(gfs_replay_session(file, record.session, record.usec,
+                                          GLOBUS_FALSE), op);
+        if (npending == cap)
+        {
+            cap = (cap == 0 ? 64 : 2 * cap);
+            pending = realloc(pending, cap * sizeof(gfs_replay_op_t *));
+            if (pending == NULL)
+            {
+                fprintf(stderr, "out of memory\n");
+                exit(2);
+            }
+        }
+        pending[npending++] = op;
+    }
+    free(pending);
+    free(buf);
+    return 0;
+}
+
+/*
+ * Preparing the replay root.
+ */
+static
+void
+gfs_replay_need(
+    gfs_replay_need_t **                needs,
+    int *                               nneeds,
+    int *                               cap,
+    const char *                        path,
+    int64_t                             size,
+    globus_bool_t                       dir)
+{
+    if (*nneeds == *cap)
+    {
+        *cap = (*cap == 0 ? 256 : 2 * *cap);
+        *needs = realloc(*needs, *cap * sizeof(gfs_replay_need_t));
+        if (*needs == NULL)
+        {
+            fprintf(stderr, "out of memory\n");
+            exit(2);
+        }
+    }
+    (*needs)[*nneeds].path = gfs_replay_local(path);
+    (*needs)[*nneeds].size = (size < 0 ? 0 : size);
+    (*needs)[*nneeds].dir = dir;
+    (*nneeds)++;
+}
+
+static
+int
+gfs_replay_need_cmp(
+    const void *                        a,
+    const void *                        b)
+{
+    return strcmp(((const gfs_replay_need_t *) a)->path,
+                  ((const gfs_replay_need_t *) b)->path);
+}
+
+/* mkdir -p of the parent of path */
+static
+int
+gfs_replay_mkdirs(
+    char *                              path)
+{
+    char *                              p;
+
+    for (p = strchr(path + 1, '/'); p != NULL; p = strchr(p + 1, '/'))
+    {
+        *p = '\0';
+        if (mkdir(path, 0755) != 0 && errno != EEXIST)
+        {
+            fprintf(stderr, "%s: %s\n", path, strerror(errno));
+            *p = '/';
+            return -1;
+        }
+        *p = '/';
+    }
+    return 0;
+}
+
+/* grow the file to size with content that does not compress */
+static
+int
+gfs_replay_fill(
+    const char *                        path,
+    int64_t                             size,
+    char *                              fill)
+{
+    struct stat                         st;
+    int64_t                             pos;
+    size_t                              len;
+    int                                 fd;
+
+    if (stat(path, &st) == 0 && S_ISREG(st.st_mode) && st.st_size >= size)
+    {
+        return 0;
+    }
+    fd = open(path, O_WRONLY|O_CREAT, 0644);
+    if (fd < 0 || fstat(fd, &st) != 0)
+    {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+    for (pos = st.st_size; pos < size; pos += len)
+    {
+        len = (size - pos < GFS_REPLAY_FILL_SIZE ?
+               size - pos : GFS_REPLAY_FILL_SIZE);
+        if (pwrite(fd, fill, len, pos) != (ssize_t) len)
+        {
+            fprintf(stderr, "%s: %s\n", path, strerror(errno));
+            close(fd);
+            return -1;
+        }
+    }
+    return close(fd);
+}
+
+static
+int
+gfs_replay_prepare(void)
+{
+    gfs_replay_need_t *                 needs = NULL;
+    gfs_replay_session_t *              session;
+    gfs_replay_op_t *                   op;
+    int64_t                             end;
+    char *                              fill;
+    int                                 nneeds = 0;
+    int                                 cap = 0;
+    int                                 nfiles = 0;
+    int                                 ndirs = 0;
+    int                                 rc = 0;
+    int                                 i, j, k;
+    int64_t                             bytes = 0;
+
+    for (i = 0; i < gfs_replay.nsessions; i++)
+    {
+        session = gfs_replay.sessions[i];
+        for (j = 0; j < session->nops; j++)
+        {
+            op = session->ops[j];
+            if (op->type == GLOBUS_L_GFS_POSIX_TRACE_SEND)
+            {
+                /* past every range, the open ended one by what was sent */
+                end = (op->offset > 0 ? op->offset : 0) +
+                      (op->length > 0 ? op->length : op->end_size);
+                for (k = 0; k < op->nranges; k++)
+                {
+                    if (op->ranges[2 * k] + (op->ranges[2 * k + 1] >= 0 ?
+                        op->ranges[2 * k + 1] : op->end_size) > end)
+                    {
+                        end = op->ranges[2 * k] + (op->ranges[2 * k + 1] >= 0 ?
+                              op->ranges[2 * k + 1] : op->end_size);
+                    }
+                }
+                gfs_replay_need(&needs, &nneeds, &cap, op->path, end,
+                                GLOBUS_FALSE);
+            }
+            else if (op->type == GLOBUS_L_GFS_POSIX_TRACE_COMMAND &&
+                     op->code == GLOBUS_GFS_CMD_CKSM)
+            {
+                gfs_replay_need(&needs, &nneeds, &cap, op->path,
+                                (op->offset > 0 ? op->offset : 0) +
+                                op->end_size, GLOBUS_FALSE);
+            }
+            else if (op->type == GLOBUS_L_GFS_POSIX_TRACE_STAT &&
+                     op->ended &&
+                     ! (op->end_flags & GLOBUS_L_GFS_POSIX_TRACE_FAILED))
+            {
+                gfs_replay_need(&needs, &nneeds, &cap, op->path,
+                    (op->end_flags & GLOBUS_L_GFS_POSIX_TRACE_DIR) ?
+                    0 : op->end_size,
+                    (op->end_flags & GLOBUS_L_GFS_POSIX_TRACE_DIR) != 0);
+            }
+            else
+            {
+                /* at least where it goes has to be there */
+                gfs_replay_need(&needs, &nneeds, &cap, op->path, 0,
+                                GLOBUS_FALSE);
+                needs[nneeds - 1].size = -1;
+            }
+        }
+    }
+    if (nneeds == 0) return 0;
+
+    fill = gfs_replay_alloc(GFS_REPLAY_FILL_SIZE);
+    srandom(20260318);
+    for (i = 0; i < GFS_REPLAY_FILL_SIZE; i++)
+    {
+        fill[i] = (char) (random() >> 7);
+    }
+    qsort(needs, nneeds, sizeof(gfs_replay_need_t), gfs_replay_need_cmp);
+    for (i = 0; i < nneeds && rc == 0; i = j)
+    {
+        /* the largest need of a path wins, a directory over a file */
+        for (j = i + 1; j < nneeds && ! strcmp(needs[i].path, needs[j].path);
+             j++)
+        {
+            if (needs[j].size > needs[i].size) needs[i].size = needs[j].size;
+            needs[i].dir |= needs[j].dir;
+        }
+        rc = gfs_replay_mkdirs(needs[i].path);
+        if (rc == 0 && needs[i].dir)
+        {
+            if (mkdir(needs[i].path, 0755) != 0 && errno != EEXIST)
+            {
+                fprintf(stderr, "%s: %s\n", needs[i].path, strerror(errno));
+                rc = -1;
+            }
+            ndirs++;
+        }
+        else if (rc == 0 && needs[i].size >= 0)
+        {
+            rc = gfs_replay_fill(needs[i].path, needs[i].size, fill);
+            bytes += needs[i].size;
+            nfiles++;
+        }
+    }
+    for (i = 0; i < nneeds; i++)
+    {
+        free(needs[i].path);
+    }
+    free(needs);
+    free(fill);
+    printf("prepared %d files (%.1f MB) and %d directories under %s\n",
+           nfiles, bytes / 1048576.0, ndirs, gfs_replay.root);
+    return rc;
+}
+
+/*
+ * Replaying. Everything below runs on the callback threads.
+ */
+static
+void
+gfs_replay_next(
+    gfs_replay_session_t *              session);
+
+/* seconds from now until t, a traced time, is due */
+static
+double
+gfs_replay_delay(
+    int64_t                             t)
+{
+    double                              delay;
+
+    if (gfs_replay.speed <= 0) return 0;
+    delay = (t - gfs_replay.t0) / 1000000.0 / gfs_replay.speed -
+            (stub_now() - gfs_replay.wall0);
+    return (delay > 0 ? delay : 0);
+}
+
+static
+void
+gfs_replay_done(
+    globus_gfs_operation_t              stub_op,
+    void *                              arg)
+{
+    gfs_replay_op_t *                   op = (gfs_replay_op_t *) arg;
+
+    op->t_done = stub_op->t_finished;
+    op->result = stub_op->result;
+    op->bytes = stub_op->bytes;
+    op->replayed = GLOBUS_TRUE;
+    if (op->result != GLOBUS_SUCCESS && stub_verbose)
+    {
+        fprintf(stderr, "%s %s: %s\n",
+                gfs_replay_kind_names[gfs_replay_kind(op)], op->local_path,
+                stub_errstr(op->result));
+    }
+    stub_op_destroy(stub_op);
+    if (op->range_list != NULL) globus_range_list_destroy(op->range_list);
+    free(op->local_path);
+    free(op->local_arg);
+    op->local_path = op->local_arg = NULL;
+    gfs_replay_next(op->session);
+}
+
+static
+void
+gfs_replay_transfer(
+    gfs_replay_op_t *                   op,
+    globus_gfs_operation_t              stub_op)
+{
+    globus_gfs_transfer_info_t *        info = &op->info.transfer;
+    int64_t                             left;
+    int64_t                             length;
+    int                                 i;
+
+    stub_op->block_size = (op->block_size > 0 ? op->block_size :
+                                                stub_op->block_size);
+    stub_op->concurrency = (op->concurrency > 0 ? op->concurrency : 1);
+    stub_op->streams = stub_op->concurrency;
+
+    globus_range_list_init(&op->range_list);
+    for (i = 0; i < op->nranges; i++)
+    {
+        globus_range_list_insert(op->range_list, op->ranges[2 * i],
+                                 op->ranges[2 * i + 1]);
+    }
+    memset(info, 0, sizeof(*info));
+    info->pathname = op->local_path;
+    info->partial_offset = op->offset;
+    info->partial_length = op->length;
+    info->range_list = op->range_list;
+    info->alloc_size = op->size;
+    info->node_count = 1;
+
+    if (op->type == GLOBUS_L_GFS_POSIX_TRACE_SEND)
+    {
+        if (op->offset > 0 || op->length > 0 || op->nranges == 0)
+        {
+            globus_range_list_insert(stub_op->ranges,
+                                     op->offset > 0 ? op->offset : 0,
+                                     op->length > 0 ? op->length : -1);
+        }
+        else
+        {
+            globus_range_list_copy(&stub_op->ranges, op->range_list);
+        }
+        return;
+    }
+
+    /* what was received: the ranges asked for, as much as arrived */
+    stub_op->write_offset = (op->offset > 0 ? op->offset : 0);
+    stub_op->write_length = (op->length > 0 ? op->length : -1);
+    left = op->end_size;
+    for (i = 0; i < op->nranges && left > 0; i++)
+    {
+        length = op->ranges[2 * i + 1];
+        if (length < 0 || length > left) length = left;
+        globus_range_list_insert(stub_op->ranges, op->ranges[2 * i], length);
+        left -= length;
+    }
+    if (op->nranges == 0 && left > 0)
+    {
+        globus_range_list_insert(stub_op->ranges, stub_op->write_offset, left);
+    }
+}
+
+static
+void
+gfs_replay_issue(
+    void *                              arg)
+{
+    gfs_replay_op_t *                   op = (gfs_replay_op_t *) arg;
+    gfs_replay_session_t *              session = op->session;
+    globus_gfs_command_info_t *         command = &op->info.command;
+    globus_gfs_operation_t              stub_op;
+    stub_op_kind_t                      kind;
+
+    switch (op->type)
+    {
+      case GLOBUS_L_GFS_POSIX_TRACE_STAT:    kind = STUB_OP_STAT; break;
+      case GLOBUS_L_GFS_POSIX_TRACE_COMMAND: kind = STUB_OP_COMMAND; break;
+      case GLOBUS_L_GFS_POSIX_TRACE_SEND:    kind = STUB_OP_SEND; break;
+      default:                               kind = STUB_OP_RECV; break;
+    }
+    stub_op = stub_op_create(kind, gfs_replay_done, op);
+    if (stub_op == NULL)
+    {
+        fprintf(stderr, "out of memory\n");
+        exit(2);
+    }
+    op->local_path = gfs_replay_local(op->path);
+    op->t_issue = stub_now();
+
+    switch (op->type)
+    {
+      case GLOBUS_L_GFS_POSIX_TRACE_STAT:
+        memset(&op->info.stat, 0, sizeof(op->info.stat));
+        op->info.stat.pathname = op->local_path;
+        op->info.stat.file_only = op->code;
+        gfs_replay.iface->stat_func(stub_op, &op->info.stat,
+                                    session->session_arg);
+        break;
+
+      case GLOBUS_L_GFS_POSIX_TRACE_COMMAND:
+        memset(command, 0, sizeof(*command));
+        command->command = op->code;
+        command->pathname = op->local_path;
+        switch (op->code)
+        {
+          case GLOBUS_GFS_CMD_CKSM:
+            command->cksm_alg = op->arg;
+            command->cksm_offset = op->offset;
+            command->cksm_length = op->length;
+            break;
+          case GLOBUS_GFS_CMD_TRNC:
+            command->cksm_offset = op->offset;
+            break;
+          case GLOBUS_GFS_CMD_RNTO:
+            command->rnfr_pathname = op->local_arg = gfs_replay_local(op->arg);
+            break;
+          case GLOBUS_GFS_CMD_SITE_CHMOD:
+            command->chmod_mode = op->offset;
+            break;
+          case GLOBUS_GFS_CMD_SITE_CHGRP:
+            command->chgrp_group = op->arg;
+            break;
+          case GLOBUS_GFS_CMD_SITE_UTIME:
+            command->utime_time = op->offset;
+            break;
+          case GLOBUS_GFS_CMD_SITE_SYMLINK:
+            command->from_pathname = op->local_arg = gfs_replay_local(op->arg);
+            break;
+        }
+        gfs_replay.iface->command_func(stub_op, command,
+                                       session->session_arg);
+        break;
+
+      case GLOBUS_L_GFS_POSIX_TRACE_SEND:
+        gfs_replay_transfer(op, stub_op);
+        gfs_replay.iface->send_func(stub_op, &op->info.transfer,
+                                    session->session_arg);
+        break;
+
+      default:
+        gfs_replay_transfer(op, stub_op);
+        gfs_replay.iface->recv_func(stub_op, &op->info.transfer,
+                                    session->session_arg);
+        break;
+    }
+}
+
+static
+void
+gfs_replay_next(
+    gfs_replay_session_t *              session)
+{
+    gfs_replay_op_t *                   op;
+    double                              delay;
+
+    /* an upload whose end is not in the trace has no known size */
+    while (session->next < session->nops &&
+           session->ops[session->next]->type ==
+           GLOBUS_L_GFS_POSIX_TRACE_RECV &&
+           ! session->ops[session->next]->ended)
+    {
+        session->next++;
+    }
+    if (session->next == session->nops)
+    {
+        gfs_replay.iface->destroy_func(session->session_arg);
+        pthread_mutex_lock(&gfs_replay.lock);
+        if (--gfs_replay.active == 0) gfs_replay.stop = 1;
+        pthread_mutex_unlock(&gfs_replay.lock);
+        return;
+    }
+    op = session->ops[session->next++];
+    delay = gfs_replay_delay(op->t_begin);
+    if (delay > 0.001)
+    {
+        stub_schedule(delay, gfs_replay_issue, op);
+    }
+    else
+    {
+        gfs_replay_issue(op);
+    }
+}
+
+static
+void
+gfs_replay_started(
+    globus_gfs_operation_t              stub_op,
+    void *                              arg)
+{
+    gfs_replay_session_t *              session;
+
+    session = (gfs_replay_session_t *) arg;
+    session->session_arg = stub_op->session_arg;
+    stub_op_destroy(stub_op);
+    gfs_replay_next(session);
+}
+
+static
+void
+gfs_replay_start(
+    void *                              arg)
+{
+    globus_gfs_session_info_t           session_info;
+    globus_gfs_operation_t              stub_op;
+
+    stub_op = stub_op_create(STUB_OP_SESSION, gfs_replay_started, arg);
+    if (stub_op == NULL)
+    {
+        fprintf(stderr, "out of memory\n");
+        exit(2);
+    }
+    memset(&session_info, 0, sizeof(session_info));
+    session_info.username = getenv("USER");
+    gfs_replay.iface->init_func(stub_op, &session_info);
+}
+
+/*
+ * Reporting.
+ */
+static
+int
+gfs_replay_double_cmp(
+    const void *                        a,
+    const void *                        b)
+{
+    double                              x = *(const double *) a;
+    double                              y = *(const double *) b;
+
+    return (x < y ? -1 : x > y);
+}
+
+/* average, median and 99th percentile of n latencies, in ms */
+static
+void
+gfs_replay_latency(
+    double *                            v,
+    int                                 n,
+    char *                              out,
+    size_t                              size)
+{
+    double                              sum = 0;
+    int                                 i;
+
+    if (n == 0)
+    {
+        snprintf(out, size, "%8s %8s %8s", "-", "-", "-");
+        return;
+    }
+    qsort(v, n, sizeof(double), gfs_replay_double_cmp);
+    for (i = 0; i < n; i++)
+    {
+        sum += v[i];
+    }
+    snprintf(out, size, "%8.2f %8.2f %8.2f", sum / n * 1000,
+             v[n / 2] * 1000, v[(int) (n * 0.99)] * 1000);
+}
+
+static
+int
+gfs_replay_report(
+    double                              wall)
+{
+    gfs_replay_session_t *              session;
+    gfs_replay_op_t *                   op;
+    double *                            traced[GFS_REPLAY_NKINDS];
+    double *                            replayed[GFS_REPLAY_NKINDS];
+    int                                 count[GFS_REPLAY_NKINDS];
+    int                                 ntraced[GFS_REPLAY_NKINDS];
+    int                                 failed[GFS_REPLAY_NKINDS];
+    int                                 differ[GFS_REPLAY_NKINDS];
+    double                              bytes[GFS_REPLAY_NKINDS];
+    double                              traced_time[GFS_REPLAY_NKINDS];
+    double                              replay_time[GFS_REPLAY_NKINDS];
+    char                                t_lat[64];
+    char                                r_lat[64];
+    int64_t                             t_first = INT64_MAX;
+    int64_t                             t_last = 0;
+    int                                 total = 0;
+    int                                 ndiffer = 0;
+    int                                 i, j, k;
+
+    memset(count, 0, sizeof(count));
+    memset(ntraced, 0, sizeof(ntraced));
+    memset(failed, 0, sizeof(failed));
+    memset(differ, 0, sizeof(differ));
+    memset(bytes, 0, sizeof(bytes));
+    memset(traced_time, 0, sizeof(traced_time));
+    memset(replay_time, 0, sizeof(replay_time));
+    for (i = 0; i < gfs_replay.nsessions; i++)
+    {
+        session = gfs_replay.sessions[i];
+        for (j = 0; j < session->nops; j++)
+        {
+            count[gfs_replay_kind(session->ops[j])]++;
+        }
+    }
+    for (k = 0; k < GFS_REPLAY_NKINDS; k++)
+    {
+        traced[k] = gfs_replay_alloc((count[k] + 1) * sizeof(double));
+        replayed[k] = gfs_replay_alloc((count[k] + 1) * sizeof(double));
+        count[k] = 0;
+    }
+
+    for (i = 0; i < gfs_replay.nsessions; i++)
+    {
+        session = gfs_replay.sessions[i];
+        for (j = 0; j < session->nops; j++)
+        {
+            op = session->ops[j];
+            if (! op->replayed) continue;
+            k = gfs_replay_kind(op);
+            replayed[k][count[k]++] = op->t_done - op->t_issue;
+            replay_time[k] += op->t_done - op->t_issue;
+            bytes[k] += op->bytes;
+            if (op->result != GLOBUS_SUCCESS) failed[k]++;
+            if (op->t_begin < t_first) t_first = op->t_begin;
+            if (op->ended)
+            {
+                traced[k][ntraced[k]++] = (op->t_end - op->t_begin) / 1e6;
+                traced_time[k] += (op->t_end - op->t_begin) / 1e6;
+                if (op->t_end > t_last) t_last = op->t_end;
+                if ((op->result != GLOBUS_SUCCESS) !=
+                    ((op->end_flags & GLOBUS_L_GFS_POSIX_TRACE_FAILED) != 0))
+                {
+                    differ[k]++;
+                }
+            }
+            total++;
+        }
+    }
+    for (k = 0; k < GFS_REPLAY_NKINDS; k++)
+    {
+        ndiffer += differ[k];
+    }
+
+    printf("replayed %d operations of %d sessions in %.2f s "
+           "(traced over %.2f s), %d with another outcome than traced\n",
+           total, gfs_replay.nsessions, wall,
+           t_last > t_first ? (t_last - t_first) / 1e6 : 0.0, ndiffer);
+    printf("%-6s %7s %6s %6s  %-26s  %-26s %10s %9s %9s\n",
+           "", "count", "failed", "differ", "traced ms: avg p50 p99",
+           "replayed ms: avg p50 p99", "MB", "MB/s", "traced");
+    for (k = 0; k < GFS_REPLAY_NKINDS; k++)
+    {
+        if (count[k] == 0) continue;
+        gfs_replay_latency(traced[k], ntraced[k], t_lat, sizeof(t_lat));
+        gfs_replay_latency(replayed[k], count[k], r_lat, sizeof(r_lat));
+        printf("%-6s %7d %6d %6d  %-26s  %-26s", gfs_replay_kind_names[k],
+               count[k], failed[k], differ[k], t_lat, r_lat);
+        if (k == GFS_REPLAY_SEND || k == GFS_REPLAY_RECV)
+        {
+            /* per transfer throughput, over the time spent in transfers */
+            printf(" %10.1f %9.1f %9.1f", bytes[k] / 1048576.0,
+                   replay_time[k] > 0 ?
+                   bytes[k] / 1048576.0 / replay_time[k] : 0.0,
+                   traced_time[k] > 0 ?
+                   bytes[k] / 1048576.0 / traced_time[k] : 0.0);
+        }
+        printf("\n");
+        free(traced[k]);
+        free(replayed[k]);
+    }
+    if (bytes[GFS_REPLAY_SEND] + bytes[GFS_REPLAY_RECV] > 0 && wall > 0)
+    {
+        printf("aggregate: %.1f MB/s\n",
+               (bytes[GFS_REPLAY_SEND] + bytes[GFS_REPLAY_RECV]) /
+               1048576.0 / wall);
+    }
+    return 0;
+}
+
+static
+int
+gfs_replay_session_cmp(
+    const void *                        a,
+    const void *                        b)
+{
+    const gfs_replay_session_t *        x;
+    const gfs_replay_session_t *        y;
+
+    x = *(const gfs_replay_session_t * const *) a;
+    y = *(const gfs_replay_session_t * const *) b;
+    return (x->t_start < y->t_start ? -1 : x->t_start > y->t_start);
+}
+
+static
+void
+gfs_replay_usage(
+    const char *                        prog)
+{
+    fprintf(stderr,
+            "usage: %s [-r root] [-s speed] [-t threads] [-n] [-v] "
+            "trace...\n", prog);
+    exit(2);
+}
+
+int
+main(
+    int                                 argc,
+    char **                             argv)
+{
+    gfs_replay_session_t *              session;
+    globus_bool_t                       prepare = GLOBUS_TRUE;
+    double                              wall;
+    int                                 opt;
+    int                                 i;
+
+    while ((opt = getopt(argc, argv, "r:s:t:nvh")) != -1)
+    {
+        switch (opt)
+        {
+          case 'r': gfs_replay.root = optarg; break;
+          case 's': gfs_replay.speed = strtod(optarg, NULL); break;
+          case 't': gfs_replay.threads = atoi(optarg); break;
+          case 'n': prepare = GLOBUS_FALSE; break;
+          case 'v': stub_verbose = 1; break;
+          default: gfs_replay_usage(argv[0]);
+        }
+    }
+    if (optind == argc || gfs_replay.speed < 0 || gfs_replay.threads < 1)
+    {
+        gfs_replay_usage(argv[0]);
+    }
+    /* a replay is not traced, it would only trace itself */
+    unsetenv("GRIDFTP_POSIX_TRACE");
+    pthread_mutex_init(&gfs_replay.lock, NULL);
+
+    for (i = optind; i < argc; i++)
+    {
+        if (gfs_replay_load(argv[i], i) != 0) return 2;
+    }
+    for (i = 0; i < gfs_replay.nsessions; i++)
+    {
+        if (gfs_replay.sessions[i]->nops == 0)
+        {
+            gfs_replay.sessions[i--] =
+                gfs_replay.sessions[--gfs_replay.nsessions];
+        }
+    }
+    if (gfs_replay.nsessions == 0)
+    {
+        printf("nothing to replay\n");
+        return 0;
+    }
+    qsort(gfs_replay.sessions, gfs_replay.nsessions,
+          sizeof(gfs_replay_session_t *), gfs_replay_session_cmp);
+
+    if (mkdir(gfs_replay.root, 0755) != 0 && errno != EEXIST)
+    {
+        fprintf(stderr, "%s: %s\n", gfs_replay.root, strerror(errno));
+        return 2;
+    }
+    if (prepare && gfs_replay_prepare() != 0) return 2;
+
+    gfs_replay.iface = stub_dsi_load(&globus_gridftp_server_posix_module);
+    if (gfs_replay.iface == NULL)
+    {
+        fprintf(stderr, "cannot activate the DSI\n");
+        return 2;
+    }
+
+    gfs_replay.t0 = gfs_replay.sessions[0]->t_start;
+    gfs_replay.wall0 = stub_now();
+    gfs_replay.active = gfs_replay.nsessions;
+    for (i = 0; i < gfs_replay.nsessions; i++)
+    {
+        session = gfs_replay.sessions[i];
+        stub_schedule(gfs_replay_delay(session->t_start), gfs_replay_start,
+                      session);
+    }
+    stub_run(gfs_replay.threads, &gfs_replay.stop);
+    wall = stub_now() - gfs_replay.wall0;
+
+    globus_gridftp_server_posix_module.deactivate();
+    return gfs_replay_report(wall);
+}
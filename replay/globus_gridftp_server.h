@@ -0,0 +1,400 @@
+/************************************************************************/
+/* replay/globus_gridftp_server.h                                       */
+/*                                                                      */
+/* Minimal stand-in for the Globus GridFTP server DSI API: just the     */
+/* types, constants and calls globus_gridftp_server_posix.c uses, so    */
+/* the DSI builds against replay/stub_runtime.c instead of globus.      */
+/* Field and function names follow the globus headers, the layouts do   */
+/* not, nothing built against this file can be loaded by a real server. */
+/************************************************************************/
+
+#ifndef GLOBUS_GRIDFTP_SERVER_H
+#define GLOBUS_GRIDFTP_SERVER_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <pwd.h>
+#include <time.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/param.h>
+#include <sys/xattr.h>
+
+/* globus_common */
+typedef int                             globus_bool_t;
+#define GLOBUS_TRUE                     1
+#define GLOBUS_FALSE                    0
+typedef int                             globus_result_t;
+#define GLOBUS_SUCCESS                  0
+#define GLOBUS_FAILURE                  -1
+typedef size_t                          globus_size_t;
+typedef int64_t                         globus_off_t;
+#define GLOBUS_OFF_T_FORMAT             "ld"
+typedef unsigned char                   globus_byte_t;
+
+typedef pthread_mutex_t                 globus_mutex_t;
+typedef pthread_cond_t                  globus_cond_t;
+typedef pthread_t                       globus_thread_t;
+int
+stub_cond_wait(
+    pthread_cond_t *                    cond,
+    pthread_mutex_t *                   mutex);
+#define globus_mutex_init(m, a)         pthread_mutex_init(m, NULL)
+#define globus_mutex_destroy(m)         pthread_mutex_destroy(m)
+#define globus_mutex_lock(m)            pthread_mutex_lock(m)
+#define globus_mutex_unlock(m)          pthread_mutex_unlock(m)
+#define globus_cond_init(c, a)          pthread_cond_init(c, NULL)
+#define globus_cond_destroy(c)          pthread_cond_destroy(c)
+#define globus_cond_wait(c, m)          stub_cond_wait(c, m)
+#define globus_cond_signal(c)           pthread_cond_signal(c)
+#define globus_cond_broadcast(c)        pthread_cond_broadcast(c)
+
+#define globus_malloc                   malloc
+#define globus_calloc                   calloc
+#define globus_realloc                  realloc
+#define globus_free                     free
+#define globus_libc_strdup              strdup
+#define globus_libc_opendir             opendir
+int
+globus_libc_readdir_r(
+    DIR *                               dir,
+    struct dirent **                    entry);
+void
+globus_panic(
+    void *                              module,
+    globus_result_t                     result,
+    const char *                        msg,
+    ...);
+
+typedef struct
+{
+    long                                tv_sec;
+    long                                tv_usec;
+} globus_reltime_t;
+#define GlobusTimeReltimeSet(r, s, u)                                       \
+    do { (r).tv_sec = (s); (r).tv_usec = (u); } while (0)
+
+typedef void (*globus_callback_func_t)(void * user_arg);
+typedef int                             globus_callback_handle_t;
+globus_result_t
+globus_callback_register_oneshot(
+    globus_callback_handle_t *          handle,
+    const globus_reltime_t *            delay,
+    globus_callback_func_t              callback,
+    void *                              user_arg);
+globus_result_t
+globus_callback_unregister(
+    globus_callback_handle_t            handle,
+    globus_callback_func_t              unregister_callback,
+    void *                              unreg_arg,
+    globus_bool_t *                     active);
+
+typedef struct globus_l_range_list_s *  globus_range_list_t;
+#define GLOBUS_RANGE_LIST_MAX           -1
+int globus_range_list_init(globus_range_list_t * list);
+void globus_range_list_destroy(globus_range_list_t list);
+int globus_range_list_insert(globus_range_list_t list,
+                             globus_off_t offset, globus_off_t length);
+int globus_range_list_remove(globus_range_list_t list,
+                             globus_off_t offset, globus_off_t length);
+int globus_range_list_size(globus_range_list_t list);
+int globus_range_list_at(globus_range_list_t list, int ndx,
+                         globus_off_t * offset, globus_off_t * length);
+int globus_range_list_remove_at(globus_range_list_t list, int ndx,
+                                globus_off_t * offset, globus_off_t * length);
+int globus_range_list_copy(globus_range_list_t * dest,
+                           globus_range_list_t src);
+
+/* globus_gridftp_server */
+typedef struct globus_l_gfs_data_operation_s * globus_gfs_operation_t;
+
+typedef struct
+{
+    globus_bool_t                       del_cred;
+    void *                              free_cred;
+    globus_bool_t                       map_user;
+    char *                              username;
+    char *                              password;
+    char *                              subject;
+    char *                              cookie;
+    char *                              host_id;
+} globus_gfs_session_info_t;
+
+typedef struct
+{
+    char *                              pathname;
+    globus_bool_t                       file_only;
+    globus_bool_t                       internal;
+    void *                              op_info;
+} globus_gfs_stat_info_t;
+
+typedef struct
+{
+    int                                 command;
+    char *                              pathname;
+    globus_off_t                        cksm_offset;
+    globus_off_t                        cksm_length;
+    char *                              cksm_alg;
+    int                                 chmod_mode;
+    char *                              rnfr_pathname;
+    char *                              authz_assert;
+    char *                              chgrp_group;
+    time_t                              utime_time;
+    char *                              from_pathname;
+    void *                              op_info;
+} globus_gfs_command_info_t;
+
+typedef struct
+{
+    char *                              pathname;
+    char *                              module_name;
+    char *                              module_args;
+    char *                              list_type;
+    globus_off_t                        partial_offset;
+    globus_off_t                        partial_length;
+    globus_range_list_t                 range_list;
+    globus_bool_t                       truncate;
+    void *                              data_arg;
+    int                                 eof_count;
+    int                                 stripe_count;
+    int                                 node_count;
+    int                                 node_ndx;
+    globus_off_t                        alloc_size;
+    char *                              expected_checksum;
+    char *                              expected_checksum_alg;
+    void *                              op_info;
+} globus_gfs_transfer_info_t;
+
+typedef struct
+{
+    int                                 mode;
+    int                                 nlink;
+    char *                              name;
+    char *                              symlink_target;
+    uid_t                               uid;
+    gid_t                               gid;
+    globus_off_t                        size;
+    time_t                              atime;
+    time_t                              ctime;
+    time_t                              mtime;
+    int                                 dev;
+    ino_t                               ino;
+} globus_gfs_stat_t;
+
+typedef struct
+{
+    void *                              session_arg;
+    char *                              username;
+    char *                              home_dir;
+} globus_gfs_session_finished_info_t;
+
+enum
+{
+    GLOBUS_GFS_OP_SESSION_START = 1
+};
+
+typedef struct
+{
+    int                                 type;
+    int                                 id;
+    int                                 code;
+    char *                              msg;
+    globus_result_t                     result;
+    union
+    {
+        globus_gfs_session_finished_info_t session;
+    }                                   info;
+    void *                              op_info;
+} globus_gfs_finished_info_t;
+
+enum
+{
+    GLOBUS_GFS_CMD_MKD = 1,
+    GLOBUS_GFS_CMD_RMD,
+    GLOBUS_GFS_CMD_DELE,
+    GLOBUS_GFS_CMD_SITE_AUTHZ_ASSERT,
+    GLOBUS_GFS_CMD_SITE_RDEL,
+    GLOBUS_GFS_CMD_RNTO,
+    GLOBUS_GFS_CMD_RNFR,
+    GLOBUS_GFS_CMD_CKSM,
+    GLOBUS_GFS_CMD_SITE_CHMOD,
+    GLOBUS_GFS_CMD_SITE_DSI,
+    GLOBUS_GFS_CMD_SITE_SETNETSTACK,
+    GLOBUS_GFS_CMD_SITE_SETDISKSTACK,
+    GLOBUS_GFS_CMD_SITE_CLIENTINFO,
+    GLOBUS_GFS_CMD_DCSC,
+    GLOBUS_GFS_CMD_SITE_CHGRP,
+    GLOBUS_GFS_CMD_SITE_UTIME,
+    GLOBUS_GFS_CMD_SITE_SYMLINK,
+    GLOBUS_GFS_CMD_SITE_TASKID,
+    GLOBUS_GFS_CMD_TRNC
+};
+
+typedef enum
+{
+    GLOBUS_GFS_LOG_ERR = 0x01,
+    GLOBUS_GFS_LOG_WARN = 0x02,
+    GLOBUS_GFS_LOG_TRANSFER = 0x04,
+    GLOBUS_GFS_LOG_INFO = 0x08,
+    GLOBUS_GFS_LOG_DUMP = 0x10
+} globus_gfs_log_type_t;
+void
+globus_gfs_log_message(
+    globus_gfs_log_type_t               type,
+    const char *                        format,
+    ...);
+
+typedef void (*globus_gridftp_server_write_cb_t)(
+    globus_gfs_operation_t              op,
+    globus_result_t                     result,
+    globus_byte_t *                     buffer,
+    globus_size_t                       nbytes,
+    globus_off_t                        offset,
+    globus_bool_t                       eof,
+    void *                              user_arg);
+typedef void (*globus_gridftp_server_read_cb_t)(
+    globus_gfs_operation_t              op,
+    globus_result_t                     result,
+    globus_byte_t *                     buffer,
+    globus_size_t                       nbytes,
+    void *                              user_arg);
+
+void globus_gridftp_server_operation_finished(globus_gfs_operation_t op,
+    globus_result_t result, globus_gfs_finished_info_t * finished_info);
+void globus_gridftp_server_finished_stat(globus_gfs_operation_t op,
+    globus_result_t result, globus_gfs_stat_t * stat_array, int stat_count);
+void globus_gridftp_server_finished_command(globus_gfs_operation_t op,
+    globus_result_t result, char * command_response);
+void globus_gridftp_server_intermediate_command(globus_gfs_operation_t op,
+    globus_result_t result, char * command_response);
+void globus_gridftp_server_finished_transfer(globus_gfs_operation_t op,
+    globus_result_t result);
+void globus_gridftp_server_begin_transfer(globus_gfs_operation_t op,
+    int event_mask, void * event_arg);
+void globus_gridftp_server_get_block_size(globus_gfs_operation_t op,
+    globus_size_t * block_size);
+void globus_gridftp_server_get_optimal_concurrency(globus_gfs_operation_t op,
+    int * count);
+void globus_gridftp_server_get_read_range(globus_gfs_operation_t op,
+    globus_off_t * offset, globus_off_t * length);
+void globus_gridftp_server_get_write_range(globus_gfs_operation_t op,
+    globus_off_t * offset, globus_off_t * length);
+void globus_gridftp_server_get_update_interval(globus_gfs_operation_t op,
+    int * interval);
+void globus_gridftp_server_update_bytes_written(globus_gfs_operation_t op,
+    globus_off_t offset, globus_off_t length);
+void globus_gridftp_server_update_range_recvd(globus_gfs_operation_t op,
+    globus_off_t offset, globus_off_t length);
+void globus_gridftp_server_set_checksum_support(globus_gfs_operation_t op,
+    const char * cksm_str);
+globus_result_t globus_gridftp_server_register_read(
+    globus_gfs_operation_t op, globus_byte_t * buffer, globus_size_t length,
+    globus_gridftp_server_write_cb_t callback, void * user_arg);
+globus_result_t globus_gridftp_server_register_write(
+    globus_gfs_operation_t op, globus_byte_t * buffer, globus_size_t length,
+    globus_off_t offset, int stripe_ndx,
+    globus_gridftp_server_read_cb_t callback, void * user_arg);
+
+/* errors carry their message, see stub_errstr() */
+globus_result_t
+stub_error(
+    const char *                        format,
+    ...);
+static const char * _gfs_name __attribute__((unused)) = "posix";
+#define GlobusGFSName(f)                                                    \
+    static const char * _gfs_name __attribute__((unused)) = #f
+#define GlobusGFSErrorGeneric(msg)                                          \
+    stub_error("%s: %s", _gfs_name, (msg))
+#define GlobusGFSErrorSystemError(cmd, err)                                 \
+    stub_error("%s: %s failed: %s", _gfs_name, (cmd), strerror(err))
+#define GlobusGFSErrorMemory(what)                                          \
+    stub_error("%s: out of memory for %s", _gfs_name, (what))
+#define GlobusGFSErrorWrapFailed(what, r)                                   \
+    stub_error("%s: %s failed", _gfs_name, (what))
+#define GlobusGFSFileDebugEnter()
+#define GlobusGFSFileDebugExit()
+#define GlobusGFSFileDebugExitWithError()
+
+typedef enum
+{
+    GLOBUS_GFS_EVENT_TRANSFER_BEGIN = 0x0001,
+    GLOBUS_GFS_EVENT_TRANSFER_ABORT = 0x0002,
+    GLOBUS_GFS_EVENT_TRANSFER_COMPLETE = 0x0004,
+    GLOBUS_GFS_EVENT_DISCONNECTED = 0x0008
+} globus_gfs_event_type_t;
+
+typedef struct
+{
+    globus_gfs_event_type_t             type;
+    void *                              event_arg;
+} globus_gfs_event_info_t;
+
+typedef void (*globus_gfs_storage_init_t)(
+    globus_gfs_operation_t, globus_gfs_session_info_t *);
+typedef void (*globus_gfs_storage_destroy_t)(void *);
+typedef void (*globus_gfs_storage_transfer_t)(
+    globus_gfs_operation_t, globus_gfs_transfer_info_t *, void *);
+typedef void (*globus_gfs_storage_command_t)(
+    globus_gfs_operation_t, globus_gfs_command_info_t *, void *);
+typedef void (*globus_gfs_storage_stat_t)(
+    globus_gfs_operation_t, globus_gfs_stat_info_t *, void *);
+
+typedef struct
+{
+    int                                 descriptor;
+    globus_gfs_storage_init_t           init_func;
+    globus_gfs_storage_destroy_t        destroy_func;
+    globus_gfs_storage_transfer_t       list_func;
+    globus_gfs_storage_transfer_t       send_func;
+    globus_gfs_storage_transfer_t       recv_func;
+    void                                (*trev_func)(
+        globus_gfs_event_info_t *, void *);
+    void *                              active_func;
+    void *                              passive_func;
+    void *                              data_destroy_func;
+    globus_gfs_storage_command_t        command_func;
+    globus_gfs_storage_stat_t           stat_func;
+    void *                              set_cred_func;
+    void *                              buffer_send_func;
+} globus_gfs_storage_iface_t;
+#define GLOBUS_GFS_DSI_DESCRIPTOR_BLOCKING  0x01
+#define GLOBUS_GFS_DSI_DESCRIPTOR_SENDER    0x02
+
+/* globus_extension */
+typedef struct
+{
+    int                                 major;
+    int                                 minor;
+    unsigned long                       timestamp;
+    int                                 branch;
+} globus_version_t;
+
+typedef struct
+{
+    const char *                        name;
+    int                                 (*activate)(void);
+    int                                 (*deactivate)(void);
+    void *                              atexit_func;
+    void *                              get_pointer_func;
+    globus_version_t *                  version;
+} globus_extension_module_t;
+#define GlobusExtensionDefineModule(name)                                   \
+    globus_extension_module_t name##_module
+#define GlobusExtensionMyModule(name)   (&name##_module)
+#define GLOBUS_GFS_DSI_REGISTRY         "gfs_dsi"
+void
+globus_extension_registry_add(
+    const char *                        registry,
+    const char *                        name,
+    globus_extension_module_t *         module,
+    void *                              data);
+void
+globus_extension_registry_remove(
+    const char *                        registry,
+    const char *                        name);
+
+#endif
@@ -0,0 +1,951 @@
+/************************************************************************/
+/* replay/stub_runtime.c                                                */
+/*                                                                      */
+/* Single process stand-in for the parts of the Globus runtime the      */
+/* POSIX DSI calls: errors and logging, range lists, oneshot callbacks  */
+/* on a pool of threads, and the server side of operations. Used by     */
+/* gfs_replay, see stub_runtime.h.                                      */
+/************************************************************************/
+
+#include <stdarg.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/time.h>
+#include "stub_runtime.h"
+
+#define STUB_MAX_THREADS                256
+#define STUB_MAX_ERRORS                 64
+
+int                                     stub_verbose = 0;
+
+double
+stub_now(void)
+{
+    struct timeval                      tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+/*
+ * Errors. A result is an index into a ring of messages, so a failure
+ * can be printed for a while after it happened.
+ */
+static char                             stub_errors[STUB_MAX_ERRORS][256];
+static unsigned                         stub_nerrors;
+
+globus_result_t
+stub_error(
+    const char *                        format,
+    ...)
+{
+    va_list                             ap;
+    int                                 i;
+
+    i = __sync_fetch_and_add(&stub_nerrors, 1) % (STUB_MAX_ERRORS - 1) + 1;
+    va_start(ap, format);
+    vsnprintf(stub_errors[i], sizeof(stub_errors[i]), format, ap);
+    va_end(ap);
+    return i;
+}
+
+const char *
+stub_errstr(
+    globus_result_t                     result)
+{
+    if (result > 0 && result < STUB_MAX_ERRORS) return stub_errors[result];
+    return (result == GLOBUS_SUCCESS ? "success" : "failure");
+}
+
+void
+globus_gfs_log_message(
+    globus_gfs_log_type_t               type,
+    const char *                        format,
+    ...)
+{
+    va_list                             ap;
+
+    if (! stub_verbose) return;
+    va_start(ap, format);
+    vfprintf(stderr, format, ap);
+    va_end(ap);
+}
+
+void
+globus_panic(
+    void *                              module,
+    globus_result_t                     result,
+    const char *                        msg,
+    ...)
+{
+    fprintf(stderr, "panic: %s\n", msg);
+    abort();
+}
+
+int
+globus_libc_readdir_r(
+    DIR *                               dir,
+    struct dirent **                    entry)
+{
+    struct dirent *                     d;
+
+    d = readdir(dir);
+    if (d == NULL)
+    {
+        *entry = NULL;
+        return 0;
+    }
+    *entry = malloc(sizeof(struct dirent));
+    if (*entry == NULL) return -1;
+    memcpy(*entry, d, sizeof(struct dirent));
+    return 0;
+}
+
+/* the DSI registers itself when activated, only one is kept */
+static globus_gfs_storage_iface_t *     stub_iface;
+
+void
+globus_extension_registry_add(
+    const char *                        registry,
+    const char *                        name,
+    globus_extension_module_t *         module,
+    void *                              data)
+{
+    stub_iface = (globus_gfs_storage_iface_t *) data;
+}
+
+void
+globus_extension_registry_remove(
+    const char *                        registry,
+    const char *                        name)
+{
+    stub_iface = NULL;
+}
+
+globus_gfs_storage_iface_t *
+stub_dsi_load(
+    globus_extension_module_t *         module)
+{
+    if (module->activate() != 0) return NULL;
+    return stub_iface;
+}
+
+/*
+ * Range lists: sorted, non overlapping (offset, length) pairs, a length
+ * of -1 reaching to the end of the file.
+ */
+struct globus_l_range_list_s
+{
+    int                                 n;
+    int                                 cap;
+    globus_off_t *                      off;
+    globus_off_t *                      len;
+};
+
+static
+globus_off_t
+stub_range_end(
+    globus_off_t                        offset,
+    globus_off_t                        length)
+{
+    return (length < 0 ? INT64_MAX : offset + length);
+}
+
+static
+int
+stub_range_put(
+    globus_range_list_t                 list,
+    int                                 at,
+    globus_off_t                        offset,
+    globus_off_t                        end)
+{
+    globus_off_t *                      off;
+    globus_off_t *                      len;
+    int                                 cap;
+
+    if (list->n == list->cap)
+    {
+        cap = (list->cap == 0 ? 8 : 2 * list->cap);
+        off = realloc(list->off, cap * sizeof(globus_off_t));
+        if (off == NULL) return -1;
+        list->off = off;
+        len = realloc(list->len, cap * sizeof(globus_off_t));
+        if (len == NULL) return -1;
+        list->len = len;
+        list->cap = cap;
+    }
+    memmove(list->off + at + 1, list->off + at,
+            (list->n - at) * sizeof(globus_off_t));
+    memmove(list->len + at + 1, list->len + at,
+            (list->n - at) * sizeof(globus_off_t));
+    list->off[at] = offset;
+    list->len[at] = (end == INT64_MAX ? -1 : end - offset);
+    list->n++;
+    return 0;
+}
+
+static
+void
+stub_range_del(
+    globus_range_list_t                 list,
+    int                                 at)
+{
+    memmove(list->off + at, list->off + at + 1,
+            (list->n - at - 1) * sizeof(globus_off_t));
+    memmove(list->len + at, list->len + at + 1,
+            (list->n - at - 1) * sizeof(globus_off_t));
+    list->n--;
+}
+
+int
+globus_range_list_init(
+    globus_range_list_t *               list)
+{
+    *list = calloc(1, sizeof(struct globus_l_range_list_s));
+    return (*list == NULL ? -1 : 0);
+}
+
+void
+globus_range_list_destroy(
+    globus_range_list_t                 list)
+{
+    if (list == NULL) return;
+    free(list->off);
+    free(list->len);
+    free(list);
+}
+
+int
+globus_range_list_size(
+    globus_range_list_t                 list)
+{
+    return list->n;
+}
+
+int
+globus_range_list_at(
+    globus_range_list_t                 list,
+    int                                 ndx,
+    globus_off_t *                      offset,
+    globus_off_t *                      length)
+{
+    if (ndx < 0 || ndx >= list->n) return -1;
+    *offset = list->off[ndx];
+    *length = list->len[ndx];
+    return 0;
+}
+
+int
+globus_range_list_insert(
+    globus_range_list_t                 list,
+    globus_off_t                        offset,
+    globus_off_t                        length)
+{
+    globus_off_t                        end;
+    globus_off_t                        i_off;
+    globus_off_t                        i_end;
+    int                                 i;
+
+    end = stub_range_end(offset, length);
+    /* merge with every range it touches */
+    for (i = 0; i < list->n; )
+    {
+        i_off = list->off[i];
+        i_end = stub_range_end(i_off, list->len[i]);
+        if (i_end < offset || i_off > end)
+        {
+            i++;
+            continue;
+        }
+        if (i_off < offset) offset = i_off;
+        if (i_end > end) end = i_end;
+        stub_range_del(list, i);
+    }
+    for (i = 0; i < list->n && list->off[i] < offset; i++);
+    return stub_range_put(list, i, offset, end);
+}
+
+int
+globus_range_list_remove(
+    globus_range_list_t                 list,
+    globus_off_t                        offset,
+    globus_off_t                        length)
+{
+    globus_off_t                        end;
+    globus_off_t                        i_off;
+    globus_off_t                        i_end;
+    int                                 i;
+
+    end = stub_range_end(offset, length);
+    for (i = 0; i < list->n; )
+    {
+        i_off = list->off[i];
+        i_end = stub_range_end(i_off, list->len[i]);
+        if (i_end <= offset || i_off >= end)
+        {
+            i++;
+            continue;
+        }
+        stub_range_del(list, i);
+        if (i_off < offset && stub_range_put(list, i++, i_off, offset) != 0)
+        {
+            return -1;
+        }
+        if (i_end > end && stub_range_put(list, i++, end, i_end) != 0)
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int
+globus_range_list_remove_at(
+    globus_range_list_t                 list,
+    int                                 ndx,
+    globus_off_t *                      offset,
+    globus_off_t *                      length)
+{
+    if (globus_range_list_at(list, ndx, offset, length) != 0) return -1;
+    stub_range_del(list, ndx);
+    return 0;
+}
+
+int
+globus_range_list_copy(
+    globus_range_list_t *               dest,
+    globus_range_list_t                 src)
+{
+    int                                 i;
+
+    if (globus_range_list_init(dest) != 0) return -1;
+    for (i = 0; i < src->n; i++)
+    {
+        if (globus_range_list_insert(*dest, src->off[i], src->len[i]) != 0)
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Callbacks. One queue ordered by due time, served by the threads of
+ * stub_run(). DSI storage I/O runs on these threads, so their number
+ * caps how much of it can block at once, like the server's thread pool.
+ */
+typedef struct stub_event_s
+{
+    struct stub_event_s *               next;
+    double                              due;
+    void                                (*fn)(void *);
+    void *                              arg;
+    int                                 id;
+    /* unregistered while running: called once it has returned */
+    void                                (*unreg_fn)(void *);
+    void *                              unreg_arg;
+} stub_event_t;
+
+static struct
+{
+    pthread_mutex_t                     lock;
+    pthread_cond_t                      cond;
+    stub_event_t *                      queue;
+    stub_event_t *                      running;
+    int                                 pending;    /* queued or running */
+    int                                 next_id;
+    volatile int *                      stop;
+} stub_events = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER,
+                  NULL, NULL, 0, 1, NULL };
+
+static
+int
+stub_event_push(
+    double                              delay,
+    void                                (*fn)(void *),
+    void *                              arg)
+{
+    stub_event_t *                      event;
+    stub_event_t **                     prev;
+    int                                 id;
+
+    event = malloc(sizeof(stub_event_t));
+    if (event == NULL)
+    {
+        fprintf(stderr, "out of memory for a callback\n");
+        abort();
+    }
+    event->due = stub_now() + delay;
+    event->fn = fn;
+    event->arg = arg;
+    event->unreg_fn = NULL;
+
+    pthread_mutex_lock(&stub_events.lock);
+    id = event->id = stub_events.next_id++;
+    for (prev = &stub_events.queue; *prev != NULL && (*prev)->due <= event->due;
+         prev = &(*prev)->next);
+    event->next = *prev;
+    *prev = event;
+    stub_events.pending++;
+    pthread_cond_broadcast(&stub_events.cond);
+    pthread_mutex_unlock(&stub_events.lock);
+    return id;
+}
+
+void
+stub_schedule(
+    double                              delay,
+    void                                (*fn)(void *),
+    void *                              arg)
+{
+    stub_event_push(delay, fn, arg);
+}
+
+globus_result_t
+globus_callback_register_oneshot(
+    globus_callback_handle_t *          handle,
+    const globus_reltime_t *            delay,
+    globus_callback_func_t              callback,
+    void *                              user_arg)
+{
+    int                                 id;
+
+    id = stub_event_push(delay == NULL ? 0 :
+                         delay->tv_sec + delay->tv_usec / 1000000.0,
+                         callback, user_arg);
+    if (handle != NULL) *handle = id;
+    return GLOBUS_SUCCESS;
+}
+
+globus_result_t
+globus_callback_unregister(
+    globus_callback_handle_t            handle,
+    globus_callback_func_t              unregister_callback,
+    void *                              unreg_arg,
+    globus_bool_t *                     active)
+{
+    stub_event_t **                     prev;
+    stub_event_t *                      event;
+    globus_bool_t                       found = GLOBUS_FALSE;
+    globus_bool_t                       running = GLOBUS_FALSE;
+
+    /* like globus, the unregister callback runs once fn cannot run */
+    pthread_mutex_lock(&stub_events.lock);
+    for (prev = &stub_events.queue; *prev != NULL; prev = &(*prev)->next)
+    {
+        if ((*prev)->id == handle)
+        {
+            event = *prev;
+            *prev = event->next;
+            free(event);
+            stub_events.pending--;
+            found = GLOBUS_TRUE;
+            break;
+        }
+    }
+    for (event = stub_events.running; ! found && event != NULL;
+         event = event->next)
+    {
+        if (event->id == handle)
+        {
+            event->unreg_fn = unregister_callback;
+            event->unreg_arg = unreg_arg;
+            found = running = GLOBUS_TRUE;
+        }
+    }
+    pthread_cond_broadcast(&stub_events.cond);
+    pthread_mutex_unlock(&stub_events.lock);
+    if (active != NULL) *active = running;
+    if (! found) return GLOBUS_FAILURE;
+    if (! running && unregister_callback != NULL)
+    {
+        stub_event_push(0, unregister_callback, unreg_arg);
+    }
+    return GLOBUS_SUCCESS;
+}
+
+static __thread int                     stub_event_thread_self;
+
+/* take the first due event, with stub_events.lock held */
+static
+stub_event_t *
+stub_event_take(void)
+{
+    stub_event_t *                      event;
+
+    event = stub_events.queue;
+    if (event == NULL || event->due > stub_now()) return NULL;
+    stub_events.queue = event->next;
+    event->next = stub_events.running;
+    stub_events.running = event;
+    return event;
+}
+
+/* run a taken event, with stub_events.lock not held */
+static
+void
+stub_event_run(
+    stub_event_t *                      event)
+{
+    stub_event_t **                     prev;
+
+    event->fn(event->arg);
+
+    pthread_mutex_lock(&stub_events.lock);
+    for (prev = &stub_events.running; *prev != event; prev = &(*prev)->next);
+    *prev = event->next;
+    pthread_mutex_unlock(&stub_events.lock);
+    if (event->unreg_fn != NULL)
+    {
+        stub_event_push(0, event->unreg_fn, event->unreg_arg);
+    }
+    free(event);
+    pthread_mutex_lock(&stub_events.lock);
+    stub_events.pending--;
+    pthread_cond_broadcast(&stub_events.cond);
+    pthread_mutex_unlock(&stub_events.lock);
+}
+
+/*
+ * globus_cond_wait(). On a callback thread it runs due callbacks while it
+ * waits, as a non-threaded globus does, so a DSI waiting for one of its
+ * own callbacks (an unregister) does not need a second thread.
+ */
+int
+stub_cond_wait(
+    pthread_cond_t *                    cond,
+    pthread_mutex_t *                   mutex)
+{
+    stub_event_t *                      event;
+    struct timespec                     ts;
+    double                              due;
+
+    if (! stub_event_thread_self) return pthread_cond_wait(cond, mutex);
+
+    pthread_mutex_unlock(mutex);
+    pthread_mutex_lock(&stub_events.lock);
+    event = stub_event_take();
+    if (event == NULL)
+    {
+        due = stub_now() + 0.001;
+        ts.tv_sec = (time_t) due;
+        ts.tv_nsec = (long) ((due - ts.tv_sec) * 1e9);
+        pthread_cond_timedwait(&stub_events.cond, &stub_events.lock, &ts);
+    }
+    pthread_mutex_unlock(&stub_events.lock);
+    if (event != NULL) stub_event_run(event);
+    pthread_mutex_lock(mutex);
+    return 0;
+}
+
+static
+void *
+stub_event_thread(
+    void *                              arg)
+{
+    stub_event_t *                      event;
+    struct timespec                     ts;
+    double                              due;
+
+    stub_event_thread_self = 1;
+    pthread_mutex_lock(&stub_events.lock);
+    for (;;)
+    {
+        if (*stub_events.stop && stub_events.pending == 0) break;
+        if ((event = stub_event_take()) != NULL)
+        {
+            pthread_mutex_unlock(&stub_events.lock);
+            stub_event_run(event);
+            pthread_mutex_lock(&stub_events.lock);
+            continue;
+        }
+        due = (stub_events.queue != NULL ? stub_events.queue->due :
+                                           stub_now() + 0.1);
+        ts.tv_sec = (time_t) due;
+        ts.tv_nsec = (long) ((due - ts.tv_sec) * 1e9);
+        pthread_cond_timedwait(&stub_events.cond, &stub_events.lock, &ts);
+    }
+    pthread_mutex_unlock(&stub_events.lock);
+    return NULL;
+}
+
+void
+stub_run(
+    int                                 nthreads,
+    volatile int *                      stop)
+{
+    pthread_t                           threads[STUB_MAX_THREADS];
+    int                                 i;
+
+    if (nthreads < 1) nthreads = 1;
+    if (nthreads > STUB_MAX_THREADS) nthreads = STUB_MAX_THREADS;
+    stub_events.stop = stop;
+    for (i = 0; i < nthreads; i++)
+    {
+        if (pthread_create(&threads[i], NULL, stub_event_thread, NULL) != 0)
+        {
+            break;
+        }
+    }
+    nthreads = i;
+    if (nthreads == 0) stub_event_thread(NULL);
+    for (i = 0; i < nthreads; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+}
+
+/*
+ * Operations.
+ */
+globus_gfs_operation_t
+stub_op_create(
+    stub_op_kind_t                      kind,
+    stub_done_func_t                    done,
+    void *                              done_arg)
+{
+    globus_gfs_operation_t              op;
+
+    op = calloc(1, sizeof(struct globus_l_gfs_data_operation_s));
+    if (op == NULL) return NULL;
+    op->kind = kind;
+    op->done = done;
+    op->done_arg = done_arg;
+    op->block_size = 256 * 1024;
+    op->concurrency = 4;
+    op->streams = 4;
+    op->write_length = -1;
+    op->seed = 1;
+    pthread_mutex_init(&op->lock, NULL);
+    if (globus_range_list_init(&op->ranges) != 0)
+    {
+        free(op);
+        return NULL;
+    }
+    return op;
+}
+
+void
+stub_op_destroy(
+    globus_gfs_operation_t              op)
+{
+    globus_range_list_destroy(op->ranges);
+    pthread_mutex_destroy(&op->lock);
+    free(op->blk_off);
+    free(op->blk_len);
+    free(op);
+}
+
+/* the driver hears of it on another thread, the DSI may hold its locks */
+static
+void
+stub_op_done(
+    void *                              arg)
+{
+    globus_gfs_operation_t              op = (globus_gfs_operation_t) arg;
+
+    op->done(op, op->done_arg);
+}
+
+static
+void
+stub_op_finish(
+    globus_gfs_operation_t              op,
+    globus_result_t                     result)
+{
+    op->result = result;
+    op->t_finished = stub_now();
+    if (op->done != NULL) stub_event_push(0, stub_op_done, op);
+}
+
+void
+globus_gridftp_server_operation_finished(
+    globus_gfs_operation_t              op,
+    globus_result_t                     result,
+    globus_gfs_finished_info_t *        finished_info)
+{
+    if (finished_info != NULL)
+    {
+        op->session_arg = finished_info->info.session.session_arg;
+    }
+    stub_op_finish(op, result);
+}
+
+void
+globus_gridftp_server_finished_stat(
+    globus_gfs_operation_t              op,
+    globus_result_t                     result,
+    globus_gfs_stat_t *                 stat_array,
+    int                                 stat_count)
+{
+    stub_op_finish(op, result);
+}
+
+void
+globus_gridftp_server_finished_command(
+    globus_gfs_operation_t              op,
+    globus_result_t                     result,
+    char *                              command_response)
+{
+    stub_op_finish(op, result);
+}
+
+void
+globus_gridftp_server_intermediate_command(
+    globus_gfs_operation_t              op,
+    globus_result_t                     result,
+    char *                              command_response)
+{
+}
+
+void
+globus_gridftp_server_finished_transfer(
+    globus_gfs_operation_t              op,
+    globus_result_t                     result)
+{
+    stub_op_finish(op, result);
+}
+
+void
+globus_gridftp_server_begin_transfer(
+    globus_gfs_operation_t              op,
+    int                                 event_mask,
+    void *                              event_arg)
+{
+}
+
+void
+globus_gridftp_server_get_block_size(
+    globus_gfs_operation_t              op,
+    globus_size_t *                     block_size)
+{
+    *block_size = op->block_size;
+}
+
+void
+globus_gridftp_server_get_optimal_concurrency(
+    globus_gfs_operation_t              op,
+    int *                               count)
+{
+    *count = op->concurrency;
+}
+
+/* hands out the ranges to send one by one, then a length of 0 */
+void
+globus_gridftp_server_get_read_range(
+    globus_gfs_operation_t              op,
+    globus_off_t *                      offset,
+    globus_off_t *                      length)
+{
+    pthread_mutex_lock(&op->lock);
+    if (globus_range_list_remove_at(op->ranges, 0, offset, length) != 0)
+    {
+        *offset = 0;
+        *length = 0;
+    }
+    pthread_mutex_unlock(&op->lock);
+}
+
+void
+globus_gridftp_server_get_write_range(
+    globus_gfs_operation_t              op,
+    globus_off_t *                      offset,
+    globus_off_t *                      length)
+{
+    *offset = op->write_offset;
+    *length = op->write_length;
+}
+
+void
+globus_gridftp_server_get_update_interval(
+    globus_gfs_operation_t              op,
+    int *                               interval)
+{
+    *interval = 5;
+}
+
+void
+globus_gridftp_server_update_bytes_written(
+    globus_gfs_operation_t              op,
+    globus_off_t                        offset,
+    globus_off_t                        length)
+{
+}
+
+void
+globus_gridftp_server_update_range_recvd(
+    globus_gfs_operation_t              op,
+    globus_off_t                        offset,
+    globus_off_t                        length)
+{
+}
+
+void
+globus_gridftp_server_set_checksum_support(
+    globus_gfs_operation_t              op,
+    const char *                        cksm_str)
+{
+}
+
+typedef struct
+{
+    globus_gfs_operation_t              op;
+    globus_byte_t *                     buffer;
+    globus_size_t                       length;
+    void *                              callback;
+    void *                              user_arg;
+} stub_io_t;
+
+/* split the ranges to receive into blocks of block_size */
+static
+int
+stub_recv_blocks(
+    globus_gfs_operation_t              op)
+{
+    globus_off_t                        offset;
+    globus_off_t                        length;
+    globus_off_t                        pos;
+    int                                 n = 0;
+    int                                 i;
+
+    for (i = 0; i < globus_range_list_size(op->ranges); i++)
+    {
+        globus_range_list_at(op->ranges, i, &offset, &length);
+        if (length > 0) n += (length + op->block_size - 1) / op->block_size;
+    }
+    op->blk_off = malloc((n + 1) * sizeof(globus_off_t));
+    op->blk_len = malloc((n + 1) * sizeof(globus_size_t));
+    if (op->blk_off == NULL || op->blk_len == NULL) return -1;
+    for (i = 0; i < globus_range_list_size(op->ranges); i++)
+    {
+        globus_range_list_at(op->ranges, i, &offset, &length);
+        for (pos = offset; length > 0 && pos < offset + length;
+             pos += op->block_size)
+        {
+            op->blk_off[op->nblk] = pos;
+            op->blk_len[op->nblk] = (offset + length - pos <
+                                     (globus_off_t) op->block_size ?
+                                     offset + length - pos : op->block_size);
+            op->nblk++;
+        }
+    }
+    return 0;
+}
+
+/*
+ * One of the next `streams` blocks, at random, like blocks arriving on
+ * parallel MODE E streams. Every 4K of the buffer is stamped with its
+ * offset, the rest is left as it is.
+ */
+static
+void
+stub_read_deliver(
+    void *                              arg)
+{
+    stub_io_t *                         io = (stub_io_t *) arg;
+    globus_gfs_operation_t              op = io->op;
+    globus_off_t                        offset = 0;
+    globus_size_t                       nbytes = 0;
+    globus_size_t                       i;
+    globus_bool_t                       eof;
+    int                                 window;
+    int                                 k;
+
+    pthread_mutex_lock(&op->lock);
+    if (op->next_blk < op->nblk)
+    {
+        window = op->nblk - op->next_blk;
+        if (window > op->streams) window = op->streams;
+        if (window < 1) window = 1;
+        k = op->next_blk + (int) (rand_r(&op->seed) % window);
+        offset = op->blk_off[k];
+        nbytes = op->blk_len[k];
+        op->blk_off[k] = op->blk_off[op->next_blk];
+        op->blk_len[k] = op->blk_len[op->next_blk];
+        op->next_blk++;
+        if (nbytes > io->length) nbytes = io->length;
+        op->bytes += nbytes;
+    }
+    eof = (op->next_blk == op->nblk);
+    pthread_mutex_unlock(&op->lock);
+
+    for (i = 0; i + sizeof(globus_off_t) <= nbytes; i += 4096)
+    {
+        memcpy(io->buffer + i, &offset, sizeof(globus_off_t));
+    }
+    ((globus_gridftp_server_write_cb_t) io->callback)(op, GLOBUS_SUCCESS,
+        io->buffer, nbytes, offset, eof, io->user_arg);
+    free(io);
+}
+
+globus_result_t
+globus_gridftp_server_register_read(
+    globus_gfs_operation_t              op,
+    globus_byte_t *                     buffer,
+    globus_size_t                       length,
+    globus_gridftp_server_write_cb_t    callback,
+    void *                              user_arg)
+{
+    stub_io_t *                         io;
+    int                                 rc = 0;
+
+    pthread_mutex_lock(&op->lock);
+    if (op->blk_off == NULL) rc = stub_recv_blocks(op);
+    pthread_mutex_unlock(&op->lock);
+    io = malloc(sizeof(stub_io_t));
+    if (rc != 0 || io == NULL || op->kind != STUB_OP_RECV)
+    {
+        free(io);
+        return GLOBUS_FAILURE;
+    }
+    io->op = op;
+    io->buffer = buffer;
+    io->length = length;
+    io->callback = callback;
+    io->user_arg = user_arg;
+    stub_event_push(0, stub_read_deliver, io);
+    return GLOBUS_SUCCESS;
+}
+
+static
+void
+stub_write_done(
+    void *                              arg)
+{
+    stub_io_t *                         io = (stub_io_t *) arg;
+    globus_gfs_operation_t              op = io->op;
+
+    pthread_mutex_lock(&op->lock);
+    op->bytes += io->length;
+    pthread_mutex_unlock(&op->lock);
+    ((globus_gridftp_server_read_cb_t) io->callback)(op, GLOBUS_SUCCESS,
+        io->buffer, io->length, io->user_arg);
+    free(io);
+}
+
+globus_result_t
+globus_gridftp_server_register_write(
+    globus_gfs_operation_t              op,
+    globus_byte_t *                     buffer,
+    globus_size_t                       length,
+    globus_off_t                        offset,
+    int                                 stripe_ndx,
+    globus_gridftp_server_read_cb_t     callback,
+    void *                              user_arg)
+{
+    stub_io_t *                         io;
+
+    io = malloc(sizeof(stub_io_t));
+    if (io == NULL || op->kind != STUB_OP_SEND)
+    {
+        free(io);
+        return GLOBUS_FAILURE;
+    }
+    io->op = op;
+    io->buffer = buffer;
+    io->length = length;
+    io->callback = callback;
+    io->user_arg = user_arg;
+    stub_event_push(0, stub_write_done, io);
+    return GLOBUS_SUCCESS;
+}
@@ -0,0 +1,90 @@
+/************************************************************************/
+/* replay/stub_runtime.h                                                */
+/*                                                                      */
+/* The driver's side of the stub runtime: operations handed to the DSI  */
+/* and the callback threads that run it. The data channel is memory,   */
+/* a receive is fed generated blocks and a send is drained as fast as   */
+/* the DSI writes, so only the DSI and the storage under it are timed.  */
+/************************************************************************/
+
+#ifndef STUB_RUNTIME_H
+#define STUB_RUNTIME_H
+
+#include "globus_gridftp_server.h"
+
+typedef enum
+{
+    STUB_OP_SESSION,
+    STUB_OP_STAT,
+    STUB_OP_COMMAND,
+    STUB_OP_SEND,
+    STUB_OP_RECV
+} stub_op_kind_t;
+
+/* called on a callback thread once the DSI has finished the operation */
+typedef void (*stub_done_func_t)(globus_gfs_operation_t op, void * arg);
+
+struct globus_l_gfs_data_operation_s
+{
+    stub_op_kind_t                      kind;
+    stub_done_func_t                    done;
+    void *                              done_arg;
+    /* set when the DSI finishes */
+    globus_result_t                     result;
+    void *                              session_arg;
+    double                              t_finished;
+    /* transfers */
+    globus_size_t                       block_size;
+    int                                 concurrency;
+    int                                 streams;    /* recv: reordering */
+    globus_range_list_t                 ranges;     /* to send or receive */
+    globus_off_t                        write_offset;
+    globus_off_t                        write_length;
+    globus_off_t                        bytes;
+    /* recv: the blocks still to deliver */
+    pthread_mutex_t                     lock;
+    globus_off_t *                      blk_off;
+    globus_size_t *                     blk_len;
+    int                                 nblk;
+    int                                 next_blk;
+    unsigned                            seed;
+};
+
+globus_gfs_operation_t
+stub_op_create(
+    stub_op_kind_t                      kind,
+    stub_done_func_t                    done,
+    void *                              done_arg);
+
+void
+stub_op_destroy(
+    globus_gfs_operation_t              op);
+
+/* the interface the module registers when activated */
+globus_gfs_storage_iface_t *
+stub_dsi_load(
+    globus_extension_module_t *         module);
+
+/* run fn(arg) on a callback thread in delay seconds */
+void
+stub_schedule(
+    double                              delay,
+    void                                (*fn)(void *),
+    void *                              arg);
+
+/* run callbacks on nthreads threads until *stop is set and none is left */
+void
+stub_run(
+    int                                 nthreads,
+    volatile int *                      stop);
+
+const char *
+stub_errstr(
+    globus_result_t                     result);
+
+double
+stub_now(void);
+
+extern int                              stub_verbose;
+
+#endif